@@ -116,6 +116,18 @@ class ClientOptions {
   // Default: 10s
   std::chrono::milliseconds unsubscribe_deduplication_timeout;
 
+  // Maximum number of subscriptions synced with the server in a single
+  // subscribe frame. Values greater than one require a server which supports
+  // batched subscribe requests.
+  // Default: 1
+  size_t max_subscribe_batch_size;
+
+  // Fraction of published messages which are traced end-to-end. Sampled
+  // messages are stamped at every hop on their way to subscribers, which
+  // aggregate per-hop latencies in their statistics.
+  // Default: 0.0 (no tracing)
+  double trace_sampling_probability;
+
   /** Creates options with default values. */
   ClientOptions();
 };
@@ -211,6 +223,30 @@ class Client {
       SubscribeCallback subscription_callback = nullptr,
       DataLossCallback data_loss_callback = nullptr) = 0;
 
+  /**
+   * Subscribes to many topics at once, all subscriptions share provided
+   * callbacks. Equivalent to calling Subscribe for every element of
+   * parameters, but much cheaper when creating thousands of subscriptions,
+   * e.g. when restoring them on startup.
+   *
+   * @param parameters Parameters of the subscriptions.
+   * @param handles An out parameter with handles of the subscriptions, in the
+   *                same order as parameters. A handle is unengaged iff the
+   *                Client failed to create the subscription.
+   * @param deliver_callback Invoked with every message received on any of the
+   *                         subscriptions.
+   * @param subscription_callback Invoked to notify termination of any of the
+   *                              subscriptions.
+   * @param data_loss_callback Invoked to notify there's been data loss.
+   * @return Status::OK() iff all subscriptions were successfully created.
+   */
+  virtual Status SubscribeBatch(
+      std::vector<SubscriptionParameters> parameters,
+      std::vector<SubscriptionHandle>* handles,
+      MessageReceivedCallback deliver_callback = nullptr,
+      SubscribeCallback subscription_callback = nullptr,
+      DataLossCallback data_loss_callback = nullptr) = 0;
+
   /**
    * Unsubscribes from a topic identified by provided handle.
    *
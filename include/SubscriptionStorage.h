@@ -38,6 +38,31 @@ class SubscriptionStorage {
                      std::string file_path,
                      std::unique_ptr<SubscriptionStorage>* out);
 
+  /**
+   * Creates subscription storage backed by an append-only journal.
+   *
+   * Instead of rewriting all subscriptions on every snapshot, only changes
+   * since the previous snapshot (new and terminated subscriptions and advanced
+   * sequence numbers) are appended to the journal. The journal is rewritten
+   * from scratch when it becomes much larger than the set of subscriptions it
+   * describes, and on the first snapshot after the storage was opened.
+   *
+   * This strategy tracks subscriptions by their handles, hence snapshots must
+   * be written with Snapshot::AppendSubscription, and at most one snapshot
+   * can be in progress at any time.
+   *
+   * The file must not be concurrently used by two different instances of the
+   * storage, and this must be ensured by the creator of the storage.
+   *
+   * @param env Environment used by the storage,
+   * @param info_log Log for info messages.
+   * @param file_path Path to a file in which subscription state is persisted,
+   */
+  static Status Journal(BaseEnv* env,
+                        std::shared_ptr<Logger> info_log,
+                        std::string file_path,
+                        std::unique_ptr<SubscriptionStorage>* out);
+
   /** Represents a snapshot being written. */
   class Snapshot {
    public:
@@ -59,6 +84,28 @@ class SubscriptionStorage {
                           const Topic& topic_name,
                           SequenceNumber start_seqno) = 0;
 
+    /**
+     * Adds entry for subscription identified by provided handle.
+     *
+     * Storage strategies which persist subscriptions incrementally use the
+     * handle to detect which subscriptions have changed since the previous
+     * snapshot. A subscription must be appended by the same thread for as long
+     * as it is alive. By default the handle is ignored.
+     *
+     * @param thread_id A numeric ID of the writing thread.
+     * @param sub_handle A handle of the subscription.
+     * @return Status::OK() iff append was successfull.
+     */
+    virtual Status AppendSubscription(size_t thread_id,
+                                      SubscriptionHandle sub_handle,
+                                      TenantID tenant_id,
+                                      const NamespaceID& namespace_id,
+                                      const Topic& topic_name,
+                                      SequenceNumber start_seqno) {
+      return Append(
+          thread_id, tenant_id, namespace_id, topic_name, start_seqno);
+    }
+
     /**
      * Commits all data written by all threads.
      *
@@ -15,6 +15,7 @@
 
 namespace rocketspeed { namespace djinni {
 
+class MessageBatchReceivedCallback;
 class MessageReceivedCallback;
 class PublishCallback;
 class SnapshotCallback;
@@ -30,6 +31,8 @@ public:
 
     virtual int64_t Subscribe(int32_t tenant_id, std::string namespace_id, std::string topic_name, int64_t start_seqno, std::shared_ptr<MessageReceivedCallback> deliver_cb, std::shared_ptr<SubscribeCallback> subscribe_cb) = 0;
 
+    virtual int64_t SubscribeBatched(int32_t tenant_id, std::string namespace_id, std::string topic_name, int64_t start_seqno, std::shared_ptr<MessageBatchReceivedCallback> deliver_cb, std::shared_ptr<SubscribeCallback> subscribe_cb) = 0;
+
     virtual int64_t Resubscribe(SubscriptionParameters params, std::shared_ptr<MessageReceivedCallback> deliver_cb, std::shared_ptr<SubscribeCallback> subscribe_cb) = 0;
 
     virtual void Unsubscribe(int64_t sub_handle) = 0;
@@ -0,0 +1,18 @@
+// AUTOGENERATED FILE - DO NOT MODIFY!
+// This file generated by Djinni from rocketspeed.djinni
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace rocketspeed { namespace djinni {
+
+class MessageBatchReceivedCallback {
+public:
+    virtual ~MessageBatchReceivedCallback() {}
+
+    virtual void Call(std::vector<uint8_t> batch) = 0;
+};
+
+} }  // namespace rocketspeed::djinni
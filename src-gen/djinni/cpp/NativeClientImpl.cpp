@@ -6,6 +6,7 @@
 #include "src-gen/djinni/cpp/NativeClientImpl.hpp"
 #include "src-gen/djinni/cpp/NativeHostId.hpp"
 #include "src-gen/djinni/cpp/NativeLogLevel.hpp"
+#include "src-gen/djinni/cpp/NativeMessageBatchReceivedCallback.hpp"
 #include "src-gen/djinni/cpp/NativeMessageReceivedCallback.hpp"
 #include "src-gen/djinni/cpp/NativeMsgId.hpp"
 #include "src-gen/djinni/cpp/NativePublishCallback.hpp"
@@ -70,6 +71,21 @@ CJNIEXPORT jlong JNICALL Java_org_rocketspeed_ClientImpl_00024CppProxy_native_1s
     } JNI_TRANSLATE_EXCEPTIONS_RETURN(jniEnv, 0 /* value doesn't matter */)
 }
 
+CJNIEXPORT jlong JNICALL Java_org_rocketspeed_ClientImpl_00024CppProxy_native_1subscribeBatched(JNIEnv* jniEnv, jobject /*this*/, jlong nativeRef, jint j_tenantId, jstring j_namespaceId, jstring j_topicName, jlong j_startSeqno, jobject j_deliverCb, jobject j_subscribeCb)
+{
+    try {
+        DJINNI_FUNCTION_PROLOGUE1(jniEnv, nativeRef);
+        const auto& ref = ::djinni::CppProxyHandle<::rocketspeed::djinni::ClientImpl>::get(nativeRef);
+        auto r = ref->SubscribeBatched(::djinni::I32::toCpp(jniEnv, j_tenantId),
+                                       ::djinni::String::toCpp(jniEnv, j_namespaceId),
+                                       ::djinni::String::toCpp(jniEnv, j_topicName),
+                                       ::djinni::I64::toCpp(jniEnv, j_startSeqno),
+                                       ::djinni_generated::NativeMessageBatchReceivedCallback::toCpp(jniEnv, j_deliverCb),
+                                       ::djinni_generated::NativeSubscribeCallback::toCpp(jniEnv, j_subscribeCb));
+        return ::djinni::I64::fromCpp(jniEnv, r);
+    } JNI_TRANSLATE_EXCEPTIONS_RETURN(jniEnv, 0 /* value doesn't matter */)
+}
+
 CJNIEXPORT jlong JNICALL Java_org_rocketspeed_ClientImpl_00024CppProxy_native_1resubscribe(JNIEnv* jniEnv, jobject /*this*/, jlong nativeRef, jobject j_params, jobject j_deliverCb, jobject j_subscribeCb)
 {
     try {
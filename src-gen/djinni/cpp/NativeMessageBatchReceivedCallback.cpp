@@ -0,0 +1,26 @@
+// AUTOGENERATED FILE - DO NOT MODIFY!
+// This file generated by Djinni from rocketspeed.djinni
+
+#include "src-gen/djinni/cpp/NativeMessageBatchReceivedCallback.hpp"  // my header
+#include "Marshal.hpp"
+
+namespace djinni_generated {
+
+NativeMessageBatchReceivedCallback::NativeMessageBatchReceivedCallback() : ::djinni::JniInterface<::rocketspeed::djinni::MessageBatchReceivedCallback, NativeMessageBatchReceivedCallback>() {}
+
+NativeMessageBatchReceivedCallback::~NativeMessageBatchReceivedCallback() = default;
+
+NativeMessageBatchReceivedCallback::JavaProxy::JavaProxy(JniType j) : JavaProxyCacheEntry(j) { }
+
+NativeMessageBatchReceivedCallback::JavaProxy::~JavaProxy() = default;
+
+void NativeMessageBatchReceivedCallback::JavaProxy::Call(std::vector<uint8_t> batch) {
+    auto jniEnv = ::djinni::jniGetThreadEnv();
+    ::djinni::JniLocalScope jscope(jniEnv, 10);
+    const auto& data = ::djinni::JniClass<::djinni_generated::NativeMessageBatchReceivedCallback>::get();
+    jniEnv->CallVoidMethod(getGlobalRef(), data.method_call,
+                           ::djinni::Binary::fromCpp(jniEnv, batch).get());
+    ::djinni::jniExceptionCheck(jniEnv);
+}
+
+}  // namespace djinni_generated
@@ -0,0 +1,46 @@
+// AUTOGENERATED FILE - DO NOT MODIFY!
+// This file generated by Djinni from rocketspeed.djinni
+
+#pragma once
+
+#include "djinni_support.hpp"
+#include "src-gen/djinni/cpp/MessageBatchReceivedCallback.hpp"
+
+namespace djinni_generated {
+
+class NativeMessageBatchReceivedCallback final : ::djinni::JniInterface<::rocketspeed::djinni::MessageBatchReceivedCallback, NativeMessageBatchReceivedCallback> {
+public:
+    using CppType = std::shared_ptr<::rocketspeed::djinni::MessageBatchReceivedCallback>;
+    using JniType = jobject;
+
+    using Boxed = NativeMessageBatchReceivedCallback;
+
+    ~NativeMessageBatchReceivedCallback();
+
+    static CppType toCpp(JNIEnv* jniEnv, JniType j) { return ::djinni::JniClass<NativeMessageBatchReceivedCallback>::get()._fromJava(jniEnv, j); }
+    static ::djinni::LocalRef<JniType> fromCpp(JNIEnv* jniEnv, const CppType& c) { return {jniEnv, ::djinni::JniClass<NativeMessageBatchReceivedCallback>::get()._toJava(jniEnv, c)}; }
+
+private:
+    NativeMessageBatchReceivedCallback();
+    friend ::djinni::JniClass<NativeMessageBatchReceivedCallback>;
+    friend ::djinni::JniInterface<::rocketspeed::djinni::MessageBatchReceivedCallback, NativeMessageBatchReceivedCallback>;
+
+    class JavaProxy final : ::djinni::JavaProxyCacheEntry, public ::rocketspeed::djinni::MessageBatchReceivedCallback
+    {
+    public:
+        JavaProxy(JniType j);
+        ~JavaProxy();
+
+        void Call(std::vector<uint8_t> batch) override;
+
+    private:
+        using ::djinni::JavaProxyCacheEntry::getGlobalRef;
+        friend ::djinni::JniInterface<::rocketspeed::djinni::MessageBatchReceivedCallback, ::djinni_generated::NativeMessageBatchReceivedCallback>;
+        friend ::djinni::JavaProxyCache<JavaProxy>;
+    };
+
+    const ::djinni::GlobalRef<jclass> clazz { ::djinni::jniFindClass("org/rocketspeed/MessageBatchReceivedCallback") };
+    const jmethodID method_call { ::djinni::jniGetMethodID(clazz.get(), "call", "([B)V") };
+};
+
+}  // namespace djinni_generated
@@ -11,6 +11,8 @@ public abstract class ClientImpl {
 
     public abstract long subscribe(int tenantId, String namespaceId, String topicName, long startSeqno, MessageReceivedCallback deliverCb, SubscribeCallback subscribeCb);
 
+    public abstract long subscribeBatched(int tenantId, String namespaceId, String topicName, long startSeqno, MessageBatchReceivedCallback deliverCb, SubscribeCallback subscribeCb);
+
     public abstract long resubscribe(SubscriptionParameters params, MessageReceivedCallback deliverCb, SubscribeCallback subscribeCb);
 
     public abstract void unsubscribe(long subHandle);
@@ -64,6 +66,14 @@ public abstract class ClientImpl {
         }
         private native long native_subscribe(long _nativeRef, int tenantId, String namespaceId, String topicName, long startSeqno, MessageReceivedCallback deliverCb, SubscribeCallback subscribeCb);
 
+        @Override
+        public long subscribeBatched(int tenantId, String namespaceId, String topicName, long startSeqno, MessageBatchReceivedCallback deliverCb, SubscribeCallback subscribeCb)
+        {
+            assert !this.destroyed.get() : "trying to use a destroyed object";
+            return native_subscribeBatched(this.nativeRef, tenantId, namespaceId, topicName, startSeqno, deliverCb, subscribeCb);
+        }
+        private native long native_subscribeBatched(long _nativeRef, int tenantId, String namespaceId, String topicName, long startSeqno, MessageBatchReceivedCallback deliverCb, SubscribeCallback subscribeCb);
+
         @Override
         public long resubscribe(SubscriptionParameters params, MessageReceivedCallback deliverCb, SubscribeCallback subscribeCb)
         {
@@ -0,0 +1,8 @@
+// AUTOGENERATED FILE - DO NOT MODIFY!
+// This file generated by Djinni from rocketspeed.djinni
+
+package org.rocketspeed;
+
+public abstract class MessageBatchReceivedCallback {
+    public abstract void call(byte[] batch);
+}
@@ -63,6 +63,11 @@ Status ClientImpl::Create(ClientOptions options,
   if (!options.backoff_distribution) {
     return Status::InvalidArgument("Missing backoff distribution.");
   }
+  if (options.trace_sampling_probability < 0.0 ||
+      options.trace_sampling_probability > 1.0) {
+    return Status::InvalidArgument(
+        "Trace sampling probability must be in [0, 1]");
+  }
   if (!options.info_log) {
     options.info_log = std::make_shared<NullLogger>();
   }
@@ -104,7 +109,9 @@ ClientImpl::ClientImpl(ClientOptions options,
                  options_.config,
                  options_.info_log,
                  msg_loop_.get(),
-                 &wake_lock_)
+                 &wake_lock_,
+                 options_.trace_sampling_probability)
+    , default_callbacks_(std::make_shared<SubscriptionCallbacks>())
     , next_sub_id_(0) {
   LOG_VITAL(options_.info_log, "Creating Client");
 
@@ -139,9 +146,10 @@ ClientImpl::ClientImpl(ClientOptions options,
 void ClientImpl::SetDefaultCallbacks(SubscribeCallback subscription_callback,
                                      MessageReceivedCallback deliver_callback,
                                      DataLossCallback data_loss_callback) {
-  subscription_cb_fallback_ = std::move(subscription_callback);
-  deliver_cb_fallback_ = std::move(deliver_callback);
-  data_loss_callback_ = std::move(data_loss_callback);
+  default_callbacks_ = std::make_shared<SubscriptionCallbacks>(
+      SubscriptionCallbacks{std::move(subscription_callback),
+                            std::move(deliver_callback),
+                            std::move(data_loss_callback)});
 }
 
 ClientImpl::~ClientImpl() {
@@ -193,16 +201,9 @@ SubscriptionHandle ClientImpl::Subscribe(
     MessageReceivedCallback deliver_callback,
     SubscribeCallback subscription_callback,
     DataLossCallback data_loss_callback) {
-  // Select callbacks taking fallbacks into an account.
-  if (!subscription_callback) {
-    subscription_callback = subscription_cb_fallback_;
-  }
-  if (!deliver_callback) {
-    deliver_callback = deliver_cb_fallback_;
-  }
-  if (!data_loss_callback) {
-    data_loss_callback = data_loss_callback_;
-  }
+  auto callbacks = SelectCallbacks(std::move(deliver_callback),
+                                   std::move(subscription_callback),
+                                   std::move(data_loss_callback));
 
   // Choose client worker for this subscription.
   const auto worker_id = msg_loop_->LoadBalancedWorkerId();
@@ -217,11 +218,8 @@ SubscriptionHandle ClientImpl::Subscribe(
   const SubscriptionID sub_id = sub_handle;
 
   // Create an object that manages state of the subscription.
-  auto moved_args =
-      folly::makeMoveWrapper(std::make_tuple(std::move(parameters),
-                                             std::move(deliver_callback),
-                                             std::move(subscription_callback),
-                                             std::move(data_loss_callback)));
+  auto moved_args = folly::makeMoveWrapper(
+      std::make_tuple(std::move(parameters), std::move(callbacks)));
 
   // Send command to responsible worker.
   Status st = msg_loop_->SendCommand(
@@ -230,14 +228,71 @@ SubscriptionHandle ClientImpl::Subscribe(
             worker_data_[worker_id]->StartSubscription(
                 sub_id,
                 std::move(std::get<0>(*moved_args)),
-                std::move(std::get<1>(*moved_args)),
-                std::move(std::get<2>(*moved_args)),
-                std::move(std::get<3>(*moved_args)));
+                std::move(std::get<1>(*moved_args)));
           })),
       worker_id);
   return st.ok() ? sub_handle : SubscriptionHandle(0);
 }
 
+Status ClientImpl::SubscribeBatch(
+    std::vector<SubscriptionParameters> parameters,
+    std::vector<SubscriptionHandle>* handles,
+    MessageReceivedCallback deliver_callback,
+    SubscribeCallback subscription_callback,
+    DataLossCallback data_loss_callback) {
+  assert(handles);
+  auto callbacks = SelectCallbacks(std::move(deliver_callback),
+                                   std::move(subscription_callback),
+                                   std::move(data_loss_callback));
+
+  // Allocate handles and split subscriptions between workers.
+  typedef std::vector<std::pair<SubscriptionID, SubscriptionParameters>>
+      WorkerBatch;
+  std::vector<WorkerBatch> batches(msg_loop_->GetNumWorkers());
+  Status result;
+  handles->clear();
+  handles->reserve(parameters.size());
+  for (auto& params : parameters) {
+    const auto worker_id = msg_loop_->LoadBalancedWorkerId();
+    const SubscriptionHandle sub_handle = CreateNewHandle(worker_id);
+    if (!sub_handle) {
+      LOG_ERROR(options_.info_log, "Client run out of subscription handles");
+      assert(false);
+      result = Status::InternalError("Out of subscription handles");
+      handles->push_back(SubscriptionHandle(0));
+      continue;
+    }
+    batches[worker_id].emplace_back(sub_handle, std::move(params));
+    handles->push_back(sub_handle);
+  }
+
+  // Send a single command to every responsible worker.
+  for (int worker_id = 0; worker_id < static_cast<int>(batches.size());
+       ++worker_id) {
+    if (batches[worker_id].empty()) {
+      continue;
+    }
+    auto moved_batch = folly::makeMoveWrapper(std::move(batches[worker_id]));
+    Status st = msg_loop_->SendCommand(
+        std::unique_ptr<Command>(MakeExecuteCommand(
+            [this, worker_id, moved_batch, callbacks]() mutable {
+              worker_data_[worker_id]->StartSubscriptions(moved_batch.move(),
+                                                          callbacks);
+            })),
+        worker_id);
+    if (!st.ok()) {
+      // None of the subscriptions assigned to this worker were created.
+      for (auto& handle : *handles) {
+        if (handle && GetWorkerID(handle) == worker_id) {
+          handle = SubscriptionHandle(0);
+        }
+      }
+      result = st;
+    }
+  }
+  return result;
+}
+
 Status ClientImpl::Unsubscribe(SubscriptionHandle sub_handle) {
   if (!sub_handle) {
     return Status::InvalidArgument("Unengaged handle.");
@@ -342,6 +397,14 @@ Statistics ClientImpl::GetStatisticsSync() {
       msg_loop_->AggregateStatsSync([this](int i) -> Statistics {
         return worker_data_[i]->GetStatistics();
       }));
+
+  // Average memory footprint of a subscription in the client.
+  const int64_t subscriptions =
+      aggregated.GetCounterValue("client.active_subscriptions");
+  const int64_t memory_bytes =
+      aggregated.GetCounterValue("client.subscriptions_memory_bytes");
+  aggregated.AddCounter("client.bytes_per_subscription")
+      ->Set(subscriptions > 0 ? memory_bytes / subscriptions : 0);
   return aggregated;
 }
 
@@ -368,6 +431,28 @@ Status ClientImpl::Start() {
   return Status::OK();
 }
 
+std::shared_ptr<const SubscriptionCallbacks> ClientImpl::SelectCallbacks(
+    MessageReceivedCallback deliver_callback,
+    SubscribeCallback subscription_callback,
+    DataLossCallback data_loss_callback) const {
+  // Select callbacks taking fallbacks into an account. Subscriptions which
+  // rely on default callbacks only share a single copy of them.
+  if (subscription_callback || deliver_callback || data_loss_callback) {
+    auto custom = std::make_shared<SubscriptionCallbacks>(*default_callbacks_);
+    if (subscription_callback) {
+      custom->subscription_callback = std::move(subscription_callback);
+    }
+    if (deliver_callback) {
+      custom->deliver_callback = std::move(deliver_callback);
+    }
+    if (data_loss_callback) {
+      custom->data_loss_callback = std::move(data_loss_callback);
+    }
+    return std::move(custom);
+  }
+  return default_callbacks_;
+}
+
 SubscriptionHandle ClientImpl::CreateNewHandle(int worker_id) {
   const auto num_workers = msg_loop_->GetNumWorkers();
   const auto handle = 1 + worker_id + num_workers * next_sub_id_++;
@@ -19,6 +19,7 @@
 #include "include/RocketSpeed.h"
 #include "src/client/publisher.h"
 #include "src/client/smart_wake_lock.h"
+#include "src/client/subscription_table.h"
 #include "src/messages/messages.h"
 #include "src/messages/stream_socket.h"
 #include "src/util/common/base_env.h"
@@ -82,6 +83,12 @@ class ClientImpl : public Client {
                      std::move(data_loss_callback));
   }
 
+  Status SubscribeBatch(std::vector<SubscriptionParameters> parameters,
+                        std::vector<SubscriptionHandle>* handles,
+                        MessageReceivedCallback deliver_callback,
+                        SubscribeCallback subscription_callback,
+                        DataLossCallback data_loss_callback) override;
+
   Status Unsubscribe(SubscriptionHandle sub_handle) override;
 
   Status Acknowledge(const MessageReceived& message) override;
@@ -121,12 +128,11 @@ class ClientImpl : public Client {
   /** The publisher object, which handles write path in the client. */
   PublisherImpl publisher_;
 
-  /** Default callback for announcing subscription status. */
-  SubscribeCallback subscription_cb_fallback_;
-  /** Default callbacks for delivering messages. */
-  MessageReceivedCallback deliver_cb_fallback_;
-  /** Default callback for data loss */
-  DataLossCallback data_loss_callback_;
+  /**
+   * Default callbacks for announcing subscription status, delivering messages
+   * and data loss, shared by all subscriptions which do not override any.
+   */
+  std::shared_ptr<const SubscriptionCallbacks> default_callbacks_;
 
   /** Next subscription ID seed to be used for new subscription ID. */
   std::atomic<uint64_t> next_sub_id_;
@@ -134,6 +140,15 @@ class ClientImpl : public Client {
   /** Starts the client. */
   Status Start();
 
+  /**
+   * Returns callbacks for a subscription, falling back to the default ones.
+   * If no callback is provided, returns the shared default callbacks.
+   */
+  std::shared_ptr<const SubscriptionCallbacks> SelectCallbacks(
+      MessageReceivedCallback deliver_callback,
+      SubscribeCallback subscription_callback,
+      DataLossCallback data_loss_callback) const;
+
   /**
    * Returns a new subscription handle. This method is thread-safe.
    *
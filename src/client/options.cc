@@ -30,7 +30,9 @@ ClientOptions::ClientOptions()
     , backoff_initial(1000)
     , backoff_limit(30 * 1000)
     , backoff_distribution(DefaultBackOffDistribution())
-    , unsubscribe_deduplication_timeout(10 * 1000) {
+    , unsubscribe_deduplication_timeout(10 * 1000)
+    , max_subscribe_batch_size(1)
+    , trace_sampling_probability(0.0) {
 }
 
 }  // namespace rocketspeed
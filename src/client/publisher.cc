@@ -6,6 +6,7 @@
 #include "publisher.h"
 
 #include <memory>
+#include <random>
 #include <unordered_map>
 
 #include "external/folly/move_wrapper.h"
@@ -15,8 +16,10 @@
 #include "src/messages/msg_loop_base.h"
 #include "src/messages/commands.h"
 #include "src/port/port.h"
+#include "src/util/common/base_env.h"
 #include "src/util/common/guid_generator.h"
 #include "src/util/common/hash.h"
+#include "src/util/common/random.h"
 #include "src/util/common/thread_check.h"
 
 namespace rocketspeed {
@@ -269,11 +272,14 @@ PublisherImpl::PublisherImpl(BaseEnv* env,
                              std::shared_ptr<Configuration> config,
                              std::shared_ptr<Logger> info_log,
                              MsgLoopBase* msg_loop,
-                             SmartWakeLock* wake_lock)
-    : config_(std::move(config))
+                             SmartWakeLock* wake_lock,
+                             double trace_sampling_probability)
+    : env_(env)
+    , config_(std::move(config))
     , info_log_(std::move(info_log))
     , msg_loop_(msg_loop)
-    , wake_lock_(wake_lock) {
+    , wake_lock_(wake_lock)
+    , trace_sampling_probability_(trace_sampling_probability) {
   using namespace std::placeholders;
 
   // clang complains the private member wake_lock_ is unused, but we will
@@ -320,6 +326,14 @@ PublishStatus PublisherImpl::Publish(TenantID tenant_id,
   }
   const MsgId msgid = message.GetMessageId();
 
+  // Decide whether to trace the message.
+  if (trace_sampling_probability_ > 0.0) {
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    if (distribution(ThreadLocalPRNG()) < trace_sampling_probability_) {
+      message.StampTrace(MessageTrace::kClientSend, env_->NowMicros());
+    }
+  }
+
   std::string serialized;
   message.SerializeToString(&serialized);
 
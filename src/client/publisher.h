@@ -37,12 +37,14 @@ class PublisherImpl {
    * @param info_log a logger object
    * @param wake_lock a non-owning pointer to the wake lock
    * @param msg_loop a non-owning pointer to the message loop
+   * @param trace_sampling_probability fraction of messages to trace
    */
   PublisherImpl(BaseEnv* env,
                 std::shared_ptr<Configuration> config,
                 std::shared_ptr<Logger> info_log,
                 MsgLoopBase* msg_loop,
-                SmartWakeLock* wake_lock);
+                SmartWakeLock* wake_lock,
+                double trace_sampling_probability);
 
   ~PublisherImpl();
 
@@ -64,10 +66,12 @@ class PublisherImpl {
  private:
   friend class PublisherWorkerData;
 
+  BaseEnv* const env_;
   const std::shared_ptr<Configuration> config_;
   const std::shared_ptr<Logger> info_log_;
   MsgLoopBase* const msg_loop_;
   SmartWakeLock* const wake_lock_;
+  const double trace_sampling_probability_;
 
   /** State of the publisher sharded by worker threads. */
   std::vector<PublisherWorkerData> worker_data_;
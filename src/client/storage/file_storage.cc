@@ -5,23 +5,30 @@
 //
 #include "file_storage.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include <errno.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include "include/Logger.h"
+#include "src/client/storage/file_util.h"
 #include "src/messages/descriptor_event.h"
 #include "src/util/common/base_env.h"
 #include "src/util/common/coding.h"
+#include "src/util/xxhash.h"
 
 namespace rocketspeed {
 
@@ -34,18 +41,137 @@ Status SubscriptionStorage::File(BaseEnv* env,
   return Status::OK();
 }
 
+namespace {
+
+/** Marks both the beginning and the end of a snapshot file. */
+const uint32_t kSnapshotMagic = 0x53535352;
+/** Version of the block-based snapshot format. */
+const uint8_t kSnapshotVersion = 1;
+const size_t kSnapshotHeaderSize = sizeof(uint32_t) + sizeof(uint8_t);
+/** Number of records, number of blocks, checksum and magic. */
+const size_t kSnapshotFooterSize =
+    sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+/** Snapshots with fewer blocks per thread are restored sequentially. */
+const size_t kMinBlocksPerRestoreThread = 16;
+
+/** A read-only memory mapping of an entire file. */
+class MappedFile {
+ public:
+  MappedFile() : data_(nullptr), size_(0) {}
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(data_, size_);
+    }
+  }
+
+  Status Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return Status::IOError("Cannot open: " + path + " " + strerror(errno));
+    }
+    // Closes the descriptor, the mapping stays valid afterwards.
+    DescriptorEvent descriptor(fd);
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      return Status::IOError("Cannot stat: " + path + " " + strerror(errno));
+    }
+    if (file_stat.st_size == 0) {
+      return Status::OK();
+    }
+    void* data = mmap(nullptr,
+                      static_cast<size_t>(file_stat.st_size),
+                      PROT_READ,
+                      MAP_PRIVATE,
+                      fd,
+                      0);
+    if (data == MAP_FAILED) {
+      return Status::IOError("Cannot mmap: " + path + " " + strerror(errno));
+    }
+    data_ = data;
+    size_ = static_cast<size_t>(file_stat.st_size);
+    return Status::OK();
+  }
+
+  Slice contents() const {
+    return Slice(static_cast<const char*>(data_), size_);
+  }
+
+ private:
+  void* data_;
+  size_t size_;
+};
+
+/** Location of a single block in a mapped snapshot. */
+struct BlockInfo {
+  Slice payload;
+  uint32_t num_records;
+};
+
+/** Decodes all subscriptions in a range of blocks. */
+Status ParseBlocks(const BlockInfo* begin,
+                   const BlockInfo* end,
+                   std::vector<SubscriptionParameters>* result) {
+  size_t num_records = 0;
+  for (auto block = begin; block != end; ++block) {
+    num_records += block->num_records;
+  }
+  result->reserve(num_records);
+
+  for (auto block = begin; block != end; ++block) {
+    Slice in = block->payload;
+    for (uint32_t i = 0; i < block->num_records; ++i) {
+      uint32_t tenant_id;
+      if (!GetVarint32(&in, &tenant_id) ||
+          tenant_id > std::numeric_limits<TenantID>::max()) {
+        return Status::IOError("Bad tenant ID");
+      }
+      SequenceNumber seqno;
+      if (!GetVarint64(&in, &seqno)) {
+        return Status::IOError("Bad sequence number");
+      }
+      Slice namespace_id, topic_name;
+      if (!GetTopicID(&in, &namespace_id, &topic_name)) {
+        return Status::IOError("Bad topic ID");
+      }
+      result->emplace_back(static_cast<TenantID>(tenant_id),
+                           namespace_id.ToString(),
+                           topic_name.ToString(),
+                           seqno);
+    }
+    if (!in.empty()) {
+      return Status::IOError("Trailing data in snapshot block");
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
-FileStorage::Snapshot::Snapshot(std::string final_path,
+FileStorage::Snapshot::Snapshot(BaseEnv* env,
+                                std::string final_path,
                                 std::string temp_path,
                                 DescriptorEvent descriptor,
                                 size_t num_threads)
-    : final_path_(std::move(final_path))
+    : env_(env)
+    , final_path_(std::move(final_path))
     , temp_path_(std::move(temp_path))
-    , descriptor_(std::move(descriptor)) {
+    , descriptor_(std::move(descriptor))
+    , writer_started_(false)
+    , writer_stop_(false)
+    , writer_thread_(0)
+    , num_records_(0)
+    , num_blocks_(0) {
 #ifndef NDEBUG
   thread_checks_.resize(num_threads);
 #endif  // NDEBUG
-  chunks_.resize(num_threads);
+  segments_.resize(num_threads);
+  XXH64_reset(&checksum_, 0);
+}
+
+FileStorage::Snapshot::~Snapshot() {
+  StopWriter();
 }
 
 Status FileStorage::Snapshot::Append(size_t thread_id,
@@ -58,26 +184,143 @@ Status FileStorage::Snapshot::Append(size_t thread_id,
   thread_checks_[thread_id].Check();
 #endif  // NDEBUG
 
-  auto buffer = &chunks_[thread_id];
+  auto segment = &segments_[thread_id];
+  auto buffer = &segment->buffer;
 
-  PutFixed16(buffer, tenant_id);
-  PutFixed64(buffer, start_seqno);
-  std::string topic_id;
-  PutTopicID(&topic_id, namespace_id, topic_name);
-  PutFixed32(buffer, static_cast<uint32_t>(topic_id.size()));
-  buffer->append(topic_id);
+  PutVarint32(buffer, tenant_id);
+  PutVarint64(buffer, start_seqno);
+  PutTopicID(buffer, namespace_id, topic_name);
+  ++segment->num_records;
 
+  if (buffer->size() >= kBlockSize) {
+    return FlushSegment(thread_id);
+  }
   return Status::OK();
 }
 
+Status FileStorage::Snapshot::FlushSegment(size_t thread_id) {
+  auto segment = &segments_[thread_id];
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!writer_started_) {
+    writer_started_ = true;
+    writer_thread_ =
+        env_->StartThread([this]() { WriterLoop(); }, "rs-snapshot");
+  }
+  // Wait until the writer is done with the previous block of this thread.
+  cond_.wait(lock,
+             [&]() { return !segment->in_flight || !status_.ok(); });
+  if (!status_.ok()) {
+    return status_;
+  }
+  std::swap(segment->buffer, segment->flushing);
+  segment->flushing_records = segment->num_records;
+  segment->in_flight = true;
+  pending_.push_back(thread_id);
+  lock.unlock();
+  cond_.notify_all();
+
+  // Reuse memory of the block which has already been written.
+  segment->buffer.clear();
+  segment->num_records = 0;
+  return Status::OK();
+}
+
+void FileStorage::Snapshot::WriterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [this]() { return writer_stop_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      // Asked to stop and all blocks have been written.
+      break;
+    }
+    const size_t thread_id = pending_.front();
+    pending_.pop_front();
+    auto segment = &segments_[thread_id];
+    const bool failed = !status_.ok();
+    lock.unlock();
+
+    // Once the snapshot failed, there is no point in writing more data.
+    Status st;
+    if (!failed) {
+      st = WriteBlock(thread_id, segment->flushing, segment->flushing_records);
+    }
+
+    lock.lock();
+    segment->in_flight = false;
+    if (!st.ok() && status_.ok()) {
+      status_ = std::move(st);
+    }
+    cond_.notify_all();
+  }
+}
+
+Status FileStorage::Snapshot::WriteBlock(size_t thread_id,
+                                         const std::string& payload,
+                                         uint32_t num_records) {
+  std::string header;
+  PutVarint32(&header, static_cast<uint32_t>(thread_id));
+  PutVarint32(&header, num_records);
+  PutVarint32(&header, static_cast<uint32_t>(payload.size()));
+
+  XXH64_update(&checksum_, header.data(), header.size());
+  XXH64_update(&checksum_, payload.data(), payload.size());
+  num_records_ += num_records;
+  ++num_blocks_;
+
+  Status st = descriptor_.Write(header);
+  if (!st.ok()) {
+    return st;
+  }
+  return descriptor_.Write(payload);
+}
+
+void FileStorage::Snapshot::StopWriter() {
+  BaseEnv::ThreadId writer_thread;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writer_started_ || writer_stop_) {
+      return;
+    }
+    writer_stop_ = true;
+    writer_thread = writer_thread_;
+  }
+  cond_.notify_all();
+  env_->WaitForJoin(writer_thread);
+}
+
 Status FileStorage::Snapshot::Commit() {
-  // Attempt to write buffers one by one.
-  for (auto& chunk : chunks_) {
-    Status st = descriptor_.Write(chunk);
+  // Drain all blocks handed off so far, so that we can write the rest inline.
+  StopWriter();
+  if (!status_.ok()) {
+    return status_;
+  }
+
+  // Attempt to write remaining buffers one by one.
+  for (size_t thread_id = 0; thread_id < segments_.size(); ++thread_id) {
+    auto segment = &segments_[thread_id];
+    if (segment->num_records == 0) {
+      continue;
+    }
+    Status st = WriteBlock(thread_id, segment->buffer, segment->num_records);
     if (!st.ok()) {
       return st;
     }
+    segment->buffer.clear();
+    segment->num_records = 0;
+  }
+
+  // Write the footer.
+  std::string footer;
+  PutFixed64(&footer, num_records_);
+  PutFixed32(&footer, num_blocks_);
+  PutFixed64(&footer, XXH64_digest(&checksum_));
+  PutFixed32(&footer, kSnapshotMagic);
+  Status st = descriptor_.Write(footer);
+  if (!st.ok()) {
+    return st;
   }
+
   // Close temp file, so that we can swap it with the destination file.
   descriptor_ = DescriptorEvent();
 
@@ -100,6 +343,124 @@ FileStorage::FileStorage(BaseEnv* env,
 
 Status FileStorage::RestoreSubscriptions(
     std::vector<SubscriptionParameters>* subscriptions) {
+  MappedFile file;
+  Status st = file.Open(file_path_);
+  if (!st.ok()) {
+    return st;
+  }
+
+  std::vector<SubscriptionParameters> result;
+  Slice contents = file.contents();
+  if (contents.size() >= sizeof(uint32_t) &&
+      DecodeFixed32(contents.data()) == kSnapshotMagic) {
+    st = RestoreFromBlocks(contents, &result);
+  } else {
+    // Snapshots written before the block-based format was introduced.
+    st = RestoreLegacy(&result);
+  }
+  if (!st.ok()) {
+    return st;
+  }
+
+  // Successfully read all subscriptions.
+  *subscriptions = std::move(result);
+  return Status::OK();
+}
+
+Status FileStorage::RestoreFromBlocks(
+    Slice contents, std::vector<SubscriptionParameters>* result) {
+  if (contents.size() < kSnapshotHeaderSize + kSnapshotFooterSize) {
+    return Status::IOError("Truncated snapshot");
+  }
+
+  // Header.
+  uint32_t magic;
+  uint8_t version;
+  if (!GetFixed32(&contents, &magic) || !GetFixed8(&contents, &version)) {
+    return Status::IOError("Bad snapshot header");
+  }
+  if (version != kSnapshotVersion) {
+    return Status::NotSupported("Unknown snapshot version " +
+                                std::to_string(version));
+  }
+
+  // Footer.
+  Slice footer(contents.data() + contents.size() - kSnapshotFooterSize,
+               kSnapshotFooterSize);
+  contents = Slice(contents.data(), contents.size() - kSnapshotFooterSize);
+  uint64_t num_records, checksum;
+  uint32_t num_blocks;
+  if (!GetFixed64(&footer, &num_records) ||
+      !GetFixed32(&footer, &num_blocks) || !GetFixed64(&footer, &checksum) ||
+      !GetFixed32(&footer, &magic) || magic != kSnapshotMagic) {
+    return Status::IOError("Bad snapshot footer");
+  }
+  if (XXH64(contents.data(), contents.size(), 0) != checksum) {
+    return Status::IOError("Snapshot checksum mismatch");
+  }
+
+  // Locate all blocks, this only skips over payloads.
+  std::vector<BlockInfo> blocks;
+  blocks.reserve(num_blocks);
+  uint64_t records_found = 0;
+  while (!contents.empty()) {
+    uint32_t thread_id, block_records, payload_size;
+    if (!GetVarint32(&contents, &thread_id) ||
+        !GetVarint32(&contents, &block_records) ||
+        !GetVarint32(&contents, &payload_size) ||
+        contents.size() < payload_size) {
+      return Status::IOError("Bad snapshot block");
+    }
+    blocks.push_back({Slice(contents.data(), payload_size), block_records});
+    contents.remove_prefix(payload_size);
+    records_found += block_records;
+  }
+  if (blocks.size() != num_blocks || records_found != num_records) {
+    return Status::IOError("Snapshot footer does not match contents");
+  }
+
+  // Decide how many threads to use for parsing.
+  size_t num_threads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()),
+      blocks.size() / kMinBlocksPerRestoreThread);
+  if (num_threads <= 1) {
+    return ParseBlocks(blocks.data(), blocks.data() + blocks.size(), result);
+  }
+
+  // Split blocks evenly between threads, the calling thread parses the first
+  // range while others are done in the background.
+  std::vector<std::vector<SubscriptionParameters>> partial(num_threads);
+  std::vector<Status> statuses(num_threads);
+  std::vector<BaseEnv::ThreadId> threads;
+  const size_t per_thread = (blocks.size() + num_threads - 1) / num_threads;
+  auto parse_range = [&](size_t i) {
+    const size_t first = std::min(blocks.size(), i * per_thread);
+    const size_t last = std::min(blocks.size(), first + per_thread);
+    statuses[i] = ParseBlocks(
+        blocks.data() + first, blocks.data() + last, &partial[i]);
+  };
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.push_back(env_->StartThread([&parse_range, i]() { parse_range(i); },
+                                        "rs-restore"));
+  }
+  parse_range(0);
+  for (auto thread : threads) {
+    env_->WaitForJoin(thread);
+  }
+
+  result->reserve(num_records);
+  for (size_t i = 0; i < num_threads; ++i) {
+    if (!statuses[i].ok()) {
+      return statuses[i];
+    }
+    std::move(partial[i].begin(), partial[i].end(),
+              std::back_inserter(*result));
+  }
+  return Status::OK();
+}
+
+Status FileStorage::RestoreLegacy(
+    std::vector<SubscriptionParameters>* subscriptions) {
   // Open the file.
   std::unique_ptr<SequentialFile> file;
   EnvOptions env_options;
@@ -171,32 +532,6 @@ Status FileStorage::RestoreSubscriptions(
   return Status::OK();
 }
 
-namespace {
-
-/**
- * A helper function which creates and opens a new file whose name starts with
- * given prefix. The file is guaranteed to be opened exclusively for the caller.
- * Returns file descriptor of the file and updates path with actual file path
- * when completed successfully or returns -1 and does not modify path on error.
- */
-int OpenNewTempFile(std::string prefix, std::string* path) {
-  prefix += "XXXXXX";
-  std::unique_ptr<char[]> path_c(new char[prefix.size() + 1]);
-  std::copy(prefix.begin(), prefix.end(), path_c.get());
-  path_c[prefix.size()] = '\0';
-  int fd = mkstemp(path_c.get());
-  if (fd < 0) {
-    return -1;
-  }
-  // Note that O_NOBLOCK has absolutely no effect on reguar file descriptors.
-  // Regular files are always readable and writable, therefore we're fine with
-  // default flags here.
-  path->assign(path_c.get());
-  return fd;
-}
-
-}  // namespace
-
 Status FileStorage::CreateSnapshot(
     size_t num_threads,
     std::shared_ptr<SubscriptionStorage::Snapshot>* snapshot) {
@@ -209,8 +544,19 @@ Status FileStorage::CreateSnapshot(
   DescriptorEvent descriptor(fd);
   fd = -1;
 
-  snapshot->reset(new Snapshot(
-      file_path_, std::move(temp_path), std::move(descriptor), num_threads));
+  std::string header;
+  PutFixed32(&header, kSnapshotMagic);
+  PutFixed8(&header, kSnapshotVersion);
+  Status st = descriptor.Write(header);
+  if (!st.ok()) {
+    return st;
+  }
+
+  snapshot->reset(new Snapshot(env_,
+                               file_path_,
+                               std::move(temp_path),
+                               std::move(descriptor),
+                               num_threads));
   return Status::OK();
 }
 
@@ -6,30 +6,52 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <vector>
 
+#include "include/Status.h"
 #include "include/SubscriptionStorage.h"
 #include "src/messages/descriptor_event.h"
+#include "src/util/common/base_env.h"
 #include "src/util/common/thread_check.h"
+#include "src/util/xxhash.h"
 
 namespace rocketspeed {
 
-class BaseEnv;
 class Logger;
-class Status;
 class SubscriptionParameters;
 
-/** A storage strategy which persists subscriptions in a binary file. */
+/**
+ * A storage strategy which persists subscriptions in a binary file.
+ *
+ * The file consists of a header, a sequence of blocks and a footer. Each block
+ * holds varint-encoded subscriptions appended by a single writer thread.
+ * Blocks are streamed to the file by a background thread while the snapshot is
+ * still being built, so that the amount of memory used by a snapshot does not
+ * depend on the number of subscriptions. The footer carries a checksum of all
+ * blocks, which is verified when subscriptions are restored.
+ *
+ * Relative order of subscriptions appended by the same thread is preserved,
+ * order of subscriptions appended by different threads is not.
+ */
 class FileStorage : public SubscriptionStorage {
  public:
+  /** Size of a block buffered by each thread before it is written out. */
+  static constexpr size_t kBlockSize = 64 * 1024;
+
   class Snapshot : public SubscriptionStorage::Snapshot {
    public:
-    Snapshot(std::string final_path,
+    Snapshot(BaseEnv* env,
+             std::string final_path,
              std::string temp_path,
              DescriptorEvent descriptor,
              size_t num_threads);
 
+    ~Snapshot();
+
     Status Append(size_t thread_id,
                   TenantID tenant_id,
                   const NamespaceID& namespace_id,
@@ -39,10 +61,42 @@ class FileStorage : public SubscriptionStorage {
     Status Commit() override;
 
    private:
+    /**
+     * Per-thread state of the snapshot. Each thread fills its own buffer,
+     * while the previously filled one is being written by the background
+     * thread, hence at most two blocks per thread are kept in memory.
+     */
+    struct Segment {
+      // Block being filled by the owning thread.
+      std::string buffer;
+      uint32_t num_records = 0;
+      // Block handed off to the writer, guarded by mutex_.
+      std::string flushing;
+      uint32_t flushing_records = 0;
+      bool in_flight = false;
+    };
+
+    /**
+     * Hands off current block of given thread to the writer. Blocks if the
+     * previous block of this thread has not been written yet.
+     */
+    Status FlushSegment(size_t thread_id);
+
+    /** Main loop of the background writer thread. */
+    void WriterLoop();
+
+    /** Writes a block to the file, must be called by the writer only. */
+    Status WriteBlock(size_t thread_id, const std::string& payload,
+                      uint32_t num_records);
+
+    /** Stops the writer thread if it is running. */
+    void StopWriter();
+
 #ifndef NDEBUG
     std::vector<ThreadCheck> thread_checks_;
 #endif  // NDEBUG
 
+    BaseEnv* const env_;
     // A path to the file which should be overwritten with snapshot.
     const std::string final_path_;
     // A path to the temporary file, which we directly write.
@@ -50,7 +104,21 @@ class FileStorage : public SubscriptionStorage {
     // A file descriptor for temporary file.
     DescriptorEvent descriptor_;
 
-    std::vector<std::string> chunks_;
+    std::vector<Segment> segments_;
+
+    // Writer state, all guarded by mutex_.
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<size_t> pending_;
+    Status status_;
+    bool writer_started_;
+    bool writer_stop_;
+    BaseEnv::ThreadId writer_thread_;
+
+    // Accessed by the writer thread only, or after it was joined.
+    XXH64_state_t checksum_;
+    uint64_t num_records_;
+    uint32_t num_blocks_;
   };
 
   /**
@@ -72,6 +140,13 @@ class FileStorage : public SubscriptionStorage {
       std::shared_ptr<SubscriptionStorage::Snapshot>* snapshot) override;
 
  private:
+  /** Reads subscriptions from mapped file in the block-based format. */
+  Status RestoreFromBlocks(Slice contents,
+                           std::vector<SubscriptionParameters>* result);
+
+  /** Reads subscriptions from a file in the legacy, fixed-width format. */
+  Status RestoreLegacy(std::vector<SubscriptionParameters>* result);
+
   BaseEnv* env_;
   const std::shared_ptr<Logger> info_log_;
   const std::string file_path_;
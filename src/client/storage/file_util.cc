@@ -0,0 +1,54 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "file_util.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "src/messages/descriptor_event.h"
+
+namespace rocketspeed {
+
+int OpenNewTempFile(std::string prefix, std::string* path) {
+  prefix += "XXXXXX";
+  std::unique_ptr<char[]> path_c(new char[prefix.size() + 1]);
+  std::copy(prefix.begin(), prefix.end(), path_c.get());
+  path_c[prefix.size()] = '\0';
+  int fd = mkstemp(path_c.get());
+  if (fd < 0) {
+    return -1;
+  }
+  // Note that O_NOBLOCK has absolutely no effect on reguar file descriptors.
+  // Regular files are always readable and writable, therefore we're fine with
+  // default flags here.
+  path->assign(path_c.get());
+  return fd;
+}
+
+Status SyncParentDirectory(const std::string& path) {
+  const size_t separator = path.rfind('/');
+  std::string directory;
+  if (separator == std::string::npos) {
+    directory = ".";
+  } else if (separator == 0) {
+    directory = "/";
+  } else {
+    directory = path.substr(0, separator);
+  }
+  int fd = open(directory.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Status::IOError("Cannot open: " + directory + strerror(errno));
+  }
+  return DescriptorEvent(fd).Sync();
+}
+
+}  // namespace rocketspeed
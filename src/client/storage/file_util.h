@@ -0,0 +1,28 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <string>
+
+#include "include/Status.h"
+
+namespace rocketspeed {
+
+/**
+ * A helper function which creates and opens a new file whose name starts with
+ * given prefix. The file is guaranteed to be opened exclusively for the caller.
+ * Returns file descriptor of the file and updates path with actual file path
+ * when completed successfully or returns -1 and does not modify path on error.
+ */
+int OpenNewTempFile(std::string prefix, std::string* path);
+
+/**
+ * Flushes the directory containing given path, so that a file created in or
+ * renamed into it survives a crash.
+ */
+Status SyncParentDirectory(const std::string& path);
+
+}  // namespace rocketspeed
@@ -0,0 +1,426 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "journal_storage.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "include/Logger.h"
+#include "src/client/storage/file_util.h"
+#include "src/messages/descriptor_event.h"
+#include "src/util/common/base_env.h"
+#include "src/util/common/coding.h"
+#include "src/util/xxhash.h"
+
+namespace rocketspeed {
+
+////////////////////////////////////////////////////////////////////////////////
+Status SubscriptionStorage::Journal(BaseEnv* env,
+                                    std::shared_ptr<Logger> info_log,
+                                    std::string file_path,
+                                    std::unique_ptr<SubscriptionStorage>* out) {
+  out->reset(new JournalStorage(env, info_log, std::move(file_path)));
+  return Status::OK();
+}
+
+namespace {
+
+/** Marks the beginning of a journal file. */
+const uint32_t kJournalMagic = 0x534a524e;
+/** Version of the journal format. */
+const uint8_t kJournalVersion = 1;
+const size_t kJournalHeaderSize = sizeof(uint32_t) + sizeof(uint8_t);
+/** Payload size and checksum. */
+const size_t kTransactionHeaderSize = sizeof(uint32_t) + sizeof(uint64_t);
+
+/** Types of records in a transaction. */
+enum RecordType : uint8_t {
+  /** Handle, tenant, sequence number, namespace and topic. */
+  kSubscribe = 1,
+  /** Handle and new sequence number. */
+  kAdvance = 2,
+  /** Handle. */
+  kUnsubscribe = 3,
+};
+
+/** Frames records as a transaction. */
+void PutTransaction(std::string* dst, Slice records) {
+  PutFixed32(dst, static_cast<uint32_t>(records.size()));
+  PutFixed64(dst, XXH64(records.data(), records.size(), 0));
+  dst->append(records.data(), records.size());
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+JournalStorage::Snapshot::Snapshot(JournalStorage* storage,
+                                   size_t num_threads,
+                                   bool compact)
+    : storage_(storage)
+    , compact_(compact)
+    , epoch_(storage->next_epoch_++)
+    , committed_(false) {
+#ifndef NDEBUG
+  thread_checks_.resize(num_threads);
+#endif  // NDEBUG
+  segments_.resize(num_threads);
+}
+
+JournalStorage::Snapshot::~Snapshot() {
+  storage_->snapshot_in_progress_ = false;
+}
+
+Status JournalStorage::Snapshot::Append(size_t thread_id,
+                                        TenantID tenant_id,
+                                        const NamespaceID& namespace_id,
+                                        const Topic& topic_name,
+                                        SequenceNumber start_seqno) {
+  return Status::NotSupported(
+      "Journal storage requires subscriptions to be identified by handles");
+}
+
+Status JournalStorage::Snapshot::AppendSubscription(
+    size_t thread_id,
+    SubscriptionHandle sub_handle,
+    TenantID tenant_id,
+    const NamespaceID& namespace_id,
+    const Topic& topic_name,
+    SequenceNumber start_seqno) {
+#ifndef NDEBUG
+  assert(thread_id < thread_checks_.size());
+  thread_checks_[thread_id].Check();
+#endif  // NDEBUG
+
+  auto segment = &segments_[thread_id];
+  auto buffer = &segment->buffer;
+
+  if (!compact_) {
+    // Only this thread touches its map of persisted subscriptions.
+    auto& persisted = storage_->persisted_[thread_id];
+    auto it = persisted.find(sub_handle);
+    if (it != persisted.end()) {
+      it->second.epoch = epoch_;
+      ++segment->num_known;
+      if (it->second.seqno != start_seqno) {
+        PutFixed8(buffer, kAdvance);
+        PutVarint64(buffer, sub_handle);
+        PutVarint64(buffer, start_seqno);
+        segment->updates.emplace_back(sub_handle, start_seqno);
+      }
+      return Status::OK();
+    }
+  }
+
+  PutFixed8(buffer, kSubscribe);
+  PutVarint64(buffer, sub_handle);
+  PutVarint32(buffer, tenant_id);
+  PutVarint64(buffer, start_seqno);
+  PutTopicID(buffer, namespace_id, topic_name);
+  segment->updates.emplace_back(sub_handle, start_seqno);
+  return Status::OK();
+}
+
+Status JournalStorage::Snapshot::Commit() {
+  if (committed_) {
+    return Status::InvalidArgument("Snapshot already committed");
+  }
+  committed_ = true;
+
+  // Subscriptions not seen by this snapshot have been terminated, these are
+  // removed first, in case a subscription has moved between threads.
+  std::string records;
+  std::vector<std::pair<size_t, SubscriptionHandle>> removed;
+  if (!compact_) {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+      const auto& persisted = storage_->persisted_[i];
+      if (segments_[i].num_known == persisted.size()) {
+        continue;
+      }
+      for (const auto& entry : persisted) {
+        if (entry.second.epoch != epoch_) {
+          PutFixed8(&records, kUnsubscribe);
+          PutVarint64(&records, entry.first);
+          removed.emplace_back(i, entry.first);
+        }
+      }
+    }
+  }
+  for (const auto& segment : segments_) {
+    records.append(segment.buffer);
+  }
+
+  std::string transaction;
+  PutTransaction(&transaction, records);
+  records.clear();
+
+  Status st;
+  if (compact_) {
+    st = storage_->RewriteJournal(transaction);
+  } else if (transaction.size() > kTransactionHeaderSize) {
+    st = storage_->AppendToJournal(transaction);
+  }
+  if (!st.ok()) {
+    // The journal might have been partially written, next snapshot will
+    // rewrite it from scratch.
+    storage_->persisted_.clear();
+    return st;
+  }
+
+  // Only now, that the transaction is persisted, update tracked state.
+  if (compact_) {
+    storage_->persisted_.clear();
+    storage_->persisted_.resize(segments_.size());
+  }
+  for (const auto& entry : removed) {
+    storage_->persisted_[entry.first].erase(entry.second);
+  }
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    auto& persisted = storage_->persisted_[i];
+    for (const auto& update : segments_[i].updates) {
+      persisted[update.first] = Persisted{update.second, epoch_};
+    }
+  }
+  return Status::OK();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+JournalStorage::JournalStorage(BaseEnv* env,
+                               std::shared_ptr<Logger> info_log,
+                               std::string file_path)
+    : env_(env)
+    , info_log_(std::move(info_log))
+    , file_path_(std::move(file_path))
+    , journal_size_(0)
+    , compacted_size_(0)
+    , next_epoch_(1)
+    , snapshot_in_progress_(false) {
+}
+
+Status JournalStorage::RestoreSubscriptions(
+    std::vector<SubscriptionParameters>* subscriptions) {
+  // Read the whole journal.
+  std::unique_ptr<SequentialFile> file;
+  EnvOptions env_options;
+  Status st = env_->NewSequentialFile(file_path_, &file, env_options);
+  if (!st.ok()) {
+    return st;
+  }
+  std::string contents;
+  {
+    const size_t kChunkSize = 64 * 1024;
+    std::unique_ptr<char[]> buffer(new char[kChunkSize]);
+    Slice chunk;
+    do {
+      st = file->Read(kChunkSize, &chunk, buffer.get());
+      if (!st.ok()) {
+        return st;
+      }
+      contents.append(chunk.data(), chunk.size());
+    } while (!chunk.empty());
+  }
+
+  Slice in(contents);
+  uint32_t magic;
+  uint8_t version;
+  if (!GetFixed32(&in, &magic) || magic != kJournalMagic ||
+      !GetFixed8(&in, &version)) {
+    return Status::IOError("Bad journal header");
+  }
+  if (version != kJournalVersion) {
+    return Status::NotSupported("Unknown journal version " +
+                                std::to_string(version));
+  }
+
+  // Replay transactions, preserving the order in which subscriptions were
+  // first added.
+  std::vector<SubscriptionParameters> result;
+  std::vector<bool> alive;
+  std::unordered_map<SubscriptionHandle, size_t> index;
+  while (!in.empty()) {
+    uint32_t size;
+    uint64_t checksum;
+    if (in.size() < kTransactionHeaderSize || !GetFixed32(&in, &size) ||
+        !GetFixed64(&in, &checksum) || in.size() < size ||
+        XXH64(in.data(), size, 0) != checksum) {
+      // Most likely the process died while appending this transaction.
+      LOG_WARN(info_log_,
+               "Ignoring torn transaction at the end of journal: %s",
+               file_path_.c_str());
+      break;
+    }
+    Slice records(in.data(), size);
+    in.remove_prefix(size);
+
+    while (!records.empty()) {
+      uint8_t type;
+      SubscriptionHandle handle;
+      if (!GetFixed8(&records, &type) || !GetVarint64(&records, &handle)) {
+        return Status::IOError("Bad journal record");
+      }
+      switch (type) {
+        case kSubscribe: {
+          uint32_t tenant_id;
+          SequenceNumber seqno;
+          Slice namespace_id, topic_name;
+          if (!GetVarint32(&records, &tenant_id) ||
+              tenant_id > std::numeric_limits<TenantID>::max() ||
+              !GetVarint64(&records, &seqno) ||
+              !GetTopicID(&records, &namespace_id, &topic_name)) {
+            return Status::IOError("Bad subscribe record");
+          }
+          auto it = index.find(handle);
+          if (it != index.end()) {
+            alive[it->second] = false;
+          }
+          index[handle] = result.size();
+          result.emplace_back(static_cast<TenantID>(tenant_id),
+                              namespace_id.ToString(),
+                              topic_name.ToString(),
+                              seqno);
+          alive.push_back(true);
+          break;
+        }
+        case kAdvance: {
+          SequenceNumber seqno;
+          if (!GetVarint64(&records, &seqno)) {
+            return Status::IOError("Bad advance record");
+          }
+          auto it = index.find(handle);
+          if (it == index.end()) {
+            return Status::IOError("Advance record for unknown subscription");
+          }
+          result[it->second].start_seqno = seqno;
+          break;
+        }
+        case kUnsubscribe: {
+          auto it = index.find(handle);
+          if (it == index.end()) {
+            return Status::IOError(
+                "Unsubscribe record for unknown subscription");
+          }
+          alive[it->second] = false;
+          index.erase(it);
+          break;
+        }
+        default:
+          return Status::IOError("Unknown journal record type " +
+                                 std::to_string(type));
+      }
+    }
+  }
+
+  // Drop terminated subscriptions.
+  size_t num_alive = 0;
+  for (size_t i = 0; i < result.size(); ++i) {
+    if (alive[i]) {
+      if (i != num_alive) {
+        result[num_alive] = std::move(result[i]);
+      }
+      ++num_alive;
+    }
+  }
+  result.resize(num_alive);
+
+  // Successfully read all subscriptions.
+  *subscriptions = std::move(result);
+  return Status::OK();
+}
+
+Status JournalStorage::CreateSnapshot(
+    size_t num_threads,
+    std::shared_ptr<SubscriptionStorage::Snapshot>* snapshot) {
+  if (snapshot_in_progress_.exchange(true)) {
+    return Status::NotSupported("Another snapshot is in progress");
+  }
+
+  // Handles are only meaningful within a single instance of the storage, so
+  // the first snapshot always rewrites the journal.
+  bool compact = !journal_ || persisted_.size() != num_threads;
+  if (!compact && journal_size_ > kMinCompactionBytes) {
+    compact = journal_size_ > kCompactionRatio * compacted_size_;
+  }
+
+  snapshot->reset(new Snapshot(this, num_threads, compact));
+  return Status::OK();
+}
+
+Status JournalStorage::RewriteJournal(const std::string& transaction) {
+  journal_.reset();
+  journal_size_ = 0;
+
+  // Create a new temporary file for writing.
+  std::string temp_path;
+  int fd = OpenNewTempFile(file_path_, &temp_path);
+  if (fd < 0) {
+    return Status::IOError("Cannot open: " + temp_path + strerror(errno));
+  }
+  {
+    DescriptorEvent descriptor(fd);
+    std::string data;
+    data.reserve(kJournalHeaderSize + transaction.size());
+    PutFixed32(&data, kJournalMagic);
+    PutFixed8(&data, kJournalVersion);
+    data.append(transaction);
+    Status st = descriptor.Write(data);
+    if (st.ok()) {
+      // The rename must not be persisted before the contents.
+      st = descriptor.Sync();
+    }
+    if (!st.ok()) {
+      return st;
+    }
+  }
+
+  // Swap the journal.
+  if (std::rename(temp_path.c_str(), file_path_.c_str()) != 0) {
+    return Status::IOError("Journal failed when committing state: " +
+                           std::string(strerror(errno)));
+  }
+  Status st = SyncParentDirectory(file_path_);
+  if (!st.ok()) {
+    return st;
+  }
+  fd = open(file_path_.c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    return Status::IOError("Cannot open: " + file_path_ + strerror(errno));
+  }
+  journal_.reset(new DescriptorEvent(fd));
+  journal_size_ = kJournalHeaderSize + transaction.size();
+  compacted_size_ = journal_size_;
+  LOG_INFO(info_log_,
+           "Compacted subscription journal %s to %" PRIu64 " bytes",
+           file_path_.c_str(),
+           journal_size_);
+  return Status::OK();
+}
+
+Status JournalStorage::AppendToJournal(const std::string& transaction) {
+  Status st = journal_->Write(transaction);
+  if (st.ok()) {
+    st = journal_->Sync();
+  }
+  if (!st.ok()) {
+    journal_.reset();
+    return st;
+  }
+  journal_size_ += transaction.size();
+  return Status::OK();
+}
+
+}  // namespace rocketspeed
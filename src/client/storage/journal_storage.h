@@ -0,0 +1,146 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "include/Status.h"
+#include "include/SubscriptionStorage.h"
+#include "src/messages/descriptor_event.h"
+#include "src/util/common/base_env.h"
+#include "src/util/common/thread_check.h"
+
+namespace rocketspeed {
+
+class Logger;
+class SubscriptionParameters;
+
+/**
+ * A storage strategy which persists subscriptions in an append-only journal.
+ *
+ * The journal consists of a header followed by a sequence of checksummed
+ * transactions, one per committed snapshot. A transaction holds records which
+ * add a subscription, advance its sequence number or remove it. Restoring
+ * replays all transactions in order, a torn transaction at the end of the
+ * journal is ignored.
+ *
+ * The storage remembers the sequence number persisted for every subscription
+ * handle, so that a snapshot only appends records for subscriptions which have
+ * changed. Once the journal grows past kCompactionRatio times the size of the
+ * last compacted journal, the next snapshot rewrites it from scratch.
+ */
+class JournalStorage : public SubscriptionStorage {
+ public:
+  /** Journal is compacted when it is this many times larger than live set. */
+  static constexpr uint64_t kCompactionRatio = 2;
+  /** Journals smaller than this are never compacted. */
+  static constexpr uint64_t kMinCompactionBytes = 64 * 1024;
+
+  class Snapshot : public SubscriptionStorage::Snapshot {
+   public:
+    Snapshot(JournalStorage* storage, size_t num_threads, bool compact);
+
+    ~Snapshot();
+
+    /** Not supported, subscriptions must be identified by a handle. */
+    Status Append(size_t thread_id,
+                  TenantID tenant_id,
+                  const NamespaceID& namespace_id,
+                  const Topic& topic_name,
+                  SequenceNumber start_seqno) override;
+
+    Status AppendSubscription(size_t thread_id,
+                              SubscriptionHandle sub_handle,
+                              TenantID tenant_id,
+                              const NamespaceID& namespace_id,
+                              const Topic& topic_name,
+                              SequenceNumber start_seqno) override;
+
+    Status Commit() override;
+
+   private:
+    /** Records appended by a single thread. */
+    struct Segment {
+      std::string buffer;
+      // Subscriptions added or advanced by this snapshot.
+      std::vector<std::pair<SubscriptionHandle, SequenceNumber>> updates;
+      // Number of subscriptions appended, that were already persisted.
+      size_t num_known = 0;
+    };
+
+#ifndef NDEBUG
+    std::vector<ThreadCheck> thread_checks_;
+#endif  // NDEBUG
+
+    // The storage must outlive all of its snapshots.
+    JournalStorage* const storage_;
+    // Whether this snapshot rewrites the journal from scratch.
+    const bool compact_;
+    // Identifies subscriptions seen by this snapshot.
+    const uint64_t epoch_;
+    std::vector<Segment> segments_;
+    bool committed_;
+  };
+
+  /**
+   * Creates a new journal-based storage.
+   *
+   * @param env An environment used by the client.
+   * @param info_log A client's logger.
+   * @param file_path Path of a file, where the journal will be written.
+   */
+  JournalStorage(BaseEnv* env,
+                 std::shared_ptr<Logger> info_log,
+                 std::string file_path);
+
+  Status RestoreSubscriptions(
+      std::vector<SubscriptionParameters>* subscriptions) override;
+
+  Status CreateSnapshot(
+      size_t num_threads,
+      std::shared_ptr<SubscriptionStorage::Snapshot>* snapshot) override;
+
+  /** Current size of the journal in bytes, zero if nothing was written yet. */
+  uint64_t GetJournalSize() const { return journal_size_; }
+
+ private:
+  friend class Snapshot;
+
+  /** State of a subscription, as persisted in the journal. */
+  struct Persisted {
+    SequenceNumber seqno;
+    // Epoch of the last snapshot which has seen this subscription.
+    uint64_t epoch;
+  };
+  using PersistedMap = std::unordered_map<SubscriptionHandle, Persisted>;
+
+  /** Replaces journal with provided transaction. */
+  Status RewriteJournal(const std::string& transaction);
+
+  /** Appends provided transaction to the journal. */
+  Status AppendToJournal(const std::string& transaction);
+
+  BaseEnv* env_;
+  const std::shared_ptr<Logger> info_log_;
+  const std::string file_path_;
+
+  // Persisted subscriptions, one map per writing thread, so that threads
+  // writing the snapshot do not need to synchronise.
+  std::vector<PersistedMap> persisted_;
+  // Journal open for appends, null until the journal is first rewritten.
+  std::unique_ptr<DescriptorEvent> journal_;
+  uint64_t journal_size_;
+  uint64_t compacted_size_;
+  uint64_t next_epoch_;
+  std::atomic<bool> snapshot_in_progress_;
+};
+
+}  // namespace rocketspeed
@@ -87,6 +87,96 @@ TEST(FileStorageTest, GenericSubscriptionStorage) {
   ASSERT_TRUE(restored == expected);
 }
 
+TEST(FileStorageTest, LargeConcurrentSnapshot) {
+  FileStorage storage(env, info_log, file_path);
+
+  // Enough subscriptions to span many blocks per thread, so that blocks are
+  // written in the background and restored in parallel.
+  const size_t kNumThreads = 4;
+  const size_t kPerThread = 50000;
+  auto make_params = [](size_t thread_id, size_t i) {
+    return SubscriptionParameters(
+        static_cast<TenantID>(100 + thread_id),
+        GuestNamespace,
+        "LargeConcurrentSnapshot_" + std::to_string(thread_id) + "_" +
+            std::to_string(i),
+        static_cast<SequenceNumber>(i * 7919));
+  };
+
+  std::shared_ptr<SubscriptionStorage::Snapshot> snapshot;
+  ASSERT_OK(storage.CreateSnapshot(kNumThreads, &snapshot));
+  std::vector<std::thread> threads;
+  std::vector<Status> statuses(kNumThreads);
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < kPerThread; ++i) {
+        auto params = make_params(t, i);
+        Status st = snapshot->Append(t,
+                                     params.tenant_id,
+                                     params.namespace_id,
+                                     params.topic_name,
+                                     params.start_seqno);
+        if (!st.ok()) {
+          statuses[t] = st;
+          return;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& st : statuses) {
+    ASSERT_OK(st);
+  }
+  ASSERT_OK(snapshot->Commit());
+
+  std::vector<SubscriptionParameters> restored;
+  ASSERT_OK(storage.RestoreSubscriptions(&restored));
+  ASSERT_EQ(restored.size(), kNumThreads * kPerThread);
+
+  // Subscriptions from each thread must appear in the order of appends.
+  std::vector<size_t> next(kNumThreads, 0);
+  for (const auto& params : restored) {
+    size_t t = params.tenant_id - 100;
+    ASSERT_LT(t, kNumThreads);
+    ASSERT_TRUE(params == make_params(t, next[t]));
+    ++next[t];
+  }
+}
+
+TEST(FileStorageTest, ChecksumMismatch) {
+  FileStorage storage(env, info_log, file_path);
+
+  std::shared_ptr<SubscriptionStorage::Snapshot> snapshot;
+  ASSERT_OK(storage.CreateSnapshot(1, &snapshot));
+  ASSERT_OK(snapshot->Append(
+      0, Tenant::GuestTenant, GuestNamespace, "ChecksumMismatch", 101));
+  ASSERT_OK(snapshot->Commit());
+
+  // Flip a byte in the topic name.
+  std::string contents;
+  {
+    std::unique_ptr<SequentialFile> file;
+    ASSERT_OK(env->NewSequentialFile(file_path, &file, EnvOptions()));
+    char buffer[4096];
+    Slice chunk;
+    ASSERT_OK(file->Read(sizeof(buffer), &chunk, buffer));
+    contents = chunk.ToString();
+  }
+  auto pos = contents.find("ChecksumMismatch");
+  ASSERT_TRUE(pos != std::string::npos);
+  contents[pos] = 'X';
+  {
+    std::unique_ptr<WritableFile> file;
+    ASSERT_OK(env->NewWritableFile(file_path, &file, EnvOptions()));
+    ASSERT_OK(file->Append(Slice(contents)));
+  }
+
+  std::vector<SubscriptionParameters> restored;
+  ASSERT_TRUE(storage.RestoreSubscriptions(&restored).IsIOError());
+}
+
 TEST(FileStorageTest, MissingFile) {
   FileStorage storage(env, info_log, file_path);
 
@@ -0,0 +1,190 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "include/Status.h"
+#include "include/Types.h"
+#include "src/port/Env.h"
+#include "src/client/storage/journal_storage.h"
+#include "src/util/auto_roll_logger.h"
+#include "src/util/testharness.h"
+#include "src/util/testutil.h"
+
+namespace rocketspeed {
+
+class JournalStorageTest {
+ public:
+  JournalStorageTest()
+      : file_path(test::TmpDir() + "/JournalStorageTest-journal_data"),
+        env(Env::Default()) {
+    ASSERT_OK(test::CreateLogger(env, "JournalStorageTest", &info_log));
+    // Make sure there is no stale data.
+    env->DeleteFile(file_path);
+  }
+
+ protected:
+  /** Writes a snapshot of subscriptions with given handles and seqnos. */
+  Status Save(JournalStorage* storage,
+              const std::vector<std::pair<SubscriptionHandle, SequenceNumber>>&
+                  subscriptions) {
+    std::shared_ptr<SubscriptionStorage::Snapshot> snapshot;
+    Status st = storage->CreateSnapshot(1, &snapshot);
+    if (!st.ok()) {
+      return st;
+    }
+    for (const auto& sub : subscriptions) {
+      st = snapshot->AppendSubscription(
+          0, sub.first, tenant_id, namespace_id, TopicName(sub.first),
+          sub.second);
+      if (!st.ok()) {
+        return st;
+      }
+    }
+    return snapshot->Commit();
+  }
+
+  static Topic TopicName(SubscriptionHandle handle) {
+    return "JournalStorageTest_" + std::to_string(handle);
+  }
+
+  SubscriptionParameters Expected(SubscriptionHandle handle,
+                                  SequenceNumber seqno) {
+    return SubscriptionParameters(
+        tenant_id, namespace_id, TopicName(handle), seqno);
+  }
+
+  const TenantID tenant_id = Tenant::GuestTenant;
+  const NamespaceID namespace_id = GuestNamespace;
+  const std::string file_path;
+
+  Env* const env;
+  std::shared_ptr<rocketspeed::Logger> info_log;
+};
+
+TEST(JournalStorageTest, IncrementalSnapshots) {
+  JournalStorage storage(env, info_log, file_path);
+
+  ASSERT_OK(Save(&storage, {{1, 100}, {2, 0}, {3, 300}}));
+  const uint64_t initial_size = storage.GetJournalSize();
+
+  // Nothing changed, nothing should be appended.
+  ASSERT_OK(Save(&storage, {{1, 100}, {2, 0}, {3, 300}}));
+  ASSERT_EQ(storage.GetJournalSize(), initial_size);
+
+  // Advance one, terminate one and add one subscription.
+  ASSERT_OK(Save(&storage, {{1, 150}, {3, 300}, {4, 400}}));
+  ASSERT_GT(storage.GetJournalSize(), initial_size);
+
+  std::vector<SubscriptionParameters> restored;
+  ASSERT_OK(storage.RestoreSubscriptions(&restored));
+  std::vector<SubscriptionParameters> expected = {
+      Expected(1, 150), Expected(3, 300), Expected(4, 400)};
+  ASSERT_TRUE(restored == expected);
+
+  // A new instance of the storage sees the same subscriptions.
+  JournalStorage reopened(env, info_log, file_path);
+  restored.clear();
+  ASSERT_OK(reopened.RestoreSubscriptions(&restored));
+  ASSERT_TRUE(restored == expected);
+}
+
+TEST(JournalStorageTest, AdvanceIsSmall) {
+  JournalStorage storage(env, info_log, file_path);
+
+  std::vector<std::pair<SubscriptionHandle, SequenceNumber>> subscriptions;
+  for (SubscriptionHandle handle = 0; handle < 1000; ++handle) {
+    subscriptions.emplace_back(handle, 1);
+  }
+  ASSERT_OK(Save(&storage, subscriptions));
+  const uint64_t initial_size = storage.GetJournalSize();
+
+  // Bytes appended depend on the number of changes, not subscriptions.
+  subscriptions[500].second = 2;
+  ASSERT_OK(Save(&storage, subscriptions));
+  ASSERT_LT(storage.GetJournalSize() - initial_size, 32U);
+
+  std::vector<SubscriptionParameters> restored;
+  ASSERT_OK(storage.RestoreSubscriptions(&restored));
+  ASSERT_EQ(restored.size(), subscriptions.size());
+  ASSERT_TRUE(restored[500] == Expected(500, 2));
+}
+
+TEST(JournalStorageTest, Compaction) {
+  JournalStorage storage(env, info_log, file_path);
+
+  std::vector<std::pair<SubscriptionHandle, SequenceNumber>> subscriptions;
+  for (SubscriptionHandle handle = 0; handle < 1000; ++handle) {
+    subscriptions.emplace_back(handle, 1);
+  }
+  ASSERT_OK(Save(&storage, subscriptions));
+  const uint64_t compacted_size = storage.GetJournalSize();
+
+  // Keep advancing all subscriptions, journal must stay bounded.
+  for (SequenceNumber seqno = 2; seqno < 100; ++seqno) {
+    for (auto& sub : subscriptions) {
+      sub.second = seqno;
+    }
+    ASSERT_OK(Save(&storage, subscriptions));
+    ASSERT_LE(storage.GetJournalSize(),
+              std::max(JournalStorage::kMinCompactionBytes,
+                       JournalStorage::kCompactionRatio * compacted_size) +
+                  compacted_size);
+  }
+
+  std::vector<SubscriptionParameters> restored;
+  ASSERT_OK(storage.RestoreSubscriptions(&restored));
+  ASSERT_EQ(restored.size(), subscriptions.size());
+  for (size_t i = 0; i < restored.size(); ++i) {
+    ASSERT_TRUE(restored[i] == Expected(subscriptions[i].first, 99));
+  }
+}
+
+TEST(JournalStorageTest, TornTransaction) {
+  {
+    JournalStorage storage(env, info_log, file_path);
+    ASSERT_OK(Save(&storage, {{1, 100}, {2, 200}}));
+    ASSERT_OK(Save(&storage, {{1, 100}}));
+  }
+
+  // Chop off the last byte, as if the process died while appending.
+  std::string contents;
+  ASSERT_OK(ReadFileToString(env, file_path, &contents));
+  contents.resize(contents.size() - 1);
+  ASSERT_OK(WriteStringToFile(env, contents, file_path));
+
+  JournalStorage storage(env, info_log, file_path);
+  std::vector<SubscriptionParameters> restored;
+  ASSERT_OK(storage.RestoreSubscriptions(&restored));
+  std::vector<SubscriptionParameters> expected = {
+      Expected(1, 100), Expected(2, 200)};
+  ASSERT_TRUE(restored == expected);
+
+  // First snapshot rewrites the journal, dropping the torn transaction.
+  ASSERT_OK(Save(&storage, {{7, 700}}));
+  restored.clear();
+  ASSERT_OK(storage.RestoreSubscriptions(&restored));
+  expected = {Expected(7, 700)};
+  ASSERT_TRUE(restored == expected);
+}
+
+TEST(JournalStorageTest, SingleSnapshotInProgress) {
+  JournalStorage storage(env, info_log, file_path);
+
+  std::shared_ptr<SubscriptionStorage::Snapshot> snapshot1, snapshot2;
+  ASSERT_OK(storage.CreateSnapshot(1, &snapshot1));
+  ASSERT_TRUE(!storage.CreateSnapshot(1, &snapshot2).ok());
+  ASSERT_TRUE(!snapshot1->Append(0, tenant_id, namespace_id, "a", 1).ok());
+  snapshot1.reset();
+  ASSERT_OK(storage.CreateSnapshot(1, &snapshot2));
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) { return rocketspeed::test::RunAllTests(); }
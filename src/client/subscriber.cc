@@ -6,6 +6,7 @@
 #define __STDC_FORMAT_MACROS
 #include "subscriber.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <chrono>
@@ -16,6 +17,8 @@
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "external/folly/move_wrapper.h"
 
@@ -30,7 +33,7 @@
 #include "src/messages/event_loop.h"
 #include "src/port/port.h"
 #include "src/util/common/random.h"
-#include "src/util/timeout_list.h"
+#include "src/util/timer_wheel.h"
 
 namespace rocketspeed {
 
@@ -38,25 +41,23 @@ namespace rocketspeed {
 void SubscriptionState::Terminate(const std::shared_ptr<Logger>& info_log,
                                   SubscriptionID sub_id,
                                   MessageUnsubscribe::Reason reason) {
-  thread_check_.Check();
-
   switch (reason) {
     case MessageUnsubscribe::Reason::kRequested:
       LOG_INFO(info_log,
                "Unsubscribed ID(%" PRIu64 ") on Topic(%s, %s)@%" PRIu64,
                sub_id,
-               namespace_id_.c_str(),
-               topic_name_.c_str(),
-               expected_seqno_);
+               cold_->namespace_id.c_str(),
+               cold_->topic_name.c_str(),
+               hot_->expected_seqno);
       AnnounceStatus(false, Status::OK());
       break;
     case MessageUnsubscribe::Reason::kInvalid:
       LOG_INFO(info_log,
                "Kicked subscription ID (%" PRIu64 ") on Topic(%s, %s)@%" PRIu64,
                sub_id,
-               namespace_id_.c_str(),
-               topic_name_.c_str(),
-               expected_seqno_);
+               cold_->namespace_id.c_str(),
+               cold_->topic_name.c_str(),
+               hot_->expected_seqno);
       AnnounceStatus(false, Status::InvalidArgument("Invalid subscription"));
       break;
     case MessageUnsubscribe::Reason::kBackOff:
@@ -124,8 +125,6 @@ class DataLossInfoImpl : public DataLossInfo {
 void SubscriptionState::ReceiveMessage(
     const std::shared_ptr<Logger>& info_log,
     std::unique_ptr<MessageDeliver> deliver) {
-  thread_check_.Check();
-
   if (!ProcessMessage(info_log, *deliver)) {
     return;
   }
@@ -133,23 +132,23 @@ void SubscriptionState::ReceiveMessage(
   switch (deliver->GetMessageType()) {
     case MessageType::mDeliverData:
       // Deliver data message to the application.
-      if (deliver_callback_) {
+      if (cold_->callbacks->deliver_callback) {
         std::unique_ptr<MessageDeliverData> data(
             static_cast<MessageDeliverData*>(deliver.release()));
         std::unique_ptr<MessageReceived> received(
             new MessageReceivedImpl(std::move(data)));
-        deliver_callback_(received);
+        cold_->callbacks->deliver_callback(received);
       }
       break;
     case MessageType::mDeliverGap:
-      if (data_loss_callback_) {
+      if (cold_->callbacks->data_loss_callback) {
         std::unique_ptr<MessageDeliverGap> gap(
             static_cast<MessageDeliverGap*>(deliver.release()));
 
         if (gap->GetGapType() != GapType::kBenign) {
           std::unique_ptr<DataLossInfo> data_loss_info(
               new DataLossInfoImpl(std::move(gap)));
-          data_loss_callback_(data_loss_info);
+          cold_->callbacks->data_loss_callback(data_loss_info);
         }
       }
       break;
@@ -160,23 +159,21 @@ void SubscriptionState::ReceiveMessage(
 
 bool SubscriptionState::ProcessMessage(const std::shared_ptr<Logger>& info_log,
                                        const MessageDeliver& deliver) {
-  thread_check_.Check();
-
   const auto current = deliver.GetSequenceNumber(),
              previous = deliver.GetPrevSequenceNumber();
   assert(current >= previous);
 
-  if (expected_seqno_ > current || expected_seqno_ < previous ||
-      (expected_seqno_ == 0 && previous != 0) ||
-      (expected_seqno_ != 0 && previous == 0)) {
+  const SequenceNumber expected = hot_->expected_seqno;
+  if (expected > current || expected < previous ||
+      (expected == 0 && previous != 0) || (expected != 0 && previous == 0)) {
     LOG_WARN(info_log,
              "Duplicate message %" PRIu64 "-%" PRIu64
              " on Topic(%s, %s) expected %" PRIu64,
              previous,
              current,
-             namespace_id_.c_str(),
-             topic_name_.c_str(),
-             expected_seqno_);
+             cold_->namespace_id.c_str(),
+             cold_->topic_name.c_str(),
+             hot_->expected_seqno);
     return false;
   }
 
@@ -187,25 +184,23 @@ bool SubscriptionState::ProcessMessage(const std::shared_ptr<Logger>& info_log,
             type_description,
             previous,
             current,
-            namespace_id_.c_str(),
-            topic_name_.c_str(),
-            expected_seqno_);
+            cold_->namespace_id.c_str(),
+            cold_->topic_name.c_str(),
+            hot_->expected_seqno);
 
-  expected_seqno_ = current + 1;
+  hot_->expected_seqno = current + 1;
   return true;
 }
 
 void SubscriptionState::Acknowledge(SequenceNumber seqno) {
-  thread_check_.Check();
-
-  if (last_acked_seqno_ < seqno) {
-    last_acked_seqno_ = seqno;
+  if (hot_->last_acked_seqno < seqno) {
+    hot_->last_acked_seqno = seqno;
   }
 }
 
 class SubscriptionStatusImpl : public SubscriptionStatus {
  public:
-  SubscriptionStatusImpl(const SubscriptionState& sub_state,
+  SubscriptionStatusImpl(SubscriptionState sub_state,
                          bool subscribed,
                          Status status)
   : sub_state_(sub_state)
@@ -231,17 +226,16 @@ class SubscriptionStatusImpl : public SubscriptionStatus {
   const Status& GetStatus() const override { return status_; }
 
  private:
-  const SubscriptionState& sub_state_;
+  const SubscriptionState sub_state_;
   bool subscribed_;
   Status status_;
 };
 
 void SubscriptionState::AnnounceStatus(bool subscribed, Status status) {
-  thread_check_.Check();
-
-  if (subscription_callback_) {
+  const auto& callback = cold_->callbacks->subscription_callback;
+  if (callback) {
     SubscriptionStatusImpl sub_status(*this, subscribed, std::move(status));
-    subscription_callback_(sub_status);
+    callback(sub_status);
   }
 }
 
@@ -262,51 +256,89 @@ Status Subscriber::Start() {
   return Status::OK();
 }
 
-const Statistics& Subscriber::GetStatistics() {
-  stats_.active_subscriptions->Set(subscriptions_.size());
+const Statistics& Subscriber::GetStatistics() const {
   return stats_.all;
 }
 
-void Subscriber::StartSubscription(SubscriptionID sub_id,
-                                   SubscriptionParameters parameters,
-                                   MessageReceivedCallback deliver_callback,
-                                   SubscribeCallback subscription_callback,
-                                   DataLossCallback data_loss_callback) {
-  SubscriptionState* sub_state;
-  {  // Store the subscription state.
-    auto emplace_result = subscriptions_.emplace(
-        sub_id,
-        SubscriptionState(std::move(parameters),
-                          std::move(subscription_callback),
-                          std::move(deliver_callback),
-                          std::move(data_loss_callback)));
-    if (!emplace_result.second) {
-      LOG_ERROR(
-          options_.info_log, "Duplicate subscription ID(%" PRIu64 ")", sub_id);
-      assert(false);
-      return;
-    }
-    sub_state = &emplace_result.first->second;
+void Subscriber::UpdateSubscriptionStats() {
+  stats_.active_subscriptions->Set(subscriptions_.Size());
+  stats_.subscriptions_memory_bytes->Set(subscriptions_.GetMemoryUsage());
+}
+
+void Subscriber::RecordTrace(MessageDeliverData* data) {
+  data->StampTrace(MessageTrace::kClientDeliver, options_.env->NowMicros());
+  stats_.traced_messages->Add(1);
+  uint64_t total = 0;
+  data->GetTrace().ForEachHopLatency(
+      [&](MessageTrace::Hop hop, uint64_t micros) {
+        stats_.trace_hop_latency[hop]->Record(micros);
+        total += micros;
+      });
+  stats_.trace_total_latency->Record(total);
+}
+
+void Subscriber::StartSubscription(
+    SubscriptionID sub_id,
+    SubscriptionParameters parameters,
+    std::shared_ptr<const SubscriptionCallbacks> callbacks) {
+  if (InsertSubscription(sub_id, std::move(parameters), std::move(callbacks))) {
+    // Issue subscription.
+    SendPendingRequests();
+  }
+}
+
+void Subscriber::StartSubscriptions(
+    std::vector<std::pair<SubscriptionID, SubscriptionParameters>> batch,
+    std::shared_ptr<const SubscriptionCallbacks> callbacks) {
+  for (auto& entry : batch) {
+    InsertSubscription(entry.first, std::move(entry.second), callbacks);
   }
+  // Issue all subscriptions at once.
+  SendPendingRequests();
+}
+
+bool Subscriber::InsertSubscription(
+    SubscriptionID sub_id,
+    SubscriptionParameters parameters,
+    std::shared_ptr<const SubscriptionCallbacks> callbacks) {
+  thread_check_.Check();
+  assert(callbacks);
+
+  // Store the subscription state.
+  const SubscriptionHotState hot = SubscriptionState::MakeHotState(parameters);
+  auto ref = subscriptions_.Insert(
+      sub_id,
+      hot,
+      SubscriptionColdState{parameters.tenant_id,
+                            std::move(parameters.namespace_id),
+                            std::move(parameters.topic_name),
+                            std::move(callbacks)});
+  if (!ref) {
+    LOG_ERROR(
+        options_.info_log, "Duplicate subscription ID(%" PRIu64 ")", sub_id);
+    assert(false);
+    return false;
+  }
+  UpdateSubscriptionStats();
+  SubscriptionState sub_state(ref);
 
   LOG_INFO(options_.info_log,
            "Subscribed on Topic(%s,%s)@%" PRIu64 " Tenant(%u) ID(%" PRIu64 ")",
-           sub_state->GetNamespace().c_str(),
-           sub_state->GetTopicName().c_str(),
-           sub_state->GetExpected(),
-           sub_state->GetTenant(),
+           sub_state.GetNamespace().c_str(),
+           sub_state.GetTopicName().c_str(),
+           sub_state.GetExpected(),
+           sub_state.GetTenant(),
            sub_id);
 
-  // Issue subscription.
   pending_subscribes_.emplace(sub_id);
-  SendPendingRequests();
+  return true;
 }
 
 void Subscriber::Acknowledge(SubscriptionID sub_id,
                              SequenceNumber acked_seqno) {
   // Find corresponding subscription state.
-  auto it = subscriptions_.find(sub_id);
-  if (it == subscriptions_.end()) {
+  auto ref = subscriptions_.Find(sub_id);
+  if (!ref) {
     LOG_WARN(options_.info_log,
              "Cannot acknowledge missing subscription ID (%" PRIu64 ")",
              sub_id);
@@ -314,29 +346,32 @@ void Subscriber::Acknowledge(SubscriptionID sub_id,
   }
 
   // Record acknowledgement in the state.
-  it->second.Acknowledge(acked_seqno);
+  SubscriptionState(ref).Acknowledge(acked_seqno);
 }
 
 void Subscriber::TerminateSubscription(SubscriptionID sub_id) {
-  // Remove subscription state entry.
-  auto it = subscriptions_.find(sub_id);
-  if (it == subscriptions_.end()) {
+  auto ref = subscriptions_.Find(sub_id);
+  if (!ref) {
     LOG_WARN(options_.info_log,
              "Cannot remove missing subscription ID(%" PRIu64 ")",
              sub_id);
     stats_.unsubscribes_invalid_handle->Add(1);
     return;
   }
-  SubscriptionState sub_state(std::move(it->second));
-  subscriptions_.erase(it);
+  SubscriptionState sub_state(ref);
+  const TenantID tenant_id = sub_state.GetTenant();
 
   // Update subscription state, which announces subscription status to the
   // application.
   sub_state.Terminate(
       options_.info_log, sub_id, MessageUnsubscribe::Reason::kRequested);
 
+  // Remove subscription state entry.
+  subscriptions_.Erase(sub_id);
+  UpdateSubscriptionStats();
+
   // Issue unsubscribe request.
-  pending_terminations_.emplace(sub_id, sub_state.GetTenant());
+  pending_terminations_.emplace(sub_id, tenant_id);
   // Remove pending subscribe request, if any.
   pending_subscribes_.erase(sub_id);
   SendPendingRequests();
@@ -344,24 +379,26 @@ void Subscriber::TerminateSubscription(SubscriptionID sub_id) {
 
 Status Subscriber::SaveState(SubscriptionStorage::Snapshot* snapshot,
                              size_t worker_id) {
-  for (const auto& entry : subscriptions_) {
-    const SubscriptionState* sub_state = &entry.second;
-    SequenceNumber start_seqno = sub_state->GetLastAcknowledged();
+  Status status;
+  subscriptions_.ForEach([&](SubscriptionTable::Ref ref) {
+    if (!status.ok()) {
+      return;
+    }
+    SubscriptionState sub_state(ref);
+    SequenceNumber start_seqno = sub_state.GetLastAcknowledged();
     // Subscription storage stores parameters of subscribe requests that shall
     // be reissued, therefore we must persiste the next sequence number.
     if (start_seqno > 0) {
       ++start_seqno;
     }
-    Status status = snapshot->Append(worker_id,
-                                     sub_state->GetTenant(),
-                                     sub_state->GetNamespace(),
-                                     sub_state->GetTopicName(),
-                                     start_seqno);
-    if (!status.ok()) {
-      return status;
-    }
-  }
-  return Status::OK();
+    status = snapshot->AppendSubscription(worker_id,
+                                          ref.id,
+                                          sub_state.GetTenant(),
+                                          sub_state.GetNamespace(),
+                                          sub_state.GetTopicName(),
+                                          start_seqno);
+  });
+  return status;
 }
 
 bool Subscriber::ExpectsMessage(const std::shared_ptr<Logger>& info_log,
@@ -382,12 +419,16 @@ bool Subscriber::ExpectsMessage(const std::shared_ptr<Logger>& info_log,
   return true;
 }
 
+bool Subscriber::IsRecentlyTerminated(SubscriptionID sub_id) {
+  recent_terminations_.ProcessExpired([](SubscriptionID) {});
+  return recent_terminations_.Contains(sub_id);
+}
+
 void Subscriber::SendPendingRequests() {
   thread_check_.Check();
 
   // Evict entries from a list of recently sent unsubscribe messages.
-  recent_terminations_.ProcessExpired(
-      options_.unsubscribe_deduplication_timeout, [](SubscriptionID) {}, -1);
+  recent_terminations_.ProcessExpired([](SubscriptionID) {});
 
   // Close the connection if the configuration has changed.
   const auto current_config_version = options_.config->GetCopilotVersion();
@@ -471,7 +512,7 @@ void Subscriber::SendPendingRequests() {
   // If we have no subscriptions and some pending requests, close the
   // connection. This way we unsubscribe all of them.
   if (options_.close_connection_with_no_subscription &&
-      subscriptions_.empty()) {
+      subscriptions_.Empty()) {
     assert(pending_subscribes_.empty());
 
     // We do not use any specific tenant, there might be many unsubscribe
@@ -507,7 +548,7 @@ void Subscriber::SendPendingRequests() {
     TenantID tenant_id = it->second;
     SubscriptionID sub_id = it->first;
 
-    if (recent_terminations_.Contains(sub_id)) {
+    if (IsRecentlyTerminated(sub_id)) {
       // Skip the unsubscribe message if we sent it recently.
       pending_terminations_.erase(it);
       continue;
@@ -523,7 +564,8 @@ void Subscriber::SendPendingRequests() {
       // Message was sent, we may clear pending request.
       pending_terminations_.erase(it);
       // Record the fact, so we don't send duplicates of the message.
-      recent_terminations_.Add(sub_id);
+      recent_terminations_.Add(sub_id,
+                               options_.unsubscribe_deduplication_timeout);
     } else {
       LOG_WARN(options_.info_log,
                "Failed to send unsubscribe response for ID(%" PRIu64 ")",
@@ -533,38 +575,78 @@ void Subscriber::SendPendingRequests() {
     }
   }
 
-  // Sync subscribe requests.
+  // Sync subscribe requests, in batches of subscriptions of a single tenant
+  // if the server supports them.
+  const size_t max_batch_size =
+      std::max<size_t>(1, options_.max_subscribe_batch_size);
+  std::vector<SubscriptionID> batched;
   while (!pending_subscribes_.empty()) {
-    auto it = pending_subscribes_.begin();
-    SubscriptionID sub_id = *it;
-
-    SubscriptionState* sub_state;
-    {
-      auto it_state = subscriptions_.find(sub_id);
-      if (it_state == subscriptions_.end()) {
+    batched.clear();
+    std::unique_ptr<MessageSubscribe> subscribe;
+    std::unique_ptr<MessageSubscribeBatch> batch;
+    TenantID tenant_id = GuestTenant;
+    for (auto it = pending_subscribes_.begin();
+         it != pending_subscribes_.end() && batched.size() < max_batch_size;) {
+      const SubscriptionID sub_id = *it;
+      auto ref = subscriptions_.Find(sub_id);
+      if (!ref) {
         // Subscription doesn't exist, no need to send request.
-        pending_subscribes_.erase(it);
+        it = pending_subscribes_.erase(it);
         continue;
       }
-      sub_state = &it_state->second;
+      SubscriptionState sub_state(ref);
+
+      if (batched.empty()) {
+        tenant_id = sub_state.GetTenant();
+        subscribe.reset(new MessageSubscribe(tenant_id,
+                                             sub_state.GetNamespace(),
+                                             sub_state.GetTopicName(),
+                                             sub_state.GetExpected(),
+                                             sub_id));
+      } else if (sub_state.GetTenant() != tenant_id) {
+        // Goes out in another batch.
+        ++it;
+        continue;
+      } else {
+        if (!batch) {
+          batch.reset(new MessageSubscribeBatch(tenant_id));
+          batch->Add(subscribe->GetNamespace(),
+                     subscribe->GetTopicName(),
+                     subscribe->GetStartSequenceNumber(),
+                     subscribe->GetSubID());
+        }
+        batch->Add(sub_state.GetNamespace(),
+                   sub_state.GetTopicName(),
+                   sub_state.GetExpected(),
+                   sub_id);
+      }
+      batched.push_back(sub_id);
+      ++it;
+    }
+    if (batched.empty()) {
+      break;
     }
 
-    MessageSubscribe subscribe(sub_state->GetTenant(),
-                               sub_state->GetNamespace(),
-                               sub_state->GetTopicName(),
-                               sub_state->GetExpected(),
-                               sub_id);
-
-    Status st = event_loop_->SendRequest(subscribe, &copilot_socket);
+    // Send a single subscription as a plain subscribe request.
+    Status st = batch ? event_loop_->SendRequest(*batch, &copilot_socket)
+                      : event_loop_->SendRequest(*subscribe, &copilot_socket);
     if (st.ok()) {
-      LOG_INFO(options_.info_log, "Subscribed ID (%" PRIu64 ")", sub_id);
+      if (batch) {
+        LOG_INFO(options_.info_log,
+                 "Subscribed %zu IDs in a batch",
+                 batched.size());
+      } else {
+        LOG_INFO(options_.info_log, "Subscribed ID (%" PRIu64 ")", batched[0]);
+      }
       last_send_time_ = now;
-      // Message was sent, we may clear pending request.
-      pending_subscribes_.erase(it);
+      // Message was sent, we may clear pending requests.
+      for (SubscriptionID sub_id : batched) {
+        pending_subscribes_.erase(sub_id);
+      }
     } else {
       LOG_WARN(options_.info_log,
-               "Failed to send subscribe request for ID(%" PRIu64 ")",
-               sub_id);
+               "Failed to send subscribe request for %zu IDs",
+               batched.size());
       // Try next time.
       return;
     }
@@ -582,11 +664,18 @@ void Subscriber::Receive(std::unique_ptr<MessageDeliver> deliver,
 
   // Find the right subscription and deliver the message to it.
   SubscriptionID sub_id = deliver->GetSubID();
-  auto it = subscriptions_.find(sub_id);
-  if (it != subscriptions_.end()) {
-    it->second.ReceiveMessage(options_.info_log, std::move(deliver));
+  auto ref = subscriptions_.Find(sub_id);
+  if (ref) {
+    if (deliver->GetMessageType() == MessageType::mDeliverData) {
+      auto data = static_cast<MessageDeliverData*>(deliver.get());
+      if (data->GetTrace().IsSampled()) {
+        RecordTrace(data);
+      }
+    }
+    SubscriptionState(ref).ReceiveMessage(options_.info_log,
+                                          std::move(deliver));
   } else {
-    if (recent_terminations_.Contains(sub_id)) {
+    if (IsRecentlyTerminated(sub_id)) {
       LOG_DEBUG(options_.info_log,
                 "Subscription ID(%" PRIu64
                 ") for delivery not found, unsubscribed recently",
@@ -615,8 +704,8 @@ void Subscriber::Receive(std::unique_ptr<MessageUnsubscribe> unsubscribe,
 
   const SubscriptionID sub_id = unsubscribe->GetSubID();
   // Find the right subscription and deliver the message to it.
-  auto it = subscriptions_.find(sub_id);
-  if (it == subscriptions_.end()) {
+  auto ref = subscriptions_.Find(sub_id);
+  if (!ref) {
     LOG_WARN(options_.info_log,
              "Received unsubscribe with unrecognised ID(%" PRIu64 ")",
              sub_id);
@@ -639,9 +728,11 @@ void Subscriber::Receive(std::unique_ptr<MessageUnsubscribe> unsubscribe,
   }
 
   // Terminate subscription, and notify the application.
-  it->second.Terminate(options_.info_log, sub_id, unsubscribe->GetReason());
+  SubscriptionState(ref).Terminate(
+      options_.info_log, sub_id, unsubscribe->GetReason());
   // Remove the corresponding state entry.
-  subscriptions_.erase(it);
+  subscriptions_.Erase(sub_id);
+  UpdateSubscriptionStats();
 }
 
 void Subscriber::Receive(std::unique_ptr<MessageGoodbye> msg, StreamID origin) {
@@ -661,11 +752,10 @@ void Subscriber::Receive(std::unique_ptr<MessageGoodbye> msg, StreamID origin) {
   recent_terminations_.Clear();
 
   // Reissue all subscriptions.
-  for (auto& entry : subscriptions_) {
-    SubscriptionID sub_id = entry.first;
+  subscriptions_.ForEach([this](SubscriptionTable::Ref ref) {
     // Mark subscription as pending.
-    pending_subscribes_.emplace(sub_id);
-  }
+    pending_subscribes_.emplace(ref.id);
+  });
 
   // Failed to reconnect, apply back off logic.
   ++consecutive_goodbyes_count_;
@@ -5,21 +5,25 @@
 //
 #pragma once
 
+#include <cassert>
 #include <memory>
 #include <random>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "include/Status.h"
 #include "include/Types.h"
 #include "include/RocketSpeed.h"
 #include "include/SubscriptionStorage.h"
+#include "src/client/subscription_table.h"
 #include "src/messages/messages.h"
 #include "src/messages/stream_socket.h"
 #include "src/port/port.h"
 #include "src/util/common/random.h"
 #include "src/util/common/statistics.h"
-#include "src/util/timeout_list.h"
+#include "src/util/timer_wheel.h"
 
 namespace rocketspeed {
 
@@ -28,42 +32,34 @@ class MessageDeliver;
 class MessageUnsubscribe;
 class MessageGoodbye;
 class EventLoop;
-class SubscriptionState;
 
-typedef uint64_t SubscriptionID;
-
-/** Represents a state of a single subscription. */
+/**
+ * A view of a state of a single subscription stored in a SubscriptionTable.
+ * Valid only until the table is modified.
+ */
 class SubscriptionState {
  public:
-  // Noncopyable
-  SubscriptionState(const SubscriptionState&) = delete;
-  SubscriptionState& operator=(const SubscriptionState&) = delete;
-  // Movable
-  SubscriptionState(SubscriptionState&&) = default;
-  SubscriptionState& operator=(SubscriptionState&&) = default;
-
-  SubscriptionState(SubscriptionParameters parameters,
-                    SubscribeCallback subscription_callback,
-                    MessageReceivedCallback deliver_callback,
-                    DataLossCallback data_loss_callback)
-  : tenant_id_(parameters.tenant_id)
-  , namespace_id_(std::move(parameters.namespace_id))
-  , topic_name_(std::move(parameters.topic_name))
-  , subscription_callback_(std::move(subscription_callback))
-  , deliver_callback_(std::move(deliver_callback))
-  , data_loss_callback_(std::move(data_loss_callback))
-  , expected_seqno_(parameters.start_seqno)
-  // If we were to restore state from subscription storage before the
-  // subscription advances, we would restore from the next sequence number,
-  // that is why we persist the previous one.
-  , last_acked_seqno_(parameters.start_seqno == 0 ? 0 : parameters.start_seqno -
-                                                            1) {}
-
-  TenantID GetTenant() const { return tenant_id_; }
-
-  const NamespaceID& GetNamespace() const { return namespace_id_; }
-
-  const Topic& GetTopicName() const { return topic_name_; }
+  explicit SubscriptionState(SubscriptionTable::Ref ref)
+  : hot_(ref.hot), cold_(ref.cold) {
+    assert(ref);
+  }
+
+  /** Creates initial state for subscription with given parameters. */
+  static SubscriptionHotState MakeHotState(
+      const SubscriptionParameters& parameters) {
+    // If we were to restore state from subscription storage before the
+    // subscription advances, we would restore from the next sequence number,
+    // that is why we persist the previous one.
+    return SubscriptionHotState{
+        parameters.start_seqno,
+        parameters.start_seqno == 0 ? 0 : parameters.start_seqno - 1};
+  }
+
+  TenantID GetTenant() const { return cold_->tenant_id; }
+
+  const NamespaceID& GetNamespace() const { return cold_->namespace_id; }
+
+  const Topic& GetTopicName() const { return cold_->topic_name; }
 
   /** Terminates subscription and notifies the application. */
   void Terminate(const std::shared_ptr<Logger>& info_log,
@@ -75,34 +71,19 @@ class SubscriptionState {
                       std::unique_ptr<MessageDeliver> deliver);
 
   /** Returns a lower bound on the seqno of the next expected message. */
-  SequenceNumber GetExpected() const {
-    thread_check_.Check();
-    return expected_seqno_;
-  }
+  SequenceNumber GetExpected() const { return hot_->expected_seqno; }
 
   /** Marks provided sequence number as acknowledged. */
   void Acknowledge(SequenceNumber seqno);
 
   /** Returns sequnce number of last acknowledged message. */
   SequenceNumber GetLastAcknowledged() const {
-    thread_check_.Check();
-    return last_acked_seqno_;
+    return hot_->last_acked_seqno;
   }
 
  private:
-  ThreadCheck thread_check_;
-
-  const TenantID tenant_id_;
-  const NamespaceID namespace_id_;
-  const Topic topic_name_;
-  const SubscribeCallback subscription_callback_;
-  const MessageReceivedCallback deliver_callback_;
-  const DataLossCallback data_loss_callback_;
-
-  /** Next expected sequence number on this subscription. */
-  SequenceNumber expected_seqno_;
-  /** Seqence number of the last acknowledged message. */
-  SequenceNumber last_acked_seqno_;
+  SubscriptionHotState* const hot_;
+  SubscriptionColdState* const cold_;
 
   /** Returns true iff message arrived in order and not duplicated. */
   bool ProcessMessage(const std::shared_ptr<Logger>& info_log,
@@ -128,14 +109,19 @@ class alignas(CACHE_LINE_SIZE) Subscriber {
 
   Status Start();
 
-  const Statistics& GetStatistics();
+  /** Statistics may be read from any thread. */
+  const Statistics& GetStatistics() const;
 
   /** Handles creation of a subscription on provided worker thread. */
-  void StartSubscription(SubscriptionID sub_id,
-                         SubscriptionParameters parameters,
-                         MessageReceivedCallback deliver_callback,
-                         SubscribeCallback subscription_callback,
-                         DataLossCallback data_loss_callback);
+  void StartSubscription(
+      SubscriptionID sub_id,
+      SubscriptionParameters parameters,
+      std::shared_ptr<const SubscriptionCallbacks> callbacks);
+
+  /** Handles creation of many subscriptions on provided worker thread. */
+  void StartSubscriptions(
+      std::vector<std::pair<SubscriptionID, SubscriptionParameters>> batch,
+      std::shared_ptr<const SubscriptionCallbacks> callbacks);
 
   /** Marks message of given seqno on given subscription as acknowledged. */
   void Acknowledge(SubscriptionID sub_id, SequenceNumber seqno);
@@ -170,12 +156,14 @@ class alignas(CACHE_LINE_SIZE) Subscriber {
   /** Version of configuration when we last fetched hosts. */
   uint64_t last_config_version_;
   /** All subscriptions served by this worker. */
-  std::unordered_map<SubscriptionID, SubscriptionState> subscriptions_;
+  SubscriptionTable subscriptions_;
   /**
    * A timeout list with recently sent unsubscribe requests, used to dedup
    * unsubscribes if we receive a burst of messages on terminated subscription.
+   * Entries only matter when looked up, so they expire on lookup and on the
+   * timer tick rather than with timeouts of their own.
    */
-  TimeoutList<SubscriptionID> recent_terminations_;
+  TimerWheel<SubscriptionID> recent_terminations_;
   /** A set of subscriptions pending subscribe message being sent out. */
   std::unordered_set<SubscriptionID> pending_subscribes_;
   /** A set of subscriptions pending unsubscribe message being sent out. */
@@ -188,13 +176,45 @@ class alignas(CACHE_LINE_SIZE) Subscriber {
       active_subscriptions = all.AddCounter(prefix + "active_subscriptions");
       unsubscribes_invalid_handle =
           all.AddCounter(prefix + "unsubscribes_invalid_handle");
+      subscriptions_memory_bytes =
+          all.AddCounter(prefix + "subscriptions_memory_bytes");
+      traced_messages = all.AddCounter(prefix + "trace.messages");
+      // The first hop has no latency.
+      trace_hop_latency[MessageTrace::kClientSend] = nullptr;
+      for (int hop = 1; hop < MessageTrace::kNumHops; ++hop) {
+        trace_hop_latency[hop] = all.AddLatency(
+            prefix + "trace." +
+            MessageTrace::HopName(static_cast<MessageTrace::Hop>(hop)) +
+            "_latency");
+      }
+      trace_total_latency = all.AddLatency(prefix + "trace.total_latency");
     }
 
     Counter* active_subscriptions;
+    Counter* subscriptions_memory_bytes;
     Counter* unsubscribes_invalid_handle;
+    Counter* traced_messages;
+    /** Latency of reaching each hop from the previous one. */
+    Histogram* trace_hop_latency[MessageTrace::kNumHops];
+    Histogram* trace_total_latency;
     Statistics all;
   } stats_;
 
+  /** Updates statistics which reflect the set of subscriptions. */
+  void UpdateSubscriptionStats();
+
+  /** Stamps delivery of a sampled message and records its latencies. */
+  void RecordTrace(MessageDeliverData* data);
+
+  /**
+   * Stores state of a new subscription and marks it as pending.
+   * Returns false if subscription with the same ID already exists.
+   */
+  bool InsertSubscription(SubscriptionID sub_id,
+                          SubscriptionParameters parameters,
+                          std::shared_ptr<const SubscriptionCallbacks>
+                              callbacks);
+
   bool ExpectsMessage(const std::shared_ptr<Logger>& info_log, StreamID origin);
 
   /**
@@ -203,6 +223,12 @@ class alignas(CACHE_LINE_SIZE) Subscriber {
    */
   void SendPendingRequests();
 
+  /**
+   * Checks whether an unsubscribe request was sent recently. Expired entries
+   * are evicted on lookup, so the check does not depend on the timer tick.
+   */
+  bool IsRecentlyTerminated(SubscriptionID sub_id);
+
   /** Handler for data and gap messages */
   void Receive(std::unique_ptr<MessageDeliver> msg, StreamID origin);
 
@@ -0,0 +1,153 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/client/subscription_table.h"
+
+#include <string>
+#include <utility>
+
+namespace rocketspeed {
+
+namespace {
+
+/** Returns number of bytes allocated on the heap by the string. */
+size_t StringHeapBytes(const std::string& str) {
+  const char* object = reinterpret_cast<const char*>(&str);
+  const char* data = str.data();
+  if (data >= object && data < object + sizeof(str)) {
+    // Short string stored inline.
+    return 0;
+  }
+  return str.capacity() + 1;
+}
+
+size_t NamesHeapBytes(const SubscriptionColdState& cold) {
+  return StringHeapBytes(cold.namespace_id) + StringHeapBytes(cold.topic_name);
+}
+
+}  // namespace
+
+constexpr size_t SubscriptionTable::kMinSlots;
+
+SubscriptionTable::SubscriptionTable() : slot_shift_(64), names_bytes_(0) {
+  Rehash(kMinSlots);
+}
+
+SubscriptionTable::Ref SubscriptionTable::Insert(SubscriptionID id,
+                                                 SubscriptionHotState hot,
+                                                 SubscriptionColdState cold) {
+  assert(id != 0);
+  // Keep load factor below 3/4.
+  if (4 * (ids_.size() + 1) > 3 * slot_ids_.size()) {
+    Rehash(2 * slot_ids_.size());
+  }
+
+  const size_t slot = FindSlot(id);
+  if (slot_ids_[slot] == id) {
+    return Ref{0, nullptr, nullptr};
+  }
+
+  const size_t pos = ids_.size();
+  slot_ids_[slot] = id;
+  slot_pos_[slot] = static_cast<uint32_t>(pos);
+  names_bytes_ += NamesHeapBytes(cold);
+  ids_.push_back(id);
+  hot_.push_back(hot);
+  cold_.push_back(std::move(cold));
+  return Ref{id, &hot_[pos], &cold_[pos]};
+}
+
+SubscriptionTable::Ref SubscriptionTable::Find(SubscriptionID id) {
+  if (id == 0) {
+    return Ref{0, nullptr, nullptr};
+  }
+  const size_t slot = FindSlot(id);
+  if (slot_ids_[slot] != id) {
+    return Ref{0, nullptr, nullptr};
+  }
+  const size_t pos = slot_pos_[slot];
+  return Ref{id, &hot_[pos], &cold_[pos]};
+}
+
+bool SubscriptionTable::Erase(SubscriptionID id) {
+  if (id == 0) {
+    return false;
+  }
+  size_t slot = FindSlot(id);
+  if (slot_ids_[slot] != id) {
+    return false;
+  }
+  const size_t pos = slot_pos_[slot];
+
+  // Remove the slot by shifting back following entries of the probe sequence,
+  // so that lookups never need tombstones.
+  const size_t mask = slot_ids_.size() - 1;
+  size_t next = slot;
+  for (;;) {
+    next = (next + 1) & mask;
+    if (slot_ids_[next] == 0) {
+      break;
+    }
+    const size_t home = HomeSlot(slot_ids_[next]);
+    // Entry may be moved iff its home slot is not in (slot, next].
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      slot_ids_[slot] = slot_ids_[next];
+      slot_pos_[slot] = slot_pos_[next];
+      slot = next;
+    }
+  }
+  slot_ids_[slot] = 0;
+
+  // Fill the hole in dense arrays with the last entry.
+  names_bytes_ -= NamesHeapBytes(cold_[pos]);
+  const size_t last = ids_.size() - 1;
+  if (pos != last) {
+    ids_[pos] = ids_[last];
+    hot_[pos] = hot_[last];
+    cold_[pos] = std::move(cold_[last]);
+    slot_pos_[FindSlot(ids_[pos])] = static_cast<uint32_t>(pos);
+  }
+  ids_.pop_back();
+  hot_.pop_back();
+  cold_.pop_back();
+  return true;
+}
+
+size_t SubscriptionTable::GetMemoryUsage() const {
+  return sizeof(*this) +
+         slot_ids_.capacity() * sizeof(SubscriptionID) +
+         slot_pos_.capacity() * sizeof(uint32_t) +
+         ids_.capacity() * sizeof(SubscriptionID) +
+         hot_.capacity() * sizeof(SubscriptionHotState) +
+         cold_.capacity() * sizeof(SubscriptionColdState) +
+         names_bytes_;
+}
+
+size_t SubscriptionTable::FindSlot(SubscriptionID id) const {
+  const size_t mask = slot_ids_.size() - 1;
+  size_t slot = HomeSlot(id);
+  while (slot_ids_[slot] != 0 && slot_ids_[slot] != id) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void SubscriptionTable::Rehash(size_t num_slots) {
+  assert((num_slots & (num_slots - 1)) == 0);
+  int shift = 64;
+  for (size_t n = num_slots; n > 1; n >>= 1) {
+    --shift;
+  }
+  slot_shift_ = shift;
+  slot_ids_.assign(num_slots, 0);
+  slot_pos_.assign(num_slots, 0);
+  for (size_t pos = 0; pos < ids_.size(); ++pos) {
+    const size_t slot = FindSlot(ids_[pos]);
+    slot_ids_[slot] = ids_[pos];
+    slot_pos_[slot] = static_cast<uint32_t>(pos);
+  }
+}
+
+}  // namespace rocketspeed
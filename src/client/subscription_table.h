@@ -0,0 +1,133 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "include/Types.h"
+#include "include/RocketSpeed.h"
+
+namespace rocketspeed {
+
+typedef uint64_t SubscriptionID;
+
+/**
+ * Application callbacks of a subscription. Subscriptions which use client's
+ * default callbacks share a single instance.
+ */
+struct SubscriptionCallbacks {
+  SubscribeCallback subscription_callback;
+  MessageReceivedCallback deliver_callback;
+  DataLossCallback data_loss_callback;
+};
+
+/** Part of subscription state touched on every delivered message. */
+struct SubscriptionHotState {
+  /** Next expected sequence number on this subscription. */
+  SequenceNumber expected_seqno;
+  /** Seqence number of the last acknowledged message. */
+  SequenceNumber last_acked_seqno;
+};
+
+/** Part of subscription state used only on (un)subscribe and callbacks. */
+struct SubscriptionColdState {
+  TenantID tenant_id;
+  NamespaceID namespace_id;
+  Topic topic_name;
+  std::shared_ptr<const SubscriptionCallbacks> callbacks;
+};
+
+/**
+ * A map from subscription ID to subscription state.
+ *
+ * Entries live in dense arrays, with hot and cold part of the state stored
+ * separately, so that delivery path does not drag names and callbacks through
+ * the cache. Dense arrays are indexed by an open-addressing hash table with
+ * linear probing, which stores only IDs and positions.
+ *
+ * Pointers in a Ref are invalidated by any modification of the table.
+ * Subscription ID 0 is reserved.
+ */
+class SubscriptionTable {
+ public:
+  /** A reference to an entry in the table. */
+  struct Ref {
+    SubscriptionID id;
+    SubscriptionHotState* hot;
+    SubscriptionColdState* cold;
+
+    explicit operator bool() const { return hot != nullptr; }
+  };
+
+  SubscriptionTable();
+
+  /**
+   * Inserts a new entry, returns null reference if entry with the same ID
+   * already exists.
+   */
+  Ref Insert(SubscriptionID id,
+             SubscriptionHotState hot,
+             SubscriptionColdState cold);
+
+  /** Returns reference to an entry, or null reference if none. */
+  Ref Find(SubscriptionID id);
+
+  /** Removes an entry, returns true iff it existed. */
+  bool Erase(SubscriptionID id);
+
+  /** Invokes visitor for each entry, visitor must not modify the table. */
+  template <typename Visitor>
+  void ForEach(Visitor&& visitor) {
+    for (size_t i = 0; i < ids_.size(); ++i) {
+      visitor(Ref{ids_[i], &hot_[i], &cold_[i]});
+    }
+  }
+
+  size_t Size() const { return ids_.size(); }
+
+  bool Empty() const { return ids_.empty(); }
+
+  /**
+   * Returns approximate number of bytes used by the table, including names,
+   * but excluding callbacks, which may be shared.
+   */
+  size_t GetMemoryUsage() const;
+
+ private:
+  /** Minimum number of slots in the index. */
+  static constexpr size_t kMinSlots = 16;
+
+  /** IDs in the index, 0 denotes an empty slot. */
+  std::vector<SubscriptionID> slot_ids_;
+  /** Position in dense arrays of an entry in corresponding slot. */
+  std::vector<uint32_t> slot_pos_;
+  /** Shift used to map hashes to slots. */
+  int slot_shift_;
+
+  /** Dense arrays of entries. */
+  std::vector<SubscriptionID> ids_;
+  std::vector<SubscriptionHotState> hot_;
+  std::vector<SubscriptionColdState> cold_;
+  /** Number of heap-allocated bytes owned by names. */
+  size_t names_bytes_;
+
+  size_t HomeSlot(SubscriptionID id) const {
+    // Fibonacci hashing spreads sequential IDs evenly.
+    return static_cast<size_t>((id * 0x9E3779B97F4A7C15ULL) >> slot_shift_);
+  }
+
+  /** Returns slot holding the ID or an empty slot where it belongs. */
+  size_t FindSlot(SubscriptionID id) const;
+
+  /** Rebuilds the index with given number of slots, a power of two. */
+  void Rehash(size_t num_slots);
+};
+
+}  // namespace rocketspeed
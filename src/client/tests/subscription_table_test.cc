@@ -0,0 +1,130 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/client/subscription_table.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "src/util/random.h"
+#include "src/util/testharness.h"
+#include "src/util/testutil.h"
+
+namespace rocketspeed {
+
+class SubscriptionTableTest {
+ public:
+  SubscriptionTableTest()
+  : callbacks(std::make_shared<SubscriptionCallbacks>()) {}
+
+ protected:
+  std::shared_ptr<const SubscriptionCallbacks> callbacks;
+
+  SubscriptionColdState Cold(SubscriptionID id) {
+    return SubscriptionColdState{
+        Tenant::GuestTenant, GuestNamespace, std::to_string(id), callbacks};
+  }
+};
+
+TEST(SubscriptionTableTest, Basic) {
+  SubscriptionTable table;
+  ASSERT_TRUE(table.Empty());
+  ASSERT_TRUE(!table.Find(1));
+
+  ASSERT_TRUE(table.Insert(1, SubscriptionHotState{10, 9}, Cold(1)));
+  ASSERT_TRUE(table.Insert(2, SubscriptionHotState{20, 19}, Cold(2)));
+  ASSERT_TRUE(!table.Insert(1, SubscriptionHotState{0, 0}, Cold(1)));
+  ASSERT_EQ(table.Size(), 2);
+
+  auto ref = table.Find(1);
+  ASSERT_TRUE(ref);
+  ASSERT_EQ(ref.id, 1);
+  ASSERT_EQ(ref.hot->expected_seqno, 10);
+  ASSERT_EQ(ref.cold->topic_name, "1");
+  ASSERT_TRUE(ref.cold->callbacks == callbacks);
+  ref.hot->last_acked_seqno = 15;
+  ASSERT_EQ(table.Find(1).hot->last_acked_seqno, 15);
+
+  ASSERT_TRUE(table.Erase(1));
+  ASSERT_TRUE(!table.Erase(1));
+  ASSERT_TRUE(!table.Find(1));
+  ref = table.Find(2);
+  ASSERT_TRUE(ref);
+  ASSERT_EQ(ref.cold->topic_name, "2");
+  ASSERT_EQ(table.Size(), 1);
+}
+
+TEST(SubscriptionTableTest, RandomOperations) {
+  // Compares the table against a reference map.
+  SubscriptionTable table;
+  std::unordered_map<SubscriptionID, SequenceNumber> expected;
+  Random64 rng(7);
+  int mismatches = 0;
+  for (int i = 0; i < 200000; ++i) {
+    const SubscriptionID id = 1 + rng.Uniform(5000);
+    switch (rng.Uniform(3)) {
+      case 0: {
+        const bool inserted =
+            static_cast<bool>(table.Insert(id, {id, 0}, Cold(id)));
+        mismatches += inserted != expected.emplace(id, id).second;
+      } break;
+      case 1:
+        mismatches += table.Erase(id) != (expected.erase(id) == 1);
+        break;
+      case 2: {
+        auto ref = table.Find(id);
+        auto it = expected.find(id);
+        if (it == expected.end()) {
+          mismatches += static_cast<bool>(ref);
+        } else {
+          mismatches += !ref || ref.hot->expected_seqno != it->second ||
+                        ref.cold->topic_name != std::to_string(id);
+        }
+      } break;
+    }
+  }
+  ASSERT_EQ(mismatches, 0);
+  ASSERT_EQ(table.Size(), expected.size());
+
+  size_t visited = 0;
+  table.ForEach([&](SubscriptionTable::Ref ref) {
+    ++visited;
+    ASSERT_EQ(expected.count(ref.id), 1);
+  });
+  ASSERT_EQ(visited, expected.size());
+}
+
+TEST(SubscriptionTableTest, MemoryUsage) {
+  SubscriptionTable table;
+  const size_t empty_usage = table.GetMemoryUsage();
+  const SubscriptionID kSubscriptions = 100000;
+  for (SubscriptionID id = 1; id <= kSubscriptions; ++id) {
+    table.Insert(id, {0, 0}, Cold(id));
+  }
+  const size_t per_subscription =
+      (table.GetMemoryUsage() - empty_usage) / kSubscriptions;
+  // Hot and cold state, index and slack of dense arrays, names fit inline.
+  ASSERT_GT(per_subscription, sizeof(SubscriptionColdState));
+  ASSERT_LT(per_subscription, 256U);
+
+  // Long names are accounted for.
+  const size_t usage = table.GetMemoryUsage();
+  table.Insert(kSubscriptions + 1,
+               {0, 0},
+               SubscriptionColdState{Tenant::GuestTenant,
+                                     GuestNamespace,
+                                     std::string(1000, 'a'),
+                                     callbacks});
+  ASSERT_GE(table.GetMemoryUsage(), usage + 1000);
+  table.Erase(kSubscriptions + 1);
+  ASSERT_EQ(table.GetMemoryUsage(), usage);
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests();
+}
@@ -6,15 +6,159 @@
 #define __STDC_FORMAT_MACROS
 #include "src/controltower/log_tailer.h"
 #include "src/util/storage.h"
+#include "src/util/common/thread_local.h"
+#include <mutex>
+#include <new>
 #include <vector>
 #include <inttypes.h>
 
 namespace rocketspeed {
 
-// Version of MessageData that holds a std::unique_ptr<LogRecord> to
-// persist the LogDevice buffer.
-struct LogRecordMessageData : public MessageData {
+namespace {
+
+// Pool of memory for LogRecordMessageData. Messages are allocated on the
+// reader threads and freed on the room threads, for every record read, so
+// recycling their memory saves a heap allocation per record.
+//
+// Each thread caches freed blocks in intrusive lists of up to kBatchSize
+// blocks. Full lists move between the threads and a shared stack, so the
+// shared lock is taken once per batch rather than once per record.
+class MessageDataPool {
  public:
+  static MessageDataPool& Default() {
+    // Never destroyed, messages may outlive static destruction.
+    static MessageDataPool* pool = new MessageDataPool();
+    return *pool;
+  }
+
+  void* Allocate(size_t size) {
+    assert(size >= sizeof(Block));
+    Cache* cache = GetCache();
+    if (!cache->current.head) {
+      if (cache->spare.head) {
+        cache->current = cache->spare;
+        cache->spare = FreeList();
+      } else {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (batches_.empty()) {
+          return ::operator new(size);
+        }
+        cache->current = batches_.back();
+        batches_.pop_back();
+      }
+    }
+    return cache->current.Pop();
+  }
+
+  void Deallocate(void* ptr) {
+    Cache* cache = GetCache();
+    cache->current.Push(ptr);
+    if (cache->current.size == kBatchSize) {
+      // Keep one full list for the next allocations, return the older one.
+      if (cache->spare.head) {
+        Release(cache->spare);
+      }
+      cache->spare = cache->current;
+      cache->current = FreeList();
+    }
+  }
+
+ private:
+  // Blocks moved between a thread and the shared stack at once.
+  static constexpr size_t kBatchSize = 64;
+  // Bounds the memory kept after a burst of records.
+  static constexpr size_t kMaxBatches = 16384 / kBatchSize;
+
+  struct Block {
+    Block* next;
+  };
+
+  struct FreeList {
+    Block* head = nullptr;
+    size_t size = 0;
+
+    void Push(void* ptr) {
+      Block* block = static_cast<Block*>(ptr);
+      block->next = head;
+      head = block;
+      ++size;
+    }
+
+    void* Pop() {
+      Block* block = head;
+      head = block->next;
+      --size;
+      return block;
+    }
+  };
+
+  struct Cache {
+    FreeList current;
+    FreeList spare;
+  };
+
+  MessageDataPool() : caches_(&ReleaseCache) {
+    batches_.reserve(kMaxBatches);
+  }
+
+  Cache* GetCache() {
+    Cache* cache = static_cast<Cache*>(caches_.Get());
+    if (!cache) {
+      cache = new Cache();
+      caches_.Reset(cache);
+    }
+    return cache;
+  }
+
+  void Release(FreeList list) {
+    if (!list.head) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (batches_.size() < kMaxBatches) {
+        batches_.push_back(list);
+        return;
+      }
+    }
+    while (list.head) {
+      ::operator delete(list.Pop());
+    }
+  }
+
+  // Returns the blocks cached by an exiting thread.
+  static void ReleaseCache(void* ptr) {
+    Cache* cache = static_cast<Cache*>(ptr);
+    Default().Release(cache->current);
+    Default().Release(cache->spare);
+    delete cache;
+  }
+
+  ThreadLocalPtr caches_;
+
+  std::mutex mutex_;
+  std::vector<FreeList> batches_;
+};
+
+constexpr size_t MessageDataPool::kBatchSize;
+constexpr size_t MessageDataPool::kMaxBatches;
+
+}  // namespace
+
+// Version of MessageData that holds a LogRecord to persist the storage
+// buffer, which the slices of the message point into. Memory of the messages
+// is pooled.
+struct LogRecordMessageData final : public MessageData {
+ public:
+  static void* operator new(size_t size) {
+    assert(size == sizeof(LogRecordMessageData));
+    return MessageDataPool::Default().Allocate(size);
+  }
+
+  static void operator delete(void* ptr) {
+    MessageDataPool::Default().Deallocate(ptr);
+  }
+
   explicit LogRecordMessageData(LogRecord record,
                                 Status* status)
   : MessageData(MessageType::mDeliver)
@@ -25,6 +169,16 @@ struct LogRecordMessageData : public MessageData {
     SetSequenceNumbers(record_.seqno - 1, record_.seqno);
   }
 
+  // Records when a sampled message was appended, as reported by the storage,
+  // and when it was read.
+  void StampRead(uint64_t now_micros) {
+    if (record_.timestamp.count() > 0) {
+      StampTrace(MessageTrace::kAppendComplete,
+                 static_cast<uint64_t>(record_.timestamp.count()));
+    }
+    StampTrace(MessageTrace::kTowerRead, now_micros);
+  }
+
   LogRecord MoveRecord() {
     return std::move(record_);
   }
@@ -33,8 +187,16 @@ struct LogRecordMessageData : public MessageData {
   LogRecord record_;
 };
 
-LogTailer::LogTailer(std::shared_ptr<LogStorage> storage,
+std::unique_ptr<MessageData> LogTailer::CreateMessage(LogRecord record,
+                                                     Status* status) {
+  return std::unique_ptr<MessageData>(
+    new LogRecordMessageData(std::move(record), status));
+}
+
+LogTailer::LogTailer(Env* env,
+               std::shared_ptr<LogStorage> storage,
                std::shared_ptr<Logger> info_log) :
+  env_(env),
   storage_(storage),
   info_log_(info_log) {
 }
@@ -89,8 +251,7 @@ Status LogTailer::CreateReader(size_t reader_id,
 
     // Convert storage record into RocketSpeed message.
     Status st;
-    std::unique_ptr<MessageData> msg(
-      new LogRecordMessageData(std::move(record), &st));
+    std::unique_ptr<MessageData> msg = CreateMessage(std::move(record), &st);
     bool success;
     if (!st.ok()) {
       LOG_ERROR(info_log_,
@@ -102,6 +263,10 @@ Status LogTailer::CreateReader(size_t reader_id,
       // Publish gap in place.
       success = on_gap(log_id, GapType::kDataLoss, seqno, seqno, reader_id);
     } else {
+      if (msg->GetTrace().IsSampled()) {
+        static_cast<LogRecordMessageData*>(msg.get())->StampRead(
+            env_->NowMicros());
+      }
       LOG_DEBUG(info_log_,
         "LogTailer received data (%.16s)@%" PRIu64
         " for Topic(%s,%s) in Log(%" PRIu64 ").",
@@ -168,7 +333,7 @@ LogTailer::CreateNewInstance(Env* env,
                           std::shared_ptr<LogStorage> storage,
                           std::shared_ptr<Logger> info_log,
                           LogTailer** tailer) {
-  *tailer = new LogTailer(storage, info_log);
+  *tailer = new LogTailer(env, storage, info_log);
   return Status::OK();
 }
 
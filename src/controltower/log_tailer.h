@@ -53,6 +53,18 @@ class LogTailer {
                            std::shared_ptr<Logger> info_log,
                            LogTailer** tailer);
 
+  /**
+   * Converts a record read from storage into a message, which keeps the record,
+   * and so the buffer its slices point into, alive. Memory of the messages is
+   * pooled.
+   *
+   * @param record The record read from storage.
+   * @param status Set to an error if the record is malformed.
+   * @return The message.
+   */
+  static std::unique_ptr<MessageData> CreateMessage(LogRecord record,
+                                                    Status* status);
+
   /**
    * Shuts down the LogTailer.
    *
@@ -101,7 +113,8 @@ class LogTailer {
 
  private:
   // private constructor
-  LogTailer(std::shared_ptr<LogStorage> storage,
+  LogTailer(Env* env,
+            std::shared_ptr<LogStorage> storage,
             std::shared_ptr<Logger> info_log);
 
   // Creates a log reader.
@@ -110,6 +123,9 @@ class LogTailer {
                       OnGapCallback on_gap,
                       AsyncLogReader** out);
 
+  // Environment used to stamp traces of sampled messages
+  Env* env_;
+
   // The Storage device
   std::shared_ptr<LogStorage> storage_;
 
@@ -49,6 +49,9 @@ ControlRoom::MsgCommand(std::unique_ptr<Message> msg,
       if (message->GetMessageType() == MessageType::mSubscribe) {
         assert(worker_id != -1);
         ProcessSubscribe(std::move(message), worker_id, origin);
+      } else if (message->GetMessageType() == MessageType::mSubscribeBatch) {
+        assert(worker_id != -1);
+        ProcessSubscribeBatch(std::move(message), worker_id, origin);
       } else if (message->GetMessageType() == MessageType::mUnsubscribe) {
         assert(worker_id != -1);
         ProcessUnsubscribe(std::move(message), worker_id, origin);
@@ -68,13 +71,40 @@ ControlRoom::MsgCommand(std::unique_ptr<Message> msg,
 void ControlRoom::ProcessSubscribe(std::unique_ptr<Message> msg,
                                    int worker_id,
                                    StreamID origin) {
+  MessageSubscribe* subscribe = static_cast<MessageSubscribe*>(msg.get());
+  AddSubscriber(subscribe->GetNamespace(),
+                subscribe->GetTopicName(),
+                subscribe->GetStartSequenceNumber(),
+                subscribe->GetSubID(),
+                worker_id,
+                origin);
+}
+
+void ControlRoom::ProcessSubscribeBatch(std::unique_ptr<Message> msg,
+                                        int worker_id,
+                                        StreamID origin) {
+  auto batch = static_cast<MessageSubscribeBatch*>(msg.get());
+  for (const auto& sub : batch->GetSubscriptions()) {
+    AddSubscriber(sub.namespace_id,
+                  sub.topic_name,
+                  sub.start_seqno,
+                  sub.sub_id,
+                  worker_id,
+                  origin);
+  }
+}
+
+void ControlRoom::AddSubscriber(const NamespaceID& namespace_id,
+                                const Topic& topic_name,
+                                SequenceNumber seqno,
+                                SubscriptionID sub_id,
+                                int worker_id,
+                                StreamID origin) {
   ControlTower* ct = control_tower_;
   ControlTowerOptions& options = ct->GetOptions();
 
-  MessageSubscribe* subscribe = static_cast<MessageSubscribe*>(msg.get());
-  CopilotSub id(origin, subscribe->GetSubID());
-  TopicUUID uuid(subscribe->GetNamespace(), subscribe->GetTopicName());
-  const SequenceNumber seqno = subscribe->GetStartSequenceNumber();
+  CopilotSub id(origin, sub_id);
+  TopicUUID uuid(namespace_id, topic_name);
 
   sub_worker_.Insert(id.stream_id, id.sub_id, worker_id);
 
@@ -84,7 +114,6 @@ void ControlRoom::ProcessSubscribe(std::unique_ptr<Message> msg,
     origin,
     uuid.ToString().c_str(),
     seqno);
-
 }
 
 void ControlRoom::ProcessUnsubscribe(std::unique_ptr<Message> msg,
@@ -155,6 +184,12 @@ ControlRoom::ProcessDeliver(std::unique_ptr<Message> msg,
       request->GetNamespaceId().ToString().c_str(),
       request->GetTopicName().ToString().c_str());
 
+  // Sampled messages carry their trace to every recipient.
+  MessageTrace trace = request->GetTrace();
+  if (trace.IsSampled()) {
+    trace.Stamp(MessageTrace::kRoomDispatch, options.env->NowMicros());
+  }
+
   // For each subscriber on this topic at prev_seqno, deliver the message and
   // advance the subscription to next_seqno.
   TopicUUID uuid(request->GetNamespaceId(), request->GetTopicName());
@@ -174,6 +209,7 @@ ControlRoom::ProcessDeliver(std::unique_ptr<Message> msg,
                                request->GetMessageId(),
                                request->GetPayload());
     deliver.SetSequenceNumbers(prev_seqno, next_seqno);
+    deliver.SetTrace(trace);
     auto command =
       options.msg_loop->ResponseCommand(deliver, recipient.stream_id);
 
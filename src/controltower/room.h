@@ -65,6 +65,9 @@ class ControlRoom {
   void ProcessSubscribe(std::unique_ptr<Message> msg,
                         int worker_id,
                         StreamID origin);
+  void ProcessSubscribeBatch(std::unique_ptr<Message> msg,
+                             int worker_id,
+                             StreamID origin);
   void ProcessUnsubscribe(std::unique_ptr<Message> msg,
                           int worker_id,
                           StreamID origin);
@@ -74,6 +77,14 @@ class ControlRoom {
                   const std::vector<CopilotSub>& recipients);
   void ProcessGoodbye(std::unique_ptr<Message> msg, StreamID origin);
 
+  /** Adds a single copilot subscription to the topic tailer. */
+  void AddSubscriber(const NamespaceID& namespace_id,
+                     const Topic& topic_name,
+                     SequenceNumber seqno,
+                     SubscriptionID sub_id,
+                     int worker_id,
+                     StreamID origin);
+
   /** Find worker for CopilotSub (from sub_worker_) or -1 if not found. */
   int CopilotWorker(const CopilotSub& id) const;
 
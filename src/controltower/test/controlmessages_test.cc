@@ -12,6 +12,7 @@
 #include "src/controltower/log_tailer.h"
 #include "src/controltower/room.h"
 #include "src/controltower/tower.h"
+#include "src/messages/commands.h"
 #include "src/port/port.h"
 #include "src/test/test_cluster.h"
 #include "src/util/testharness.h"
@@ -170,6 +171,164 @@ TEST(ControlTowerTest, MultipleSubscribers) {
 }
 
 
+TEST(ControlTowerTest, UnsubscribeBeforeTail) {
+  // Delay finding the tail, so that the unsubscribe arrives first.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log_;
+  opts.start_copilot = false;
+  opts.start_controltower = true;
+  opts.memory_storage = true;
+  opts.memory_storage_options.find_time_latency =
+    std::chrono::milliseconds(200);
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+  auto ct = cluster.GetControlTower();
+
+  MsgLoop loop(env_, env_options_, 58499, 1, info_log_, "loop");
+  StreamSocket socket(loop.CreateOutboundStream(ct->GetHostId(), 0));
+  loop.RegisterCallbacks({
+      {MessageType::mDeliver, [](std::unique_ptr<Message>, StreamID) {}},
+      {MessageType::mGap, [](std::unique_ptr<Message>, StreamID){}},
+  });
+  ASSERT_OK(loop.Initialize());
+  MsgLoopThread t(env_, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  // Subscribe at the tail, and unsubscribe while the tail is still unknown.
+  MessageSubscribe subscribe(Tenant::GuestTenant, "test", "topic", 0, 1);
+  ASSERT_OK(loop.SendRequest(subscribe, &socket, 0));
+  MessageUnsubscribe unsubscribe(
+    Tenant::GuestTenant, 1, MessageUnsubscribe::Reason::kRequested);
+  ASSERT_OK(loop.SendRequest(unsubscribe, &socket, 0));
+
+  // Once the tail is found, the subscription must not be added back.
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  ASSERT_EQ(0, GetNumOpenLogs(ct));
+}
+
+TEST(ControlTowerTest, StorageToRoomOverflow) {
+  // Small queues, so that records from storage overflow the room queue.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log_;
+  opts.start_copilot = false;
+  opts.start_controltower = true;
+  opts.memory_storage = true;
+  opts.tower.readers_per_room = 1;
+  opts.tower_loop.event_loop.command_queue_size = 16;
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+  auto ct = cluster.GetControlTower();
+  auto ct_loop = cluster.GetControlTowerLoop();
+
+  MsgLoop loop(env_, env_options_, 58499, 1, info_log_, "loop");
+  StreamSocket socket(loop.CreateOutboundStream(ct->GetHostId(), 0));
+  loop.RegisterCallbacks({
+      {MessageType::mDeliverData, [](std::unique_ptr<Message>, StreamID) {}},
+      {MessageType::mDeliverGap, [](std::unique_ptr<Message>, StreamID) {}},
+  });
+  ASSERT_OK(loop.Initialize());
+  MsgLoopThread t(env_, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  MessageSubscribe subscribe(Tenant::GuestTenant, "test", "topic", 1, 1);
+  ASSERT_OK(loop.SendRequest(subscribe, &socket, 0));
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_EQ(1, GetNumOpenLogs(ct));
+
+  // Block the rooms while the records are appended.
+  port::Semaphore unblock;
+  for (int i = 0; i < ct_loop->GetNumWorkers(); ++i) {
+    ASSERT_OK(ct_loop->SendCommand(
+      std::unique_ptr<Command>(MakeExecuteCommand([&] () {
+        unblock.Wait();
+      })),
+      i));
+  }
+  LogID log_id;
+  ASSERT_OK(cluster.GetLogRouter()->GetLogID("test", "topic", &log_id));
+  const int kRecords = 200;
+  for (int i = 0; i < kRecords; ++i) {
+    std::string payload = "record" + std::to_string(i);
+    MessageData data(MessageType::mPublish,
+                     Tenant::GuestTenant,
+                     "topic",
+                     "test",
+                     payload);
+    ASSERT_OK(cluster.GetMemoryLogStorage()->AppendAsync(
+      log_id, data.SerializeStorage(), [] (Status, SequenceNumber) {}));
+  }
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  for (int i = 0; i < ct_loop->GetNumWorkers(); ++i) {
+    unblock.Post();
+  }
+
+  // Records refused by a full queue are redelivered by the storage, and must
+  // only be processed once.
+  const std::string stat = "tower.topic_tailer.log_records_received";
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (ct->GetStatisticsSync().GetCounterValue(stat) < kRecords &&
+         std::chrono::steady_clock::now() < deadline) {
+    /* sleep override */
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  ASSERT_EQ(ct->GetStatisticsSync().GetCounterValue(stat), kRecords);
+}
+
+TEST(ControlTowerTest, SubscribeUnsubscribeMany) {
+  // Subscriptions are forwarded to rooms on other threads, which may free
+  // the subscribe message as soon as it is queued.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log_;
+  opts.start_copilot = false;
+  opts.start_controltower = true;
+  opts.memory_storage = true;
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+  auto ct = cluster.GetControlTower();
+
+  MsgLoop loop(env_, env_options_, 58499, 1, info_log_, "loop");
+  StreamSocket socket(loop.CreateOutboundStream(ct->GetHostId(), 0));
+  loop.RegisterCallbacks({
+      {MessageType::mDeliverData, [](std::unique_ptr<Message>, StreamID) {}},
+      {MessageType::mDeliverGap, [](std::unique_ptr<Message>, StreamID) {}},
+  });
+  ASSERT_OK(loop.Initialize());
+  MsgLoopThread t(env_, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  const int kTopics = 5000;
+  for (int i = 0; i < kTopics; ++i) {
+    MessageSubscribe subscribe(Tenant::GuestTenant,
+                               "test",
+                               "topic" + std::to_string(i),
+                               1,
+                               SubscriptionID(i + 1));
+    ASSERT_OK(loop.SendRequest(subscribe, &socket, 0));
+  }
+  for (int i = 0; i < kTopics; ++i) {
+    MessageUnsubscribe unsubscribe(Tenant::GuestTenant,
+                                   SubscriptionID(i + 1),
+                                   MessageUnsubscribe::Reason::kRequested);
+    ASSERT_OK(loop.SendRequest(unsubscribe, &socket, 0));
+  }
+
+  // Every unsubscribe must find the room of its subscription.
+  const std::string stat = "tower.topic_tailer.remove_subscriber_requests";
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (ct->GetStatisticsSync().GetCounterValue(stat) < kTopics &&
+         std::chrono::steady_clock::now() < deadline) {
+    /* sleep override */
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(ct->GetStatisticsSync().GetCounterValue(stat), kTopics);
+  ASSERT_EQ(0, GetNumOpenLogs(ct));
+}
+
 TEST(ControlTowerTest, NoLogger) {
   // Create cluster with tower only (only need this for the log storage).
   LocalTestCluster cluster(info_log_, true, false, false);
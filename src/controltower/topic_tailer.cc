@@ -55,15 +55,18 @@ class LogReader {
    * @param reader_id LogTailer reader ID.
    * @param max_subscription_lag Maximum number of sequence numbers a
    *                             subscription can lag behind before sending gap.
+   * @param seeks Counter of seeks issued to storage (null for virtual readers).
    */
   explicit LogReader(std::shared_ptr<Logger> info_log,
                      LogTailer* tailer,
                      size_t reader_id,
-                     int64_t max_subscription_lag)
+                     int64_t max_subscription_lag,
+                     Counter* seeks)
   : info_log_(info_log)
   , tailer_(tailer)
   , reader_id_(reader_id)
-  , max_subscription_lag_(max_subscription_lag) {
+  , max_subscription_lag_(max_subscription_lag)
+  , seeks_(seeks) {
   }
 
   /**
@@ -258,6 +261,7 @@ class LogReader {
   size_t reader_id_;
   std::unordered_map<LogID, LogState> log_state_;
   int64_t max_subscription_lag_;
+  Counter* seeks_;
 };
 
 Status LogReader::ProcessRecord(LogID log_id,
@@ -471,6 +475,7 @@ Status LogReader::StartReading(const TopicUUID& topic,
 
     if (!IsVirtual()) {
       st = tailer_->StartReading(log_id, seqno, reader_id_, first_open);
+      seeks_->Add(1);
       if (!st.ok()) {
         LOG_ERROR(info_log_,
           "Reader(%zu) failed to start reading Log(%" PRIu64 ")@%" PRIu64": %s",
@@ -667,6 +672,7 @@ void LogReader::StealLogSubscriptions(LogReader* reader, LogID log_id) {
                                     log_state.start_seqno,
                                     reader_id_,
                                     first_open);
+  seeks_->Add(1);
   if (st.ok()) {
     assert(!log_state.topics.empty());
     log_state_.emplace(log_id, std::move(log_state));
@@ -1031,13 +1037,15 @@ Status TopicTailer::Initialize(const std::vector<size_t>& reader_ids,
       new LogReader(info_log_,
                     log_tailer_,
                     reader_id,
-                    max_subscription_lag));
+                    max_subscription_lag,
+                    stats_.log_reader_seeks));
   }
   pending_reader_.reset(
     new LogReader(info_log_,
                   nullptr,  // null LogTailer <=> virtual reader
                   0,
-                  max_subscription_lag));
+                  max_subscription_lag,
+                  nullptr));
   return Status::OK();
 }
 
@@ -1115,7 +1123,15 @@ Status TopicTailer::AddSubscriber(const TopicUUID& topic,
         // This callback is invoked on the storage worker threads, so the
         // response needs to be forwarded back to the TopicTailer/Room thread.
         bool sent = Forward([this, topic, id, logid, seqno] () {
-          AddTailSubscriber(topic, id, logid, seqno);
+          if (pending_tail_subscriptions_.Find(id.stream_id, id.sub_id)) {
+            pending_tail_subscriptions_.Remove(id.stream_id, id.sub_id);
+            AddTailSubscriber(topic, id, logid, seqno);
+          } else {
+            LOG_DEBUG(info_log_,
+              "%s was unsubscribed before finding tail of Log(%" PRIu64 ")",
+              id.ToString().c_str(),
+              logid);
+          }
 
           LOG_INFO(info_log_,
             "Suggesting tail for Log(%" PRIu64 ")@%" PRIu64,
@@ -1138,8 +1154,10 @@ Status TopicTailer::AddSubscriber(const TopicUUID& topic,
         }
       };
 
+      pending_tail_subscriptions_.Insert(id.stream_id, id.sub_id, topic);
       Status seqno_status = log_tailer_->FindLatestSeqno(logid, callback);
       if (!seqno_status.ok()) {
+        pending_tail_subscriptions_.Remove(id.stream_id, id.sub_id);
         LOG_WARN(info_log_,
           "Failed to find latest seqno (%s) for %s",
           seqno_status.ToString().c_str(),
@@ -1163,6 +1181,15 @@ Status TopicTailer::RemoveSubscriber(CopilotSub id) {
   thread_check_.Check();
   stats_.remove_subscriber_requests->Add(1);
 
+  if (pending_tail_subscriptions_.Find(id.stream_id, id.sub_id)) {
+    // Still waiting for the tail seqno, so just drop the subscription.
+    pending_tail_subscriptions_.Remove(id.stream_id, id.sub_id);
+    LOG_DEBUG(info_log_,
+      "%s unsubscribed while finding tail",
+      id.ToString().c_str());
+    return Status::OK();
+  }
+
   TopicUUID topic;
   if (!stream_subscriptions_.MoveOut(id.stream_id, id.sub_id, &topic)) {
     LOG_WARN(info_log_,
@@ -1443,6 +1470,7 @@ void TopicTailer::RemoveSubscriberInternal(StreamID stream_id) {
     });
 
   stream_subscriptions_.Remove(stream_id);
+  pending_tail_subscriptions_.Remove(stream_id);
 }
 
 LogReader* TopicTailer::FindLogReader(size_t reader_id) {
@@ -1503,7 +1531,11 @@ void TopicTailer::AttemptReaderMerges(LogReader* src, LogID log_id) {
 }
 
 bool TopicTailer::Forward(std::unique_ptr<Command> command) {
-  return storage_to_room_queues_->GetThreadLocal()->Write(command);
+  // Write would keep the command on overflow and return false, but callers
+  // take false to mean that the command was dropped, and the storage will
+  // redeliver the same record, so only report success if it was written.
+  CommandQueue* queue = storage_to_room_queues_->GetThreadLocal();
+  return queue->FlushPending(true) && queue->TryWrite(command, true);
 }
 
 }  // namespace rocketspeed
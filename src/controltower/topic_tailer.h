@@ -277,6 +277,10 @@ class TopicTailer {
   // Map of subscriptions per stream.
   SubscriptionMap<TopicUUID> stream_subscriptions_;
 
+  // Subscriptions at 0 waiting for FindLatestSeqno, which may be cancelled
+  // before the result arrives.
+  SubscriptionMap<TopicUUID> pending_tail_subscriptions_;
+
   struct Stats {
     Stats() {
       const std::string prefix = "tower.topic_tailer.";
@@ -325,6 +329,8 @@ class TopicTailer {
         all.AddCounter(prefix + "remove_subscriber_requests");
       records_served_from_cache =
         all.AddCounter(prefix + "records_served_from_cache");
+      log_reader_seeks =
+        all.AddCounter(prefix + "log_reader_seeks");
     }
 
     Statistics all;
@@ -350,6 +356,7 @@ class TopicTailer {
     Counter* updated_subscriptions;
     Counter* remove_subscriber_requests;
     Counter* records_served_from_cache;
+    Counter* log_reader_seeks;
   } stats_;
 };
 
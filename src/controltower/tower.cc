@@ -245,27 +245,84 @@ void ControlTower::ProcessSubscribe(std::unique_ptr<Message> msg,
   ControlRoom* room = rooms_[room_number].get();
   int worker_id = options_.msg_loop->GetThreadWorkerIndex();
 
+  // The room owns the message once it is written to the queue, and may have
+  // freed it by the time Write returns.
+  const SubscriptionID sub_id = subscribe->GetSubID();
+  auto& room_map = sub_to_room_[worker_id];
+  room_map.Insert(origin, sub_id, room_number);
+  LOG_DEBUG(options_.info_log,
+      "Forwarding subscription for Topic(%s,%s)@%" PRIu64 " to rooms-%u",
+      subscribe->GetNamespace().c_str(),
+      subscribe->GetTopicName().c_str(),
+      subscribe->GetStartSequenceNumber(),
+      room_number);
+
   auto command = room->MsgCommand(std::move(msg), worker_id, origin);
   auto& queue = tower_to_room_queues_[worker_id][room_number];
   if (!queue->Write(command)) {
     LOG_WARN(options_.info_log,
-        "Unable to forward subscription for Topic(%s,%s)@%" PRIu64
-        " to rooms-%u",
-        subscribe->GetNamespace().c_str(),
-        subscribe->GetTopicName().c_str(),
-        subscribe->GetStartSequenceNumber(),
-        room_number);
-  } else {
-    LOG_DEBUG(options_.info_log,
-        "Forwarded subscription for Topic(%s,%s)@%" PRIu64 " to rooms-%u",
-        subscribe->GetNamespace().c_str(),
-        subscribe->GetTopicName().c_str(),
-        subscribe->GetStartSequenceNumber(),
+        "Unable to forward subscription %" PRIu64 " to rooms-%u",
+        sub_id,
         room_number);
   }
+}
+
+void ControlTower::ProcessSubscribeBatch(std::unique_ptr<Message> msg,
+                                         StreamID origin) {
+  options_.msg_loop->ThreadCheck();
 
+  auto batch = static_cast<MessageSubscribeBatch*>(msg.get());
+  int worker_id = options_.msg_loop->GetThreadWorkerIndex();
   auto& room_map = sub_to_room_[worker_id];
-  room_map.Insert(origin, subscribe->GetSubID(), room_number);
+
+  // Split the batch between rooms, so that every room gets a single command.
+  std::vector<std::unique_ptr<MessageSubscribeBatch>> room_batches(
+      rooms_.size());
+  for (const auto& sub : batch->GetSubscriptions()) {
+    LogID log_id;
+    Status st = options_.log_router->GetLogID(sub.namespace_id,
+                                              sub.topic_name,
+                                              &log_id);
+    if (!st.ok()) {
+      LOG_WARN(options_.info_log,
+          "Unable to map Topic(%s,%s) to logid %s",
+          sub.namespace_id.c_str(),
+          sub.topic_name.c_str(),
+          st.ToString().c_str());
+      continue;
+    }
+    const int room_number = LogIDToRoom(log_id);
+    auto& room_batch = room_batches[room_number];
+    if (!room_batch) {
+      room_batch.reset(new MessageSubscribeBatch(batch->GetTenantID()));
+    }
+    room_batch->Add(
+        sub.namespace_id, sub.topic_name, sub.start_seqno, sub.sub_id);
+    room_map.Insert(origin, sub.sub_id, room_number);
+  }
+
+  for (size_t room_number = 0; room_number < room_batches.size();
+       ++room_number) {
+    if (!room_batches[room_number]) {
+      continue;
+    }
+    const size_t size = room_batches[room_number]->GetSize();
+    ControlRoom* room = rooms_[room_number].get();
+    auto command = room->MsgCommand(
+        std::move(room_batches[room_number]), worker_id, origin);
+    auto& queue = tower_to_room_queues_[worker_id][room_number];
+    if (!queue->Write(command)) {
+      LOG_WARN(options_.info_log,
+          "Unable to forward %zu subscriptions to rooms-%zu",
+          size,
+          room_number);
+    } else {
+      LOG_DEBUG(options_.info_log,
+          "Forwarded %zu subscriptions to rooms-%zu",
+          size,
+          room_number);
+    }
+  }
 }
 
 void ControlTower::ProcessUnsubscribe(std::unique_ptr<Message> msg,
@@ -418,6 +475,10 @@ ControlTower::InitializeCallbacks() {
                                         StreamID origin) {
     ProcessSubscribe(std::move(msg), origin);
   };
+  cb[MessageType::mSubscribeBatch] = [this] (std::unique_ptr<Message> msg,
+                                             StreamID origin) {
+    ProcessSubscribeBatch(std::move(msg), origin);
+  };
   cb[MessageType::mUnsubscribe] = [this] (std::unique_ptr<Message> msg,
                                           StreamID origin) {
     ProcessUnsubscribe(std::move(msg), origin);
@@ -521,6 +582,9 @@ std::string ControlTower::GetInfoSync(std::vector<std::string> args) {
         sum += std::stol(result); // add up the per-room caches
       }
       return std::to_string(sum);
+    } else if (args[0] == "loop_profile") {
+      // loop_profile  -- where time is spent on event loops.
+      return options_.msg_loop->GetProfileInfo();
     }
   }
   return "Unknown info for control tower";
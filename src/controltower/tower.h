@@ -111,6 +111,7 @@ class ControlTower {
 
   // callbacks to process incoming messages
   void ProcessSubscribe(std::unique_ptr<Message> msg, StreamID origin);
+  void ProcessSubscribeBatch(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessUnsubscribe(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessFindTailSeqno(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessGoodbye(std::unique_ptr<Message> msg, StreamID origin);
@@ -281,6 +281,65 @@ void Copilot::ProcessSubscribe(std::unique_ptr<Message> msg, StreamID origin) {
   }
 }
 
+void Copilot::ProcessSubscribeBatch(std::unique_ptr<Message> msg,
+                                    StreamID origin) {
+  options_.msg_loop->ThreadCheck();
+
+  auto batch = static_cast<MessageSubscribeBatch*>(msg.get());
+  LOG_DEBUG(options_.info_log,
+            "Received batch of %zu subscribe requests on stream (%llu)",
+            batch->GetSize(),
+            origin);
+
+  // Split the batch between workers responsible for the topics, so that every
+  // worker gets a single command.
+  const int num_workers = options_.msg_loop->GetNumWorkers();
+  std::vector<std::unique_ptr<MessageSubscribeBatch>> worker_batches(
+      num_workers);
+  std::vector<std::vector<LogID>> worker_logids(num_workers);
+  auto worker_id = options_.msg_loop->GetThreadWorkerIndex();
+  for (const auto& sub : batch->GetSubscriptions()) {
+    LogID logid;
+    Status st = options_.log_router->GetLogID(
+        sub.namespace_id, sub.topic_name, &logid);
+    if (!st.ok()) {
+      LOG_WARN(options_.info_log,
+               "Unable to map Topic(%s, %s) to LogID: %s",
+               sub.namespace_id.c_str(),
+               sub.topic_name.c_str(),
+               st.ToString().c_str());
+      continue;
+    }
+
+    auto dest_worker_id = GetLogWorker(logid);
+    auto& worker_batch = worker_batches[dest_worker_id];
+    if (!worker_batch) {
+      worker_batch.reset(new MessageSubscribeBatch(batch->GetTenantID()));
+    }
+    worker_batch->Add(
+        sub.namespace_id, sub.topic_name, sub.start_seqno, sub.sub_id);
+    worker_logids[dest_worker_id].push_back(logid);
+    sub_id_map_[worker_id].Insert(origin, sub.sub_id, dest_worker_id);
+  }
+
+  // Forward batches to responsible workers.
+  for (int dest_worker_id = 0; dest_worker_id < num_workers;
+       ++dest_worker_id) {
+    if (!worker_batches[dest_worker_id]) {
+      continue;
+    }
+    auto command = workers_[dest_worker_id]->WorkerCommand(
+        std::move(worker_batches[dest_worker_id]),
+        std::move(worker_logids[dest_worker_id]),
+        worker_id,
+        origin);
+    auto& queue = client_to_worker_queues_[worker_id][dest_worker_id];
+    if (!queue->Write(command)) {
+      LOG_WARN(options_.info_log, "Worker %d queue is full.", worker_id);
+    }
+  }
+}
+
 void Copilot::ProcessUnsubscribe(std::unique_ptr<Message> msg,
                                  StreamID origin) {
   options_.msg_loop->ThreadCheck();
@@ -371,6 +430,8 @@ std::map<MessageType, MsgCallbackType> Copilot::InitializeCallbacks() {
   };
   cb[MessageType::mSubscribe] =
       std::bind(&Copilot::ProcessSubscribe, this, _1, _2);
+  cb[MessageType::mSubscribeBatch] =
+      std::bind(&Copilot::ProcessSubscribeBatch, this, _1, _2);
   cb[MessageType::mUnsubscribe] =
       std::bind(&Copilot::ProcessUnsubscribe, this, _1, _2);
   return cb;
@@ -428,6 +489,9 @@ std::string Copilot::GetInfoSync(std::vector<std::string> args) {
           },
           &result);
       return st.ok() ? result : st.ToString();
+    } else if (args[0] == "loop_profile") {
+      // loop_profile  -- where time is spent on event loops.
+      return options_.msg_loop->GetProfileInfo();
     }
   }
   return "Unknown info for copilot";
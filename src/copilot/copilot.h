@@ -107,6 +107,7 @@ class Copilot {
   void ProcessGap(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessTailSeqno(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessSubscribe(std::unique_ptr<Message> msg, StreamID origin);
+  void ProcessSubscribeBatch(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessUnsubscribe(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessGoodbye(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessTimerTick();
@@ -23,6 +23,7 @@ CopilotOptions::CopilotOptions()
     rollcall_enabled(true),
     rollcall_max_batch_size_bytes(16 << 10),
     rollcall_flush_latency(500),
+    rollcall_compact_batches(false),
     timer_interval_micros(500000),
     resubscriptions_per_second(10000),
     tower_subscriptions_check_period(10 * 60),
@@ -93,6 +93,12 @@ struct CopilotOptions {
   // Default: 500ms
   std::chrono::milliseconds rollcall_flush_latency;
 
+  // Write rollcall batches in the compact format, where subscribe and
+  // unsubscribe entries on the same topic cancel out and topic names are
+  // prefix compressed. Rollcall readers have to support the format.
+  // Default: false
+  bool rollcall_compact_batches;
+
   // Time between health check ticks.
   // Default: 500,000 (0.5s)
   uint64_t timer_interval_micros;
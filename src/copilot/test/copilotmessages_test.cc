@@ -22,6 +22,7 @@
 #include "src/util/testharness.h"
 #include "src/util/control_tower_router.h"
 #include "src/rollcall/rollcall_impl.h"
+#include "src/rollcall/rollcall_subscription_set.h"
 
 namespace rocketspeed {
 
@@ -258,6 +259,170 @@ TEST(CopilotTest, Rollcall) {
             num_msg / 2);
 }
 
+TEST(CopilotTest, RollcallSubscriptionSet) {
+  // Create cluster with pilot, copilot and controltower only.
+  LocalTestCluster cluster(info_log_, true, true, true);
+  ASSERT_OK(cluster.GetStatus());
+
+  // Create a Client mock.
+  MsgLoop client(env_, env_options_, 0, 1, info_log_, "client_mock");
+  StreamSocket socket(
+      client.CreateOutboundStream(cluster.GetCopilot()->GetHostId(), 0));
+  client.RegisterCallbacks({
+      {MessageType::mDeliverGap, [](std::unique_ptr<Message>, StreamID) {}},
+      {MessageType::mDeliverData, [](std::unique_ptr<Message>, StreamID) {}},
+  });
+  ASSERT_OK(client.Initialize());
+  MsgLoopThread client_thread(env_, &client, "client_mock");
+  ASSERT_OK(client.WaitUntilRunning());
+
+  std::shared_ptr<RollcallImpl> rollcall;
+  {
+    std::unique_ptr<ClientImpl> rc_client;
+    ASSERT_OK(cluster.CreateClient(&rc_client, true));
+    rollcall.reset(new RollcallImpl(std::move(rc_client), GuestTenant));
+  }
+
+  const size_t num_topics = 50;
+  std::mutex changes_mutex;
+  std::vector<std::pair<RollcallShard, SequenceNumber>> changes;
+  port::Semaphore changed;
+  RollcallSubscriptionSet::Options options;
+  options.snapshot_period = std::chrono::milliseconds(0);
+  options.on_change =
+    [&](RollcallShard shard, SequenceNumber seqno, Slice, uint64_t) {
+      std::lock_guard<std::mutex> lock(changes_mutex);
+      changes.emplace_back(shard, seqno);
+      changed.Post();
+    };
+  RollcallSubscriptionSet set(rollcall, GuestNamespace, options);
+  ASSERT_OK(set.Start());
+
+  // Wait a little so that the subscribe to 0 isn't affected by rollcall writes.
+  env_->SleepForMicroseconds(500000);
+
+  // Two subscriptions on each topic, one on each of its first half.
+  SubscriptionID sub_id = 0;
+  for (size_t i = 0; i < num_topics; ++i) {
+    std::string topic = "subscription_set_" + std::to_string(i);
+    for (int j = 0; j < (i < num_topics / 2 ? 2 : 1); ++j) {
+      MessageSubscribe msg(
+          Tenant::GuestTenant, GuestNamespace, topic, 0, sub_id++);
+      ASSERT_OK(client.SendRequest(msg, &socket, 0));
+    }
+  }
+  for (SubscriptionID i = 0; i < sub_id; ++i) {
+    ASSERT_TRUE(changed.TimedWait(std::chrono::seconds(5)));
+  }
+  ASSERT_OK(set.GetStatus());
+  ASSERT_EQ(set.GetNumTopics(), num_topics);
+  ASSERT_EQ(set.GetSubscriberCount("subscription_set_0"), 2U);
+  ASSERT_EQ(set.GetSubscriberCount("subscription_set_49"), 1U);
+  ASSERT_EQ(set.GetSubscriberCount("subscription_set_50"), 0U);
+
+  auto snapshot = set.GetSnapshot();
+  ASSERT_EQ(snapshot->topics.size(), num_topics);
+  ASSERT_EQ(snapshot->topics[0].first, "subscription_set_0");
+  ASSERT_EQ(snapshot->topics[0].second, 2U);
+  {
+    // Every change seen so far is covered by the snapshot.
+    std::lock_guard<std::mutex> lock(changes_mutex);
+    for (const auto& change : changes) {
+      ASSERT_LE(change.second, snapshot->shard_seqnos.at(change.first));
+    }
+  }
+
+  // Start another set from the snapshot, it should follow the changes.
+  port::Semaphore resumed_changed;
+  RollcallSubscriptionSet::Options resumed_options;
+  resumed_options.on_change =
+    [&](RollcallShard, SequenceNumber, Slice, uint64_t) {
+      resumed_changed.Post();
+    };
+  RollcallSubscriptionSet resumed(rollcall, GuestNamespace, resumed_options);
+  ASSERT_OK(resumed.Start(snapshot));
+  ASSERT_EQ(resumed.GetNumTopics(), num_topics);
+  ASSERT_EQ(resumed.GetSubscriberCount("subscription_set_0"), 2U);
+  env_->SleepForMicroseconds(500000);
+
+  // Unsubscribe everything but the first subscription.
+  for (SubscriptionID i = 1; i < sub_id; ++i) {
+    MessageUnsubscribe msg(
+        Tenant::GuestTenant, i, MessageUnsubscribe::Reason::kRequested);
+    ASSERT_OK(client.SendRequest(msg, &socket, 0));
+  }
+  for (SubscriptionID i = 1; i < sub_id; ++i) {
+    ASSERT_TRUE(changed.TimedWait(std::chrono::seconds(5)));
+  }
+  ASSERT_EQ(set.GetNumTopics(), 1U);
+  ASSERT_EQ(set.GetSubscriberCount("subscription_set_0"), 1U);
+  snapshot = set.GetSnapshot();
+  ASSERT_EQ(snapshot->topics.size(), 1U);
+
+  for (SubscriptionID i = 1; i < sub_id; ++i) {
+    ASSERT_TRUE(resumed_changed.TimedWait(std::chrono::seconds(5)));
+  }
+  ASSERT_OK(resumed.GetStatus());
+  ASSERT_EQ(resumed.GetNumTopics(), 1U);
+  ASSERT_EQ(resumed.GetSubscriberCount("subscription_set_0"), 1U);
+  ASSERT_EQ(resumed.GetSnapshot()->shard_seqnos, snapshot->shard_seqnos);
+}
+
+TEST(CopilotTest, RollcallSubscriptionSetBeforeStart) {
+  // Create cluster with pilot, copilot and controltower only.
+  LocalTestCluster cluster(info_log_, true, true, true);
+  ASSERT_OK(cluster.GetStatus());
+
+  // Create a Client mock.
+  MsgLoop client(env_, env_options_, 0, 1, info_log_, "client_mock");
+  StreamSocket socket(
+      client.CreateOutboundStream(cluster.GetCopilot()->GetHostId(), 0));
+  client.RegisterCallbacks({
+      {MessageType::mDeliverGap, [](std::unique_ptr<Message>, StreamID) {}},
+      {MessageType::mDeliverData, [](std::unique_ptr<Message>, StreamID) {}},
+  });
+  ASSERT_OK(client.Initialize());
+  MsgLoopThread client_thread(env_, &client, "client_mock");
+  ASSERT_OK(client.WaitUntilRunning());
+
+  std::shared_ptr<RollcallImpl> rollcall;
+  {
+    std::unique_ptr<ClientImpl> rc_client;
+    ASSERT_OK(cluster.CreateClient(&rc_client, true));
+    rollcall.reset(new RollcallImpl(std::move(rc_client), GuestTenant));
+  }
+
+  // Subscribe before the set is started, so it never sees the subscription.
+  const std::string topic = "subscription_set_before_start";
+  MessageSubscribe subscribe(Tenant::GuestTenant, GuestNamespace, topic, 0, 0);
+  ASSERT_OK(client.SendRequest(subscribe, &socket, 0));
+  env_->SleepForMicroseconds(500000);
+
+  port::Semaphore changed;
+  RollcallSubscriptionSet::Options options;
+  options.on_change = [&](RollcallShard, SequenceNumber, Slice, uint64_t) {
+    changed.Post();
+  };
+  RollcallSubscriptionSet set(rollcall, GuestNamespace, options);
+  ASSERT_OK(set.Start());
+  env_->SleepForMicroseconds(500000);
+
+  // The unsubscription must not leave the topic with a negative count.
+  MessageUnsubscribe unsubscribe(
+      Tenant::GuestTenant, 0, MessageUnsubscribe::Reason::kRequested);
+  ASSERT_OK(client.SendRequest(unsubscribe, &socket, 0));
+  for (SubscriptionID i = 1; i <= 2; ++i) {
+    MessageSubscribe msg(Tenant::GuestTenant, GuestNamespace, topic, 0, i);
+    ASSERT_OK(client.SendRequest(msg, &socket, 0));
+  }
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(changed.TimedWait(std::chrono::seconds(5)));
+  }
+  ASSERT_OK(set.GetStatus());
+  ASSERT_EQ(set.GetSubscriberCount(topic), 2U);
+  ASSERT_EQ(set.GetNumTopics(), 1U);
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
@@ -56,7 +56,8 @@ CopilotWorker::CopilotWorker(
     assert(client);
     rollcall_.reset(new RollcallImpl(std::move(client),
                                      InvalidTenant,
-                                     "copilot.rollcall"));
+                                     "copilot.rollcall",
+                                     options_.rollcall_compact_batches));
     rollcall_error_queues_ = options_.msg_loop->CreateThreadLocalQueues(myid_);
   }
 }
@@ -121,6 +122,20 @@ CopilotWorker::WorkerCommand(LogID logid,
   return command;
 }
 
+std::unique_ptr<Command> CopilotWorker::WorkerCommand(
+    std::unique_ptr<MessageSubscribeBatch> batch,
+    std::vector<LogID> logids,
+    int worker_id,
+    StreamID origin) {
+  auto moved_batch = folly::makeMoveWrapper(std::move(batch));
+  auto moved_logids = folly::makeMoveWrapper(std::move(logids));
+  std::unique_ptr<Command> command(MakeExecuteCommand(
+      [this, moved_batch, moved_logids, worker_id, origin]() mutable {
+        ProcessSubscribeBatch(**moved_batch, *moved_logids, worker_id, origin);
+      }));
+  return command;
+}
+
 std::unique_ptr<Command> CopilotWorker::WorkerCommand(
     std::shared_ptr<ControlTowerRouter> new_router) {
   std::unique_ptr<Command> command(MakeExecuteCommand(
@@ -128,16 +143,7 @@ std::unique_ptr<Command> CopilotWorker::WorkerCommand(
   return command;
 }
 
-Statistics CopilotWorker::GetStatistics() {
-  stats_.subscribed_topics->Set(topics_.size());
-
-  size_t total_sockets = 0;
-  for (const auto& entry : control_tower_sockets_) {
-    total_sockets += entry.second.size();
-  }
-  stats_.control_tower_sockets->Set(total_sockets);
-  stats_.orphaned_topics->Set(active_resubscribe_requests_by_topic_.size());
-
+Statistics CopilotWorker::GetStatistics() const {
   Statistics stats = stats_.all;
   if (options_.rollcall_enabled) {
     stats.Aggregate(rollcall_->GetStatistics());
@@ -145,6 +151,16 @@ Statistics CopilotWorker::GetStatistics() {
   return stats;
 }
 
+void CopilotWorker::RecordTrace(const MessageTrace& trace) {
+  stats_.traced_messages->Add(1);
+  uint64_t total = 0;
+  trace.ForEachHopLatency([&](MessageTrace::Hop hop, uint64_t micros) {
+    stats_.trace_hop_latency[hop]->Record(micros);
+    total += micros;
+  });
+  stats_.trace_total_latency->Record(total);
+}
+
 void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
                                 StreamID origin) {
   MessageDeliverData* msg = static_cast<MessageDeliverData*>(message.get());
@@ -157,6 +173,7 @@ void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
     return;
   }
   const TopicUUID uuid = *ptr;
+  stats_.data_received->Add(1);
 
   // Get the list of subscriptions for this topic.
   LOG_DEBUG(options_.info_log,
@@ -174,6 +191,13 @@ void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
     // Find tower for this origin and update its state.
     AdvanceTowers(&topic, prev_seqno, seqno, origin, msg->GetSubID());
 
+    // Sampled messages carry their trace to every subscriber.
+    MessageTrace trace = msg->GetTrace();
+    if (trace.IsSampled()) {
+      trace.Stamp(MessageTrace::kCopilotDispatch, options_.env->NowMicros());
+      RecordTrace(trace);
+    }
+
     // Send to all subscribers.
     bool delivered_at_least_once = false;
     for (auto& sub : topic.subscriptions) {
@@ -225,10 +249,12 @@ void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
                               msg->GetMessageID(),
                               msg->GetPayload());
       data.SetSequenceNumbers(prev_seqno, seqno);
+      data.SetTrace(trace);
       auto command = options_.msg_loop->ResponseCommand(data, recipient);
       if (client_queues_[sub->worker_id]->Write(command)) {
         sub->seqno = seqno + 1;
         ++topic.records_sent;
+        stats_.data_delivered->Add(1);
 
         LOG_DEBUG(options_.info_log,
                   "Sent data (%.16s)@%" PRIu64 " for ID(%" PRIu64
@@ -459,6 +485,7 @@ void CopilotWorker::ProcessSubscribe(const TenantID tenant_id,
   auto topic_iter = topics_.find(uuid);
   if (topic_iter == topics_.end()) {
     topic_iter = topics_.emplace(uuid, TopicState(logid)).first;
+    stats_.subscribed_topics->Set(topics_.size());
   }
   TopicState& topic = topic_iter->second;
 
@@ -499,6 +526,35 @@ void CopilotWorker::ProcessSubscribe(const TenantID tenant_id,
                 subscriber);
 }
 
+void CopilotWorker::ProcessSubscribeBatch(const MessageSubscribeBatch& batch,
+                                          const std::vector<LogID>& logids,
+                                          const int worker_id,
+                                          const StreamID subscriber) {
+  assert(batch.GetSize() == logids.size());
+  LOG_INFO(options_.info_log,
+           "Received batch of %zu subscribe requests for %llu",
+           batch.GetSize(),
+           subscriber);
+
+  // Tower subscriptions resulting from the batch are sent in batches as well.
+  assert(!batch_tower_subscribes_);
+  batch_tower_subscribes_ = true;
+  const auto& subscriptions = batch.GetSubscriptions();
+  for (size_t i = 0; i < subscriptions.size(); ++i) {
+    const auto& sub = subscriptions[i];
+    ProcessSubscribe(batch.GetTenantID(),
+                     sub.namespace_id,
+                     sub.topic_name,
+                     sub.start_seqno,
+                     sub.sub_id,
+                     logids[i],
+                     worker_id,
+                     subscriber);
+  }
+  batch_tower_subscribes_ = false;
+  FlushTowerSubscribes();
+}
+
 void CopilotWorker::ProcessUnsubscribe(TenantID tenant_id,
                                        SubscriptionID sub_id,
                                        MessageUnsubscribe::Reason reason,
@@ -565,6 +621,7 @@ void CopilotWorker::RemoveSubscription(const TenantID tenant_id,
     // No more subscriptions, so remove from map.
     if (topic.subscriptions.empty()) {
       topics_.erase(topic_iter);
+      stats_.subscribed_topics->Set(topics_.size());
       CancelResubscribeRequest(uuid);
       topic_checkup_list_.Erase(uuid);
     }
@@ -651,14 +708,11 @@ void CopilotWorker::ProcessTimerTick() {
     }
   }
 
-  if (options_.rollcall_enabled) {
-    rollcall_->CheckBatchTimeouts(options_.rollcall_flush_latency);
-  }
-
   // Get a list of topics/tower subscriptions that are due a check up.
+  // Check ups stay on the tick, as they are rate limited per tick to avoid
+  // flooding control towers with resubscriptions.
   std::vector<TopicUUID> updates;
   topic_checkup_list_.GetExpired(
-    options_.tower_subscriptions_check_period,
     std::back_inserter(updates),
     static_cast<int>(rebalances_per_tick_));
 
@@ -672,7 +726,7 @@ void CopilotWorker::ProcessTimerTick() {
         stats_.tower_rebalances_performed->Add(1);
       }
       // Put back in the list to check again later.
-      topic_checkup_list_.Add(std::move(uuid));
+      topic_checkup_list_.Add(uuid, options_.tower_subscriptions_check_period);
     }
   }
   stats_.tower_rebalances_checked->Add(updates.size());
@@ -702,6 +756,7 @@ void CopilotWorker::CloseControlTowerStream(StreamID stream) {
     for (auto it = streams.begin(); it != streams.end(); ) {
       if (it->second.GetStreamID() == stream) {
         it = streams.erase(it);
+        stats_.control_tower_sockets->Add(-1);
       } else {
         ++it;
       }
@@ -715,6 +770,15 @@ bool CopilotWorker::SendSubscribe(TenantID tenant_id,
                                   StreamSocket* stream,
                                   SubscriptionID sub_id,
                                   int worker_id) {
+  if (batch_tower_subscribes_) {
+    // Defer until the whole batch of subscriptions is processed.
+    pending_tower_subscribe_index_[sub_id] = pending_tower_subscribes_.size();
+    sub_to_topic_.Insert(stream->GetStreamID(), sub_id, uuid);
+    pending_tower_subscribes_.push_back(PendingTowerSubscribe{
+        stream, worker_id, tenant_id, std::move(uuid), seqno, sub_id, false});
+    return true;
+  }
+
   Slice namespace_id;
   Slice topic_name;
   uuid.GetTopicID(&namespace_id, &topic_name);
@@ -749,6 +813,17 @@ bool CopilotWorker::SendUnsubscribe(TenantID tenant_id,
                                     StreamSocket* stream,
                                     SubscriptionID sub_id,
                                     int worker_id) {
+  if (batch_tower_subscribes_) {
+    auto it = pending_tower_subscribe_index_.find(sub_id);
+    if (it != pending_tower_subscribe_index_.end()) {
+      // Subscription was never sent, so simply cancel it.
+      pending_tower_subscribes_[it->second].cancelled = true;
+      pending_tower_subscribe_index_.erase(it);
+      sub_to_topic_.Remove(stream->GetStreamID(), sub_id);
+      return true;
+    }
+  }
+
   MessageUnsubscribe message(tenant_id,
                              sub_id,
                              MessageUnsubscribe::Reason::kRequested);
@@ -768,6 +843,97 @@ bool CopilotWorker::SendUnsubscribe(TenantID tenant_id,
   }
 }
 
+void CopilotWorker::FlushTowerSubscribes() {
+  // Group deferred subscriptions by tower stream and tenant.
+  struct TowerBatch {
+    StreamSocket* stream;
+    int worker_id;
+    std::unique_ptr<MessageSubscribeBatch> message;
+  };
+  std::vector<TowerBatch> batches;
+  for (PendingTowerSubscribe& pending : pending_tower_subscribes_) {
+    if (pending.cancelled) {
+      continue;
+    }
+    TowerBatch* batch = nullptr;
+    for (TowerBatch& candidate : batches) {
+      if (candidate.stream == pending.stream &&
+          candidate.worker_id == pending.worker_id &&
+          candidate.message->GetTenantID() == pending.tenant_id) {
+        batch = &candidate;
+        break;
+      }
+    }
+    if (!batch) {
+      batches.push_back(TowerBatch{
+          pending.stream,
+          pending.worker_id,
+          std::unique_ptr<MessageSubscribeBatch>(
+              new MessageSubscribeBatch(pending.tenant_id))});
+      batch = &batches.back();
+    }
+    Slice namespace_id;
+    Slice topic_name;
+    pending.uuid.GetTopicID(&namespace_id, &topic_name);
+    batch->message->Add(namespace_id.ToString(),
+                       topic_name.ToString(),
+                       pending.seqno,
+                       pending.sub_id);
+  }
+  pending_tower_subscribes_.clear();
+  pending_tower_subscribe_index_.clear();
+
+  for (TowerBatch& batch : batches) {
+    std::unique_ptr<Command> command;
+    if (batch.message->GetSize() == 1) {
+      // Towers handle single subscriptions more efficiently.
+      const auto& sub = batch.message->GetSubscriptions()[0];
+      MessageSubscribe message(batch.message->GetTenantID(),
+                               sub.namespace_id,
+                               sub.topic_name,
+                               sub.start_seqno,
+                               sub.sub_id);
+      command = options_.msg_loop->RequestCommand(message, batch.stream);
+    } else {
+      command = options_.msg_loop->RequestCommand(*batch.message, batch.stream);
+    }
+    if (tower_queues_[batch.worker_id]->Write(command)) {
+      LOG_DEBUG(options_.info_log,
+        "Sent batch of %zu subscriptions to tower stream %llu",
+        batch.message->GetSize(),
+        batch.stream->GetStreamID());
+    } else {
+      LOG_WARN(options_.info_log,
+        "Failed to send batch of %zu subscriptions to tower stream %llu",
+        batch.message->GetSize(),
+        batch.stream->GetStreamID());
+      for (const auto& sub : batch.message->GetSubscriptions()) {
+        RollbackTowerSubscribe(batch.stream, sub.sub_id);
+      }
+    }
+  }
+}
+
+void CopilotWorker::RollbackTowerSubscribe(StreamSocket* stream,
+                                           SubscriptionID sub_id) {
+  TopicUUID uuid;
+  if (!sub_to_topic_.MoveOut(stream->GetStreamID(), sub_id, &uuid)) {
+    return;
+  }
+  auto topic_it = topics_.find(uuid);
+  if (topic_it == topics_.end()) {
+    return;
+  }
+  TopicState& topic = topic_it->second;
+  for (auto it = topic.towers.begin(); it != topic.towers.end(); ++it) {
+    if (it->sub_id == sub_id) {
+      topic.towers.erase(it);
+      ScheduleResubscribeRequest(uuid, topic);
+      break;
+    }
+  }
+}
+
 // Find earliest non-zero subscription, or zero if only zero subscriptions.
 SequenceNumber CopilotWorker::FindLowestSequenceNumber(
     const TopicState& topic, bool* have_zero_sub) {
@@ -959,7 +1125,7 @@ void CopilotWorker::UpdateTowerSubscriptions(
     if (resub_needed) {
       // We successfully resubscribed to all towers, so add to checkup list
       // (or push to the back of the queue, since subscriptions are up to date).
-      topic_checkup_list_.Add(uuid);
+      topic_checkup_list_.Add(uuid, options_.tower_subscriptions_check_period);
     }
   }
 }
@@ -1029,7 +1195,8 @@ CopilotWorker::RollcallWrite(const SubscriptionID sub_id,
                                static_cast<size_t>(logid),
                                type == MetadataType::mSubscribe ? true : false,
                                publish_callback,
-                               options_.rollcall_max_batch_size_bytes);
+                               options_.rollcall_max_batch_size_bytes,
+                               options_.rollcall_flush_latency);
   stats_.rollcall_writes_total->Add(1);
   if (status.ok()) {
     LOG_INFO(options_.info_log,
@@ -1049,7 +1216,33 @@ CopilotWorker::RollcallWrite(const SubscriptionID sub_id,
     }
   }
 
-  rollcall_->CheckBatchTimeouts(options_.rollcall_flush_latency);
+  ScheduleRollcallFlush();
+}
+
+void CopilotWorker::ScheduleRollcallFlush() {
+  const auto deadline = rollcall_->GetNextBatchTimeout();
+  if (rollcall_flush_timeout_ && deadline >= rollcall_flush_deadline_) {
+    // Scheduled timeout fires early enough.
+    return;
+  }
+  if (deadline == std::chrono::steady_clock::time_point::max()) {
+    // No pending batches.
+    return;
+  }
+
+  EventLoop* event_loop = options_.msg_loop->GetEventLoop(myid_);
+  if (rollcall_flush_timeout_) {
+    event_loop->CancelTimeout(rollcall_flush_timeout_);
+  }
+  const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::max(deadline - std::chrono::steady_clock::now(),
+             std::chrono::steady_clock::duration::zero()));
+  rollcall_flush_deadline_ = deadline;
+  rollcall_flush_timeout_ = event_loop->ScheduleTimeout(delay, [this] () {
+    rollcall_flush_timeout_ = 0;
+    rollcall_->CheckBatchTimeouts();
+    ScheduleRollcallFlush();
+  });
 }
 
 StreamSocket* CopilotWorker::GetControlTowerSocket(const HostId& tower,
@@ -1063,6 +1256,7 @@ StreamSocket* CopilotWorker::GetControlTowerSocket(const HostId& tower,
                                    tower, outgoing_worker_id))
              .first;
     stats_.control_tower_socket_creations->Add(1);
+    stats_.control_tower_sockets->Add(1);
   }
   return &it->second;
 }
@@ -1228,6 +1422,7 @@ void CopilotWorker::CancelResubscribeRequest(const TopicUUID& topic_uuid) {
   if (request_it != active_resubscribe_requests_by_topic_.end()) {
     request_it->second->cancelled = true;
     active_resubscribe_requests_by_topic_.erase(request_it);
+    stats_.orphaned_topics->Set(active_resubscribe_requests_by_topic_.size());
   }
   // Note: cancelled request will be destroyed when it is popped.
 }
@@ -1244,6 +1439,7 @@ CopilotWorker::PopNextResubscribeRequest() {
 
   current_resubscribe_request_queue_.pop();
   active_resubscribe_requests_by_topic_.erase(top_request->topic_uuid);
+  stats_.orphaned_topics->Set(active_resubscribe_requests_by_topic_.size());
 
   return top_request;
 }
@@ -1301,6 +1497,7 @@ void CopilotWorker::ScheduleResubscribeRequest(
   resubscribe_request_queue.push(SafeResubscribeRequest(request));
   active_resubscribe_requests_by_topic_.insert(
       std::make_pair(topic_uuid, request));
+  stats_.orphaned_topics->Set(active_resubscribe_requests_by_topic_.size());
 }
 
 }  // namespace rocketspeed
@@ -22,7 +22,7 @@
 #include "src/util/common/linked_map.h"
 #include "src/util/subscription_map.h"
 #include "src/util/storage.h"
-#include "src/util/timeout_list.h"
+#include "src/util/timer_wheel.h"
 #include "src/util/topic_uuid.h"
 
 namespace rocketspeed {
@@ -53,6 +53,14 @@ class CopilotWorker {
                                          int worker_id,
                                          StreamID origin);
 
+  // Creates a worker command for processing a batch of subscriptions, where
+  // logids[i] is the log of i-th subscription in the batch.
+  std::unique_ptr<Command> WorkerCommand(
+    std::unique_ptr<MessageSubscribeBatch> batch,
+    std::vector<LogID> logids,
+    int worker_id,
+    StreamID origin);
+
   std::unique_ptr<Command> WorkerCommand(
     std::shared_ptr<ControlTowerRouter> new_router);
 
@@ -64,7 +72,8 @@ class CopilotWorker {
     return options_.msg_loop->GetHostId();
   }
 
-  Statistics GetStatistics();
+  // Takes a snapshot of statistics, may be called from any thread.
+  Statistics GetStatistics() const;
 
   /**
    * Returns human-readable info on the towers serving a particular log.
@@ -143,6 +152,24 @@ class CopilotWorker {
         all.AddCounter("copilot.tower_rebalances_checked");
       tower_rebalances_performed =
         all.AddCounter("copilot.tower_rebalances_performed");
+      data_received =
+        all.AddCounter("copilot.data_received");
+      data_delivered =
+        all.AddCounter("copilot.data_delivered");
+      traced_messages =
+        all.AddCounter("copilot.trace.messages");
+      // Copilot sees hops up to its own dispatch, the first has no latency.
+      for (int hop = 0; hop < MessageTrace::kNumHops; ++hop) {
+        trace_hop_latency[hop] =
+          hop == MessageTrace::kClientSend ||
+          hop > MessageTrace::kCopilotDispatch
+          ? nullptr
+          : all.AddLatency(
+              std::string("copilot.trace.") +
+              MessageTrace::HopName(static_cast<MessageTrace::Hop>(hop)) +
+              "_latency");
+      }
+      trace_total_latency = all.AddLatency("copilot.trace.total_latency");
     }
 
     Statistics all;
@@ -163,8 +190,17 @@ class CopilotWorker {
     Counter* orphaned_resubscribes;
     Counter* tower_rebalances_checked;
     Counter* tower_rebalances_performed;
+    Counter* data_received;       // records received from towers
+    Counter* data_delivered;      // records sent to subscribers
+    Counter* traced_messages;
+    // Latency of reaching each hop from the previous one, for sampled messages.
+    Histogram* trace_hop_latency[MessageTrace::kNumHops];
+    Histogram* trace_total_latency;
   } stats_;
 
+  // Records latencies of hops taken by a sampled message.
+  void RecordTrace(const MessageTrace& trace);
+
   // Add a subscriber to a topic.
   void ProcessSubscribe(TenantID tenant_id,
                         const NamespaceID& namespace_id,
@@ -175,6 +211,12 @@ class CopilotWorker {
                         int worker_id,
                         StreamID subscriber);
 
+  // Add a batch of subscribers, batching resulting tower subscriptions.
+  void ProcessSubscribeBatch(const MessageSubscribeBatch& batch,
+                             const std::vector<LogID>& logids,
+                             int worker_id,
+                             StreamID subscriber);
+
   // Remove a subscriber from a topic.
   void ProcessUnsubscribe(TenantID tenant_id,
                           SubscriptionID sub_id,
@@ -218,6 +260,15 @@ class CopilotWorker {
                        int worker_id);
 
 
+  /** Sends all tower subscriptions deferred while processing a batch. */
+  void FlushTowerSubscribes();
+
+  /**
+   * Removes tower subscription which failed to be sent and schedules the
+   * topic for resubscription.
+   */
+  void RollbackTowerSubscribe(StreamSocket* stream, SubscriptionID sub_id);
+
   // Removes a single subscription.
   // May update subscription to control tower.
   // Does not send response to subscriber.
@@ -235,6 +286,9 @@ class CopilotWorker {
                      int worker_id,
                      StreamID origin);
 
+  // Schedules a timeout flushing rollcall batches when the next one is due.
+  void ScheduleRollcallFlush();
+
   /** Gets or (re)open socket to control tower. */
   StreamSocket* GetControlTowerSocket(const HostId& tower,
                                       MsgLoop* msg_loop,
@@ -373,10 +427,15 @@ class CopilotWorker {
   // A client to write rollcall topic
   std::unique_ptr<RollcallImpl> rollcall_;
 
+  // Timeout flushing rollcall batches when the earliest one is due, zero if
+  // none is scheduled, and the time at which it fires.
+  TimeoutID rollcall_flush_timeout_{0};
+  std::chrono::steady_clock::time_point rollcall_flush_deadline_;
+
   // A list of subscriptions to check topic health periodically.
   // For long-living subscriptions, we need to ensure that the subscription
   // is on the correct control tower.
-  TimeoutList<TopicUUID> topic_checkup_list_;
+  TimerWheel<TopicUUID> topic_checkup_list_;
 
   // Cache of control tower mapping per log.
   mutable std::unordered_map<LogID, std::vector<const HostId*>>
@@ -385,6 +444,23 @@ class CopilotWorker {
   // State of subscription ID generator.
   uint64_t next_sub_id_state_{0};
 
+  // A tower subscription deferred while processing a batch of subscriptions.
+  struct PendingTowerSubscribe {
+    StreamSocket* stream;
+    int worker_id;
+    TenantID tenant_id;
+    TopicUUID uuid;
+    SequenceNumber seqno;
+    SubscriptionID sub_id;
+    bool cancelled;
+  };
+
+  // True iff tower subscriptions should be deferred and sent in batches.
+  bool batch_tower_subscribes_{false};
+  std::vector<PendingTowerSubscribe> pending_tower_subscribes_;
+  // Index of deferred tower subscriptions by subscription ID.
+  std::unordered_map<SubscriptionID, size_t> pending_tower_subscribe_index_;
+
   /***
    * Re-subscription data structures
    */
@@ -6,20 +6,28 @@
 #include "client_wrapper.h"
 
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <limits>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "include/RocketSpeed.h"
 #include "include/Status.h"
 #include "include/Types.h"
 #include "src/djinni/jvm_env.h"
 #include "src/djinni/type_conversions.h"
+#include "src/util/common/coding.h"
 #include "src/util/common/fixed_configuration.h"
 
 #include "src-gen/djinni/cpp/LogLevel.hpp"
 #include "src-gen/djinni/cpp/PublishCallback.hpp"
+#include "src-gen/djinni/cpp/MessageBatchReceivedCallback.hpp"
 #include "src-gen/djinni/cpp/MessageReceivedCallback.hpp"
 #include "src-gen/djinni/cpp/StorageType.hpp"
 #include "src-gen/djinni/cpp/SnapshotCallback.hpp"
@@ -83,6 +91,167 @@ std::shared_ptr<ClientImpl> ClientImpl::Create(LogLevel log_level,
                                          std::move(info_log));
 }
 
+/**
+ * Collects messages of batched subscriptions and hands them to Java from a
+ * single thread, one batch per callback at a time. Messages arriving while
+ * Java processes a batch form the next one, so batches grow with the load.
+ *
+ * A batch is laid out as follows, all integers are little-endian:
+ *
+ *   batch   := fixed32(count) message{count}
+ *   message := fixed64(sub_handle) fixed64(seqno) fixed32(size) bytes[size]
+ *
+ * Messages are encoded straight into the buffer handed to Java. See
+ * MessageBatch.java.
+ */
+class ClientWrapper::BatchDelivery {
+ public:
+  static constexpr size_t kCountSize = 4;
+  static constexpr size_t kHeaderSize = 20;
+
+  /**
+   * Starts the thread delivering batches. The thread keeps the delivery alive
+   * until it exits, so that the wrapper can be closed or destroyed from a
+   * batch callback.
+   */
+  static std::shared_ptr<BatchDelivery> Start(
+      std::shared_ptr<Logger> info_log) {
+    std::shared_ptr<BatchDelivery> delivery(
+        new BatchDelivery(std::move(info_log)));
+    delivery->thread_ = JvmEnv::Default()->StartThread(
+        [delivery]() { delivery->Run(); }, "rs-batch-delivery");
+    return delivery;
+  }
+
+  /**
+   * Stops delivering batches, after the one being delivered if any, and
+   * unblocks client threads waiting in Add.
+   */
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  /**
+   * Waits for the thread to exit after Stop. When called from a batch
+   * callback, detaches the thread instead, which exits once the callback
+   * returns.
+   */
+  void Join() {
+    if (JvmEnv::Default()->GetCurrentThreadId() == thread_) {
+      JvmEnv::Default()->DetachThread(thread_);
+    } else {
+      JvmEnv::Default()->WaitForJoin(thread_);
+    }
+  }
+
+  /**
+   * Appends a message to the next batch of the callback. Blocks the calling
+   * client thread while too much data waits for Java, which pushes back on
+   * the connection.
+   */
+  void Add(const std::shared_ptr<MessageBatchReceivedCallback>& callback,
+           const MessageReceived& message) {
+    const Slice contents = message.GetContents();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return pending_bytes_ < kMaxPendingBytes ||
+                                     stop_; });
+    if (stop_) {
+      return;
+    }
+
+    auto it = batches_.find(callback.get());
+    if (it == batches_.end()) {
+      it = batches_.emplace(callback.get(), Batch()).first;
+      it->second.callback = callback;
+      // Leave room for the count, which is known once the batch is complete.
+      it->second.data.resize(kCountSize);
+      ready_.push_back(callback.get());
+    }
+    Batch& batch = it->second;
+    const size_t offset = batch.data.size();
+    batch.data.resize(offset + kHeaderSize + contents.size());
+    char* header = reinterpret_cast<char*>(batch.data.data() + offset);
+    EncodeFixed64(header,
+                  static_cast<uint64_t>(message.GetSubscriptionHandle()));
+    EncodeFixed64(header + 8, message.GetSequenceNumber());
+    EncodeFixed32(header + 16, static_cast<uint32_t>(contents.size()));
+    memcpy(header + kHeaderSize, contents.data(), contents.size());
+    ++batch.count;
+    pending_bytes_ += kHeaderSize + contents.size();
+    cv_.notify_all();
+  }
+
+ private:
+  static constexpr size_t kMaxPendingBytes = 4 << 20;
+
+  explicit BatchDelivery(std::shared_ptr<Logger> info_log)
+  : info_log_(std::move(info_log)) {}
+
+  struct Batch {
+    std::shared_ptr<MessageBatchReceivedCallback> callback;
+    uint32_t count = 0;
+    std::vector<uint8_t> data;
+  };
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cv_.wait(lock, [this]() { return !ready_.empty() || stop_; });
+      if (stop_) {
+        return;
+      }
+      // Batches are delivered in the order they were started.
+      auto it = batches_.find(ready_.front());
+      ready_.pop_front();
+      Batch batch = std::move(it->second);
+      batches_.erase(it);
+      const size_t size = batch.data.size() - kCountSize;
+
+      lock.unlock();
+      EncodeFixed32(reinterpret_cast<char*>(batch.data.data()), batch.count);
+      try {
+        batch.callback->Call(std::move(batch.data));
+      } catch (const std::exception& e) {
+        LOG_WARN(info_log_,
+                 "MessageBatchReceivedCallback caught exception: %s",
+                 e.what());
+      }
+      lock.lock();
+
+      pending_bytes_ -= size;
+      cv_.notify_all();
+    }
+  }
+
+  const std::shared_ptr<Logger> info_log_;
+  BaseEnv::ThreadId thread_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Batches being filled, by callback.
+  std::unordered_map<MessageBatchReceivedCallback*, Batch> batches_;
+  // Callbacks with a batch, in the order the batches were started.
+  std::deque<MessageBatchReceivedCallback*> ready_;
+  size_t pending_bytes_ = 0;
+  bool stop_ = false;
+};
+
+constexpr size_t ClientWrapper::BatchDelivery::kCountSize;
+constexpr size_t ClientWrapper::BatchDelivery::kHeaderSize;
+constexpr size_t ClientWrapper::BatchDelivery::kMaxPendingBytes;
+
+ClientWrapper::ClientWrapper(std::unique_ptr<rocketspeed::Client> client,
+                             std::shared_ptr<Logger> info_log)
+: client_(std::move(client)), info_log_(std::move(info_log)) {}
+
+ClientWrapper::~ClientWrapper() {
+  Close();
+}
+
 MsgId ClientWrapper::Publish(int32_t tenant_id,
                              std::string namespace_id,
                              std::string topic_name,
@@ -129,11 +298,6 @@ int64_t ClientWrapper::Subscribe(
     int64_t start_seqno,
     std::shared_ptr<MessageReceivedCallback> deliver_cb,
     std::shared_ptr<SubscribeCallback> subscribe_cb) {
-  auto tenant_id1 = static_cast<rocketspeed::TenantID>(tenant_id);
-  if (tenant_id != tenant_id1) {
-    throw std::runtime_error("TenantID out of range.");
-  }
-
   rocketspeed::MessageReceivedCallback deliver_cb1 = nullptr;
   if (deliver_cb) {
     deliver_cb1 =
@@ -149,6 +313,51 @@ int64_t ClientWrapper::Subscribe(
           }
         };
   }
+  return DoSubscribe(tenant_id,
+                     std::move(namespace_id),
+                     std::move(topic_name),
+                     start_seqno,
+                     std::move(deliver_cb1),
+                     std::move(subscribe_cb));
+}
+
+int64_t ClientWrapper::SubscribeBatched(
+    int32_t tenant_id,
+    std::string namespace_id,
+    std::string topic_name,
+    int64_t start_seqno,
+    std::shared_ptr<MessageBatchReceivedCallback> deliver_cb,
+    std::shared_ptr<SubscribeCallback> subscribe_cb) {
+  rocketspeed::MessageReceivedCallback deliver_cb1 = nullptr;
+  if (deliver_cb) {
+    std::call_once(batch_delivery_started_, [this]() {
+      batch_delivery_ = BatchDelivery::Start(info_log_);
+    });
+    std::shared_ptr<BatchDelivery> batch_delivery = batch_delivery_;
+    deliver_cb1 =
+        [batch_delivery, deliver_cb](std::unique_ptr<MessageReceived>& msg) {
+          batch_delivery->Add(deliver_cb, *msg);
+        };
+  }
+  return DoSubscribe(tenant_id,
+                     std::move(namespace_id),
+                     std::move(topic_name),
+                     start_seqno,
+                     std::move(deliver_cb1),
+                     std::move(subscribe_cb));
+}
+
+int64_t ClientWrapper::DoSubscribe(
+    int32_t tenant_id,
+    std::string namespace_id,
+    std::string topic_name,
+    int64_t start_seqno,
+    rocketspeed::MessageReceivedCallback deliver_cb,
+    std::shared_ptr<SubscribeCallback> subscribe_cb) {
+  auto tenant_id1 = static_cast<rocketspeed::TenantID>(tenant_id);
+  if (tenant_id != tenant_id1) {
+    throw std::runtime_error("TenantID out of range.");
+  }
 
   rocketspeed::SubscribeCallback subscribe_cb1 = nullptr;
   if (subscribe_cb) {
@@ -170,7 +379,7 @@ int64_t ClientWrapper::Subscribe(
                                        std::move(namespace_id),
                                        std::move(topic_name),
                                        ToSequenceNumber(start_seqno),
-                                       std::move(deliver_cb1),
+                                       std::move(deliver_cb),
                                        std::move(subscribe_cb1));
   if (!sub_handle) {
     throw std::runtime_error("Failed to create subscription.");
@@ -257,7 +466,18 @@ std::vector<SubscriptionParameters> ClientWrapper::RestoreSubscriptions() {
 }
 
 void ClientWrapper::Close() {
+  // Unblock client threads waiting for batches to be delivered, then stop
+  // deliveries before stopping the thread delivering batches.
+  if (batch_delivery_) {
+    batch_delivery_->Stop();
+  }
   client_.reset();
+  if (batch_delivery_) {
+    // When closed from a batch callback, the thread is detached and frees the
+    // delivery once the callback returns.
+    batch_delivery_->Join();
+    batch_delivery_.reset();
+  }
   info_log_.reset();
 }
 
@@ -6,12 +6,13 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 
+#include "include/RocketSpeed.h"
 #include "src-gen/djinni/cpp/ClientImpl.hpp"
 
 namespace rocketspeed {
 
-class Client;
 class Logger;
 
 namespace djinni {
@@ -19,8 +20,9 @@ namespace djinni {
 class ClientWrapper : public ClientImpl {
  public:
   ClientWrapper(std::unique_ptr<rocketspeed::Client> client,
-                std::shared_ptr<Logger> info_log)
-      : client_(std::move(client)), info_log_(std::move(info_log)) {}
+                std::shared_ptr<Logger> info_log);
+
+  ~ClientWrapper();
 
   MsgId Publish(int32_t tenant_id,
                 std::string namespace_id,
@@ -36,6 +38,14 @@ class ClientWrapper : public ClientImpl {
                     std::shared_ptr<MessageReceivedCallback> deliver_cb,
                     std::shared_ptr<SubscribeCallback> subscribe_cb) override;
 
+  int64_t SubscribeBatched(
+      int32_t tenant_id,
+      std::string namespace_id,
+      std::string topic_name,
+      int64_t start_seqno,
+      std::shared_ptr<MessageBatchReceivedCallback> deliver_cb,
+      std::shared_ptr<SubscribeCallback> subscribe_cb) override;
+
   int64_t Resubscribe(SubscriptionParameters params,
                       std::shared_ptr<MessageReceivedCallback> deliver_cb,
                       std::shared_ptr<SubscribeCallback> subscribe_cb) override;
@@ -52,6 +62,20 @@ class ClientWrapper : public ClientImpl {
   void Close() override;
 
  private:
+  class BatchDelivery;
+
+  int64_t DoSubscribe(int32_t tenant_id,
+                      std::string namespace_id,
+                      std::string topic_name,
+                      int64_t start_seqno,
+                      rocketspeed::MessageReceivedCallback deliver_cb,
+                      std::shared_ptr<SubscribeCallback> subscribe_cb);
+
+  // Started with the first batched subscription, stopped after the client,
+  // so that it outlives all deliveries.
+  std::once_flag batch_delivery_started_;
+  std::shared_ptr<BatchDelivery> batch_delivery_;
+
   std::unique_ptr<rocketspeed::Client> client_;
   std::shared_ptr<Logger> info_log_;
 };
@@ -6,22 +6,29 @@
 #define __STDC_FORMAT_MACROS
 #include "rocketeer.h"
 
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
-
-#include "external/folly/move_wrapper.h"
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "include/Logger.h"
 #include "include/RocketSpeed.h"
 #include "include/Slice.h"
 #include "include/Status.h"
 #include "include/Types.h"
+#include "src/messages/commands.h"
+#include "src/messages/event_loop.h"
 #include "src/messages/msg_loop.h"
+#include "src/messages/queues.h"
 #include "src/port/Env.h"
+#include "src/port/port.h"
 #include "src/util/common/guid_generator.h"
+#include "src/util/common/heterogeneous_queue.h"
 
 namespace rocketspeed {
 
@@ -37,14 +44,292 @@ RocketeerOptions::RocketeerOptions()
     : env(Env::Default())
     , info_log(std::make_shared<NullLogger>())
     , port(DEFAULT_PORT)
-    , stats_prefix("rocketeer.") {
+    , stats_prefix("rocketeer.")
+    , queue_size(256 * 1024)
+    , send_queue_limit(0) {
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Single producer, single consumer queue of calls to a Rocketeer, from an
+ * application thread to the worker that the Rocketeer runs on. Calls are
+ * stored in place, so that queueing them doesn't allocate, and the worker is
+ * woken up once for all calls queued while it was busy.
+ */
+class RocketeerQueue {
+ public:
+  RocketeerQueue(std::shared_ptr<Logger> info_log, size_t size)
+  : info_log_(std::move(info_log))
+  , queue_(size)
+  , wake_fd_(true, true)
+  , signalled_(false) {
+    assert(wake_fd_.status() == 0);
+  }
+
+  ~RocketeerQueue() {
+    // The worker has stopped, calls left in the queue are discarded.
+    read_event_.reset();
+    queue_.ResetReadThread();
+    while (ReadOne(nullptr)) {
+    }
+    wake_fd_.closefd();
+  }
+
+  /** Starts reading calls on the worker, must be called on its thread. */
+  void Attach(EventLoop* event_loop, Rocketeer* rocketeer) {
+    assert(!read_event_);
+    read_event_ = CreateEventFdReadCallback(
+        event_loop, wake_fd_.readfd(), [this, rocketeer]() {
+          Drain(rocketeer);
+        });
+    read_event_->Enable();
+  }
+
+  bool Deliver(InboundID inbound_id,
+               SequenceNumber seqno,
+               std::string payload,
+               MsgId msg_id) {
+    return Write(
+        Call::kDeliver,
+        DeliverCall{inbound_id, seqno, std::move(payload), msg_id});
+  }
+
+  bool DeliverMulticast(
+      std::vector<std::pair<InboundID, SequenceNumber>> recipients,
+      SharedPayload payload,
+      MsgId msg_id) {
+    return Write(
+        Call::kDeliverMulticast,
+        MulticastCall{std::move(recipients), std::move(payload), msg_id});
+  }
+
+  bool DeliverBatch(std::vector<InboundDelivery> deliveries) {
+    return Write(Call::kDeliverBatch, std::move(deliveries));
+  }
+
+  bool Advance(InboundID inbound_id, SequenceNumber seqno) {
+    return Write(Call::kAdvance, AdvanceCall{inbound_id, seqno});
+  }
+
+  bool Terminate(InboundID inbound_id, MessageUnsubscribe::Reason reason) {
+    return Write(Call::kTerminate, TerminateCall{inbound_id, reason});
+  }
+
+ private:
+  // Tag written before each call.
+  enum class Call : char {
+    kDeliver,
+    kDeliverMulticast,
+    kDeliverBatch,
+    kAdvance,
+    kTerminate,
+  };
+
+  struct DeliverCall {
+    InboundID inbound_id;
+    SequenceNumber seqno;
+    std::string payload;
+    MsgId msg_id;
+  };
+
+  struct MulticastCall {
+    std::vector<std::pair<InboundID, SequenceNumber>> recipients;
+    SharedPayload payload;
+    MsgId msg_id;
+  };
+
+  struct AdvanceCall {
+    InboundID inbound_id;
+    SequenceNumber seqno;
+  };
+
+  struct TerminateCall {
+    InboundID inbound_id;
+    MessageUnsubscribe::Reason reason;
+  };
+
+  template <typename Value>
+  bool Write(Call call, Value&& value) {
+    HeterogeneousQueue::Transaction tx(&queue_);
+    tx.Write(call);
+    tx.Write(std::forward<Value>(value));
+    if (!tx.Commit()) {
+      LOG_WARN(info_log_, "The rocketeer queue is full");
+      return false;
+    }
+    // Only the first call since the worker last looked wakes it up.
+    if (!signalled_.exchange(true, std::memory_order_acq_rel)) {
+      Signal();
+    }
+    return true;
+  }
+
+  void Signal() {
+    if (wake_fd_.write_event(1)) {
+      LOG_ERROR(info_log_,
+                "Error writing a notification to rocketeer eventfd, errno=%d",
+                errno);
+    }
+  }
+
+  void Drain(Rocketeer* rocketeer) {
+    eventfd_t value;
+    wake_fd_.read_event(&value);
+    // Calls queued from now on wake the worker up again. Calls queued before,
+    // which did not, are visible to the reads below.
+    signalled_.exchange(false, std::memory_order_acq_rel);
+    for (size_t i = 0; i < kMaxQueueBatchReadSize; ++i) {
+      if (!ReadOne(rocketeer)) {
+        return;
+      }
+    }
+    // Come back for the rest after other events had their turn.
+    signalled_.store(true, std::memory_order_release);
+    Signal();
+  }
+
+  // Reads a call and invokes it on the rocketeer, or discards it if the
+  // rocketeer is null. Returns false if the queue is empty.
+  bool ReadOne(Rocketeer* rocketeer) {
+    Call call;
+    if (!queue_.Read(&call)) {
+      return false;
+    }
+    switch (call) {
+      case Call::kDeliver: {
+        DeliverCall c;
+        queue_.Read(&c);
+        if (rocketeer &&
+            !rocketeer->Deliver(
+                c.inbound_id, c.seqno, std::move(c.payload), c.msg_id)) {
+          rocketeer->HandleBlocked(c.inbound_id);
+        }
+        break;
+      }
+      case Call::kDeliverMulticast: {
+        MulticastCall c;
+        queue_.Read(&c);
+        if (rocketeer &&
+            !rocketeer->DeliverMulticast(c.recipients, c.payload, c.msg_id)) {
+          std::unordered_set<InboundID> blocked;
+          for (const auto& recipient : c.recipients) {
+            NotifyBlocked(rocketeer, recipient.first, &blocked);
+          }
+        }
+        break;
+      }
+      case Call::kDeliverBatch: {
+        std::vector<InboundDelivery> deliveries;
+        queue_.Read(&deliveries);
+        if (rocketeer && !rocketeer->DeliverBatch(deliveries)) {
+          std::unordered_set<InboundID> blocked;
+          for (const auto& delivery : deliveries) {
+            NotifyBlocked(rocketeer, delivery.inbound_id, &blocked);
+          }
+        }
+        break;
+      }
+      case Call::kAdvance: {
+        AdvanceCall c;
+        queue_.Read(&c);
+        if (rocketeer && !rocketeer->Advance(c.inbound_id, c.seqno)) {
+          rocketeer->HandleBlocked(c.inbound_id);
+        }
+        break;
+      }
+      case Call::kTerminate: {
+        TerminateCall c;
+        queue_.Read(&c);
+        if (rocketeer) {
+          rocketeer->Terminate(c.inbound_id, c.reason);
+        }
+        break;
+      }
+    }
+    return true;
+  }
+
+  // Invokes HandleBlocked once for each subscription of a call that is not
+  // writable, the call only tells that some of them are not.
+  static void NotifyBlocked(Rocketeer* rocketeer,
+                            const InboundID& inbound_id,
+                            std::unordered_set<InboundID>* blocked) {
+    if (!rocketeer->IsWritable(inbound_id) &&
+        blocked->insert(inbound_id).second) {
+      rocketeer->HandleBlocked(inbound_id);
+    }
+  }
+
+  std::shared_ptr<Logger> info_log_;
+  HeterogeneousQueue queue_;
+  port::Eventfd wake_fd_;
+  // Set when the worker has been woken up and has not looked at the queue
+  // since.
+  std::atomic<bool> signalled_;
+  std::unique_ptr<EventCallback> read_event_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Sends a message with the same payload on many subscriptions. The payload
+ * is shared by all of them, and only the head of the message, which differs
+ * between subscriptions, is serialized for each.
+ */
+class MulticastDeliverCommand : public SendCommand {
+ public:
+  MulticastDeliverCommand(SharedPayload payload, MsgId msg_id)
+  : SendCommand(Recipients()), payload_(std::move(payload)), msg_id_(msg_id) {}
+
+  void Add(StreamID stream_id,
+           TenantID tenant_id,
+           SubscriptionID sub_id,
+           SequenceNumber prev_seqno,
+           SequenceNumber seqno) {
+    MutableDestinations()->emplace_back(stream_id, HostId());
+    heads_.push_back(Head{tenant_id, sub_id, prev_seqno, seqno});
+  }
+
+  void GetMessage(std::string* out) override {
+    out->assign(*payload_);
+  }
+
+  void AppendPrefix(size_t index, std::string* out) override {
+    const Head& head = heads_[index];
+    MessageDeliverData data(
+        head.tenant_id, head.sub_id, msg_id_, Slice(*payload_));
+    data.SetSequenceNumbers(head.prev_seqno, head.seqno);
+    data.SerializeHead(out);
+  }
+
+ private:
+  struct Head {
+    TenantID tenant_id;
+    SubscriptionID sub_id;
+    SequenceNumber prev_seqno;
+    SequenceNumber seqno;
+  };
+
+  SharedPayload payload_;
+  MsgId msg_id_;
+  std::vector<Head> heads_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 Rocketeer::Rocketeer() : server_(nullptr) {
 }
 
-void Rocketeer::Deliver(InboundID inbound_id,
+bool Rocketeer::IsWritable(const InboundID& inbound_id) {
+  thread_check_.Check();
+
+  auto event_loop = server_->msg_loop_->GetEventLoop(inbound_id.worker_id);
+  if (event_loop->IsStreamWritable(inbound_id.stream_id)) {
+    return true;
+  }
+  blocked_[inbound_id.stream_id].insert(inbound_id.sub_id);
+  return false;
+}
+
+bool Rocketeer::Deliver(InboundID inbound_id,
                         SequenceNumber seqno,
                         std::string payload,
                         MsgId msg_id) {
@@ -53,26 +338,68 @@ void Rocketeer::Deliver(InboundID inbound_id,
   if (msg_id.Empty()) {
     msg_id = GUIDGenerator::ThreadLocalGUIDGenerator()->Generate();
   }
-  if (auto* sub = Find(inbound_id)) {
-    if (sub->prev_seqno < seqno) {
-      MessageDeliverData data(
-          sub->tenant_id, inbound_id.sub_id, msg_id, payload);
-      data.SetSequenceNumbers(sub->prev_seqno, seqno);
-      sub->prev_seqno = seqno;
-      server_->msg_loop_->SendResponse(
-          data, inbound_id.stream_id, inbound_id.worker_id);
-    } else {
-      stats_->dropped_reordered->Add(1);
-      LOG_WARN(server_->options_.info_log,
-               "Attempted to deliver data at %" PRIu64
-               ", but subscription has previous seqno %" PRIu64,
-               seqno,
-               sub->prev_seqno);
+  SequenceNumber prev_seqno;
+  if (auto* sub = PrepareDelivery(inbound_id, seqno, &prev_seqno)) {
+    MessageDeliverData data(
+        sub->tenant_id, inbound_id.sub_id, msg_id, payload);
+    data.SetSequenceNumbers(prev_seqno, seqno);
+    server_->msg_loop_->SendResponse(
+        data, inbound_id.stream_id, inbound_id.worker_id);
+    return IsWritable(inbound_id);
+  }
+  return true;
+}
+
+bool Rocketeer::DeliverMulticast(
+    const std::vector<std::pair<InboundID, SequenceNumber>>& recipients,
+    const SharedPayload& payload,
+    MsgId msg_id) {
+  thread_check_.Check();
+
+  if (msg_id.Empty()) {
+    msg_id = GUIDGenerator::ThreadLocalGUIDGenerator()->Generate();
+  }
+  std::unique_ptr<MulticastDeliverCommand> command(
+      new MulticastDeliverCommand(payload, msg_id));
+  bool writable = true;
+  for (const auto& recipient : recipients) {
+    writable =
+        AddDelivery(command.get(), recipient.first, recipient.second) &&
+        writable;
+  }
+  SendMulticast(std::move(command));
+  return writable;
+}
+
+bool Rocketeer::DeliverBatch(const std::vector<InboundDelivery>& deliveries) {
+  thread_check_.Check();
+
+  bool writable = true;
+  size_t i = 0;
+  while (i < deliveries.size()) {
+    const InboundDelivery& first = deliveries[i];
+    MsgId msg_id = first.msg_id;
+    if (msg_id.Empty()) {
+      msg_id = GUIDGenerator::ThreadLocalGUIDGenerator()->Generate();
     }
+    // Consecutive deliveries of the same message share a command.
+    std::unique_ptr<MulticastDeliverCommand> command(
+        new MulticastDeliverCommand(first.payload, msg_id));
+    do {
+      writable = AddDelivery(command.get(),
+                             deliveries[i].inbound_id,
+                             deliveries[i].seqno) &&
+                 writable;
+      ++i;
+    } while (i < deliveries.size() &&
+             deliveries[i].payload == first.payload &&
+             deliveries[i].msg_id == first.msg_id);
+    SendMulticast(std::move(command));
   }
+  return writable;
 }
 
-void Rocketeer::Advance(InboundID inbound_id, SequenceNumber seqno) {
+bool Rocketeer::Advance(InboundID inbound_id, SequenceNumber seqno) {
   thread_check_.Check();
 
   if (auto* sub = Find(inbound_id)) {
@@ -83,6 +410,7 @@ void Rocketeer::Advance(InboundID inbound_id, SequenceNumber seqno) {
       sub->prev_seqno = seqno;
       server_->msg_loop_->SendResponse(
           gap, inbound_id.stream_id, inbound_id.worker_id);
+      return IsWritable(inbound_id);
     } else {
       stats_->dropped_reordered->Add(1);
       LOG_WARN(server_->options_.info_log,
@@ -92,6 +420,7 @@ void Rocketeer::Advance(InboundID inbound_id, SequenceNumber seqno) {
                sub->prev_seqno);
     }
   }
+  return true;
 }
 
 void Rocketeer::Terminate(InboundID inbound_id,
@@ -157,28 +486,104 @@ InboundSubscription* Rocketeer::Find(const InboundID& inbound_id) {
   return nullptr;
 }
 
+InboundSubscription* Rocketeer::PrepareDelivery(const InboundID& inbound_id,
+                                                SequenceNumber seqno,
+                                                SequenceNumber* prev_seqno) {
+  auto* sub = Find(inbound_id);
+  if (!sub) {
+    return nullptr;
+  }
+  if (sub->prev_seqno >= seqno) {
+    stats_->dropped_reordered->Add(1);
+    LOG_WARN(server_->options_.info_log,
+             "Attempted to deliver data at %" PRIu64
+             ", but subscription has previous seqno %" PRIu64,
+             seqno,
+             sub->prev_seqno);
+    return nullptr;
+  }
+  *prev_seqno = sub->prev_seqno;
+  sub->prev_seqno = seqno;
+  return sub;
+}
+
+bool Rocketeer::AddDelivery(MulticastDeliverCommand* command,
+                            const InboundID& inbound_id,
+                            SequenceNumber seqno) {
+  assert(static_cast<size_t>(inbound_id.worker_id) == id_);
+  SequenceNumber prev_seqno;
+  if (auto* sub = PrepareDelivery(inbound_id, seqno, &prev_seqno)) {
+    command->Add(inbound_id.stream_id,
+                 sub->tenant_id,
+                 inbound_id.sub_id,
+                 prev_seqno,
+                 seqno);
+    return IsWritable(inbound_id);
+  }
+  return true;
+}
+
+void Rocketeer::SendMulticast(
+    std::unique_ptr<MulticastDeliverCommand> command) {
+  if (command->GetDestinations().empty()) {
+    return;
+  }
+  Status st = server_->msg_loop_->SendCommand(std::move(command),
+                                              static_cast<int>(id_));
+  if (!st.ok()) {
+    LOG_WARN(server_->options_.info_log,
+             "Failed to send multicast delivery: %s",
+             st.ToString().c_str());
+  }
+}
+
 void Rocketeer::Receive(std::unique_ptr<MessageSubscribe> subscribe,
                         StreamID origin) {
   thread_check_.Check();
 
-  SubscriptionID sub_id = subscribe->GetSubID();
-  SequenceNumber start_seqno = subscribe->GetStartSequenceNumber();
+  HandleSubscribe(subscribe->GetTenantID(),
+                  subscribe->GetNamespace(),
+                  subscribe->GetTopicName(),
+                  subscribe->GetStartSequenceNumber(),
+                  subscribe->GetSubID(),
+                  origin);
+}
+
+void Rocketeer::Receive(std::unique_ptr<MessageSubscribeBatch> batch,
+                        StreamID origin) {
+  thread_check_.Check();
+
+  for (const auto& sub : batch->GetSubscriptions()) {
+    HandleSubscribe(batch->GetTenantID(),
+                    sub.namespace_id,
+                    sub.topic_name,
+                    sub.start_seqno,
+                    sub.sub_id,
+                    origin);
+  }
+}
+
+void Rocketeer::HandleSubscribe(TenantID tenant_id,
+                                NamespaceID namespace_id,
+                                Topic topic_name,
+                                SequenceNumber start_seqno,
+                                SubscriptionID sub_id,
+                                StreamID origin) {
   auto result = inbound_subscriptions_[origin].emplace(
       sub_id,
-      InboundSubscription(subscribe->GetTenantID(),
+      InboundSubscription(tenant_id,
                           start_seqno == 0 ? start_seqno : start_seqno - 1));
   if (!result.second) {
     LOG_WARN(server_->options_.info_log,
              "Duplicated subscription stream: %llu, sub_id: %" PRIu64,
              origin,
-             subscribe->GetSubID());
+             sub_id);
     return;
   }
-  // TODO(stupaq) store subscription parameters in a message and move them out
-  SubscriptionParameters params(subscribe->GetTenantID(),
-                                subscribe->GetNamespace(),
-                                subscribe->GetTopicName(),
-                                subscribe->GetStartSequenceNumber());
+  SubscriptionParameters params(tenant_id,
+                                std::move(namespace_id),
+                                std::move(topic_name),
+                                start_seqno);
   HandleNewSubscription(InboundID(origin, sub_id, GetID()), std::move(params));
   stats_->subscribes->Add(1);
   stats_->inbound_subscriptions->Add(1);
@@ -213,6 +618,7 @@ void Rocketeer::Receive(std::unique_ptr<MessageGoodbye> goodbye,
                         StreamID origin) {
   thread_check_.Check();
 
+  blocked_.erase(origin);
   auto it = inbound_subscriptions_.find(origin);
   if (it == inbound_subscriptions_.end()) {
     LOG_WARN(server_->options_.info_log, "Missing stream: %llu", origin);
@@ -227,6 +633,29 @@ void Rocketeer::Receive(std::unique_ptr<MessageGoodbye> goodbye,
   inbound_subscriptions_.erase(it);
 }
 
+void Rocketeer::HandleStreamWritable(StreamID stream_id) {
+  thread_check_.Check();
+
+  auto it = blocked_.find(stream_id);
+  if (it == blocked_.end()) {
+    return;
+  }
+  std::unordered_set<SubscriptionID> blocked;
+  blocked.swap(it->second);
+  blocked_.erase(it);
+
+  // Subscriptions might have been terminated in the meantime.
+  auto it1 = inbound_subscriptions_.find(stream_id);
+  if (it1 == inbound_subscriptions_.end()) {
+    return;
+  }
+  for (SubscriptionID sub_id : blocked) {
+    if (it1->second.count(sub_id)) {
+      HandleWritable(InboundID(stream_id, sub_id, GetID()));
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 Rocketeer::Stats::Stats(const std::string& prefix) {
   subscribes = all.AddCounter(prefix + "subscribes");
@@ -255,12 +684,20 @@ size_t RocketeerServer::Register(Rocketeer* rocketeer) {
 }
 
 Status RocketeerServer::Start() {
+  MsgLoop::Options msg_loop_options;
+  msg_loop_options.event_loop.send_queue_limit = options_.send_queue_limit;
+  msg_loop_options.event_loop.stream_writable_callback = [this](
+      StreamID stream_id) {
+    auto worker_id = msg_loop_->GetThreadWorkerIndex();
+    rocketeers_[worker_id]->HandleStreamWritable(stream_id);
+  };
   msg_loop_.reset(new MsgLoop(options_.env,
                               EnvOptions(),
                               options_.port,
                               static_cast<int>(rocketeers_.size()),
                               options_.info_log,
-                              "rocketeer"));
+                              "rocketeer",
+                              std::move(msg_loop_options)));
 
   Status st = msg_loop_->Initialize();
   if (!st.ok()) {
@@ -269,10 +706,17 @@ Status RocketeerServer::Start() {
 
   msg_loop_->RegisterCallbacks({
       {MessageType::mSubscribe, CreateCallback<MessageSubscribe>()},
+      {MessageType::mSubscribeBatch, CreateCallback<MessageSubscribeBatch>()},
       {MessageType::mUnsubscribe, CreateCallback<MessageUnsubscribe>()},
       {MessageType::mGoodbye, CreateCallback<MessageGoodbye>()},
   });
 
+  worker_queues_.resize(rocketeers_.size());
+  for (size_t i = 0; i < rocketeers_.size(); ++i) {
+    thread_queues_.emplace_back(new ThreadLocalQueue(
+        []() { return new std::shared_ptr<RocketeerQueue>(); }));
+  }
+
   msg_loop_thread_.reset(
       new MsgLoopThread(options_.env, msg_loop_.get(), "rocketeer"));
   return Status::OK();
@@ -286,38 +730,80 @@ bool RocketeerServer::Deliver(InboundID inbound_id,
                               SequenceNumber seqno,
                               std::string payload,
                               MsgId msg_id) {
-  auto moved_payload = folly::makeMoveWrapper(std::move(payload));
-  auto command = [this, inbound_id, seqno, moved_payload, msg_id]() mutable {
-    rocketeers_[inbound_id.worker_id]->Deliver(
-        inbound_id, seqno, moved_payload.move(), msg_id);
-  };
-  return msg_loop_->SendCommand(std::unique_ptr<Command>(
-                                    MakeExecuteCommand(std::move(command))),
-                                inbound_id.worker_id)
-      .ok();
+  auto queue = GetThreadLocalQueue(inbound_id.worker_id);
+  return queue &&
+         queue->Deliver(inbound_id, seqno, std::move(payload), msg_id);
+}
+
+bool RocketeerServer::DeliverMulticast(
+    const std::vector<std::pair<InboundID, SequenceNumber>>& recipients,
+    SharedPayload payload,
+    MsgId msg_id) {
+  // All workers must send the same message ID.
+  if (msg_id.Empty()) {
+    msg_id = GUIDGenerator::ThreadLocalGUIDGenerator()->Generate();
+  }
+  std::vector<std::vector<std::pair<InboundID, SequenceNumber>>> per_worker(
+      rocketeers_.size());
+  for (const auto& recipient : recipients) {
+    per_worker[recipient.first.worker_id].push_back(recipient);
+  }
+
+  bool all_sent = true;
+  for (size_t worker_id = 0; worker_id < per_worker.size(); ++worker_id) {
+    if (per_worker[worker_id].empty()) {
+      continue;
+    }
+    auto queue = GetThreadLocalQueue(worker_id);
+    all_sent = queue &&
+               queue->DeliverMulticast(
+                   std::move(per_worker[worker_id]), payload, msg_id) &&
+               all_sent;
+  }
+  return all_sent;
+}
+
+bool RocketeerServer::DeliverBatch(std::vector<InboundDelivery> deliveries) {
+  // Deliveries without an ID get one here, so that deliveries of the same
+  // message are recognised as such on all workers.
+  MsgId msg_id;
+  const std::string* payload = nullptr;
+  std::vector<std::vector<InboundDelivery>> per_worker(rocketeers_.size());
+  for (auto& delivery : deliveries) {
+    if (delivery.msg_id.Empty()) {
+      if (delivery.payload.get() != payload || msg_id.Empty()) {
+        payload = delivery.payload.get();
+        msg_id = GUIDGenerator::ThreadLocalGUIDGenerator()->Generate();
+      }
+      delivery.msg_id = msg_id;
+    } else {
+      payload = nullptr;
+    }
+    per_worker[delivery.inbound_id.worker_id].push_back(std::move(delivery));
+  }
+
+  bool all_sent = true;
+  for (size_t worker_id = 0; worker_id < per_worker.size(); ++worker_id) {
+    if (per_worker[worker_id].empty()) {
+      continue;
+    }
+    auto queue = GetThreadLocalQueue(worker_id);
+    all_sent = queue &&
+               queue->DeliverBatch(std::move(per_worker[worker_id])) &&
+               all_sent;
+  }
+  return all_sent;
 }
 
 bool RocketeerServer::Advance(InboundID inbound_id, SequenceNumber seqno) {
-  auto command = std::bind(&Rocketeer::Advance,
-                           rocketeers_[inbound_id.worker_id],
-                           inbound_id,
-                           seqno);
-  return msg_loop_->SendCommand(std::unique_ptr<Command>(
-                                    MakeExecuteCommand(std::move(command))),
-                                inbound_id.worker_id)
-      .ok();
+  auto queue = GetThreadLocalQueue(inbound_id.worker_id);
+  return queue && queue->Advance(inbound_id, seqno);
 }
 
 bool RocketeerServer::Terminate(InboundID inbound_id,
                                 MessageUnsubscribe::Reason reason) {
-  auto command = std::bind(&Rocketeer::Terminate,
-                           rocketeers_[inbound_id.worker_id],
-                           inbound_id,
-                           reason);
-  return msg_loop_->SendCommand(std::unique_ptr<Command>(
-                                    MakeExecuteCommand(std::move(command))),
-                                inbound_id.worker_id)
-      .ok();
+  auto queue = GetThreadLocalQueue(inbound_id.worker_id);
+  return queue && queue->Terminate(inbound_id, reason);
 }
 
 Statistics RocketeerServer::GetStatisticsSync() {
@@ -327,6 +813,35 @@ Statistics RocketeerServer::GetStatisticsSync() {
   return stats;
 }
 
+RocketeerQueue* RocketeerServer::GetThreadLocalQueue(size_t worker_id) {
+  assert(worker_id < thread_queues_.size());
+  std::shared_ptr<RocketeerQueue>& queue =
+      thread_queues_[worker_id]->GetThreadLocal();
+  if (!queue) {
+    auto created =
+        std::make_shared<RocketeerQueue>(options_.info_log, options_.queue_size);
+    // The worker keeps the queue, so that calls queued by a thread are handled
+    // even after the thread exits.
+    auto attach = [this, worker_id, created]() {
+      created->Attach(msg_loop_->GetEventLoop(static_cast<int>(worker_id)),
+                      rocketeers_[worker_id]);
+      worker_queues_[worker_id].push_back(created);
+    };
+    Status st = msg_loop_->SendCommand(
+        std::unique_ptr<Command>(MakeExecuteCommand(std::move(attach))),
+        static_cast<int>(worker_id));
+    if (!st.ok()) {
+      LOG_WARN(options_.info_log,
+               "Failed to attach rocketeer queue to worker %zu: %s",
+               worker_id,
+               st.ToString().c_str());
+      return nullptr;
+    }
+    queue = std::move(created);
+  }
+  return queue.get();
+}
+
 template <typename Msg>
 std::function<void(std::unique_ptr<Message>, StreamID)>
 RocketeerServer::CreateCallback() {
@@ -9,6 +9,8 @@
 #include <limits>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "include/Types.h"
@@ -18,13 +20,16 @@
 #include "src/util/common/hash.h"
 #include "src/util/common/statistics.h"
 #include "src/util/common/thread_check.h"
+#include "src/util/common/thread_local.h"
 
 namespace rocketspeed {
 
 class MsgLoop;
 class MsgLoopThread;
 class Logger;
+class MulticastDeliverCommand;
 class Rocketeer;
+class RocketeerQueue;
 class RocketeerServer;
 
 /** Uniquely identifies subscription within RocketeerServer. */
@@ -54,6 +59,26 @@ class InboundID {
   std::string ToString() const;
 };
 
+/** Payload shared by many deliveries, which is serialized only once. */
+typedef std::shared_ptr<const std::string> SharedPayload;
+
+/** One delivery of a batch, see RocketeerServer::DeliverBatch. */
+struct InboundDelivery {
+  InboundDelivery(InboundID _inbound_id,
+                  SequenceNumber _seqno,
+                  SharedPayload _payload,
+                  MsgId _msg_id = MsgId())
+      : inbound_id(_inbound_id)
+      , seqno(_seqno)
+      , payload(std::move(_payload))
+      , msg_id(_msg_id) {}
+
+  InboundID inbound_id;
+  SequenceNumber seqno;
+  SharedPayload payload;
+  MsgId msg_id;
+};
+
 class InboundSubscription {
  public:
   InboundSubscription(TenantID _tenant_id, SequenceNumber _prev_seqno)
@@ -81,6 +106,20 @@ struct RocketeerOptions {
 
   /** Stats prefix, defaults to "rocketeer.". */
   std::string stats_prefix;
+
+  /**
+   * Size in bytes of the queue from each application thread to each worker,
+   * which holds calls of the thread-safe RocketeerServer methods. Defaults to
+   * 256KB.
+   */
+  size_t queue_size;
+
+  /**
+   * Bytes waiting to be sent to a subscriber, above which sending on its
+   * subscriptions returns false, see Rocketeer::HandleWritable. Defaults to
+   * 0, which disables the limit.
+   */
+  size_t send_queue_limit;
 };
 
 class Rocketeer {
@@ -112,6 +151,40 @@ class Rocketeer {
   virtual void HandleTermination(InboundID inbound_id,
                                  TerminationSource source) = 0;
 
+  /**
+   * Notifies that a subscription, for which sending returned false, has
+   * drained below RocketeerOptions::send_queue_limit. Implementations that
+   * paused producing for the subscription may resume.
+   * This method is guarenteed to always be called on the same thread.
+   *
+   * @param inbound_id ID of the subscription.
+   */
+  virtual void HandleWritable(InboundID inbound_id) {}
+
+  /**
+   * Notifies that a call made through RocketeerServer, such as
+   * RocketeerServer::Deliver, found the subscription over
+   * RocketeerOptions::send_queue_limit. This is the counterpart of false
+   * returned by the Rocketeer methods, which the thread-safe versions cannot
+   * return. Implementations should hold back further messages on the
+   * subscription until HandleWritable is invoked for it.
+   * This method is guarenteed to always be called on the same thread.
+   *
+   * @param inbound_id ID of the subscription.
+   */
+  virtual void HandleBlocked(InboundID inbound_id) {}
+
+  /**
+   * Checks whether messages sent on a subscription would be queued behind
+   * more than RocketeerOptions::send_queue_limit bytes. If so, HandleWritable
+   * will be invoked for the subscription once it drains.
+   * This method needs to be called on the thread this instance runs on.
+   *
+   * @param inbound_id ID of the subscription.
+   * @return true iff the subscription is writable.
+   */
+  bool IsWritable(const InboundID& inbound_id);
+
   /**
    * Sends a message on given subscription.
    * This method needs to be called on the thread this instance runs on.
@@ -120,12 +193,43 @@ class Rocketeer {
    * @param seqno Sequence number of the message.
    * @param payload Payload of the message.
    * @param msg_id The ID of the message.
+   * @return false iff the subscription is over the send queue limit, the
+   *         message is sent anyway, but the caller should hold back further
+   *         messages until HandleWritable is invoked.
    */
-  void Deliver(InboundID inbound_id,
+  bool Deliver(InboundID inbound_id,
                SequenceNumber seqno,
                std::string payload,
                MsgId msg_id = MsgId());
 
+  /**
+   * Sends the same message on many subscriptions. The payload is serialized
+   * once, and only the per-subscription part of each message is serialized
+   * separately.
+   * This method needs to be called on the thread this instance runs on.
+   *
+   * @param recipients Subscriptions and sequence numbers to send message on.
+   * @param payload Payload of the message.
+   * @param msg_id The ID of the message, the same for all subscriptions.
+   * @return false iff any of the subscriptions is over the send queue limit,
+   *         as with Deliver.
+   */
+  bool DeliverMulticast(
+      const std::vector<std::pair<InboundID, SequenceNumber>>& recipients,
+      const SharedPayload& payload,
+      MsgId msg_id = MsgId());
+
+  /**
+   * Sends a batch of messages. Consecutive deliveries of the same payload
+   * and message ID are sent as with DeliverMulticast.
+   * This method needs to be called on the thread this instance runs on.
+   *
+   * @param deliveries Messages to send, in order.
+   * @return false iff any of the subscriptions is over the send queue limit,
+   *         as with Deliver.
+   */
+  bool DeliverBatch(const std::vector<InboundDelivery>& deliveries);
+
   /**
    * Advances next expected sequence number on a subscription without sending
    * data on it. Client might be notified, so that the next time it
@@ -136,9 +240,10 @@ class Rocketeer {
    * @param inbound_id ID of the subscription to advance.
    * @param seqno The subscription will be advanced, so that it expects the next
    *              sequence number.
-   * @return true iff operation was successfully sheduled.
+   * @return false iff the subscription is over the send queue limit, as with
+   *         Deliver.
    */
-  void Advance(InboundID inbound_id, SequenceNumber seqno);
+  bool Advance(InboundID inbound_id, SequenceNumber seqno);
 
   /**
    * Terminates given subscription.
@@ -146,7 +251,6 @@ class Rocketeer {
    *
    * @param inbound_id ID of the subscription to terminate.
    * @param reason A reason why this subscription was terminated.
-   * @return true iff operation was successfully sheduled.
    */
   void Terminate(InboundID inbound_id, MessageUnsubscribe::Reason reason);
 
@@ -180,6 +284,8 @@ class Rocketeer {
   using SubscriptionsOnStream =
       std::unordered_map<SubscriptionID, InboundSubscription>;
   std::unordered_map<StreamID, SubscriptionsOnStream> inbound_subscriptions_;
+  // Subscriptions found not writable, to be notified once their stream is.
+  std::unordered_map<StreamID, std::unordered_set<SubscriptionID>> blocked_;
 
   void Initialize(RocketeerServer* server, size_t id);
 
@@ -187,12 +293,38 @@ class Rocketeer {
 
   InboundSubscription* Find(const InboundID& inbound_id);
 
+  // Advances the subscription to seqno for sending a message on it, and
+  // stores its previous seqno. Returns null if the subscription is missing
+  // or seqno is not after the previous one.
+  InboundSubscription* PrepareDelivery(const InboundID& inbound_id,
+                                       SequenceNumber seqno,
+                                       SequenceNumber* prev_seqno);
+
+  // Adds a subscription to a multicast delivery, if the message can be sent
+  // on it. Returns false iff the subscription is not writable.
+  bool AddDelivery(MulticastDeliverCommand* command,
+                   const InboundID& inbound_id,
+                   SequenceNumber seqno);
+
+  void SendMulticast(std::unique_ptr<MulticastDeliverCommand> command);
+
   void Receive(std::unique_ptr<MessageSubscribe> subscribe, StreamID origin);
 
+  void Receive(std::unique_ptr<MessageSubscribeBatch> batch, StreamID origin);
+
+  void HandleSubscribe(TenantID tenant_id,
+                       NamespaceID namespace_id,
+                       Topic topic_name,
+                       SequenceNumber start_seqno,
+                       SubscriptionID sub_id,
+                       StreamID origin);
+
   void Receive(std::unique_ptr<MessageUnsubscribe> unsubscribe,
                StreamID origin);
 
   void Receive(std::unique_ptr<MessageGoodbye> goodbye, StreamID origin);
+
+  void HandleStreamWritable(StreamID stream_id);
 };
 
 class RocketeerServer {
@@ -222,7 +354,9 @@ class RocketeerServer {
   void Stop();
 
   /**
-   * A thread-safe version of Rocketeer::Deliver.
+   * A thread-safe version of Rocketeer::Deliver. Whether the subscription is
+   * over the send queue limit is only known once the call runs on the worker,
+   * which then invokes Rocketeer::HandleBlocked for it.
    *
    * @return true iff operation was successfully sheduled.
    */
@@ -232,13 +366,37 @@ class RocketeerServer {
                MsgId msg_id = MsgId());
 
   /**
-   * A thread-safe version of Rocketeer::Advance.
+   * A thread-safe version of Rocketeer::DeliverMulticast. Subscriptions are
+   * grouped by worker, with a single command per worker.
+   * Rocketeer::HandleBlocked is invoked for every subscription found over the
+   * send queue limit.
+   *
+   * @return true iff operation was successfully sheduled on all workers.
+   */
+  bool DeliverMulticast(
+      const std::vector<std::pair<InboundID, SequenceNumber>>& recipients,
+      SharedPayload payload,
+      MsgId msg_id = MsgId());
+
+  /**
+   * A thread-safe version of Rocketeer::DeliverBatch. Deliveries are
+   * grouped by worker, with a single command per worker.
+   * Rocketeer::HandleBlocked is invoked for every subscription found over the
+   * send queue limit.
+   *
+   * @return true iff operation was successfully sheduled on all workers.
+   */
+  bool DeliverBatch(std::vector<InboundDelivery> deliveries);
+
+  /**
+   * A thread-safe version of Rocketeer::Advance. Rocketeer::HandleBlocked is
+   * invoked if the subscription is found over the send queue limit.
    *
    * @return true iff operation was successfully sheduled.
    */
   bool Advance(InboundID inbound_id, SequenceNumber seqno);
 
-  /** A thread-safe version of Rocketeer::.
+  /** A thread-safe version of Rocketeer::Terminate.
    *
    * @return true iff operation was successfully sheduled.
    */
@@ -257,8 +415,20 @@ class RocketeerServer {
   std::unique_ptr<MsgLoopThread> msg_loop_thread_;
   std::vector<Rocketeer*> rocketeers_;
 
+  typedef ThreadLocalObject<std::shared_ptr<RocketeerQueue>> ThreadLocalQueue;
+
+  // Queues from application threads to each worker, created on first use
+  // by each thread.
+  std::vector<std::unique_ptr<ThreadLocalQueue>> thread_queues_;
+  // Queues attached to each worker, accessed only on the worker thread.
+  std::vector<std::vector<std::shared_ptr<RocketeerQueue>>> worker_queues_;
+
   template <typename M>
   std::function<void(std::unique_ptr<Message>, StreamID)> CreateCallback();
+
+  // Returns the queue from this thread to the worker, or null if it could not
+  // be attached to the worker.
+  RocketeerQueue* GetThreadLocalQueue(size_t worker_id);
 };
 
 }  // namespace rocketspeed
@@ -5,8 +5,16 @@
 //
 #define __STDC_FORMAT_MACROS
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "include/RocketSpeed.h"
 #include "src/engine/rocketeer.h"
@@ -23,7 +31,11 @@ class RocketeerTest {
   RocketeerTest()
   : positive_timeout(1000), negative_timeout(100), env_(Env::Default()) {
     ASSERT_OK(test::CreateLogger(env_, "RocketeerTest", &info_log_));
-    RocketeerOptions options;
+    ResetServer(RocketeerOptions());
+  }
+
+  void ResetServer(RocketeerOptions options) {
+    server_.reset();
     options.info_log = info_log_;
     options.env = env_;
     options.port = 5880;
@@ -128,6 +140,9 @@ TEST(RocketeerTest, SubscribeUnsubscribe) {
   ASSERT_OK(client.msg_loop->SendRequest(unsubscribe, &socket, 0));
 
   ASSERT_TRUE(rocketeer.terminate_sem_.TimedWait(positive_timeout));
+
+  // The rocketeer must not receive goodbyes after it is destroyed.
+  server_->Stop();
 }
 
 struct SubscribeTerminate : public Rocketeer {
@@ -173,6 +188,410 @@ TEST(RocketeerTest, SubscribeTerminate) {
   ASSERT_TRUE(unsubscribe_sem.TimedWait(positive_timeout));
   // Rocketeer should also be called.
   ASSERT_TRUE(rocketeer.terminate_sem_.TimedWait(positive_timeout));
+
+  // The rocketeer must not receive goodbyes after it is destroyed.
+  server_->Stop();
+}
+
+struct MulticastRocketeer : public Rocketeer {
+  std::mutex mutex_;
+  std::vector<InboundID> inbound_ids_;
+  port::Semaphore subscribe_sem_;
+
+  void HandleNewSubscription(InboundID inbound_id,
+                             SubscriptionParameters params) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      inbound_ids_.push_back(inbound_id);
+    }
+    subscribe_sem_.Post();
+  }
+
+  void HandleTermination(InboundID inbound_id, TerminationSource source) {}
+};
+
+TEST(RocketeerTest, DeliverMulticastAndBatch) {
+  MulticastRocketeer rocketeer;
+  server_->Register(&rocketeer);
+  ASSERT_OK(server_->Start());
+
+  struct Received {
+    StreamID stream_id;
+    SubscriptionID sub_id;
+    SequenceNumber prev_seqno;
+    SequenceNumber seqno;
+    std::string payload;
+    MsgId msg_id;
+  };
+  std::mutex received_mutex;
+  std::vector<Received> received;
+  port::Semaphore deliver_sem;
+  auto client = MockClient({
+      {MessageType::mDeliverData,
+       [&](std::unique_ptr<Message> msg, StreamID stream_id) {
+         auto data = static_cast<MessageDeliverData*>(msg.get());
+         {
+           std::lock_guard<std::mutex> lock(received_mutex);
+           received.push_back(Received{stream_id,
+                                       data->GetSubID(),
+                                       data->GetPrevSequenceNumber(),
+                                       data->GetSequenceNumber(),
+                                       data->GetPayload().ToString(),
+                                       data->GetMessageID()});
+         }
+         deliver_sem.Post();
+       }},
+  });
+  // Two streams, with two and one subscription.
+  auto socket1 = client.msg_loop->CreateOutboundStream(server_addr_, 0);
+  auto socket2 = client.msg_loop->CreateOutboundStream(server_addr_, 0);
+  for (SubscriptionID sub_id : {1, 2}) {
+    MessageSubscribe subscribe(
+        GuestTenant, GuestNamespace, "DeliverMulticast", 101, sub_id);
+    ASSERT_OK(client.msg_loop->SendRequest(subscribe, &socket1, 0));
+  }
+  MessageSubscribe subscribe(
+      GuestTenant, GuestNamespace, "DeliverMulticast", 101, 3);
+  ASSERT_OK(client.msg_loop->SendRequest(subscribe, &socket2, 0));
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(rocketeer.subscribe_sem_.TimedWait(positive_timeout));
+  }
+  std::vector<InboundID> ids;
+  {
+    std::lock_guard<std::mutex> lock(rocketeer.mutex_);
+    ids = rocketeer.inbound_ids_;
+  }
+  std::sort(ids.begin(), ids.end(), [](const InboundID& a, const InboundID& b) {
+    return a.sub_id < b.sub_id;
+  });
+
+  // The same message on all subscriptions.
+  auto payload = std::make_shared<const std::string>("multicast");
+  ASSERT_TRUE(server_->DeliverMulticast(
+      {{ids[0], 101}, {ids[1], 101}, {ids[2], 101}}, payload));
+  // A batch of two messages, and an empty message on one subscription.
+  auto payload1 = std::make_shared<const std::string>("batch1");
+  auto payload2 = std::make_shared<const std::string>("batch2");
+  auto empty = std::make_shared<const std::string>();
+  std::vector<InboundDelivery> batch;
+  batch.emplace_back(ids[0], 102, payload1);
+  batch.emplace_back(ids[1], 102, payload1);
+  batch.emplace_back(ids[2], 102, payload2);
+  batch.emplace_back(ids[0], 103, empty);
+  // Out of order delivery is dropped.
+  batch.emplace_back(ids[1], 102, payload2);
+  ASSERT_TRUE(server_->DeliverBatch(std::move(batch)));
+
+  for (int i = 0; i < 7; ++i) {
+    ASSERT_TRUE(deliver_sem.TimedWait(positive_timeout));
+  }
+  ASSERT_TRUE(!deliver_sem.TimedWait(negative_timeout));
+
+  std::lock_guard<std::mutex> lock(received_mutex);
+  // Messages on each subscription arrive in order.
+  auto find = [&](SubscriptionID sub_id, size_t nth) -> const Received& {
+    for (const auto& r : received) {
+      if (r.sub_id == sub_id && nth-- == 0) {
+        return r;
+      }
+    }
+    ASSERT_TRUE(false);
+    return received.front();
+  };
+  for (SubscriptionID sub_id : {1, 2, 3}) {
+    const Received& r = find(sub_id, 0);
+    ASSERT_EQ(r.payload, "multicast");
+    ASSERT_EQ(r.prev_seqno, 100U);
+    ASSERT_EQ(r.seqno, 101U);
+    ASSERT_TRUE(r.msg_id == find(1, 0).msg_id);
+  }
+  ASSERT_TRUE(find(1, 0).stream_id == find(2, 0).stream_id);
+  ASSERT_TRUE(find(1, 0).stream_id != find(3, 0).stream_id);
+
+  ASSERT_EQ(find(1, 1).payload, "batch1");
+  ASSERT_EQ(find(2, 1).payload, "batch1");
+  ASSERT_EQ(find(3, 1).payload, "batch2");
+  for (SubscriptionID sub_id : {1, 2, 3}) {
+    ASSERT_EQ(find(sub_id, 1).prev_seqno, 101U);
+    ASSERT_EQ(find(sub_id, 1).seqno, 102U);
+  }
+  ASSERT_TRUE(find(1, 1).msg_id == find(2, 1).msg_id);
+  ASSERT_TRUE(!(find(1, 1).msg_id == find(3, 1).msg_id));
+  ASSERT_TRUE(!(find(1, 1).msg_id == find(1, 0).msg_id));
+
+  ASSERT_EQ(find(1, 2).payload, "");
+  ASSERT_EQ(find(1, 2).prev_seqno, 102U);
+  ASSERT_EQ(find(1, 2).seqno, 103U);
+
+  // The rocketeer must not receive goodbyes after it is destroyed.
+  server_->Stop();
+}
+
+TEST(RocketeerTest, DeliverFromManyThreads) {
+  MulticastRocketeer rocketeer;
+  server_->Register(&rocketeer);
+  ASSERT_OK(server_->Start());
+
+  // Each thread delivers on one subscription, and each message must arrive
+  // in order of the calls, whichever method was used.
+  const SequenceNumber kLast = 100 + 3000;
+  std::mutex received_mutex;
+  std::map<SubscriptionID, SequenceNumber> last_seqno;
+  bool in_order = true;
+  port::Semaphore done_sem;
+  auto receive = [&](const MessageDeliver* deliver) {
+    std::lock_guard<std::mutex> lock(received_mutex);
+    SequenceNumber& last = last_seqno[deliver->GetSubID()];
+    in_order = in_order && deliver->GetPrevSequenceNumber() == last;
+    last = deliver->GetSequenceNumber();
+    if (last == kLast) {
+      done_sem.Post();
+    }
+  };
+  auto client = MockClient({
+      {MessageType::mDeliverData,
+       [&](std::unique_ptr<Message> msg, StreamID stream_id) {
+         receive(static_cast<MessageDeliver*>(msg.get()));
+       }},
+      {MessageType::mDeliverGap,
+       [&](std::unique_ptr<Message> msg, StreamID stream_id) {
+         receive(static_cast<MessageDeliver*>(msg.get()));
+       }},
+  });
+  auto socket = client.msg_loop->CreateOutboundStream(server_addr_, 0);
+  for (SubscriptionID sub_id : {1, 2}) {
+    last_seqno[sub_id] = 100;
+    MessageSubscribe subscribe(
+        GuestTenant, GuestNamespace, "DeliverFromManyThreads", 101, sub_id);
+    ASSERT_OK(client.msg_loop->SendRequest(subscribe, &socket, 0));
+    ASSERT_TRUE(rocketeer.subscribe_sem_.TimedWait(positive_timeout));
+  }
+  std::vector<InboundID> ids;
+  {
+    std::lock_guard<std::mutex> lock(rocketeer.mutex_);
+    ids = rocketeer.inbound_ids_;
+  }
+
+  std::vector<std::thread> threads;
+  for (const InboundID& id : ids) {
+    threads.emplace_back([this, id, kLast]() {
+      auto payload = std::make_shared<const std::string>("batch");
+      for (SequenceNumber seqno = 101; seqno <= kLast; ++seqno) {
+        // Retry while the queue is full.
+        for (;;) {
+          bool ok;
+          if (seqno % 3 == 0) {
+            ok = server_->Advance(id, seqno);
+          } else if (seqno % 3 == 1) {
+            ok = server_->Deliver(id, seqno, "deliver");
+          } else {
+            std::vector<InboundDelivery> batch;
+            batch.emplace_back(id, seqno, payload);
+            ok = server_->DeliverBatch(std::move(batch));
+          }
+          if (ok) {
+            break;
+          }
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_TRUE(done_sem.TimedWait(std::chrono::seconds(10)));
+  ASSERT_TRUE(done_sem.TimedWait(std::chrono::seconds(10)));
+  {
+    std::lock_guard<std::mutex> lock(received_mutex);
+    ASSERT_TRUE(in_order);
+    ASSERT_EQ(last_seqno[1], kLast);
+    ASSERT_EQ(last_seqno[2], kLast);
+  }
+
+  // The rocketeer must not receive goodbyes after it is destroyed.
+  server_->Stop();
+}
+
+struct SlowSubscriber : public Rocketeer {
+  InboundID inbound_id_;
+  port::Semaphore subscribe_sem_;
+  port::Semaphore blocked_sem_;
+  port::Semaphore writable_sem_;
+  SequenceNumber seqno_ = 0;
+  bool blocked_ = false;
+
+  void HandleNewSubscription(InboundID inbound_id,
+                             SubscriptionParameters params) {
+    inbound_id_ = inbound_id;
+    seqno_ = params.start_seqno;
+    subscribe_sem_.Post();
+  }
+
+  void HandleTermination(InboundID inbound_id, TerminationSource source) {}
+
+  void HandleWritable(InboundID inbound_id) {
+    ASSERT_TRUE(inbound_id == inbound_id_);
+    ASSERT_TRUE(blocked_);
+    blocked_ = false;
+    writable_sem_.Post();
+  }
+
+  // Delivers messages until the subscription is not writable.
+  void Produce() {
+    for (int i = 0; i < 100 && !blocked_; ++i) {
+      blocked_ = !Deliver(inbound_id_, seqno_++, std::string(10000, 'x'));
+    }
+    if (blocked_) {
+      blocked_sem_.Post();
+    }
+  }
+};
+
+TEST(RocketeerTest, SlowSubscriber) {
+  RocketeerOptions options;
+  options.send_queue_limit = 64 * 1024;
+  ResetServer(std::move(options));
+  SlowSubscriber rocketeer;
+  server_->Register(&rocketeer);
+  ASSERT_OK(server_->Start());
+
+  // The subscriber stops reading after the first message.
+  port::Semaphore reading_sem;
+  std::atomic<int> received(0);
+  auto client = MockClient({
+      {MessageType::mDeliverData,
+       [&](std::unique_ptr<Message> msg, StreamID stream_id) {
+         if (received++ == 0) {
+           reading_sem.Wait();
+         }
+       }},
+  });
+  auto socket = client.msg_loop->CreateOutboundStream(server_addr_, 0);
+  MessageSubscribe subscribe(
+      GuestTenant, GuestNamespace, "SlowSubscriber", 1, 1);
+  ASSERT_OK(client.msg_loop->SendRequest(subscribe, &socket, 0));
+  ASSERT_TRUE(rocketeer.subscribe_sem_.TimedWait(positive_timeout));
+
+  // Produce until the subscription is not writable, bounding the amount of
+  // data in case the limit is not enforced.
+  auto produce = [&]() {
+    std::unique_ptr<Command> command(
+        MakeExecuteCommand([&]() { rocketeer.Produce(); }));
+    ASSERT_OK(server_->GetMsgLoop()->SendCommand(std::move(command), 0));
+  };
+  bool blocked = false;
+  for (int i = 0; i < 100 && !blocked; ++i) {
+    produce();
+    blocked = rocketeer.blocked_sem_.TimedWait(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(blocked);
+
+  // Once the subscriber catches up, the subscription is writable again.
+  reading_sem.Post();
+  ASSERT_TRUE(rocketeer.writable_sem_.TimedWait(positive_timeout));
+
+  // Nothing was dropped.
+  SequenceNumber produced = 0;
+  port::Semaphore produced_sem;
+  std::unique_ptr<Command> command(MakeExecuteCommand([&]() {
+    rocketeer.Produce();
+    produced = rocketeer.seqno_ - 1;
+    produced_sem.Post();
+  }));
+  ASSERT_OK(server_->GetMsgLoop()->SendCommand(std::move(command), 0));
+  ASSERT_TRUE(produced_sem.TimedWait(positive_timeout));
+  auto deadline = TestClock::now() + std::chrono::seconds(5);
+  while (received.load() < static_cast<int>(produced) &&
+         TestClock::now() < deadline) {
+    env_->SleepForMicroseconds(1000);
+  }
+  ASSERT_EQ(received.load(), static_cast<int>(produced));
+
+  // The rocketeer must not receive goodbyes after it is destroyed.
+  server_->Stop();
+}
+
+struct BlockedSubscriber : public Rocketeer {
+  InboundID inbound_id_;
+  port::Semaphore subscribe_sem_;
+  port::Semaphore writable_sem_;
+  std::atomic<bool> blocked_{false};
+  std::atomic<int> blocked_count_{0};
+
+  void HandleNewSubscription(InboundID inbound_id,
+                             SubscriptionParameters params) {
+    inbound_id_ = inbound_id;
+    subscribe_sem_.Post();
+  }
+
+  void HandleTermination(InboundID inbound_id, TerminationSource source) {}
+
+  void HandleBlocked(InboundID inbound_id) {
+    ASSERT_TRUE(inbound_id == inbound_id_);
+    blocked_count_++;
+    blocked_ = true;
+  }
+
+  void HandleWritable(InboundID inbound_id) {
+    ASSERT_TRUE(inbound_id == inbound_id_);
+    ASSERT_TRUE(blocked_.load());
+    blocked_ = false;
+    writable_sem_.Post();
+  }
+};
+
+TEST(RocketeerTest, SlowSubscriberThroughServer) {
+  RocketeerOptions options;
+  options.send_queue_limit = 64 * 1024;
+  ResetServer(std::move(options));
+  BlockedSubscriber rocketeer;
+  server_->Register(&rocketeer);
+  ASSERT_OK(server_->Start());
+
+  // The subscriber stops reading after the first message.
+  port::Semaphore reading_sem;
+  std::atomic<int> received(0);
+  auto client = MockClient({
+      {MessageType::mDeliverData,
+       [&](std::unique_ptr<Message> msg, StreamID stream_id) {
+         if (received++ == 0) {
+           reading_sem.Wait();
+         }
+       }},
+  });
+  auto socket = client.msg_loop->CreateOutboundStream(server_addr_, 0);
+  MessageSubscribe subscribe(
+      GuestTenant, GuestNamespace, "SlowSubscriber", 1, 1);
+  ASSERT_OK(client.msg_loop->SendRequest(subscribe, &socket, 0));
+  ASSERT_TRUE(rocketeer.subscribe_sem_.TimedWait(positive_timeout));
+
+  // Deliver from this thread, through the server, until the rocketeer is
+  // told that the subscription is blocked. Alternate single deliveries and
+  // batches, which report blocked subscriptions the same way.
+  const InboundID inbound_id = rocketeer.inbound_id_;
+  auto payload = std::make_shared<std::string>(10000, 'x');
+  SequenceNumber seqno = 1;
+  auto deadline = TestClock::now() + std::chrono::seconds(5);
+  while (!rocketeer.blocked_.load() && TestClock::now() < deadline) {
+    if (seqno % 2) {
+      ASSERT_TRUE(server_->Deliver(inbound_id, seqno++, *payload));
+    } else {
+      ASSERT_TRUE(server_->DeliverBatch(
+          {InboundDelivery(inbound_id, seqno++, payload)}));
+    }
+    env_->SleepForMicroseconds(1000);
+  }
+  ASSERT_TRUE(rocketeer.blocked_.load());
+  ASSERT_GE(rocketeer.blocked_count_.load(), 1);
+
+  // Once the subscriber catches up, the subscription is writable again.
+  reading_sem.Post();
+  ASSERT_TRUE(rocketeer.writable_sem_.TimedWait(positive_timeout));
+
+  // The rocketeer must not receive goodbyes after it is destroyed.
+  server_->Stop();
 }
 
 }  // namespace rocketspeed
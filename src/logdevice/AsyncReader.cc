@@ -7,175 +7,168 @@
 #include "src/logdevice/AsyncReader.h"
 #include "src/logdevice/Common.h"
 #include <assert.h>
+#include <poll.h>
 #include <algorithm>
+#include <chrono>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#include "logdevice/include/Err.h"
 
 namespace facebook { namespace logdevice {
 
-// Version of the LogDevice DataRecord that frees the payload when done.
-// The payload is copied into a member string to persist it.
-struct MockDataRecord : public DataRecord {
- public:
-  MockDataRecord(logid_t logid,
-                 const Payload& payload,
-                 lsn_t lsn,
-                 std::chrono::milliseconds timestamp)
-  : payload_(reinterpret_cast<const char*>(payload.data), payload.size) {
-    this->payload = Payload(payload_.data(), payload_.size());
-    this->logid = logid;
-    this->attrs.lsn = lsn;
-    this->attrs.timestamp = timestamp;
-  }
+namespace {
+
+// Reader threads also poll for appends from other processes, which are not
+// notified, at this interval.
+const int kScanIntervalMs = 100;
+
+// Interval for redelivering records and gaps refused by the callbacks.
+const int kRetryIntervalMs = 1;
 
- private:
-  std::string payload_;
-};
+// Maximum number of records copied out of the store at once.
+const size_t kReadBatchSize = 256;
 
-AsyncReaderImpl::AsyncReaderImpl()
-: env_(rocketspeed::Env::Default()) {
-  // Start a thread that polls all the logs currently being read.
+}  // namespace
+
+AsyncReaderImpl::AsyncReaderImpl(std::shared_ptr<LogStore> store)
+: store_(std::move(store))
+, wake_fd_(true, true) {
+  // Start a thread that reads the logs whenever they are appended to.
   thread_ = std::thread([this] {
+    bool retry = false;
+    auto last_scan = std::chrono::steady_clock::now();
     while (!done_) {
-      // Wait 100ms before polling again
-      // Allows other threads to lock the mutex, and stops us from busily
-      // hitting the OS for file attrs.
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-      // Check all the logs for data
-      std::lock_guard<std::mutex> lock(mutex_);
-      for (auto& tailer : logs_) {
-        Log& log = tailer.second;
-        std::string fname = LogFilename(tailer.first);
-        uint64_t modTime;
-        // Check if file exists
-        if (!env_->FileExists(fname)) {
-          // Determine whether or not file deleted due to trimming
-          auto lsn = LastSequenceNumber(tailer.first);
-          if (lsn != LSN_INVALID) {
-            // File has been written to at some point and deleted due to
-            // trimming.
-            if (log.from_ <= lsn) {
-              // If the from_ is before or up to final lsn
-              // and the file doesn't exist, then we need to send a gap
-              GapRecord record {
-                tailer.first,
-                GapType::TRIM,
-                log.from_,
-                std::min(log.until_, lsn)
-              };
-              if (gap_cb_) {
-                bool success = gap_cb_(record);
-                (void)success;  // ignore in mock impl.
-                assert(success);
-              }
-            }
-          }
-        } else if (env_->GetFileModificationTime(fname, &modTime).ok()) {
-          // Has the file been modified since last successful read?
-          if (modTime > tailer.second.last_mod_) {
-            auto newLSN = ReadFile(tailer.first, log.from_, log.until_);
-            if (newLSN != LSN_INVALID) {
-              log.from_ = newLSN;
-
-              // Update the last_mod_ time.
-              // We set this to the min of the actual last modified time, and
-              // 1 second ago. The reason for this is because a write could
-              // happen to a log within one second of reading from it, and since
-              // modified time is only accurate to one second, we will think
-              // there is no additional write. Using now - 1 second means we
-              // process any modification in the last second, even if we have
-              // already read the file during that time.
-              log.last_mod_ = std::min<uint64_t>(modTime, time(0) - 1);
-            }
-          }
+      struct pollfd pfd;
+      pfd.fd = wake_fd_.readfd();
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      poll(&pfd, 1, retry ? kRetryIntervalMs : kScanIntervalMs);
+      eventfd_t value;
+      wake_fd_.read_event(&value);
+
+      std::set<logid_t> logs;
+      {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        logs.swap(woken_);
+        signalled_ = false;
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (retry ||
+          now - last_scan >= std::chrono::milliseconds(kScanIntervalMs)) {
+        // Check all the logs.
+        last_scan = now;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& entry : logs_) {
+          logs.insert(entry.first);
         }
       }
+
+      retry = false;
+      for (logid_t logid : logs) {
+        retry = ReadLog(logid) || retry;
+      }
     }
   });
 }
 
-// Returns the last sequence number written by a file
-// Possibly could be moved to env_posix as a duplicate
-// piece of code exists in Client.cc
-lsn_t AsyncReaderImpl::LastSequenceNumber(logid_t logid) {
-  // Seqno is stored in its own file.
-  std::string fname = SeqnoFilename(logid);
-  rocketspeed::FileLock* fileLock;
+AsyncReaderImpl::~AsyncReaderImpl() {
+  done_ = true;
+  wake_fd_.write_event(1);
+  thread_.join();
+  for (auto& entry : logs_) {
+    store_->Unwatch(entry.second.log_, this);
+  }
+  wake_fd_.closefd();
+}
 
-  while (!(env_->LockFile(fname, &fileLock).ok() && fileLock)) {
-    // Another thread or process has the lock, so yield to let them finish.
-    std::this_thread::yield();
+void AsyncReaderImpl::Wake(logid_t logid) {
+  std::lock_guard<std::mutex> lock(wake_mutex_);
+  woken_.insert(logid);
+  if (!signalled_) {
+    signalled_ = true;
+    wake_fd_.write_event(1);
   }
+}
 
-  // Lock acquired, now try to open the file.
-  rocketspeed::EnvOptions opts;
-  opts.use_mmap_writes = false;  // PosixRandomRWFile doesn't support this
-  std::unique_ptr<rocketspeed::RandomRWFile> file;
-  if (!(env_->NewRandomRWFile(fname, &file, opts).ok() && file)) {
-    env_->UnlockFile(fileLock);
-    return LSN_INVALID;
+bool AsyncReaderImpl::ReadLog(logid_t logid) {
+  LogStore::Log* log;
+  lsn_t from;
+  lsn_t until;
+  uint64_t generation;
+  std::unique_ptr<DataRecord> pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = logs_.find(logid);
+    if (it == logs_.end()) {
+      return false;
+    }
+    log = it->second.log_;
+    from = it->second.from_;
+    until = it->second.until_;
+    generation = it->second.generation_;
+    pending = std::move(it->second.pending_);
   }
 
-  lsn_t lsn = LastSeqnoWritten(fname, file, env_);
-  env_->UnlockFile(fileLock);
-
-  // Return last lsn written
-  return lsn - 1;
-}
-
-// Process a log file, calling the callback for each record in the LSN range.
-// Returns the next LSN to begin reading from.
-lsn_t AsyncReaderImpl::ReadFile(logid_t logid, lsn_t from, lsn_t until) {
-  // Iterate log records.
-  LogFile file(logid, false);
-  bool opened = false;
-  lsn_t last_lsn = 0;
-  (void)last_lsn;
-  auto expected_lsn = from;
-  while (file.Next()) {
-    opened = true;
-    lsn_t current_lsn = file.GetLSN();
-    assert(current_lsn > last_lsn);
-    last_lsn = current_lsn;
-    if (current_lsn > expected_lsn) {
-      // There is a gap from expected lsn to the minimum
-      // of current lsn or until.
+  // Deliver one batch of records, a trim gap, or a refused record.
+  bool refused = false;
+  bool more = false;
+  if (from <= until) {
+    const lsn_t trim_point = LogStore::GetTrimPoint(log);
+    if (pending) {
+      if (data_cb_(pending)) {
+        pending.reset();
+        ++from;
+        more = true;
+      } else {
+        refused = true;
+      }
+    } else if (from <= trim_point) {
       GapRecord record {
         logid,
         GapType::TRIM,
-        expected_lsn,
-        std::min(until, current_lsn - 1)
+        from,
+        std::min(until, trim_point)
       };
-      if (gap_cb_) {
-        bool success = gap_cb_(record);
-        (void)success;  // ignore in mock impl.
-        assert(success);
+      if (!gap_cb_ || gap_cb_(record)) {
+        from = record.hi + 1;
+        more = true;
+      } else {
+        refused = true;
       }
-
-      // We are now proccessing from current_lsn.
-      expected_lsn = current_lsn;
-    }
-    if (current_lsn > until) {
-      // Past the end of our LSN range, so exit now.
-      return current_lsn;
+    } else {
+      std::vector<std::unique_ptr<DataRecord>> records;
+      store_->Read(log, from, until, kReadBatchSize, &records);
+      for (auto& record : records) {
+        if (!data_cb_(record)) {
+          // Callback must give the record back if it refused it.
+          assert(record);
+          pending = std::move(record);
+          refused = true;
+          break;
+        }
+        ++from;
+      }
+      more = !refused && records.size() == kReadBatchSize;
     }
-    if (current_lsn == expected_lsn) {
-      // In range, so call callback and adjust the return LSN.
-      expected_lsn++;
-      std::unique_ptr<DataRecord> dataRecord(
-        new MockDataRecord(
-          logid,
-          file.GetData(),
-          current_lsn,
-          file.GetTimestamp()));
-      bool success = data_cb_(dataRecord);
-      (void)success;  // ignore in mock impl.
-      assert(success);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = logs_.find(logid);
+    if (it == logs_.end() || it->second.generation_ != generation) {
+      // Reading was stopped or restarted meanwhile.
+      return false;
     }
+    it->second.from_ = from;
+    it->second.pending_ = std::move(pending);
   }
-  return opened ? expected_lsn : LSN_INVALID;
+  if (more) {
+    // Come back for the rest after other logs had their turn.
+    Wake(logid);
+  }
+  return refused;
 }
 
 void AsyncReader::setRecordCallback(
@@ -193,15 +186,34 @@ void AsyncReader::setDoneCallback(std::function<void(logid_t)>) {
 
 int AsyncReader::startReading(logid_t log_id, lsn_t from, lsn_t until) {
   assert(impl()->data_cb_);  // must set CB before starting to read
-  std::lock_guard<std::mutex> lock(impl()->mutex_);
-  impl()->logs_[log_id] = AsyncReaderImpl::Log{from, until, 0};
+  LogStore::Log* log = impl()->store_->GetLog(log_id);
+  if (!log) {
+    err = E::FAILED;
+    return -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(impl()->mutex_);
+    AsyncReaderImpl::Log& entry = impl()->logs_[log_id];
+    entry.log_ = log;
+    entry.from_ = from;
+    entry.until_ = until;
+    entry.generation_ = ++impl()->next_generation_;
+    entry.pending_.reset();
+    impl()->store_->Watch(log, impl());
+  }
+  // Records may already be there.
+  impl()->Wake(log_id);
   return 0;
 }
 
 int AsyncReader::stopReading(logid_t log_id, std::function<void()> cb) {
   assert(!cb);  // callback not supported
   std::lock_guard<std::mutex> lock(impl()->mutex_);
-  impl()->logs_.erase(log_id);
+  auto it = impl()->logs_.find(log_id);
+  if (it != impl()->logs_.end()) {
+    impl()->store_->Unwatch(it->second.log_, impl());
+    impl()->logs_.erase(it);
+  }
   return 0;
 }
 
@@ -8,57 +8,68 @@
 #include <atomic>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <thread>
 #include <utility>
-#include "src/port/Env.h"
+#include "src/port/port.h"
 #include "logdevice/include/AsyncReader.h"
-#include "src/logdevice/Common.h"
+#include "src/logdevice/LogStore.h"
 
 namespace facebook { namespace logdevice {
 
 class AsyncReaderImpl : public AsyncReader {
  public:
-  AsyncReaderImpl();
+  explicit AsyncReaderImpl(std::shared_ptr<LogStore> store);
 
-  ~AsyncReaderImpl() {
-    done_ = true;
-    thread_.join();
-  }
+  ~AsyncReaderImpl();
+
+  /**
+   * Called by the store after appends to or trims of a log that this reader
+   * watches. Thread safe.
+   */
+  void Wake(logid_t logid);
 
  private:
   friend class AsyncReader;
 
-  // LSN range to read from a particular log, and the last modified time,
-  // used to wait for reads.
+  // LSN range to read from a particular log. The generation changes when
+  // reading is restarted, so that stale progress is discarded.
   struct Log {
+    LogStore::Log* log_;
     lsn_t from_;
     lsn_t until_;
-    uint64_t last_mod_;
+    uint64_t generation_;
+    // Record that the callback refused, to be redelivered.
+    std::unique_ptr<DataRecord> pending_;
   };
 
-  // Reads a log file and calls the data callback for all records in the
-  // supplied range. Returns the last LSN read.
-  lsn_t ReadFile(logid_t logid, lsn_t from, lsn_t until);
-
-  // Gets the last sequence number written to a file
-  lsn_t LastSequenceNumber(logid_t logid);
+  // Delivers available records and gaps of a log, returns true if the
+  // callbacks refused a record or gap and it should be retried later.
+  bool ReadLog(logid_t logid);
 
   // Callbacks
   std::function<bool(std::unique_ptr<DataRecord>&)> data_cb_;
   std::function<bool(const GapRecord&)> gap_cb_;
 
+  std::shared_ptr<LogStore> store_;
+
   // Mutex for locking the logs_ map.
   std::mutex mutex_;
 
-  // Map containing logs currently read from. Maps a log ID to a Log,
-  // which stores the current LSN range a last modified time.
+  // Map containing logs currently read from.
   std::map<logid_t, Log> logs_;
+  uint64_t next_generation_ = 0;
 
-  // File reading daemon thread.
-  std::thread thread_;
+  // Logs with new records or trims since the reader thread last looked.
+  std::mutex wake_mutex_;
+  std::set<logid_t> woken_;
+  bool signalled_ = false;
+  rocketspeed::port::Eventfd wake_fd_;
 
-  rocketspeed::Env* env_;
+  // Reading daemon thread.
+  std::thread thread_;
 
   // Flag used to tell the reading thread that we should stop.
   std::atomic<bool> done_{false};
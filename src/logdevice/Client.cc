@@ -9,17 +9,18 @@
 #include <assert.h>
 #include <algorithm>
 #include <chrono>
-#include <future>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <string>
 #include <thread>
-#include "include/Slice.h"
+#include <vector>
 #include "src/port/Env.h"
 #include "logdevice/include/Record.h"
 #include "src/logdevice/AsyncReader.h"
 #include "src/logdevice/Common.h"
-#include "src/util/scoped_file_lock.h"
+#include "src/logdevice/LogStore.h"
 
 namespace facebook { namespace logdevice {
 
@@ -27,50 +28,64 @@ class ClientImpl : public Client {
  public:
   ClientImpl() {}
 
+  ~ClientImpl() {
+    {
+      std::lock_guard<std::mutex> lock(append_mutex_);
+      stop_ = true;
+    }
+    append_cv_.notify_one();
+    append_thread_.join();
+  }
+
  private:
   friend class Client;
 
-  lsn_t GetLogSeqno(logid_t logid);
+  // Applies pending asynchronous appends in batches, until stopped and
+  // all are applied.
+  void AppendLoop();
 
   rocketspeed::Env* env_;
   std::unique_ptr<ClientSettings> settings_;
   std::chrono::milliseconds timeout_;
   std::default_random_engine rng_;
+  std::shared_ptr<LogStore> store_;
+
+  // Asynchronous appends and their callbacks, waiting for the append thread.
+  std::mutex append_mutex_;
+  std::condition_variable append_cv_;
+  std::vector<LogStore::Append> appends_;
+  std::vector<append_callback_t> append_callbacks_;
+  bool stop_ = false;
+  std::thread append_thread_;
 };
 
-lsn_t ClientImpl::GetLogSeqno(logid_t logid) {
-  // Seqno is stored in its own file.
-  std::string fname = SeqnoFilename(logid);
-  rocketspeed::FileLock* fileLock;
-
-  while (!(env_->LockFile(fname, &fileLock).ok() && fileLock)) {
-    // Another thread or process has the lock, so yield to let them finish.
-    std::this_thread::yield();
-  }
-
-  // Lock acquired, now try to open the file.
-  rocketspeed::EnvOptions opts;
-  opts.use_mmap_writes = false;  // PosixRandomRWFile doesn't support this
-  std::unique_ptr<rocketspeed::RandomRWFile> file;
-  if (!(env_->NewRandomRWFile(fname, &file, opts).ok() && file)) {
-    env_->UnlockFile(fileLock);
-    return LSN_INVALID;
-  }
-
-  // Get the file size to use as the write offset (to append).
-  lsn_t lsn = LastSeqnoWritten(fname, file, env_);
+void ClientImpl::AppendLoop() {
+  std::vector<LogStore::Append> batch;
+  std::vector<append_callback_t> callbacks;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(append_mutex_);
+      append_cv_.wait(lock, [this] () { return stop_ || !appends_.empty(); });
+      if (appends_.empty()) {
+        break;
+      }
+      // Take everything appended meanwhile as one batch.
+      batch.swap(appends_);
+      callbacks.swap(append_callbacks_);
+    }
 
-  // Write new seqno.
-  lsn_t newlsn = lsn + 1;
-  uint8_t buff[sizeof(lsn_t)];
-  for (int i = static_cast<int>(sizeof(buff)) - 1; i >= 0; --i) {
-    buff[i] = newlsn & 0xff;
-    newlsn >>= 8;
+    store_->AppendBatch(&batch);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      DataRecord record(batch[i].logid,
+                        Payload(batch[i].payload.data(),
+                                batch[i].payload.size()),
+                        batch[i].lsn,
+                        batch[i].timestamp);
+      callbacks[i](batch[i].lsn == LSN_INVALID ? E::FAILED : E::OK, record);
+    }
+    batch.clear();
+    callbacks.clear();
   }
-  file->Write(0, rocketspeed::Slice(reinterpret_cast<char*>(buff),
-                                    sizeof(buff)));
-  env_->UnlockFile(fileLock);
-  return lsn;
 }
 
 std::shared_ptr<Client> Client::create(
@@ -88,75 +103,36 @@ std::shared_ptr<Client> Client::create(
   // Make sure log directory exists
   impl->env_->CreateDirIfMissing(MOCK_LOG_DIR);
 
+  LogStore::Options options;
+  if (impl->settings_) {
+    const ClientSettingsImpl* settings_impl =
+      static_cast<const ClientSettingsImpl*>(impl->settings_.get());
+    options.segment_size = static_cast<size_t>(
+      settings_impl->GetInt("mock-segment-size", options.segment_size));
+    options.sync = settings_impl->GetInt("mock-sync", options.sync) != 0;
+  }
+  impl->store_ = LogStore::Open(MOCK_LOG_DIR, options);
+  impl->append_thread_ = std::thread([impl] () { impl->AppendLoop(); });
+
   return std::shared_ptr<Client>(impl);
 }
 
 lsn_t Client::appendSync(logid_t logid, const Payload& payload) noexcept {
-  using std::chrono::duration_cast;
-  using std::chrono::microseconds;
-  using std::chrono::milliseconds;
-
-  // Try to get a lock on the log file.
-  std::string fname = LogFilename(logid);
-  rocketspeed::FileLock* fileLock;
-
-  // Keep trying to lock the file forever!
-  // Append should not fail just because someone is reading the file.
-  while (!(impl()->env_->LockFile(fname, &fileLock).ok() && fileLock)) {
-    // Another thread or process has the lock, so yield to let them finish.
-    std::this_thread::yield();
-  }
-
-  // Lock acquired, now try to open the file.
-  rocketspeed::EnvOptions opts;
-  opts.use_mmap_writes = false;  // PosixRandomRWFile doesn't support this
-  std::unique_ptr<rocketspeed::RandomRWFile> file;
-  if (!(impl()->env_->NewRandomRWFile(fname, &file, opts).ok() && file)) {
-    impl()->env_->UnlockFile(fileLock);
-    return LSN_INVALID;
-  }
-
-  auto now = std::chrono::system_clock::now().time_since_epoch();
-
-  RecordHeader header;
-  header.lsn = impl()->GetLogSeqno(logid);
-  header.timestamp = duration_cast<milliseconds>(now).count();
-  header.datasize = payload.size;
-
-  // Get the file size to use as the write offset (to append).
-  uint64_t offset;
-  if (!impl()->env_->GetFileSize(fname, &offset).ok()) {
-    impl()->env_->UnlockFile(fileLock);
-    return LSN_INVALID;
-  }
-
-  // Write header.
-  rocketspeed::Slice headerSlice(reinterpret_cast<const char*>(&header),
-                                 sizeof(RecordHeader));
-  file->Write(offset, headerSlice);
-
-  // Write payload.
-  rocketspeed::Slice payloadSlice(reinterpret_cast<const char*>(payload.data),
-                                  payload.size);
-  file->Write(offset + sizeof(RecordHeader), payloadSlice);
-
-  // Clean up.
-  impl()->env_->UnlockFile(fileLock);
-  return header.lsn;
+  return impl()->store_->AppendSync(logid, payload);
 }
 
 int Client::append(logid_t logid,
                    const Payload& payload,
                    append_callback_t cb) noexcept {
-  // Synchronous for now.
-  // TODO(pja) 1 : Create some sort of event loop to for async handling.
-  lsn_t lsn = appendSync(logid, payload);
-  DataRecord record(logid, payload, lsn);
-  if (lsn == LSN_INVALID) {
-    cb(E::FAILED, record);
-  } else {
-    cb(E::OK, record);
+  LogStore::Append append;
+  append.logid = logid;
+  append.payload.assign(static_cast<const char*>(payload.data), payload.size);
+  {
+    std::lock_guard<std::mutex> lock(impl()->append_mutex_);
+    impl()->appends_.emplace_back(std::move(append));
+    impl()->append_callbacks_.emplace_back(std::move(cb));
   }
+  impl()->append_cv_.notify_one();
   return 0;
 }
 
@@ -168,7 +144,7 @@ std::unique_ptr<Reader> Client::createReader(
 }
 
 std::unique_ptr<AsyncReader> Client::createAsyncReader() noexcept {
-  return std::unique_ptr<AsyncReader>(new AsyncReaderImpl());
+  return std::unique_ptr<AsyncReader>(new AsyncReaderImpl(impl()->store_));
 }
 
 void Client::setTimeout(std::chrono::milliseconds timeout) noexcept {
@@ -176,89 +152,16 @@ void Client::setTimeout(std::chrono::milliseconds timeout) noexcept {
 }
 
 int Client::trimSync(logid_t logid, lsn_t lsn) noexcept {
-  // Find file offset to trim to.
-  std::string fname = LogFilename(logid);
-  uint64_t offset = 0;
-  bool found = false;
-  {
-    LogFile file(logid, true);
-    while (file.Next()) {
-      if (file.GetLSN() > lsn) {
-        // File offset will be at end of header here, so rewind a little.
-        assert(file.GetOffset() >= sizeof(RecordHeader));
-        offset = file.GetOffset() - sizeof(RecordHeader);
-        found = true;
-        break;
-      }
-    }
-  }
-
-  if (!found) {
-    // Didn't find any LSN after the trim point, so delete the whole file.
-    impl()->env_->DeleteFile(fname);
-  }
-
-  if (offset == 0) {
-    // Nothing to trim
-    return 0;
-  }
-
-  // Get a lock. Didn't need this above as LogFile has its own lock.
-  rocketspeed::ScopedFileLock fileLock(impl()->env_, fname, false);
-
-  // Get file size
-  uint64_t fileSize;
-  if (!impl()->env_->GetFileSize(fname, &fileSize).ok()) {
-    return 1;
-  }
-
-  rocketspeed::EnvOptions opts;
-  opts.use_mmap_writes = false;  // PosixRandomRWFile doesn't support this
-
-  // Read tail of the file into temporary buffer
-  std::vector<char> buffer;
-  rocketspeed::Slice tailSlice;
-  {
-    uint64_t tailSize = fileSize - offset;
-    buffer.resize(fileSize - offset);
-    std::unique_ptr<rocketspeed::RandomAccessFile> file;
-    if (!(impl()->env_->NewRandomAccessFile(fname, &file, opts).ok() && file)) {
-      return 1;
-    }
-    if (!file->Read(offset, tailSize, &tailSlice, buffer.data()).ok()) {
-      return 1;
-    }
-  }
-
-  // Write tail over the old file
-  {
-    std::unique_ptr<rocketspeed::WritableFile> file;
-    if (!(impl()->env_->NewWritableFile(fname, &file, opts).ok() && file)) {
-      return 1;
-    }
-    if (!file->Append(tailSlice).ok()) {
-      return 1;
-    }
-  }
-
-  return 0;
+  return impl()->store_->Trim(logid, lsn);
 }
 
 lsn_t Client::findTimeSync(logid_t logid,
                            std::chrono::milliseconds timestamp,
                            Status *status_out) noexcept {
-  // Opens the log and reads through until we find the timestamp.
+  // Returns the first LSN at or after the timestamp.
   // If not found, returns the last LSN + 1 (i.e. the next LSN).
   // If log empty, returns LSN_OLDEST.
-  LogFile file(logid, true);
-  lsn_t lsn = LSN_OLDEST;
-  while (file.Next()) {
-    lsn = file.GetLSN();
-    if (file.GetTimestamp() >= timestamp) {
-      break;
-    }
-    ++lsn;
-  }
+  lsn_t lsn = impl()->store_->FindTime(logid, timestamp);
   if (status_out) {
     // E::PARTIAL should be accepted as success also.
     // Fuzzing here to get more code coverage.
@@ -4,25 +4,34 @@
 // of patent rights can be found in the PATENTS file in the same directory.
 //
 #include <stdint.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <string>
 #include "logdevice/include/ClientSettings.h"
+#include "src/logdevice/Common.h"
 
 namespace facebook { namespace logdevice {
 
-class ClientSettingsImpl : public ClientSettings {
- public:
-  ClientSettingsImpl() {}
-};
+int64_t ClientSettingsImpl::GetInt(const std::string& name,
+                                   int64_t default_value) const {
+  auto it = settings_.find(name);
+  if (it == settings_.end()) {
+    return default_value;
+  }
+  return strtoll(it->second.c_str(), nullptr, 10);
+}
 
 ClientSettings* ClientSettings::create() {
   return new ClientSettingsImpl();
 }
 
 int ClientSettings::set(const char *name, const char *value) {
+  impl()->settings_[name] = value;
   return 0;
 }
 
 int ClientSettings::set(const char *name, int64_t value) {
+  impl()->settings_[name] = std::to_string(value);
   return 0;
 }
 
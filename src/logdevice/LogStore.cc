@@ -0,0 +1,519 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma GCC diagnostic ignored "-Wshadow"
+
+#include "src/logdevice/LogStore.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <utility>
+#include "src/logdevice/AsyncReader.h"
+
+namespace facebook { namespace logdevice {
+
+namespace {
+
+const uint64_t kMagic = 0x524f434b45544c47;  // "ROCKETLG"
+const size_t kHeaderSize = 4096;
+const size_t kIndexChunkEntries = 64 * 1024;
+
+/** First page of the index file, shared by all processes mapping it. */
+struct LogHeader {
+  uint64_t magic;
+  std::atomic<uint64_t> next_lsn;
+  std::atomic<uint64_t> trim_point;
+  // Segment currently appended to, and the offset of its end.
+  uint64_t segment;
+  uint64_t segment_tail;
+  // Oldest segment not deleted by trimming.
+  uint64_t first_segment;
+  // Timestamp of the last record, timestamps never go backwards.
+  uint64_t last_timestamp;
+};
+static_assert(sizeof(LogHeader) <= kHeaderSize, "LogHeader too large");
+
+/** Location and timestamp of a record. */
+struct IndexEntry {
+  uint32_t segment;
+  uint32_t offset;
+  uint64_t timestamp;
+};
+
+const size_t kIndexChunkSize = kIndexChunkEntries * sizeof(IndexEntry);
+
+size_t RecordSize(size_t datasize) {
+  return (sizeof(RecordHeader) + datasize + 7) & ~size_t(7);
+}
+
+/** Maps length bytes of the file at offset, or returns null. */
+char* MapFile(int fd, size_t offset, size_t length) {
+  void* addr = mmap(nullptr,
+                    length,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    fd,
+                    static_cast<off_t>(offset));
+  return addr == MAP_FAILED ? nullptr : static_cast<char*>(addr);
+}
+
+int SyncFile(int fd) {
+#if defined(OS_MACOSX)
+  return fsync(fd);
+#else
+  return fdatasync(fd);
+#endif
+}
+
+/** Holds flock on the index file, for appends from other processes. */
+class ScopedFlock {
+ public:
+  explicit ScopedFlock(int fd) : fd_(fd) {
+    while (flock(fd_, LOCK_EX) != 0 && errno == EINTR) {
+    }
+  }
+
+  ~ScopedFlock() {
+    flock(fd_, LOCK_UN);
+  }
+
+ private:
+  int fd_;
+};
+
+}  // namespace
+
+class LogStore::Log {
+ public:
+  struct Segment {
+    int fd = -1;
+    char* data = nullptr;
+    size_t size = 0;
+  };
+
+  explicit Log(logid_t _logid) : logid(_logid) {}
+
+  ~Log() {
+    for (auto& entry : segments) {
+      CloseSegment(&entry.second);
+    }
+    for (char* chunk : index_chunks) {
+      if (chunk) {
+        munmap(chunk, kIndexChunkSize);
+      }
+    }
+    if (header) {
+      munmap(header, kHeaderSize);
+    }
+    if (index_fd >= 0) {
+      close(index_fd);
+    }
+  }
+
+  static void CloseSegment(Segment* segment) {
+    munmap(segment->data, segment->size);
+    close(segment->fd);
+  }
+
+  /** Returns the index entry of an LSN, mapping its chunk if necessary. */
+  IndexEntry* GetEntry(lsn_t lsn, bool extend) {
+    const size_t index = static_cast<size_t>(lsn - LSN_OLDEST);
+    const size_t chunk = index / kIndexChunkEntries;
+    if (chunk >= index_chunks.size()) {
+      index_chunks.resize(chunk + 1, nullptr);
+    }
+    if (!index_chunks[chunk]) {
+      const size_t offset = kHeaderSize + chunk * kIndexChunkSize;
+      struct stat st;
+      if (fstat(index_fd, &st) != 0) {
+        return nullptr;
+      }
+      if (static_cast<size_t>(st.st_size) < offset + kIndexChunkSize) {
+        if (!extend ||
+            ftruncate(index_fd,
+                      static_cast<off_t>(offset + kIndexChunkSize)) != 0) {
+          return nullptr;
+        }
+      }
+      index_chunks[chunk] = MapFile(index_fd, offset, kIndexChunkSize);
+      if (!index_chunks[chunk]) {
+        return nullptr;
+      }
+    }
+    return reinterpret_cast<IndexEntry*>(index_chunks[chunk]) +
+           index % kIndexChunkEntries;
+  }
+
+  const logid_t logid;
+
+  // Serialises appends, trims and changes to the mappings in this process.
+  std::mutex mutex;
+  int index_fd = -1;
+  LogHeader* header = nullptr;
+  std::vector<char*> index_chunks;
+  std::map<uint64_t, Segment> segments;
+
+  // Readers of this log, woken on appends and trims.
+  std::vector<AsyncReaderImpl*> readers;
+};
+
+std::shared_ptr<LogStore> LogStore::Open(const std::string& dir,
+                                         const Options& options) {
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::weak_ptr<LogStore>> registry;
+
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::shared_ptr<LogStore> store = registry[dir].lock();
+  if (!store) {
+    store.reset(new LogStore(dir, options));
+    registry[dir] = store;
+  }
+  return store;
+}
+
+LogStore::LogStore(std::string dir, Options options)
+: dir_(std::move(dir))
+, options_(options) {
+}
+
+LogStore::~LogStore() {
+  for (auto& entry : logs_) {
+    // All readers hold a reference to the store.
+    assert(entry.second->readers.empty());
+  }
+}
+
+std::string LogStore::IndexFilename(logid_t logid) const {
+  return dir_ + "/" + std::to_string((uint64_t)logid) + ".index";
+}
+
+std::string LogStore::SegmentFilename(logid_t logid, uint64_t segment) const {
+  return dir_ + "/" + std::to_string((uint64_t)logid) + "." +
+         std::to_string(segment) + ".segment";
+}
+
+LogStore::Log* LogStore::GetLog(logid_t logid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = logs_.find(logid);
+  if (it != logs_.end()) {
+    return it->second.get();
+  }
+
+  std::unique_ptr<Log> log(new Log(logid));
+  const std::string fname = IndexFilename(logid);
+  log->index_fd = open(fname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (log->index_fd < 0) {
+    return nullptr;
+  }
+  {
+    // Initialise the header if we are the first to open the log.
+    ScopedFlock file_lock(log->index_fd);
+    struct stat st;
+    if (fstat(log->index_fd, &st) != 0) {
+      return nullptr;
+    }
+    if (static_cast<size_t>(st.st_size) < kHeaderSize &&
+        ftruncate(log->index_fd, kHeaderSize) != 0) {
+      return nullptr;
+    }
+    log->header = reinterpret_cast<LogHeader*>(
+      MapFile(log->index_fd, 0, kHeaderSize));
+    if (!log->header) {
+      return nullptr;
+    }
+    if (log->header->magic != kMagic) {
+      log->header->next_lsn = LSN_OLDEST;
+      log->header->trim_point = LSN_INVALID;
+      log->header->segment = 0;
+      log->header->segment_tail = 0;
+      log->header->first_segment = 0;
+      log->header->last_timestamp = 0;
+      log->header->magic = kMagic;
+    }
+  }
+  Log* result = log.get();
+  logs_.emplace(logid, std::move(log));
+  return result;
+}
+
+namespace {
+
+/**
+ * Returns the mapping of a segment, creating the file with at least
+ * create_size bytes if create_size is non-zero.
+ */
+LogStore::Log::Segment* GetSegment(LogStore::Log* log,
+                                   const std::string& fname,
+                                   uint64_t segment,
+                                   size_t create_size) {
+  auto it = log->segments.find(segment);
+  if (it != log->segments.end()) {
+    return &it->second;
+  }
+  LogStore::Log::Segment seg;
+  const int flags = O_RDWR | O_CLOEXEC | (create_size ? O_CREAT : 0);
+  seg.fd = open(fname.c_str(), flags, 0644);
+  if (seg.fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(seg.fd, &st) != 0) {
+    close(seg.fd);
+    return nullptr;
+  }
+  seg.size = static_cast<size_t>(st.st_size);
+  if (seg.size < create_size) {
+    if (ftruncate(seg.fd, static_cast<off_t>(create_size)) != 0) {
+      close(seg.fd);
+      return nullptr;
+    }
+    seg.size = create_size;
+  }
+  if (seg.size == 0 || !(seg.data = MapFile(seg.fd, 0, seg.size))) {
+    close(seg.fd);
+    return nullptr;
+  }
+  return &log->segments.emplace(segment, seg).first->second;
+}
+
+}  // namespace
+
+lsn_t LogStore::AppendSync(logid_t logid, const Payload& payload) {
+  std::vector<Append> batch(1);
+  batch[0].logid = logid;
+  batch[0].payload.assign(static_cast<const char*>(payload.data),
+                          payload.size);
+  AppendBatch(&batch);
+  return batch[0].lsn;
+}
+
+void LogStore::AppendBatch(std::vector<Append>* batch) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  // Group appends by log, preserving their order within each log.
+  std::vector<size_t> order(batch->size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+    [batch] (size_t a, size_t b) {
+      return (*batch)[a].logid < (*batch)[b].logid;
+    });
+
+  std::set<int> dirty_fds;
+  size_t i = 0;
+  while (i < order.size()) {
+    const logid_t logid = (*batch)[order[i]].logid;
+    size_t end = i;
+    while (end < order.size() && (*batch)[order[end]].logid == logid) {
+      ++end;
+    }
+
+    Log* log = GetLog(logid);
+    if (log) {
+      std::lock_guard<std::mutex> lock(log->mutex);
+      ScopedFlock file_lock(log->index_fd);
+      LogHeader* header = log->header;
+      for (; i < end; ++i) {
+        Append& append = (*batch)[order[i]];
+        const size_t size = RecordSize(append.payload.size());
+        const lsn_t lsn = header->next_lsn.load(std::memory_order_relaxed);
+
+        // Roll over to a new segment if the record does not fit.
+        Log::Segment* segment = GetSegment(
+          log,
+          SegmentFilename(logid, header->segment),
+          header->segment,
+          std::max(options_.segment_size, size));
+        if (segment && header->segment_tail + size > segment->size) {
+          ++header->segment;
+          header->segment_tail = 0;
+          segment = GetSegment(log,
+                               SegmentFilename(logid, header->segment),
+                               header->segment,
+                               std::max(options_.segment_size, size));
+        }
+        IndexEntry* entry = log->GetEntry(lsn, true);
+        if (!segment || !entry) {
+          append.lsn = LSN_INVALID;
+          continue;
+        }
+
+        const uint64_t now = duration_cast<milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+        RecordHeader record;
+        record.lsn = lsn;
+        record.timestamp = std::max(now, header->last_timestamp);
+        record.datasize = append.payload.size();
+        char* dest = segment->data + header->segment_tail;
+        memcpy(dest, &record, sizeof(record));
+        memcpy(dest + sizeof(record),
+               append.payload.data(),
+               append.payload.size());
+
+        entry->segment = static_cast<uint32_t>(header->segment);
+        entry->offset = static_cast<uint32_t>(header->segment_tail);
+        entry->timestamp = record.timestamp;
+        header->segment_tail += size;
+        header->last_timestamp = record.timestamp;
+        header->next_lsn.store(lsn + 1, std::memory_order_release);
+
+        append.lsn = lsn;
+        append.timestamp = milliseconds(record.timestamp);
+        if (options_.sync) {
+          dirty_fds.insert(segment->fd);
+          dirty_fds.insert(log->index_fd);
+        }
+      }
+      for (AsyncReaderImpl* reader : log->readers) {
+        reader->Wake(logid);
+      }
+    } else {
+      for (; i < end; ++i) {
+        (*batch)[order[i]].lsn = LSN_INVALID;
+      }
+    }
+  }
+
+  // One sync per touched file for the whole batch.
+  for (int fd : dirty_fds) {
+    SyncFile(fd);
+  }
+}
+
+int LogStore::Trim(logid_t logid, lsn_t lsn) {
+  Log* log = GetLog(logid);
+  if (!log) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> lock(log->mutex);
+  ScopedFlock file_lock(log->index_fd);
+  LogHeader* header = log->header;
+
+  // Records past the end of the log cannot be trimmed.
+  const lsn_t next_lsn = header->next_lsn.load(std::memory_order_relaxed);
+  lsn = std::min(lsn, next_lsn - 1);
+  if (lsn <= header->trim_point.load(std::memory_order_relaxed)) {
+    return 0;
+  }
+  header->trim_point.store(lsn, std::memory_order_release);
+
+  // Delete all segments before the one holding the first untrimmed record.
+  uint64_t keep = header->segment;
+  if (lsn + 1 < next_lsn) {
+    IndexEntry* entry = log->GetEntry(lsn + 1, false);
+    if (entry) {
+      keep = entry->segment;
+    }
+  }
+  for (; header->first_segment < keep; ++header->first_segment) {
+    auto it = log->segments.find(header->first_segment);
+    if (it != log->segments.end()) {
+      Log::CloseSegment(&it->second);
+      log->segments.erase(it);
+    }
+    unlink(SegmentFilename(logid, header->first_segment).c_str());
+  }
+
+  for (AsyncReaderImpl* reader : log->readers) {
+    reader->Wake(logid);
+  }
+  return 0;
+}
+
+lsn_t LogStore::FindTime(logid_t logid, std::chrono::milliseconds timestamp) {
+  Log* log = GetLog(logid);
+  if (!log) {
+    return LSN_OLDEST;
+  }
+  std::lock_guard<std::mutex> lock(log->mutex);
+
+  // Timestamps are non-decreasing, so binary search the untrimmed records.
+  lsn_t lo = log->header->trim_point.load(std::memory_order_acquire) + 1;
+  lsn_t hi = log->header->next_lsn.load(std::memory_order_acquire);
+  const uint64_t target = static_cast<uint64_t>(timestamp.count());
+  while (lo < hi) {
+    const lsn_t mid = lo + (hi - lo) / 2;
+    IndexEntry* entry = log->GetEntry(mid, false);
+    if (!entry) {
+      break;
+    }
+    if (entry->timestamp >= target) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+lsn_t LogStore::GetTrimPoint(const Log* log) {
+  return log->header->trim_point.load(std::memory_order_acquire);
+}
+
+lsn_t LogStore::GetNextLSN(const Log* log) {
+  return log->header->next_lsn.load(std::memory_order_acquire);
+}
+
+void LogStore::Read(Log* log,
+                    lsn_t from,
+                    lsn_t until,
+                    size_t max,
+                    std::vector<std::unique_ptr<DataRecord>>* records) {
+  std::lock_guard<std::mutex> lock(log->mutex);
+  const lsn_t next_lsn = GetNextLSN(log);
+  for (lsn_t lsn = from; lsn <= until && lsn < next_lsn && max; ++lsn, --max) {
+    if (lsn <= GetTrimPoint(log)) {
+      return;
+    }
+    IndexEntry* entry = log->GetEntry(lsn, false);
+    if (!entry) {
+      return;
+    }
+    Log::Segment* segment = GetSegment(log,
+                                       SegmentFilename(log->logid,
+                                                       entry->segment),
+                                       entry->segment,
+                                       0);
+    if (!segment || entry->offset + sizeof(RecordHeader) > segment->size) {
+      return;
+    }
+    RecordHeader header;
+    memcpy(&header, segment->data + entry->offset, sizeof(header));
+    assert(header.lsn == lsn);
+    records->emplace_back(new MockDataRecord(
+      log->logid,
+      Payload(segment->data + entry->offset + sizeof(header), header.datasize),
+      lsn,
+      std::chrono::milliseconds(header.timestamp)));
+  }
+}
+
+void LogStore::Watch(Log* log, AsyncReaderImpl* reader) {
+  std::lock_guard<std::mutex> lock(log->mutex);
+  if (std::find(log->readers.begin(), log->readers.end(), reader) ==
+      log->readers.end()) {
+    log->readers.push_back(reader);
+  }
+}
+
+void LogStore::Unwatch(Log* log, AsyncReaderImpl* reader) {
+  std::lock_guard<std::mutex> lock(log->mutex);
+  log->readers.erase(
+    std::remove(log->readers.begin(), log->readers.end(), reader),
+    log->readers.end());
+}
+
+}  // namespace logdevice
+}  // namespace facebook
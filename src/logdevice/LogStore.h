@@ -0,0 +1,174 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "logdevice/include/Record.h"
+#include "logdevice/include/types.h"
+
+namespace facebook { namespace logdevice {
+
+class AsyncReaderImpl;
+
+/* Log Storage Format:
+
+Each log is stored in MOCK_LOG_DIR as one index file and a sequence of
+segment files, all of which are memory mapped.
+
+<logid>.index:
++-Page---+-Field----------+-Size------------------------------+
+| Header | LogHeader      | 4096 bytes                        |
++--------+----------------+-----------------------------------+
+| Chunks | IndexEntry     | 16 bytes per LSN, starting at 1   |
++--------+----------------+-----------------------------------+
+
+<logid>.<segment>.segment, preallocated to the segment size:
++-Record-+-Field------+-Size--------+
+| 1      | LSN        | 8 bytes     |
+|        +------------+-------------+
+|        | Timestamp  | 8 bytes     |
+|        +------------+-------------+
+|        | Data size  | 8 bytes     |
+|        +------------+-------------+
+|        | Data       | "Data size" |
+|        +------------+-------------+
+|        | Padding    | to 8 bytes  |
++--------+------------+-------------+
+| 2      | ...        | ...         |
+
+Appends from other processes are serialised with flock on the index file, and
+readers in other processes notice them by polling the shared header.
+
+*/
+
+/**
+ * Structure for the three header fields from the above format diagram.
+ */
+struct RecordHeader {
+  lsn_t lsn = 0;
+  uint64_t timestamp = 0;
+  uint64_t datasize = 0;
+};
+
+/**
+ * Version of the LogDevice DataRecord that frees the payload when done.
+ * The payload is copied out of the segment, so that it outlives trimming.
+ */
+struct MockDataRecord : public DataRecord {
+ public:
+  MockDataRecord(logid_t logid,
+                 const Payload& payload,
+                 lsn_t lsn,
+                 std::chrono::milliseconds timestamp)
+  : payload_(reinterpret_cast<const char*>(payload.data), payload.size) {
+    this->payload = Payload(payload_.data(), payload_.size());
+    this->logid = logid;
+    this->attrs.lsn = lsn;
+    this->attrs.timestamp = timestamp;
+  }
+
+ private:
+  std::string payload_;
+};
+
+/**
+ * Local log storage shared by all mock Clients and AsyncReaders of a process
+ * that use the same directory.
+ */
+class LogStore {
+ public:
+  struct Options {
+    // Size of newly created segment files.
+    size_t segment_size = 4 << 20;
+
+    // Sync appended records to disk, once per batch of appends.
+    bool sync = false;
+  };
+
+  /** One append of a batch. */
+  struct Append {
+    logid_t logid;
+    std::string payload;
+    lsn_t lsn = LSN_INVALID;  // set by AppendBatch
+    std::chrono::milliseconds timestamp{0};  // set by AppendBatch
+  };
+
+  class Log;
+
+  /**
+   * Opens the store in a directory, or returns the already open one.
+   * Options are only used if the store is not open yet.
+   */
+  static std::shared_ptr<LogStore> Open(const std::string& dir,
+                                        const Options& options);
+
+  ~LogStore();
+
+  /** Returns the log, creating it if necessary, or null on error. */
+  Log* GetLog(logid_t logid);
+
+  /** Appends a record, returns its LSN or LSN_INVALID on error. */
+  lsn_t AppendSync(logid_t logid, const Payload& payload);
+
+  /**
+   * Appends all records in the batch, in order for each log, taking each
+   * log lock once and syncing each touched file once.
+   */
+  void AppendBatch(std::vector<Append>* batch);
+
+  /** Trims all records up to and including lsn. Returns 0 on success. */
+  int Trim(logid_t logid, lsn_t lsn);
+
+  /**
+   * Returns the first LSN with timestamp at or after the given time, or the
+   * next LSN to be written if there is none.
+   */
+  lsn_t FindTime(logid_t logid, std::chrono::milliseconds timestamp);
+
+  /** Highest trimmed LSN of the log. */
+  static lsn_t GetTrimPoint(const Log* log);
+
+  /** LSN that will be assigned to the next record. */
+  static lsn_t GetNextLSN(const Log* log);
+
+  /**
+   * Copies up to max records from [from, until] out of the log, stopping at
+   * the first record that is trimmed or not written yet.
+   */
+  void Read(Log* log,
+            lsn_t from,
+            lsn_t until,
+            size_t max,
+            std::vector<std::unique_ptr<DataRecord>>* records);
+
+  /** Registers a reader to be woken on appends and trims of the log. */
+  void Watch(Log* log, AsyncReaderImpl* reader);
+
+  /** Unregisters a reader, it will not be woken once this returns. */
+  void Unwatch(Log* log, AsyncReaderImpl* reader);
+
+ private:
+  LogStore(std::string dir, Options options);
+
+  std::string IndexFilename(logid_t logid) const;
+  std::string SegmentFilename(logid_t logid, uint64_t segment) const;
+
+  const std::string dir_;
+  const Options options_;
+
+  // Logs are never closed while the store is open, so Log pointers are stable.
+  std::mutex mutex_;
+  std::map<logid_t, std::unique_ptr<Log>> logs_;
+};
+
+}  // namespace logdevice
+}  // namespace facebook
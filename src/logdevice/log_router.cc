@@ -4,14 +4,249 @@
 // of patent rights can be found in the PATENTS file in the same directory.
 
 #include "src/logdevice/log_router.h"
+#include <algorithm>
+#include <cctype>
 #include <string>
+#include "src/port/Env.h"
+#include "src/util/logging.h"
+#include "src/util/topic_uuid.h"
 
 namespace rocketspeed {
 
-LogDeviceLogRouter::LogDeviceLogRouter(LogID first, LogID last)
+namespace {
+
+bool IsValidName(Slice name) {
+  // Names are separated by whitespace in the text format.
+  return !name.empty() &&
+    std::none_of(name.data(), name.data() + name.size(),
+                 [] (char c) { return isspace(c); });
+}
+
+// Removes and returns the next whitespace separated token of a line.
+Slice NextToken(Slice* line) {
+  while (!line->empty() && isspace((*line)[0])) {
+    line->remove_prefix(1);
+  }
+  size_t size = 0;
+  while (size < line->size() && !isspace((*line)[size])) {
+    ++size;
+  }
+  Slice token(line->data(), size);
+  line->remove_prefix(size);
+  return token;
+}
+
+}  // namespace
+
+Status LogPlacementTable::AddTopic(Slice namespace_id,
+                                   Slice topic_name,
+                                   LogID log) {
+  if (!IsValidName(namespace_id) || !IsValidName(topic_name)) {
+    return Status::InvalidArgument("Invalid topic");
+  }
+  if (log == 0) {
+    return Status::InvalidArgument("Invalid log ID");
+  }
+  const size_t routing_hash = TopicUUID::RoutingHash(namespace_id, topic_name);
+  auto range = topics_.equal_range(routing_hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.namespace_id == namespace_id &&
+        it->second.topic_name == topic_name) {
+      return Status::InvalidArgument("Topic already placed");
+    }
+  }
+  topics_.emplace(routing_hash,
+                  TopicOverride{namespace_id.ToString(),
+                                topic_name.ToString(),
+                                log});
+  return Status::OK();
+}
+
+Status LogPlacementTable::AddNamespace(Slice namespace_id, LogID log) {
+  if (!IsValidName(namespace_id)) {
+    return Status::InvalidArgument("Invalid namespace");
+  }
+  if (log == 0) {
+    return Status::InvalidArgument("Invalid log ID");
+  }
+  for (const auto& entry : namespaces_) {
+    if (entry.first == namespace_id) {
+      return Status::InvalidArgument("Namespace already placed");
+    }
+  }
+  namespaces_.emplace_back(namespace_id.ToString(), log);
+  return Status::OK();
+}
+
+bool LogPlacementTable::Lookup(Slice namespace_id,
+                               Slice topic_name,
+                               size_t routing_hash,
+                               LogID* out) const {
+  auto range = topics_.equal_range(routing_hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second.namespace_id == namespace_id &&
+        it->second.topic_name == topic_name) {
+      *out = it->second.log;
+      return true;
+    }
+  }
+  for (const auto& entry : namespaces_) {
+    if (entry.first == namespace_id) {
+      *out = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+Status LogPlacementTable::Validate(LogID first, LogID last) const {
+  auto overlaps = [&] (LogID log) { return log >= first && log <= last; };
+  for (const auto& entry : topics_) {
+    if (overlaps(entry.second.log)) {
+      return Status::InvalidArgument(
+        "Log of topic " + entry.second.topic_name + " is in the hashed range");
+    }
+  }
+  for (const auto& entry : namespaces_) {
+    if (overlaps(entry.second)) {
+      return Status::InvalidArgument(
+        "Log of namespace " + entry.first + " is in the hashed range");
+    }
+  }
+  return Status::OK();
+}
+
+Status LogPlacementTable::Parse(Slice text, LogPlacementTable* out) {
+  LogPlacementTable table;
+  size_t line_number = 0;
+  while (!text.empty()) {
+    ++line_number;
+    const char* end = std::find(text.data(), text.data() + text.size(), '\n');
+    Slice line(text.data(), static_cast<size_t>(end - text.data()));
+    text.remove_prefix(std::min(line.size() + 1, text.size()));
+
+    Slice tokens[4];
+    size_t num_tokens = 0;
+    for (; num_tokens < 4; ++num_tokens) {
+      tokens[num_tokens] = NextToken(&line);
+      if (tokens[num_tokens].empty()) {
+        break;
+      }
+    }
+    if (num_tokens == 0 || tokens[0][0] == '#') {
+      continue;
+    }
+
+    Slice log_token = tokens[num_tokens - 1];
+    uint64_t log;
+    Status st;
+    if (num_tokens < 2 || num_tokens > 3 ||
+        !ConsumeDecimalNumber(&log_token, &log) || !log_token.empty()) {
+      st = Status::InvalidArgument("Malformed override");
+    } else if (num_tokens == 2) {
+      st = table.AddNamespace(tokens[0], log);
+    } else {
+      st = table.AddTopic(tokens[0], tokens[1], log);
+    }
+    if (!st.ok()) {
+      return Status::InvalidArgument(
+        "Line " + std::to_string(line_number) + ": " + st.ToString());
+    }
+  }
+  *out = std::move(table);
+  return Status::OK();
+}
+
+std::string LogPlacementTable::ToString() const {
+  std::vector<std::string> lines;
+  for (const auto& entry : namespaces_) {
+    lines.push_back(entry.first + " " + std::to_string(entry.second));
+  }
+  std::sort(lines.begin(), lines.end());
+  const size_t num_namespaces = lines.size();
+  for (const auto& entry : topics_) {
+    lines.push_back(entry.second.namespace_id + " " +
+                    entry.second.topic_name + " " +
+                    std::to_string(entry.second.log));
+  }
+  std::sort(lines.begin() + num_namespaces, lines.end());
+
+  std::string result;
+  for (const std::string& line : lines) {
+    result += line;
+    result.push_back('\n');
+  }
+  return result;
+}
+
+Status LogPlacementTable::CheckRecorded(Env* env,
+                                       const std::string& fname) const {
+  const std::string text = ToString();
+  if (!env->FileExists(fname)) {
+    return WriteStringToFile(env, text, fname, true);
+  }
+  std::string recorded;
+  Status st = ReadFileToString(env, fname, &recorded);
+  if (!st.ok()) {
+    return st;
+  }
+  if (recorded != text) {
+    return Status::InvalidArgument(
+      "Log placement differs from the one recorded in " + fname);
+  }
+  return Status::OK();
+}
+
+Status LogDeviceLogRouter::Create(LogID first,
+                                  LogID last,
+                                  LogPlacementTable placement,
+                                  std::shared_ptr<LogDeviceLogRouter>* out) {
+  if (first == 0 || first > last) {
+    return Status::InvalidArgument("Invalid log range");
+  }
+  Status st = placement.Validate(first, last);
+  if (!st.ok()) {
+    return st;
+  }
+  out->reset(new LogDeviceLogRouter(first, last, std::move(placement)));
+  return Status::OK();
+}
+
+Status LogDeviceLogRouter::Create(LogID first,
+                                  LogID last,
+                                  std::shared_ptr<LogDeviceLogRouter>* out) {
+  return Create(first, last, LogPlacementTable(), out);
+}
+
+LogDeviceLogRouter::LogDeviceLogRouter(LogID first,
+                                       LogID last,
+                                       LogPlacementTable placement)
 : first_(first)
-, count_(last - first + 1) {
-  assert(last >= first);
+, count_(last - first + 1)
+, placement_(std::move(placement)) {
+}
+
+Status LogDeviceLogRouter::GetLogID(Slice namespace_id,
+                                    Slice topic_name,
+                                    LogID* out) const {
+  const size_t routing_hash = TopicUUID::RoutingHash(namespace_id, topic_name);
+  if (!placement_.Empty() &&
+      placement_.Lookup(namespace_id, topic_name, routing_hash, out)) {
+    return Status::OK();
+  }
+  return RouteToLog(routing_hash, out);
+}
+
+Status LogDeviceLogRouter::GetLogID(const TopicUUID& topic, LogID* out) const {
+  if (!placement_.Empty()) {
+    Slice namespace_id;
+    Slice topic_name;
+    topic.GetTopicID(&namespace_id, &topic_name);
+    if (placement_.Lookup(namespace_id, topic_name, topic.RoutingHash(), out)) {
+      return Status::OK();
+    }
+  }
+  return RouteToLog(topic.RoutingHash(), out);
 }
 
 Status LogDeviceLogRouter::RouteToLog(size_t routing_hash,
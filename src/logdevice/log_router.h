@@ -5,11 +5,119 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "include/Types.h"
 #include "src/util/storage.h"
 
 namespace rocketspeed {
 
+class Env;
+class TopicUUID;
+
+/**
+ * Static overrides of the log placement of specific topics or whole
+ * namespaces. Topic overrides take precedence over namespace overrides, and
+ * both take precedence over the consistent hash.
+ *
+ * Overrides are used to move heavy topics to dedicated logs, so that towers
+ * reading them do not also read and filter the records of many cold topics,
+ * and vice versa. Several topics may share a dedicated log, which co-locates
+ * topics that are read together.
+ *
+ * Tables are written by hand and are immutable once handed to a router. Like
+ * the log range, the same table must be used by all pilots, copilots and
+ * control towers. Topics are not handed off between logs: changing the table
+ * moves topics to logs that their subscribers do not read, and loses the
+ * history on the previous log. A table that differs from the recorded one is
+ * therefore rejected, see CheckRecorded.
+ */
+class LogPlacementTable {
+ public:
+  /**
+   * Places a topic on a log.
+   *
+   * @return on success OK(), otherwise errorcode.
+   */
+  Status AddTopic(Slice namespace_id, Slice topic_name, LogID log);
+
+  /**
+   * Places all topics of a namespace without a topic override on a log.
+   *
+   * @return on success OK(), otherwise errorcode.
+   */
+  Status AddNamespace(Slice namespace_id, LogID log);
+
+  /**
+   * Finds the override of a topic.
+   *
+   * @param routing_hash Routing hash of the topic.
+   * @param out Where to place the Log ID of the override.
+   * @return true iff the topic or its namespace has an override.
+   */
+  bool Lookup(Slice namespace_id,
+              Slice topic_name,
+              size_t routing_hash,
+              LogID* out) const;
+
+  /** Returns true iff there are no overrides. */
+  bool Empty() const {
+    return topics_.empty() && namespaces_.empty();
+  }
+
+  /**
+   * Checks that the overrides are disjoint from the logs of a router, so that
+   * overridden topics do not share logs with hashed topics.
+   *
+   * @return on success OK(), otherwise errorcode.
+   */
+  Status Validate(LogID first, LogID last) const;
+
+  /**
+   * Parses a table from text, one override per line:
+   *
+   *   <namespace> <log>
+   *   <namespace> <topic> <log>
+   *
+   * Empty lines and lines starting with '#' are ignored.
+   *
+   * @return on success OK(), otherwise errorcode.
+   */
+  static Status Parse(Slice text, LogPlacementTable* out);
+
+  /** Formats the table so that it can be parsed back, sorted. */
+  std::string ToString() const;
+
+  /**
+   * Checks that the table is the one recorded in a file by an earlier run,
+   * or records it if the file does not exist. The file has to be removed to
+   * deliberately change the placement of topics.
+   *
+   * @param env Environment used to access the file.
+   * @param fname Name of the file recording the table.
+   * @return on success OK(), InvalidArgument if the table differs from the
+   *         recorded one, otherwise errorcode.
+   */
+  Status CheckRecorded(Env* env, const std::string& fname) const;
+
+ private:
+  struct TopicOverride {
+    std::string namespace_id;
+    std::string topic_name;
+    LogID log;
+  };
+
+  // Topic overrides keyed by routing hash, so that lookups do not allocate.
+  std::unordered_multimap<size_t, TopicOverride> topics_;
+
+  // Namespace overrides, there are only a few.
+  std::vector<std::pair<std::string, LogID>> namespaces_;
+};
+
 /**
  * Class that provides logic for routing topic names to logs.
  * This will primarily be used by the Pilots and Control Towers when sending
@@ -18,21 +126,41 @@ namespace rocketspeed {
  * The topic to log mapping uses jump consistent hashing, which is a fast
  * low memory way of mapping keys to an arbitrary number of buckets in a way
  * that shuffles the mapping minimally when the number of buckets increases.
+ * An optional LogPlacementTable overrides the mapping of specific topics.
  */
 class LogDeviceLogRouter : public LogRouter {
  public:
   /**
-   * Constructs a new LogDeviceLogRouter.
+   * Creates a new LogDeviceLogRouter.
    * All clients should use either the same LogRouter instance, or different
    * LogRouter instances created with identical parameters. Otherwise, topics
    * will not map to the same logs for different instances.
    *
    * @param first The first log ID to map to (inclusive).
    * @param last The last log ID to map to (inclusive).
+   * @param placement Overrides of the mapping, on logs outside of the range.
+   * @param out Where to place the router.
+   * @return on success OK(), otherwise errorcode.
    */
-  explicit LogDeviceLogRouter(LogID first, LogID last);
+  static Status Create(LogID first,
+                       LogID last,
+                       LogPlacementTable placement,
+                       std::shared_ptr<LogDeviceLogRouter>* out);
+
+  /** Creates a router without placement overrides, see above. */
+  static Status Create(LogID first,
+                       LogID last,
+                       std::shared_ptr<LogDeviceLogRouter>* out);
+
+  Status GetLogID(Slice namespace_id,
+                  Slice topic_name,
+                  LogID* out) const override;
+
+  Status GetLogID(const TopicUUID& topic, LogID* out) const override;
 
  private:
+  LogDeviceLogRouter(LogID first, LogID last, LogPlacementTable placement);
+
   /**
    * Gets the Log ID where a topic's messages are to be stored.
    *
@@ -51,6 +179,7 @@ class LogDeviceLogRouter : public LogRouter {
 
   LogID first_;
   uint64_t count_;
+  const LogPlacementTable placement_;
 };
 
 }  // namespace rocketspeed
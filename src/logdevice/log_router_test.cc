@@ -8,6 +8,8 @@
 #include <set>
 #include <string>
 #include "src/logdevice/log_router.h"
+#include "src/port/Env.h"
+#include "src/util/topic_uuid.h"
 #include "src/util/testharness.h"
 #include "src/util/testutil.h"
 
@@ -20,8 +22,10 @@ class LogRouterTest { };
 TEST(LogRouterTest, ConsistencyTest) {
   // Test that topic mapping changes minimally when increasing number of logs.
   int numLogs = 10000;
-  LogDeviceLogRouter router1(1, numLogs);
-  LogDeviceLogRouter router2(1, numLogs * 105 / 100);  // 5% more
+  std::shared_ptr<LogDeviceLogRouter> router1, router2;
+  ASSERT_OK(LogDeviceLogRouter::Create(1, numLogs, &router1));
+  ASSERT_OK(LogDeviceLogRouter::Create(1, numLogs * 105 / 100,  // 5% more
+                                       &router2));
 
   // Count number of changed for 100k topics.
   int numChanged = 0;
@@ -30,8 +34,8 @@ TEST(LogRouterTest, ConsistencyTest) {
     Topic topic = std::to_string(i);
     LogID logID1;
     LogID logID2;
-    ASSERT_TRUE(router1.GetLogID("guest", topic, &logID1).ok());
-    ASSERT_TRUE(router2.GetLogID("guest", topic, &logID2).ok());
+    ASSERT_TRUE(router1->GetLogID("guest", topic, &logID1).ok());
+    ASSERT_TRUE(router2->GetLogID("guest", topic, &logID2).ok());
     if (logID1 != logID2) {
       ++numChanged;
     }
@@ -45,7 +49,8 @@ TEST(LogRouterTest, ConsistencyTest) {
 TEST(LogRouterTest, LogDistribution) {
   // Test that topics are well distributed among logs
   int numLogs = 1000 * static_cast<int>(Retention::Total);
-  LogDeviceLogRouter router(1, numLogs);
+  std::shared_ptr<LogDeviceLogRouter> router;
+  ASSERT_OK(LogDeviceLogRouter::Create(1, numLogs, &router));
   std::vector<int> topicCount(numLogs, 0);
 
   // Count number of changed for 1 million topics.
@@ -53,7 +58,7 @@ TEST(LogRouterTest, LogDistribution) {
   for (int i = 0; i < numTopics; ++i) {
     Topic topic = std::to_string(i);
     LogID logID;
-    ASSERT_TRUE(router.GetLogID("guest", topic, &logID).ok());
+    ASSERT_TRUE(router->GetLogID("guest", topic, &logID).ok());
     topicCount[logID - 1]++;  // LogIDs start at 1, not 0.
   }
 
@@ -64,6 +69,106 @@ TEST(LogRouterTest, LogDistribution) {
   ASSERT_LT(*minmax.second, expected * 1.3);
 }
 
+TEST(LogRouterTest, PlacementOverrides) {
+  LogPlacementTable placement;
+  ASSERT_OK(placement.AddTopic("guest", "hot", 2001));
+  ASSERT_OK(placement.AddTopic("guest", "also_hot", 2001));
+  ASSERT_OK(placement.AddNamespace("noisy", 2002));
+  ASSERT_OK(placement.AddTopic("noisy", "special", 2003));
+  ASSERT_TRUE(!placement.AddTopic("guest", "hot", 2004).ok());
+  ASSERT_TRUE(!placement.AddNamespace("noisy", 2004).ok());
+  ASSERT_TRUE(!placement.AddTopic("guest", "bad topic", 2004).ok());
+  ASSERT_TRUE(!placement.AddNamespace("guest", 0).ok());
+
+  ASSERT_OK(placement.Validate(1, 1000));
+  ASSERT_TRUE(!placement.Validate(1, 2001).ok());
+  ASSERT_TRUE(!placement.Validate(2002, 3000).ok());
+
+  std::shared_ptr<LogDeviceLogRouter> hashed, router;
+  ASSERT_OK(LogDeviceLogRouter::Create(1, 1000, &hashed));
+  ASSERT_OK(LogDeviceLogRouter::Create(1, 1000, placement, &router));
+  ASSERT_TRUE(!LogDeviceLogRouter::Create(1, 2001, placement, &router).ok());
+  ASSERT_TRUE(!LogDeviceLogRouter::Create(0, 1000, &router).ok());
+  ASSERT_TRUE(!LogDeviceLogRouter::Create(1000, 1, &router).ok());
+  LogID log_id;
+  ASSERT_OK(router->GetLogID("guest", "hot", &log_id));
+  ASSERT_EQ(log_id, 2001U);
+  ASSERT_OK(router->GetLogID(TopicUUID("guest", "also_hot"), &log_id));
+  ASSERT_EQ(log_id, 2001U);
+  ASSERT_OK(router->GetLogID("noisy", "anything", &log_id));
+  ASSERT_EQ(log_id, 2002U);
+  ASSERT_OK(router->GetLogID(TopicUUID("noisy", "special"), &log_id));
+  ASSERT_EQ(log_id, 2003U);
+
+  // Other topics are routed by the consistent hash.
+  for (int i = 0; i < 1000; ++i) {
+    Topic topic = std::to_string(i);
+    LogID expected;
+    ASSERT_OK(hashed->GetLogID("guest", topic, &expected));
+    ASSERT_OK(router->GetLogID("guest", topic, &log_id));
+    ASSERT_EQ(log_id, expected);
+    ASSERT_OK(router->GetLogID(TopicUUID("guest", topic), &log_id));
+    ASSERT_EQ(log_id, expected);
+  }
+}
+
+TEST(LogRouterTest, PlacementParse) {
+  LogPlacementTable placement;
+  ASSERT_OK(LogPlacementTable::Parse(
+    "# Dedicated logs\n"
+    "\n"
+    "guest hot 2001\n"
+    "  noisy\t2002  \n"
+    "guest also_hot 2001",
+    &placement));
+  ASSERT_EQ(placement.ToString(),
+            "noisy 2002\n"
+            "guest also_hot 2001\n"
+            "guest hot 2001\n");
+
+  LogPlacementTable parsed;
+  ASSERT_OK(LogPlacementTable::Parse(placement.ToString(), &parsed));
+  ASSERT_EQ(parsed.ToString(), placement.ToString());
+
+  ASSERT_TRUE(!LogPlacementTable::Parse("guest", &parsed).ok());
+  ASSERT_TRUE(!LogPlacementTable::Parse("guest hot", &parsed).ok());
+  ASSERT_TRUE(!LogPlacementTable::Parse("guest hot 12x", &parsed).ok());
+  ASSERT_TRUE(!LogPlacementTable::Parse("a b c 1", &parsed).ok());
+  ASSERT_TRUE(!LogPlacementTable::Parse("a 1\na 2", &parsed).ok());
+}
+
+TEST(LogRouterTest, PlacementRecord) {
+  Env* env = Env::Default();
+  const std::string fname = test::TmpDir() + "/log_placement_record";
+  env->DeleteFile(fname);
+
+  LogPlacementTable placement;
+  ASSERT_OK(placement.AddTopic("guest", "hot", 2001));
+  ASSERT_OK(placement.AddNamespace("noisy", 2002));
+
+  // First run records the table, later runs must use the same one.
+  ASSERT_OK(placement.CheckRecorded(env, fname));
+  ASSERT_OK(placement.CheckRecorded(env, fname));
+  LogPlacementTable reordered;
+  ASSERT_OK(LogPlacementTable::Parse("noisy 2002\nguest hot 2001\n",
+                                     &reordered));
+  ASSERT_OK(reordered.CheckRecorded(env, fname));
+
+  // Moving, adding or removing overrides is rejected.
+  LogPlacementTable moved;
+  ASSERT_OK(moved.AddTopic("guest", "hot", 2003));
+  ASSERT_OK(moved.AddNamespace("noisy", 2002));
+  ASSERT_TRUE(moved.CheckRecorded(env, fname).IsInvalidArgument());
+  ASSERT_TRUE(LogPlacementTable().CheckRecorded(env, fname)
+                .IsInvalidArgument());
+
+  // Removing the record allows the change.
+  ASSERT_OK(env->DeleteFile(fname));
+  ASSERT_OK(moved.CheckRecorded(env, fname));
+  ASSERT_TRUE(placement.CheckRecorded(env, fname).IsInvalidArgument());
+  env->DeleteFile(fname);
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
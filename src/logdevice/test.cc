@@ -315,6 +315,57 @@ TEST(MockLogDeviceTest, ConcurrentReadsWrites) {
   ASSERT_EQ(count2, numMessages);
 }
 
+TEST(MockLogDeviceTest, RefusedRecords) {
+  auto client = MakeTestClient();
+
+  // Large records, so that the log spans several segments.
+  logid_t logid(1);
+  const int numMessages = 200;
+  const std::string padding(64 * 1024, 'x');
+
+  port::Semaphore checkpoint;
+  std::atomic<int> count{0};
+  int attempts = 0;
+  auto reader = client->createAsyncReader();
+  reader->setRecordCallback(
+    [&] (std::unique_ptr<facebook::logdevice::DataRecord>& rec) {
+      // Refuse every other delivery, the record must be redelivered in order.
+      if (++attempts % 2) {
+        return false;
+      }
+      ASSERT_EQ(std::string(reinterpret_cast<const char*>(rec->payload.data)),
+                std::to_string(count) + padding);
+      if (++count == numMessages) {
+        checkpoint.Post();
+      }
+      rec.reset();
+      return true;
+    });
+  reader->startReading(logid, LSN_OLDEST, LSN_MAX);
+
+  port::Semaphore appended_all;
+  std::atomic<int> appended{0};
+  for (int i = 0; i < numMessages; ++i) {
+    ASSERT_EQ(client->append(logid,
+                             payload(std::to_string(i) + padding),
+                             [&] (facebook::logdevice::Status st,
+                                  const facebook::logdevice::DataRecord&) {
+                               if (st == facebook::logdevice::E::OK &&
+                                   ++appended == numMessages) {
+                                 appended_all.Post();
+                               }
+                             }),
+              0);
+  }
+
+  // Append callbacks may still be running after the reader has seen every
+  // record, so wait for both sides independently.
+  ASSERT_TRUE(checkpoint.TimedWait(std::chrono::seconds(5)));
+  ASSERT_TRUE(appended_all.TimedWait(std::chrono::seconds(5)));
+  ASSERT_EQ(count, numMessages);
+  ASSERT_EQ(appended, numMessages);
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
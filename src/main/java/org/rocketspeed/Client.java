@@ -56,6 +56,25 @@ public class Client implements AutoCloseable {
     return client.subscribe(tenantId, namespaceId, topicName, startSeqno, deliverCb, subscribeCb);
   }
 
+  /**
+   * Subscribes like {@link #subscribe}, but hands received messages to the callback in batches,
+   * which amortises JNI transitions and allocations over many messages. Read the batches with
+   * {@link MessageBatch}.
+   */
+  public long subscribeBatched(
+      int tenantId,
+      String namespaceId,
+      String topicName,
+      long startSeqno,
+      MessageBatchReceivedCallback deliverCb,
+      SubscribeCallback subscribeCb) {
+    if (startSeqno < 0) {
+      throw new IllegalArgumentException("Sequence number must be non-negative");
+    }
+    return client.subscribeBatched(
+        tenantId, namespaceId, topicName, startSeqno, deliverCb, subscribeCb);
+  }
+
   public long subscribe(SubscriptionParameters params, MessageReceivedCallback deliverCb) {
     return subscribe(params, deliverCb, null);
   }
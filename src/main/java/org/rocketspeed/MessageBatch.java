@@ -0,0 +1,103 @@
+package org.rocketspeed;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Read-only view over a batch of messages handed to a
+ * {@link MessageBatchReceivedCallback}. Messages are indexed once per batch. To read contents
+ * without copying or allocating per message, use {@link #getBuffer()} with
+ * {@link #getContentsOffset(int)} and {@link #getContentsSize(int)}.
+ *
+ * <p>Layout, little-endian: {@code int count}, then {@code count} messages, each a header of
+ * {@code (long subHandle, long seqno, int size)} followed by {@code size} bytes of contents.
+ */
+public final class MessageBatch {
+
+  private static final int COUNT_SIZE = 4;
+  private static final int HEADER_SIZE = 20;
+
+  private final ByteBuffer buffer;
+  private final ByteBuffer readOnlyBuffer;
+  // Offset of the header of each message.
+  private final int[] offsets;
+
+  public MessageBatch(byte[] batch) {
+    this.buffer = ByteBuffer.wrap(batch).order(ByteOrder.LITTLE_ENDIAN);
+    this.readOnlyBuffer = buffer.asReadOnlyBuffer();
+    int count = batch.length < COUNT_SIZE ? -1 : buffer.getInt(0);
+    if (count < 0 || (long) count * HEADER_SIZE > batch.length - COUNT_SIZE) {
+      throw new IllegalArgumentException("Malformed message batch");
+    }
+    this.offsets = new int[count];
+    int offset = COUNT_SIZE;
+    for (int i = 0; i < count; ++i) {
+      if (batch.length - offset < HEADER_SIZE) {
+        throw new IllegalArgumentException("Malformed message batch");
+      }
+      int size = buffer.getInt(offset + 16);
+      if (size < 0 || size > batch.length - offset - HEADER_SIZE) {
+        throw new IllegalArgumentException("Malformed message batch");
+      }
+      offsets[i] = offset;
+      offset += HEADER_SIZE + size;
+    }
+  }
+
+  /** Number of messages in the batch. */
+  public int size() {
+    return offsets.length;
+  }
+
+  public long getSubHandle(int index) {
+    return buffer.getLong(headerOffset(index));
+  }
+
+  public long getSeqno(int index) {
+    return buffer.getLong(headerOffset(index) + 8);
+  }
+
+  /**
+   * Returns a read-only buffer over the whole batch, shared by all calls. Contents of message
+   * {@code i} span {@code getContentsSize(i)} bytes from {@code getContentsOffset(i)}. Use absolute
+   * reads, the position and limit of the buffer are not meaningful.
+   */
+  public ByteBuffer getBuffer() {
+    return readOnlyBuffer;
+  }
+
+  /** Offset of the contents of a message in {@link #getBuffer()}. */
+  public int getContentsOffset(int index) {
+    return headerOffset(index) + HEADER_SIZE;
+  }
+
+  /** Size of the contents of a message, in bytes. */
+  public int getContentsSize(int index) {
+    return buffer.getInt(headerOffset(index) + 16);
+  }
+
+  /**
+   * Returns a new read-only view of the contents of a message, valid as long as the batch is. Does
+   * not copy the contents, but allocates the view.
+   */
+  public ByteBuffer getContents(int index) {
+    int offset = getContentsOffset(index);
+    ByteBuffer contents = readOnlyBuffer.duplicate();
+    contents.limit(offset + getContentsSize(index)).position(offset);
+    return contents.slice();
+  }
+
+  /** Copies the contents of a message. */
+  public byte[] getContentsArray(int index) {
+    byte[] array = new byte[getContentsSize(index)];
+    System.arraycopy(buffer.array(), getContentsOffset(index), array, 0, array.length);
+    return array;
+  }
+
+  private int headerOffset(int index) {
+    if (index < 0 || index >= offsets.length) {
+      throw new IndexOutOfBoundsException("Message " + index + " of " + offsets.length);
+    }
+    return offsets[index];
+  }
+}
@@ -78,12 +78,23 @@ class SendCommand : public Command {
    */
   virtual void GetMessage(std::string* out) = 0;
 
+  /**
+   * Appends the part of the message that is specific to the destination at
+   * given index in GetDestinations(). It is sent right before the message
+   * from GetMessage(), which is shared by all destinations. Nothing by
+   * default.
+   */
+  virtual void AppendPrefix(size_t index, std::string* out) {}
+
   /**
    * If this is a command to send a mesage to remote hosts, then returns the
    * list of destination stream specs.
    */
   const Recipients& GetDestinations() const { return recipients_; }
 
+ protected:
+  Recipients* MutableDestinations() { return &recipients_; }
+
  private:
   Recipients recipients_;
 };
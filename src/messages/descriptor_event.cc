@@ -29,4 +29,11 @@ Status DescriptorEvent::Write(Slice data) {
   return Status::OK();
 }
 
+Status DescriptorEvent::Sync() {
+  if (fsync(fd_) != 0) {
+    return Status::IOError(strerror(errno));
+  }
+  return Status::OK();
+}
+
 }  // namespace rocketspeed
@@ -38,6 +38,9 @@ class DescriptorEvent {
 
   Status Write(Slice data);
 
+  /** Flushes written data to the storage device. */
+  Status Sync();
+
  private:
   // The descriptor.
   int fd_;
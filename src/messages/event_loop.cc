@@ -6,14 +6,18 @@
 #define __STDC_FORMAT_MACROS
 #include "event_loop.h"
 
+#include <cxxabi.h>
 #include <limits.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <netinet/in.h>
+#include <algorithm>
+#include <condition_variable>
 #include <deque>
 #include <functional>
 #include <thread>
 #include <tuple>
+#include <unordered_set>
 #include <vector>
 
 #include "src/messages/event2_version.h"
@@ -27,6 +31,7 @@
 #include "external/folly/move_wrapper.h"
 
 #include "src/port/port.h"
+#include "src/port/stack_trace.h"
 #include "src/messages/queues.h"
 #include "src/messages/serializer.h"
 #include "src/messages/stream_socket.h"
@@ -50,40 +55,126 @@ const int EventLoop::kLogSeverityErr = _EVENT_LOG_ERR;
  */
 static const size_t kMaxIovecs = 256;
 
-struct MessageHeader {
-  /**
-   * Attempts to parse slice into a MessageHeader.
-   *
-   * @param in Input bytes (will be advanced past header).
-   * @param header Output header.
-   * @return ok() if fully parsed, error otherwise.
-   */
-  static Status Parse(Slice* in, MessageHeader* header) {
-    if (!GetFixed8(in, &header->version)) {
-      return Status::InvalidArgument("Bad version");
+/** Maximum number of stall records with stacks kept for reporting. */
+static const size_t kMaxRecentStalls = 16;
+
+/** Maximum number of distinct stalled callbacks summarised for reporting. */
+static const size_t kMaxStallSummaries = 64;
+
+/** Maximum number of frames in a sampled stack of a stalled loop. */
+static const int kMaxStallFrames = 32;
+
+static uint64_t SteadyMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* CommandTypeName(CommandType type) {
+  switch (type) {
+    case kSendCommand:
+      return "send";
+    case kAcceptCommand:
+      return "accept";
+    case kExecuteCommand:
+      return "execute";
+    case kNotInitialized:
+      break;
+  }
+  return "invalid";
+}
+
+/**
+ * Single thread for all event loops, which samples stacks of loops that are
+ * stuck in a callback for longer than their stall threshold.
+ */
+class StallWatchdog {
+ public:
+  static StallWatchdog* Get() {
+    // Leaked on purpose, the thread may outlive static destructors.
+    static StallWatchdog* watchdog = new StallWatchdog();
+    return watchdog;
+  }
+
+  void Register(EventLoop* event_loop) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    event_loops_.push_back(event_loop);
+    if (!started_) {
+      started_ = true;
+      std::thread([this] () { Run(); }).detach();
     }
-    if (!GetFixed32(in, &header->size)) {
-      return Status::InvalidArgument("Bad size");
+    cond_.notify_one();
+  }
+
+  void Unregister(EventLoop* event_loop) {
+    // Once we hold the lock, the loop is not being sampled.
+    std::lock_guard<std::mutex> lock(mutex_);
+    event_loops_.erase(
+        std::remove(event_loops_.begin(), event_loops_.end(), event_loop),
+        event_loops_.end());
+  }
+
+ private:
+  StallWatchdog() = default;
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cond_.wait(lock, [this] () { return !event_loops_.empty(); });
+      const uint64_t now = SteadyMicros();
+      for (EventLoop* event_loop : event_loops_) {
+        event_loop->SampleIfStalled(now);
+      }
+      cond_.wait_for(lock, std::chrono::milliseconds(10));
     }
-    return Status::OK();
   }
 
-  /**
-   * @return Header encoded as string.
-   */
-  std::string ToString() {
-    std::string result;
-    result.reserve(encoding_size);
-    PutFixed8(&result, version);
-    PutFixed32(&result, size);
-    return result;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<EventLoop*> event_loops_;
+  bool started_ = false;
+};
+
+/**
+ * Times a callback run by the loop thread. The outermost callback is
+ * published to other threads for stall detection and reporting.
+ */
+class EventLoop::ProfileScope {
+ public:
+  ProfileScope(EventLoop* event_loop,
+               Histogram* latency,
+               const char* kind,
+               const std::type_info* type)
+  : event_loop_(event_loop)
+  , latency_(latency)
+  , start_micros_(SteadyMicros()) {
+    if (event_loop_->callback_depth_++ == 0) {
+      const auto relaxed = std::memory_order_relaxed;
+      event_loop_->callback_kind_.store(kind, relaxed);
+      event_loop_->callback_type_.store(type, relaxed);
+      event_loop_->callback_seqno_.store(
+          event_loop_->callback_seqno_.load(relaxed) + 1, relaxed);
+      event_loop_->callback_start_micros_.store(start_micros_);
+    }
   }
 
-  uint8_t version;
-  uint32_t size;
+  ~ProfileScope() {
+    const uint64_t end_micros = SteadyMicros();
+    const uint64_t micros = end_micros - start_micros_;
+    latency_->Record(micros);
+    if (--event_loop_->callback_depth_ == 0) {
+      event_loop_->callback_start_micros_.store(0);
+      const auto threshold = std::chrono::microseconds(
+          event_loop_->options_.stall_threshold).count();
+      if (threshold > 0 && micros >= static_cast<uint64_t>(threshold)) {
+        event_loop_->RecordStall(micros, end_micros);
+      }
+    }
+  }
 
-  /** Size of MessageHeader encoding */
-  static constexpr size_t encoding_size = sizeof(version) + sizeof(size);
+ private:
+  EventLoop* event_loop_;
+  Histogram* latency_;
+  const uint64_t start_micros_;
 };
 
 struct TimestampedString {
@@ -140,6 +231,7 @@ class SocketEvent {
   Status Enqueue(std::shared_ptr<TimestampedString> msg) {
     event_loop_->thread_check_.Check();
 
+    send_queue_bytes_ += msg->string.size();
     send_queue_.emplace_back(std::move(msg));
 
     // If the write-ready event is not currently registered, add a write
@@ -155,6 +247,19 @@ class SocketEvent {
     return destination_;
   }
 
+  /**
+   * Checks whether the send queue is below the limit. If not, the stream is
+   * reported to the stream writable callback once the queue drains.
+   */
+  bool IsWritable(StreamID global) {
+    const size_t limit = event_loop_->options_.send_queue_limit;
+    if (limit == 0 || send_queue_bytes_ < limit) {
+      return true;
+    }
+    blocked_streams_.insert(global);
+    return false;
+  }
+
   std::list<std::unique_ptr<SocketEvent>>::iterator GetListHandle() const {
     return list_handle_;
   }
@@ -163,6 +268,26 @@ class SocketEvent {
     list_handle_ = it;
   }
 
+  /**
+   * Closes the socket if it doesn't become writable within provided timeout.
+   * Non-blocking connects do eventually timeout after ~2 minutes, but this
+   * is too long, and generally non-configurable.
+   */
+  void StartConnectTimeout(std::chrono::microseconds timeout) {
+    connect_timeout_ = event_loop_->ScheduleTimeout(timeout, [this]() {
+      connect_timeout_ = 0;
+      Disconnect(this, true);
+    });
+  }
+
+  /** Cancels the connect timeout, if any. */
+  void CancelConnectTimeout() {
+    if (connect_timeout_) {
+      event_loop_->CancelTimeout(connect_timeout_);
+      connect_timeout_ = 0;
+    }
+  }
+
   /**
    * Does everything necessary to close a socket connection: removes streams,
    * cleans up connection cache, dispatches goodbyes, and frees the SocketEvent.
@@ -197,11 +322,13 @@ class SocketEvent {
   : hdr_idx_(0)
   , msg_idx_(0)
   , msg_size_(0)
+  , origin_size_(0)
   , fd_(fd)
   , event_loop_(event_loop)
   , write_ev_added_(false)
   , was_initiated_(initiated)
-  , timeout_cancelled_(false) {
+  , connect_timeout_(0)
+  , send_queue_bytes_(0) {
     // Can only add events from the event loop thread.
     event_loop->thread_check_.Check();
 
@@ -224,15 +351,31 @@ class SocketEvent {
         if (!WriteCallback().ok()) {
           Disconnect(this, false);
         } else {
+          NotifyWritable();
           ProcessHeartbeats();
         }
       });
   }
 
+  // Reports blocked streams as writable once the send queue has drained to
+  // half of the limit, so that they don't flip on every write.
+  void NotifyWritable() {
+    if (blocked_streams_.empty() ||
+        send_queue_bytes_ > event_loop_->options_.send_queue_limit / 2) {
+      return;
+    }
+    std::unordered_set<StreamID> blocked;
+    blocked.swap(blocked_streams_);
+    if (event_loop_->options_.stream_writable_callback) {
+      for (StreamID global : blocked) {
+        event_loop_->options_.stream_writable_callback(global);
+      }
+    }
+  }
+
   void ProcessHeartbeats() {
     if (event_loop_->heartbeat_enabled_) {
       event_loop_->heartbeat_.ProcessExpired(
-        event_loop_->heartbeat_timeout_,
         event_loop_->heartbeat_expired_callback_,
         event_loop_->heartbeat_expire_batch_);
     }
@@ -241,11 +384,8 @@ class SocketEvent {
   Status WriteCallback() {
     event_loop_->thread_check_.Check();
 
-    if (!timeout_cancelled_) {
-      // This socket is now writable, so we can cancel the connect timeout.
-      event_loop_->connect_timeout_.Erase(this);
-      timeout_cancelled_ = true;
-    }
+    // This socket is now writable, so we can cancel the connect timeout.
+    CancelConnectTimeout();
 
     assert(send_queue_.size() > 0);
 
@@ -321,6 +461,7 @@ class SocketEvent {
           }
           event_loop_->stats_.write_latency->Record(
             event_loop_->env_->NowMicros() - item->issued_time);
+          send_queue_bytes_ -= item->string.size();
           send_queue_.pop_front();
         }
         event_loop_->stats_.write_succeed_iovec->Record(iovcnt);
@@ -352,6 +493,7 @@ class SocketEvent {
     // This will keep reading while there is data to be read,
     // but not more than 1MB to give other sockets a chance to read.
     ssize_t total_read = 0;
+    const bool raw = !!event_loop_->options_.raw_message_callback;
     while (total_read < 1024 * 1024) {
       if (hdr_idx_ < sizeof(hdr_buf_)) {
         // Read the header.
@@ -383,13 +525,35 @@ class SocketEvent {
           return st;
         }
         msg_size_ = hdr.size;
-        msg_buf_.reset(new char[msg_size_]);
+        if (raw) {
+          // The origin is received separately, so that the serialized message
+          // starts the buffer, which is handed over to the callback, which may
+          // append to it.
+          origin_size_ = std::min<size_t>(msg_size_, sizeof(origin_buf_));
+          raw_buf_.reserve(msg_size_ - origin_size_ +
+                           event_loop_->options_.raw_message_reserve);
+          raw_buf_.resize(msg_size_ - origin_size_);
+        } else {
+          msg_buf_.reset(new char[msg_size_]);
+        }
         msg_idx_ = 0;
       }
       assert(msg_idx_ < msg_size_);
 
       ssize_t count = msg_size_ - msg_idx_;
-      ssize_t n = read(fd_, msg_buf_.get() + msg_idx_, count);
+      ssize_t n;
+      if (!raw) {
+        n = read(fd_, msg_buf_.get() + msg_idx_, count);
+      } else if (msg_idx_ < origin_size_) {
+        iovec iov[2];
+        iov[0].iov_base = origin_buf_ + msg_idx_;
+        iov[0].iov_len = origin_size_ - msg_idx_;
+        iov[1].iov_base = &raw_buf_[0];
+        iov[1].iov_len = raw_buf_.size();
+        n = readv(fd_, iov, 2);
+      } else {
+        n = read(fd_, &raw_buf_[msg_idx_ - origin_size_], count);
+      }
       // If n == -1 then an error has occurred (don't close on EAGAIN though).
       // If n == 0 and this is our first read (total_read == 0) then this
       // means the other end has closed, so we should close, too.
@@ -412,20 +576,30 @@ class SocketEvent {
       // No reader state modification shall happen after this point.
 
       // Process received message.
-      Slice in(msg_buf_.get(), msg_size_);
+      Slice in = raw ? Slice(origin_buf_, origin_size_)
+                     : Slice(msg_buf_.get(), msg_size_);
 
       // Decode the recipients.
       StreamID local = 0;
       if (!DecodeOrigin(&in, &local)) {
         continue;
       }
+      if (raw) {
+        in = Slice(raw_buf_);
+      }
 
-      // Decode the rest of the message.
-      std::unique_ptr<Message> msg =
-          Message::CreateNewInstance(std::move(msg_buf_), in);
-      if (!msg) {
-        LOG_WARN(event_loop_->GetLog(), "Failed to decode message");
-        continue;
+      // Decode the rest of the message, unless it can be passed on undecoded.
+      std::unique_ptr<Message> msg;
+      MessageType msg_type;
+      if (!raw || !Message::PeekMessageType(in, &msg_type) ||
+          msg_type == MessageType::mGoodbye) {
+        msg = raw ? Message::CreateNewInstance(in.ToUniqueChars(), in.size())
+                  : Message::CreateNewInstance(std::move(msg_buf_), in);
+        if (!msg) {
+          LOG_WARN(event_loop_->GetLog(), "Failed to decode message");
+          continue;
+        }
+        msg_type = msg->GetMessageType();
       }
 
       // We need to remap stream ID local to the connection into globally
@@ -456,10 +630,9 @@ class SocketEvent {
       }
 
       if (do_insert && event_loop_->heartbeat_enabled_) {
-        event_loop_->heartbeat_.Add(global);
+        event_loop_->heartbeat_.Add(global, event_loop_->heartbeat_timeout_);
       }
 
-      const MessageType msg_type = msg->GetMessageType();
       if (msg_type == MessageType::mGoodbye) {
         MessageGoodbye* goodbye = static_cast<MessageGoodbye*>(msg.get());
         LOG_INFO(event_loop_->GetLog(),
@@ -484,7 +657,12 @@ class SocketEvent {
       event_loop_->stats_.messages_received[size_t(msg_type)]->Add(1);
 
       // Invoke the callback for this message.
-      event_loop_->Dispatch(std::move(msg), global);
+      if (msg) {
+        event_loop_->Dispatch(std::move(msg), global);
+      } else {
+        event_loop_->DispatchRaw(msg_type, std::move(raw_buf_), global);
+        raw_buf_.clear();
+      }
     }
     return Status::OK();
   }
@@ -494,13 +672,16 @@ class SocketEvent {
   size_t msg_idx_;
   size_t msg_size_;
   std::unique_ptr<char[]> msg_buf_;  // receive buffer
+  std::string raw_buf_;  // receive buffer when messages are not decoded
+  char origin_buf_[sizeof(uint64_t)];  // origin of a message not decoded
+  size_t origin_size_;
   evutil_socket_t fd_;
   std::unique_ptr<EventCallback> read_ev_;
   std::unique_ptr<EventCallback> write_ev_;
   EventLoop* event_loop_;
   bool write_ev_added_;    // is the write event added?
   bool was_initiated_;   // was this connection initiated by us?
-  bool timeout_cancelled_;   // have we removed from EventLoop connect_timeout_?
+  TimeoutID connect_timeout_;   // pending connect timeout, zero if none
 
   /**
    * A remote destination, if non-empty the socket can be reused by anyone, who
@@ -515,6 +696,10 @@ class SocketEvent {
   // partial_ records the next valid offset in the earliest message.
   std::deque<std::shared_ptr<TimestampedString>> send_queue_;
   Slice partial_;
+  // Total size of the messages in send_queue_, including the partial one.
+  size_t send_queue_bytes_;
+  // Streams found not writable, to be reported once the queue drains.
+  std::unordered_set<StreamID> blocked_streams_;
 };
 
 class AcceptCommand : public Command {
@@ -522,14 +707,38 @@ class AcceptCommand : public Command {
   explicit AcceptCommand(int fd)
       : fd_(fd) {}
 
+  // Closes the accepted socket if the command was never handled, e.g. when
+  // the loop was stopped, so that the peer observes the connection closing.
+  ~AcceptCommand() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
   CommandType GetCommandType() const { return kAcceptCommand; }
 
-  int GetFD() const { return fd_; }
+  /** Transfers ownership of the socket to the caller. */
+  int ReleaseFD() {
+    int fd = fd_;
+    fd_ = -1;
+    return fd;
+  }
 
  private:
   int fd_;
 };
 
+SocketEvent* StreamRouter::FindConnection(StreamID global) {
+  thread_check_.Check();
+
+  SocketEvent* sev;
+  StreamID local;
+  if (open_streams_.FindLocalAndContext(global, &sev, &local)) {
+    return sev;
+  }
+  return nullptr;
+}
+
 Status StreamRouter::GetOutboundStream(const SendCommand::StreamSpec& spec,
                                        EventLoop* event_loop,
                                        SocketEvent** out_sev,
@@ -652,11 +861,12 @@ void EventLoop::HandleSendCommand(std::unique_ptr<Command> command) {
   auto msg = std::make_shared<TimestampedString>();
   send_cmd->GetMessage(&msg->string);
   msg->issued_time = now;
-  assert (!msg->string.empty());
 
   // Have to handle the case when the message-send failed to write
   // to output socket and have to invoke *some* callback to the app.
-  for (const SendCommand::StreamSpec& spec : send_cmd->GetDestinations()) {
+  const SendCommand::Recipients& recipients = send_cmd->GetDestinations();
+  for (size_t i = 0; i < recipients.size(); ++i) {
+    const SendCommand::StreamSpec& spec = recipients[i];
     // Find or create a connection and original stream ID.
     SocketEvent* sev = nullptr;
     StreamID local;
@@ -674,23 +884,22 @@ void EventLoop::HandleSendCommand(std::unique_ptr<Command> command) {
 
       // Enqueue data to SocketEvent queue. This message will be sent out
       // when the output socket is ready to write.
-      auto destinations = std::make_shared<TimestampedString>();
-      EncodeOrigin(&destinations->string, local);
-      destinations->issued_time = now;
+      std::string destination;
+      EncodeOrigin(&destination, local);
+      send_cmd->AppendPrefix(i, &destination);
+      assert(!destination.empty());
 
-      size_t frame_size = destinations->string.size() + msg->string.size();
+      size_t frame_size = destination.size() + msg->string.size();
       MessageHeader header { ROCKETSPEED_CURRENT_MSG_VERSION,
                              static_cast<uint32_t>(frame_size) };
       auto hdr = std::make_shared<TimestampedString>();
       hdr->string = header.ToString();
+      hdr->string.append(destination);
       hdr->issued_time = now;
 
-      // Add message header, destinations, and contents.
+      // Add message header with destination, and shared contents.
       st = sev->Enqueue(std::move(hdr));
-      if (st.ok()) {
-        st = sev->Enqueue(std::move(destinations));
-      }
-      if (st.ok()) {
+      if (st.ok() && !msg->string.empty()) {
         st = sev->Enqueue(msg);
       }
     }
@@ -718,8 +927,8 @@ void EventLoop::HandleAcceptCommand(std::unique_ptr<Command> command) {
   // itself during an EOF callback.
   thread_check_.Check();
   AcceptCommand* accept_cmd = static_cast<AcceptCommand*>(command.get());
-  std::unique_ptr<SocketEvent> sev = SocketEvent::Create(this,
-                                                         accept_cmd->GetFD());
+  std::unique_ptr<SocketEvent> sev =
+      SocketEvent::Create(this, accept_cmd->ReleaseFD());
   if (sev) {
     all_sockets_.emplace_front(std::move(sev));
     all_sockets_.front()->SetListHandle(all_sockets_.begin());
@@ -742,9 +951,32 @@ EventLoop::do_startevent(evutil_socket_t listener, short event, void *arg) {
 void
 EventLoop::do_timerevent(evutil_socket_t listener, short event, void *arg) {
   Timer* obj = static_cast<Timer*>(arg);
+  ProfileScope profile(obj->event_loop,
+                       obj->event_loop->stats_.timer_latency,
+                       "timer",
+                       &obj->callback.target_type());
   obj->callback();
 }
 
+void
+EventLoop::do_timeoutevent(evutil_socket_t listener, short event, void *arg) {
+  EventLoop* obj = static_cast<EventLoop*>(arg);
+  obj->thread_check_.Check();
+  obj->timeout_event_deadline_ = std::chrono::steady_clock::time_point::max();
+  obj->timeouts_.ProcessExpired([obj](TimeoutID timeout_id) {
+    auto it = obj->timeout_callbacks_.find(timeout_id);
+    assert(it != obj->timeout_callbacks_.end());
+    TimerCallbackType callback = std::move(it->second);
+    obj->timeout_callbacks_.erase(it);
+    ProfileScope profile(obj,
+                         obj->stats_.timer_latency,
+                         "timeout",
+                         &callback.target_type());
+    callback();
+  });
+  obj->RearmTimeoutEvent();
+}
+
 void
 EventLoop::do_accept(evconnlistener *listener,
                      evutil_socket_t fd,
@@ -865,6 +1097,17 @@ EventLoop::Initialize() {
     return Status::InternalError("Failed to add startup event to event base");
   }
 
+  // A non-persistent event, which is rearmed to fire when the earliest
+  // scheduled timeout is due.
+  timeout_event_ = evtimer_new(
+    base_,
+    this->do_timeoutevent,
+    reinterpret_cast<void*>(this));
+  if (timeout_event_ == nullptr) {
+    return Status::InternalError("Failed to create timeout event");
+  }
+  timeout_event_deadline_ = std::chrono::steady_clock::time_point::max();
+
   // An event that signals the shutdown of the event loop.
   if (shutdown_eventfd_.status() < 0) {
     return Status::InternalError(
@@ -908,21 +1151,23 @@ void EventLoop::Run() {
   LOG_VITAL(info_log_, "Starting EventLoop at port %d", port_number_);
   info_log_->Flush();
 
-  // Register a timer for checking expired connections.
-  RegisterTimerCallback(
-    [this] () {
-      connect_timeout_.ProcessExpired(
-        options_.connect_timeout,
-        [](SocketEvent* sev) { SocketEvent::Disconnect(sev, true); },
-        -1);
-    },
-    options_.connect_timeout);
-
   // Start the event loop.
   // This will not exit until Stop is called, or some error
   // happens within libevent.
   thread_check_.Reset();
+  // Statistics may have been updated while initialising on another thread.
+  // Only the thread checks are reset, snapshots may be taken concurrently.
+  stats_.all.ResetThreadChecks();
+  loop_thread_ = pthread_self();
+  const bool watched = options_.sample_stalled_stacks &&
+                       options_.stall_threshold.count() > 0;
+  if (watched) {
+    StallWatchdog::Get()->Register(this);
+  }
   event_base_dispatch(base_);
+  if (watched) {
+    StallWatchdog::Get()->Unregister(this);
+  }
 
   // Shutdown everything
   if (listener_) {
@@ -934,7 +1179,16 @@ void EventLoop::Run() {
   for (auto& timer : timers_) {
     event_free(timer->loop_event);
   }
-  incoming_queues_.clear();
+  if (timeout_event_) {
+    event_free(timeout_event_);
+    timeout_event_ = nullptr;
+  }
+  timeouts_.Clear();
+  timeout_callbacks_.clear();
+  {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    incoming_queues_.clear();
+  }
   shutdown_event_.reset();
   teardown_all_connections();
   event_base_free(base_);
@@ -969,6 +1223,7 @@ Status EventLoop::RegisterTimerCallback(TimerCallbackType callback,
   assert(!IsRunning());
 
   std::unique_ptr<Timer> timer(new Timer(std::move(callback)));
+  timer->event_loop = this;
   timer->loop_event = event_new(
     base_,
     -1,
@@ -997,6 +1252,47 @@ Status EventLoop::RegisterTimerCallback(TimerCallbackType callback,
   return Status::OK();
 }
 
+TimeoutID EventLoop::ScheduleTimeout(std::chrono::microseconds timeout,
+                                     TimerCallbackType callback) {
+  thread_check_.Check();
+  assert(timeout_event_);
+
+  const TimeoutID timeout_id = next_timeout_id_++;
+  timeouts_.Add(timeout_id, timeout);
+  timeout_callbacks_.emplace(timeout_id, std::move(callback));
+  RearmTimeoutEvent();
+  return timeout_id;
+}
+
+bool EventLoop::CancelTimeout(TimeoutID timeout_id) {
+  thread_check_.Check();
+  if (!timeouts_.Erase(timeout_id)) {
+    return false;
+  }
+  timeout_callbacks_.erase(timeout_id);
+  // The event might fire early, but this is harmless.
+  return true;
+}
+
+void EventLoop::RearmTimeoutEvent() {
+  const auto deadline = timeouts_.GetNextDeadline();
+  if (deadline >= timeout_event_deadline_) {
+    // Event is already armed to fire early enough, or nothing to wait for.
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::max(deadline - now, std::chrono::steady_clock::duration::zero()));
+  timeval timeout_time;
+  timeout_time.tv_sec = delay.count() / 1000000ULL;
+  timeout_time.tv_usec = delay.count() % 1000000ULL;
+  if (evtimer_add(timeout_event_, &timeout_time) != 0) {
+    LOG_ERROR(info_log_, "Failed to add timeout event to event base");
+    return;
+  }
+  timeout_event_deadline_ = deadline;
+}
+
 StreamSocket EventLoop::CreateOutboundStream(HostId destination) {
   return StreamSocket(std::move(destination), outbound_allocator_.Next());
 }
@@ -1077,7 +1373,9 @@ Status EventLoop::AddIncomingQueue(
   queue->SetReadEnabled(true);
 
   LOG_INFO(info_log_, "Added new command queue to EventLoop");
+  std::lock_guard<std::mutex> lock(profile_mutex_);
   incoming_queues_.emplace_back(std::move(incoming_queue));
+  stats_.queue_count->Set(incoming_queues_.size());
   return Status::OK();
 }
 
@@ -1126,6 +1424,12 @@ Status EventLoop::SendResponse(const Message& msg, StreamID stream_id) {
   return SendCommand(command);
 }
 
+bool EventLoop::IsStreamWritable(StreamID stream_id) {
+  thread_check_.Check();
+  SocketEvent* sev = stream_router_.FindConnection(stream_id);
+  return !sev || sev->IsWritable(stream_id);
+}
+
 void EventLoop::Accept(int fd) {
   // May be called from another thread, so must add to the command queue.
   std::unique_ptr<Command> command(new AcceptCommand(fd));
@@ -1133,9 +1437,21 @@ void EventLoop::Accept(int fd) {
 }
 
 void EventLoop::Dispatch(std::unique_ptr<Message> message, StreamID origin) {
+  ProfileScope profile(this,
+                       stats_.message_latency,
+                       MessageTypeName(message->GetMessageType()),
+                       nullptr);
   event_callback_(std::move(message), origin);
 }
 
+void EventLoop::DispatchRaw(MessageType type,
+                            std::string message,
+                            StreamID origin) {
+  ProfileScope profile(
+      this, stats_.message_latency, MessageTypeName(type), nullptr);
+  options_.raw_message_callback(type, std::move(message), origin);
+}
+
 void EventLoop::Dispatch(std::unique_ptr<Command> command) {
   stats_.commands_processed->Add(1);
 
@@ -1144,6 +1460,10 @@ void EventLoop::Dispatch(std::unique_ptr<Command> command) {
   const auto type = command->GetCommandType();
   auto iter = command_callbacks_.find(type);
   if (iter != command_callbacks_.end()) {
+    ProfileScope profile(this,
+                         stats_.command_latency[type],
+                         CommandTypeName(type),
+                         &typeid(*command));
     iter->second(std::move(command));
   } else {
     // If the user has not registered a callback for this command type, then
@@ -1167,7 +1487,7 @@ Status EventLoop::WaitUntilRunning(std::chrono::seconds timeout) {
 void EventLoop::teardown_connection(SocketEvent* sev, bool timed_out) {
   thread_check_.Check();
   if (!timed_out) {
-    connect_timeout_.Erase(sev);
+    sev->CancelConnectTimeout();
   }
   all_sockets_.erase(sev->GetListHandle());
   active_connections_.fetch_sub(1, std::memory_order_acq_rel);
@@ -1202,7 +1522,7 @@ EventLoop::setup_connection(const HostId& destination) {
   if (!sev) {
     return nullptr;
   }
-  connect_timeout_.Add(sev.get());
+  sev->StartConnectTimeout(options_.connect_timeout);
   all_sockets_.emplace_front(std::move(sev));
   all_sockets_.front()->SetListHandle(all_sockets_.begin());
   active_connections_.fetch_add(1, std::memory_order_acq_rel);
@@ -1305,6 +1625,10 @@ EventLoop::EventLoop(BaseEnv* env,
     , outbound_allocator_(std::move(allocator))
     , active_connections_(0)
     , stats_(options_.stats_prefix)
+    , callback_start_micros_(0)
+    , callback_kind_(nullptr)
+    , callback_type_(nullptr)
+    , callback_seqno_(0)
     , queue_stats_(std::make_shared<QueueStats>(options_.stats_prefix +
                                                 ".queues"))
     , default_command_queue_size_(options_.command_queue_size) {
@@ -1367,15 +1691,163 @@ EventLoop::Stats::Stats(const std::string& prefix) {
     messages_received[i] = all.AddCounter(
       prefix + ".messages_received." + MessageTypeName(MessageType(i)));
   }
+  command_latency[kNotInitialized] = nullptr;
+  for (CommandType type : {kSendCommand, kAcceptCommand, kExecuteCommand}) {
+    command_latency[type] = all.AddLatency(
+      prefix + ".command_latency." + CommandTypeName(type));
+  }
+  message_latency = all.AddLatency(prefix + ".message_latency");
+  timer_latency = all.AddLatency(prefix + ".timer_latency");
+  stalls = all.AddCounter(prefix + ".stalls");
 }
 
 Statistics EventLoop::GetStatistics() const {
-  stats_.queue_count->Set(incoming_queues_.size());
   Statistics stats = stats_.all;
   stats.Aggregate(queue_stats_->all);
   return stats;
 }
 
+std::string EventLoop::DescribeCallback() const {
+  const char* kind = callback_kind_.load(std::memory_order_relaxed);
+  const std::type_info* type = callback_type_.load(std::memory_order_relaxed);
+  std::string result = kind ? kind : "unknown";
+  if (type) {
+    int status = 0;
+    char* demangled =
+        abi::__cxa_demangle(type->name(), nullptr, nullptr, &status);
+    result += " ";
+    result += status == 0 && demangled ? demangled : type->name();
+    free(demangled);
+  }
+  return result;
+}
+
+void EventLoop::RecordStall(uint64_t micros, uint64_t end_micros) {
+  stats_.stalls->Add(1);
+  StallRecord record;
+  record.callback = DescribeCallback();
+  record.micros = micros;
+  record.end_micros = end_micros;
+  LOG_WARN(info_log_,
+           "EventLoop stalled for %" PRIu64 "us in %s",
+           micros,
+           record.callback.c_str());
+
+  std::lock_guard<std::mutex> lock(profile_mutex_);
+  if (sampled_stack_seqno_ == callback_seqno_.load()) {
+    record.stack = std::move(sampled_stack_);
+    sampled_stack_.clear();
+  }
+  auto it = stall_summary_.find(record.callback);
+  if (it == stall_summary_.end() &&
+      stall_summary_.size() < kMaxStallSummaries) {
+    it = stall_summary_.emplace(record.callback, StallSummary()).first;
+  }
+  if (it != stall_summary_.end()) {
+    it->second.count++;
+    it->second.total_micros += micros;
+    it->second.max_micros = std::max(it->second.max_micros, micros);
+  }
+  recent_stalls_.emplace_back(std::move(record));
+  if (recent_stalls_.size() > kMaxRecentStalls) {
+    recent_stalls_.pop_front();
+  }
+}
+
+void EventLoop::SampleIfStalled(uint64_t now_micros) {
+  const uint64_t start = callback_start_micros_.load();
+  const auto threshold =
+      std::chrono::microseconds(options_.stall_threshold).count();
+  if (start == 0 || now_micros < start + threshold) {
+    return;
+  }
+  const uint64_t seqno = callback_seqno_.load();
+  {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (sampled_stack_seqno_ == seqno) {
+      // Already sampled this callback.
+      return;
+    }
+  }
+  void* frames[kMaxStallFrames];
+  const int num_frames = port::CaptureThreadStack(
+      loop_thread_, frames, kMaxStallFrames, std::chrono::milliseconds(100));
+  if (num_frames == 0 || callback_seqno_.load() != seqno) {
+    return;
+  }
+  std::string stack = port::SymbolizeStack(frames, num_frames);
+  std::lock_guard<std::mutex> lock(profile_mutex_);
+  sampled_stack_seqno_ = seqno;
+  sampled_stack_ = std::move(stack);
+}
+
+std::string EventLoop::GetProfileInfo() const {
+  char buffer[256];
+  std::string result;
+  const uint64_t now = SteadyMicros();
+
+  // Snapshots of histograms may be taken from any thread.
+  for (CommandType type : {kSendCommand, kAcceptCommand, kExecuteCommand}) {
+    snprintf(buffer, sizeof(buffer), "command_latency.%s: ",
+             CommandTypeName(type));
+    result += buffer + Histogram(*stats_.command_latency[type]).Report();
+    result += "\n";
+  }
+  result += "message_latency: " + Histogram(*stats_.message_latency).Report();
+  result += "\ntimer_latency: " + Histogram(*stats_.timer_latency).Report();
+  result += "\n";
+
+  const uint64_t start = callback_start_micros_.load();
+  if (start != 0 && now > start) {
+    snprintf(buffer, sizeof(buffer), "running for %" PRIu64 "us: ",
+             now - start);
+    result += buffer + DescribeCallback() + "\n";
+  }
+
+  std::lock_guard<std::mutex> lock(profile_mutex_);
+  for (size_t i = 0; i < incoming_queues_.size(); ++i) {
+    const CommandQueue* queue = incoming_queues_[i]->queue.get();
+    const auto dwell = queue->GetDwellStats();
+    snprintf(buffer, sizeof(buffer),
+             "queue[%zu] size: %zu reads: %" PRIu64 " avg_dwell: %" PRIu64
+             "us max_dwell: %" PRIu64 "us\n",
+             i,
+             queue->GetSize(),
+             dwell.reads,
+             dwell.reads ? dwell.total_micros / dwell.reads : 0,
+             dwell.max_micros);
+    result += buffer;
+  }
+  if (sampled_stack_seqno_ == callback_seqno_.load() && start != 0) {
+    result += "stack of running callback:\n" + sampled_stack_;
+  }
+
+  // Slowest callbacks first.
+  std::vector<std::pair<std::string, StallSummary>> summaries(
+      stall_summary_.begin(), stall_summary_.end());
+  std::sort(summaries.begin(), summaries.end(),
+            [] (const std::pair<std::string, StallSummary>& a,
+                const std::pair<std::string, StallSummary>& b) {
+              return a.second.max_micros > b.second.max_micros;
+            });
+  for (const auto& entry : summaries) {
+    snprintf(buffer, sizeof(buffer),
+             "stalls: %" PRIu64 " avg: %" PRIu64 "us max: %" PRIu64 "us in ",
+             entry.second.count,
+             entry.second.total_micros / entry.second.count,
+             entry.second.max_micros);
+    result += buffer + entry.first + "\n";
+  }
+  for (auto it = recent_stalls_.rbegin(); it != recent_stalls_.rend(); ++it) {
+    snprintf(buffer, sizeof(buffer),
+             "stalled %" PRIu64 "us, %" PRIu64 "ms ago in ",
+             it->micros,
+             (now - it->end_micros) / 1000);
+    result += buffer + it->callback + "\n" + it->stack;
+  }
+  return result;
+}
+
 EventLoop::~EventLoop() {
   // Event loop should already be stopped by this point, and the running
   // thread should be joined.
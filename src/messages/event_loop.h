@@ -15,12 +15,14 @@
 
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <functional>
 #include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <tuple>
+#include <typeinfo>
 #include <unordered_map>
 #include <vector>
 
@@ -36,7 +38,7 @@
 #include "src/util/common/statistics.h"
 #include "src/util/common/thread_check.h"
 #include "src/util/common/thread_local.h"
-#include "src/util/timeout_list.h"
+#include "src/util/timer_wheel.h"
 
 // libevent2 forward declarations.
 struct event;
@@ -58,6 +60,9 @@ typedef std::function<void(std::unique_ptr<Command> command)>
 
 typedef std::function<void()> TimerCallbackType;
 
+// Identifies a one-shot timeout scheduled on an EventLoop.
+typedef uint64_t TimeoutID;
+
 class CommandQueue;
 class EventCallback;
 class EventLoop;
@@ -92,6 +97,12 @@ class StreamRouter {
                            SocketEvent** out_sev,
                            StreamID* out_local);
 
+  /**
+   * Returns the connection of given stream (identified by global stream ID),
+   * or null if the stream is not open.
+   */
+  SocketEvent* FindConnection(StreamID global);
+
   typedef UniqueStreamMap<SocketEvent*>::GetGlobalStatus RemapStatus;
 
   /**
@@ -198,6 +209,27 @@ class EventLoop {
   Status RegisterTimerCallback(TimerCallbackType callback,
                              std::chrono::microseconds period);
 
+  /**
+   * Schedules a callback to be invoked once on the event loop thread after
+   * provided timeout. Unlike periodic timer callbacks, the loop wakes up
+   * precisely when the earliest timeout is due.
+   * Must be called on the event loop thread.
+   *
+   * @param timeout Time after which the callback is invoked.
+   * @param callback The callback.
+   * @return An ID which can be used to cancel the timeout.
+   */
+  TimeoutID ScheduleTimeout(std::chrono::microseconds timeout,
+                            TimerCallbackType callback);
+
+  /**
+   * Cancels a timeout, if it has not fired yet.
+   * Must be called on the event loop thread.
+   *
+   * @return true iff the timeout was cancelled.
+   */
+  bool CancelTimeout(TimeoutID timeout_id);
+
   /**
    * Returns stream ID allocator used by this event loop to create outbound
    * streams.
@@ -232,6 +264,19 @@ class EventLoop {
 
   Status SendResponse(const Message& msg, StreamID stream_id);
 
+  /**
+   * Checks whether the connection of a stream has less than
+   * Options::send_queue_limit bytes waiting to be sent. If not, the stream
+   * is passed to Options::stream_writable_callback once the backlog drains.
+   * Messages can still be sent on a stream that is not writable, they are
+   * queued regardless of the limit.
+   * Must be called on the event loop thread.
+   *
+   * @param stream_id ID of the stream.
+   * @return true iff the stream is writable, or not open.
+   */
+  bool IsStreamWritable(StreamID stream_id);
+
   // Start communicating on a fd.
   // This call is thread-safe.
   void Accept(int fd);
@@ -239,6 +284,9 @@ class EventLoop {
   // Dispatches a message to the event callback.
   void Dispatch(std::unique_ptr<Message> message, StreamID origin);
 
+  // Dispatches an undecoded message to Options::raw_message_callback.
+  void DispatchRaw(MessageType type, std::string message, StreamID origin);
+
   /**
    * Invokes callback for provided command in the calling thread.
    * Can only be called from the message loop thread.
@@ -250,8 +298,17 @@ class EventLoop {
   // Get the info log.
   const std::shared_ptr<Logger>& GetLog() { return info_log_; }
 
+  // Takes a snapshot of statistics, may be called from any thread.
   Statistics GetStatistics() const;
 
+  /**
+   * Reports where time is spent on this loop: execution latency per command
+   * type, dwell time per incoming queue, the callback currently running and
+   * the slowest callbacks, with stacks sampled while they were stalled.
+   * Thread-safe, may be called while the loop is blocked.
+   */
+  std::string GetProfileInfo() const;
+
   void ThreadCheck() const {
     thread_check_.Check();
   }
@@ -365,11 +422,33 @@ class EventLoop {
     bool heartbeat_enabled = false;
     // timeout for asynchronous ::connect calls
     std::chrono::milliseconds connect_timeout{10000};
+    // callbacks running for longer than this are reported as stalls,
+    // zero disables stall detection
+    std::chrono::milliseconds stall_threshold{0};
+    // whether to sample the stack of the loop thread while it is stalled,
+    // which installs a SIGUSR2 handler for the whole process
+    bool sample_stalled_stacks = false;
+    // bytes waiting to be sent on a connection above which its streams are
+    // not writable, zero disables the limit
+    size_t send_queue_limit = 0;
+    // invoked on the event loop thread when a stream that was found not
+    // writable by IsStreamWritable can be written to again
+    std::function<void(StreamID)> stream_writable_callback;
+    // if set, received messages other than goodbyes are not decoded, but
+    // passed to this callback on the event loop thread as serialized
+    // messages, with the origin stream stripped
+    std::function<void(MessageType, std::string, StreamID)>
+        raw_message_callback;
+    // spare capacity of the strings passed to raw_message_callback, so that
+    // it can append to them without reallocating
+    size_t raw_message_reserve = 0;
   };
 
  private:
   friend class SocketEvent;
   friend class StreamRouter;
+  friend class StallWatchdog;
+  class ProfileScope;
 
   const Options options_;
 
@@ -432,7 +511,7 @@ class EventLoop {
   // weather the stream heartbeat check is enabled
   bool heartbeat_enabled_;
   // the timed list used for tracking the stream activity & expire unused ones
-  TimeoutList<StreamID> heartbeat_;
+  TimerWheel<StreamID> heartbeat_;
   // timeout after which all inactive streams should be considered expired
   std::chrono::seconds heartbeat_timeout_;
   // since we expire the streams in the blocking call, limit the number of
@@ -442,11 +521,14 @@ class EventLoop {
   // be responsible for closing the stream properly
   std::function<void(StreamID)> heartbeat_expired_callback_;
 
-  // Timeouts for connect calls.
-  // Non-blocking connects do eventually timeout after ~2 minutes, but this
-  // is too long, and generally non-configurable, so we actively close the
-  // socket if it doesn't become writable after some time.
-  TimeoutList<SocketEvent*> connect_timeout_;
+  // One-shot timeouts, with callbacks to be invoked when they fire.
+  TimerWheel<TimeoutID> timeouts_;
+  std::unordered_map<TimeoutID, TimerCallbackType> timeout_callbacks_;
+  TimeoutID next_timeout_id_ = 1;
+  // Fires when the earliest timeout is due.
+  event* timeout_event_ = nullptr;
+  // Time for which the timeout event is armed.
+  std::chrono::steady_clock::time_point timeout_event_deadline_;
 
   // Timer callbacks.
   struct Timer {
@@ -461,6 +543,7 @@ class EventLoop {
 
     TimerCallbackType callback;
     event* loop_event = nullptr;
+    EventLoop* event_loop = nullptr;
   };
   std::vector<std::unique_ptr<Timer>> timers_;
 
@@ -483,8 +566,53 @@ class EventLoop {
     Counter* messages_received[size_t(MessageType::max) + 1];
     Counter* socket_writes;       // number of calls to write(v)
     Counter* partial_socket_writes; // number of writes that partially succeeded
+    Histogram* command_latency[kExecuteCommand + 1]; // execution per type
+    Histogram* message_latency;   // time to dispatch a received message
+    Histogram* timer_latency;     // time to run timer and timeout callbacks
+    Counter* stalls;              // callbacks running over stall_threshold
   } stats_;
 
+  // Callback currently being run by the loop thread, readable from any
+  // thread. Zero start time means that the loop is idle.
+  std::atomic<uint64_t> callback_start_micros_;
+  std::atomic<const char*> callback_kind_;
+  std::atomic<const std::type_info*> callback_type_;
+  std::atomic<uint64_t> callback_seqno_;
+  // Nesting level of profiled callbacks, only outermost ones are tracked.
+  int callback_depth_ = 0;
+  // Thread running the loop, set while running.
+  pthread_t loop_thread_;
+
+  struct StallRecord {
+    std::string callback;
+    uint64_t micros;
+    uint64_t end_micros;
+    std::string stack;
+  };
+  struct StallSummary {
+    uint64_t count = 0;
+    uint64_t total_micros = 0;
+    uint64_t max_micros = 0;
+  };
+  // Guards stall records, sampled stack and incoming_queues_, so that they
+  // can be reported from another thread.
+  mutable std::mutex profile_mutex_;
+  std::deque<StallRecord> recent_stalls_;
+  std::map<std::string, StallSummary> stall_summary_;
+  // Stack sampled during the callback with sampled_stack_seqno_.
+  uint64_t sampled_stack_seqno_ = 0;
+  std::string sampled_stack_;
+
+  // Records stall of the outermost callback that has just finished.
+  void RecordStall(uint64_t micros, uint64_t end_micros);
+
+  // Samples stack of the loop thread if stalled in the current callback.
+  // Invoked from the watchdog thread.
+  void SampleIfStalled(uint64_t now_micros);
+
+  // Describes the currently running (or just finished) callback.
+  std::string DescribeCallback() const;
+
   const std::shared_ptr<QueueStats> queue_stats_;
 
   const uint32_t default_command_queue_size_;
@@ -524,6 +652,10 @@ class EventLoop {
   static void accept_error_cb(evconnlistener *listener, void *arg);
   static void do_startevent(int listener, short event, void *arg);
   static void do_timerevent(int listener, short event, void *arg);
+  static void do_timeoutevent(int listener, short event, void *arg);
+
+  // Rearms timeout event for the earliest scheduled timeout.
+  void RearmTimeoutEvent();
 };
 
 class EventCallback {
@@ -5,6 +5,7 @@
 //
 #include "messages.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -38,6 +39,7 @@ const char* const kMessageTypeNames[size_t(MessageType::max) + 1] = {
   "deliver_data",
   "find_tail_seqno",
   "tail_seqno",
+  "subscribe_batch",
 };
 
  /**
@@ -112,6 +114,15 @@ Message::CreateNewInstance(Slice* in) {
       break;
     }
 
+    case MessageType::mSubscribeBatch: {
+      std::unique_ptr<MessageSubscribeBatch> msg(new MessageSubscribeBatch());
+      st = msg->DeSerialize(in);
+      if (st.ok()) {
+        return std::unique_ptr<Message>(msg.release());
+      }
+      break;
+    }
+
     case MessageType::mUnsubscribe: {
       std::unique_ptr<MessageUnsubscribe> msg(new MessageUnsubscribe());
       st = msg->DeSerialize(in);
@@ -178,6 +189,10 @@ std::unique_ptr<Message> Message::CreateNewInstance(std::unique_ptr<char[]> in,
   return std::move(msg);
 }
 
+bool Message::PeekMessageType(Slice in, MessageType* type) {
+  return GetFixedEnum8(&in, type);
+}
+
 std::unique_ptr<Message> Message::Copy(const Message& msg) {
   // Not efficient, but not used often, and should be efficient once we
   // have shared serialized buffers.
@@ -243,6 +258,62 @@ Status MessagePing::DeSerialize(Slice* in) {
   return Status::OK();
 }
 
+const char* MessageTrace::HopName(Hop hop) {
+  switch (hop) {
+    case kClientSend:
+      return "client_send";
+    case kPilotReceive:
+      return "pilot_receive";
+    case kAppendComplete:
+      return "append_complete";
+    case kTowerRead:
+      return "tower_read";
+    case kRoomDispatch:
+      return "room_dispatch";
+    case kCopilotDispatch:
+      return "copilot_dispatch";
+    case kClientDeliver:
+      return "client_deliver";
+    case kNumHops:
+      break;
+  }
+  assert(false);
+  return "unknown";
+}
+
+void MessageTrace::Serialize(std::string* out) const {
+  if (!IsSampled()) {
+    return;
+  }
+  PutFixed8(out, stamped_);
+  for (int hop = 0; hop < kNumHops; ++hop) {
+    if (Has(static_cast<Hop>(hop))) {
+      PutVarint64(out, timestamps_[hop]);
+    }
+  }
+}
+
+Status MessageTrace::DeSerialize(Slice* in) {
+  stamped_ = 0;
+  if (in->empty()) {
+    return Status::OK();
+  }
+  uint8_t stamped;
+  if (!GetFixed8(in, &stamped) || stamped >= (1u << kNumHops)) {
+    return Status::InvalidArgument("Bad trace");
+  }
+  for (int hop = 0; hop < kNumHops; ++hop) {
+    if (stamped & (1u << hop)) {
+      uint64_t micros;
+      if (!GetVarint64(in, &micros)) {
+        return Status::InvalidArgument("Bad trace timestamp");
+      }
+      Stamp(static_cast<Hop>(hop), micros);
+    }
+  }
+  return Status::OK();
+}
+
 MessageData::MessageData(MessageType type,
                          TenantID tenantID,
                          const Slice& topic_name,
@@ -314,6 +385,12 @@ size_t MessageData::GetTotalSize() const {
          payload_.size() + namespaceid_.size() + storage_slice_.size();
 }
 
+Slice MessageData::SerializeStorage() const {
+  serialize_buffer__.clear();
+  SerializeInternal();
+  return Slice(serialize_buffer__);
+}
+
 void MessageData::SerializeInternal() const {
   PutFixed16(&serialize_buffer__, tenantid_);
   PutTopicID(&serialize_buffer__, namespaceid_, topic_name_);
@@ -321,6 +398,7 @@ void MessageData::SerializeInternal() const {
                          Slice((const char*)&msgid_, sizeof(msgid_)));
 
   PutLengthPrefixedSlice(&serialize_buffer__, payload_);
+  trace_.Serialize(&serialize_buffer__);
 }
 
 Status MessageData::DeSerializeStorage(Slice* in) {
@@ -342,11 +420,13 @@ Status MessageData::DeSerializeStorage(Slice* in) {
   }
   memcpy(&msgid_, idSlice.data(), sizeof(msgid_));
 
-  // extract payload (the rest of the message)
+  // extract payload
   if (!GetLengthPrefixedSlice(in, &payload_)) {
     return Status::InvalidArgument("Bad payload");
   }
-  return Status::OK();
+
+  // extract trace (the rest of the message)
+  return trace_.DeSerialize(in);
 }
 
 MessageDataAck::MessageDataAck(TenantID tenantID,
@@ -594,6 +674,46 @@ Status MessageSubscribe::DeSerialize(Slice* in) {
   return Status::OK();
 }
 
+Slice MessageSubscribeBatch::Serialize() const {
+  Message::Serialize();
+  PutVarint64(&serialize_buffer__, subscriptions_.size());
+  for (const auto& sub : subscriptions_) {
+    PutTopicID(&serialize_buffer__, sub.namespace_id, sub.topic_name);
+    PutVarint64(&serialize_buffer__, sub.start_seqno);
+    PutVarint64(&serialize_buffer__, sub.sub_id);
+  }
+  return Slice(serialize_buffer__);
+}
+
+Status MessageSubscribeBatch::DeSerialize(Slice* in) {
+  Status st = Message::DeSerialize(in);
+  if (!st.ok()) {
+    return st;
+  }
+  uint64_t count;
+  if (!GetVarint64(in, &count)) {
+    return Status::InvalidArgument("Bad number of subscriptions");
+  }
+  // Every subscription takes at least one byte, do not trust the count when
+  // reserving space.
+  subscriptions_.clear();
+  subscriptions_.reserve(std::min<uint64_t>(count, in->size()));
+  for (uint64_t i = 0; i < count; ++i) {
+    Subscription sub;
+    if (!GetTopicID(in, &sub.namespace_id, &sub.topic_name)) {
+      return Status::InvalidArgument("Bad NamespaceID and/or TopicName");
+    }
+    if (!GetVarint64(in, &sub.start_seqno)) {
+      return Status::InvalidArgument("Bad SequenceNumber");
+    }
+    if (!GetVarint64(in, &sub.sub_id)) {
+      return Status::InvalidArgument("Bad SubscriptionID");
+    }
+    subscriptions_.push_back(std::move(sub));
+  }
+  return Status::OK();
+}
+
 Slice MessageUnsubscribe::Serialize() const {
   Message::Serialize();
   PutVarint64(&serialize_buffer__, sub_id_);
@@ -667,9 +787,21 @@ Slice MessageDeliverData::Serialize() const {
   PutLengthPrefixedSlice(&serialize_buffer__,
                          Slice((const char*)&message_id_, sizeof(message_id_)));
   PutLengthPrefixedSlice(&serialize_buffer__, payload_);
+  trace_.Serialize(&serialize_buffer__);
   return Slice(serialize_buffer__);
 }
 
+void MessageDeliverData::SerializeHead(std::string* out) const {
+  assert(!trace_.IsSampled());
+  serialize_buffer__.clear();
+  MessageDeliver::Serialize();
+  PutLengthPrefixedSlice(&serialize_buffer__,
+                         Slice((const char*)&message_id_, sizeof(message_id_)));
+  PutVarint32(&serialize_buffer__, static_cast<uint32_t>(payload_.size()));
+  out->append(serialize_buffer__);
+  serialize_buffer__.clear();
+}
+
 Status MessageDeliverData::DeSerialize(Slice* in) {
   Status st = MessageDeliver::DeSerialize(in);
   if (!st.ok()) {
@@ -684,7 +816,7 @@ Status MessageDeliverData::DeSerialize(Slice* in) {
   if (!GetLengthPrefixedSlice(in, &payload_)) {
     return Status::InvalidArgument("Bad payload");
   }
-  return Status::OK();
+  return trace_.DeSerialize(in);
 }
 
 }  // namespace rocketspeed
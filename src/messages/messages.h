@@ -15,6 +15,7 @@
 #include "include/Types.h"
 #include "src/messages/serializer.h"
 #include "src/util/common/autovector.h"
+#include "src/util/common/coding.h"
 
 /*
  * This file contains all the messages used by RocketSpeed. These messages are
@@ -44,9 +45,10 @@ enum class MessageType : uint8_t {
   mDeliverData = 0x0B,   // MessageDeliverData
   mFindTailSeqno = 0x0C, // MessageFindTailSeqno
   mTailSeqno = 0x0D,     // MessageTailSeqno
+  mSubscribeBatch = 0x0E,  // MessageSubscribeBatch
 
   min = mPing,
-  max = mTailSeqno,
+  max = mSubscribeBatch,
 };
 
 inline bool ValidateEnum(MessageType e) {
@@ -113,6 +115,45 @@ class TopicPair {
   TopicPair() {}
 };
 
+/**
+ * Frame header preceding every serialized message on a stream.
+ */
+struct MessageHeader {
+  /**
+   * Attempts to parse slice into a MessageHeader.
+   *
+   * @param in Input bytes (will be advanced past header).
+   * @param header Output header.
+   * @return ok() if fully parsed, error otherwise.
+   */
+  static Status Parse(Slice* in, MessageHeader* header) {
+    if (!GetFixed8(in, &header->version)) {
+      return Status::InvalidArgument("Bad version");
+    }
+    if (!GetFixed32(in, &header->size)) {
+      return Status::InvalidArgument("Bad size");
+    }
+    return Status::OK();
+  }
+
+  /**
+   * @return Header encoded as string.
+   */
+  std::string ToString() {
+    std::string result;
+    result.reserve(encoding_size);
+    PutFixed8(&result, version);
+    PutFixed32(&result, size);
+    return result;
+  }
+
+  uint8_t version;
+  uint32_t size;
+
+  /** Size of MessageHeader encoding */
+  static constexpr size_t encoding_size = sizeof(version) + sizeof(size);
+};
+
 /**
  * This is a superclass of all RocketSpeed messages.
  * All RocketSpeed messages have a type, tenant-id and Origin.
@@ -150,6 +191,15 @@ class Message : public Serializer {
   static std::unique_ptr<Message> CreateNewInstance(std::unique_ptr<char[]> in,
                                                     Slice slice);
 
+  /**
+   * Reads the type of a serialized message without decoding the rest of it.
+   *
+   * @param in Serialized message.
+   * @param type Output parameter for the message type.
+   * @return true iff the message starts with a valid type.
+   */
+  static bool PeekMessageType(Slice in, MessageType* type);
+
   /*
    * Inherited from Serializer
    */
@@ -236,6 +286,81 @@ inline bool ValidateEnum(MessagePing::PingType e) {
   return e >= MessagePing::Request && e <= MessagePing::Response;
 }
 
+/**
+ * Timestamps of a sampled message taken at consecutive hops on its way from
+ * the publisher to a subscriber. Each timestamp is in microseconds of the
+ * wall clock of the host which took the hop, so latencies across hosts are
+ * only as accurate as clock synchronisation.
+ *
+ * A message is sampled iff it was stamped at client send. Trace of a sampled
+ * message is serialized as an optional trailer, which is skipped by readers
+ * unaware of tracing, and takes no space for messages which are not sampled.
+ */
+class MessageTrace {
+ public:
+  enum Hop : uint8_t {
+    kClientSend = 0,
+    kPilotReceive,
+    kAppendComplete,
+    kTowerRead,
+    kRoomDispatch,
+    kCopilotDispatch,
+    kClientDeliver,
+    kNumHops,
+  };
+
+  /** @return Short, human readable name of the hop. */
+  static const char* HopName(Hop hop);
+
+  MessageTrace() : stamped_(0), timestamps_() {}
+
+  bool IsSampled() const { return Has(kClientSend); }
+
+  bool Has(Hop hop) const { return (stamped_ & (1u << hop)) != 0; }
+
+  uint64_t Get(Hop hop) const { return Has(hop) ? timestamps_[hop] : 0; }
+
+  void Stamp(Hop hop, uint64_t micros) {
+    stamped_ = static_cast<uint8_t>(stamped_ | (1u << hop));
+    timestamps_[hop] = micros;
+  }
+
+  /**
+   * Invokes visitor with each stamped hop other than the first, and the time
+   * in microseconds elapsed since the previous stamped hop. Latencies which
+   * appear negative due to clock skew are reported as zero.
+   */
+  template <typename Visitor>
+  void ForEachHopLatency(Visitor&& visitor) const {
+    int previous = -1;
+    for (int hop = 0; hop < kNumHops; ++hop) {
+      if (!Has(static_cast<Hop>(hop))) {
+        continue;
+      }
+      if (previous >= 0) {
+        const uint64_t from = timestamps_[previous];
+        const uint64_t to = timestamps_[hop];
+        visitor(static_cast<Hop>(hop), to > from ? to - from : 0);
+      }
+      previous = hop;
+    }
+  }
+
+  /** Appends the trailer to the buffer, iff the message is sampled. */
+  void Serialize(std::string* out) const;
+
+  /**
+   * Reads the trailer, if any. Must be positioned at the end of a message,
+   * empty input leaves the trace empty.
+   */
+  Status DeSerialize(Slice* in);
+
+ private:
+  /** Bitmask of hops that were stamped. */
+  uint8_t stamped_;
+  uint64_t timestamps_[kNumHops];
+};
+
 /*
  * This is a data message.
  * The payload is the user-data in the message.
@@ -321,6 +446,27 @@ class MessageData : public Message {
    */
   Slice GetStorageSlice() const;
 
+  /**
+   * @return Trace of the message, empty unless the message is sampled.
+   */
+  const MessageTrace& GetTrace() const { return trace_; }
+
+  /**
+   * Stamps a hop of the trace. Affects only subsequent serialization, the
+   * storage slice of a deserialized message is not updated.
+   */
+  void StampTrace(MessageTrace::Hop hop, uint64_t micros) {
+    trace_.Stamp(hop, micros);
+  }
+
+  /**
+   * Serializes the log storage format of the message, including the trace,
+   * into an internal buffer.
+   *
+   * @return Slice valid for the lifetime of the message.
+   */
+  Slice SerializeStorage() const;
+
   /*
    * Inherited from Serializer
    */
@@ -351,6 +497,7 @@ class MessageData : public Message {
   Slice payload_;             // user data of message
   Slice namespaceid_;         // message namespace
   Slice storage_slice_;       // slice starting from tenantid from buffer_
+  MessageTrace trace_;        // timestamps of a sampled message
 };
 
 /*
@@ -682,6 +829,50 @@ class MessageSubscribe final : public Message {
   SubscriptionID sub_id_;
 };
 
+/**
+ * A request to establish many subscriptions of a single tenant at once.
+ * Equivalent to a sequence of MessageSubscribe, but lets the subscriber sync
+ * thousands of subscriptions in a single frame.
+ */
+class MessageSubscribeBatch final : public Message {
+ public:
+  /** Parameters of a single subscription in the batch. */
+  struct Subscription {
+    NamespaceID namespace_id;
+    Topic topic_name;
+    SequenceNumber start_seqno;
+    /** ID of the requested subscription assigned by the subscriber. */
+    SubscriptionID sub_id;
+  };
+
+  explicit MessageSubscribeBatch(TenantID tenant_id)
+      : Message(MessageType::mSubscribeBatch, tenant_id) {}
+
+  MessageSubscribeBatch() : Message(MessageType::mSubscribeBatch) {}
+
+  void Add(NamespaceID namespace_id,
+           Topic topic_name,
+           SequenceNumber start_seqno,
+           SubscriptionID sub_id) {
+    subscriptions_.push_back(Subscription{std::move(namespace_id),
+                                          std::move(topic_name),
+                                          start_seqno,
+                                          sub_id});
+  }
+
+  const std::vector<Subscription>& GetSubscriptions() const {
+    return subscriptions_;
+  }
+
+  size_t GetSize() const { return subscriptions_.size(); }
+
+  Slice Serialize() const override;
+  Status DeSerialize(Slice* in) override;
+
+ private:
+  std::vector<Subscription> subscriptions_;
+};
+
 /**
  * A request or response which notifies that subscription was terminated by
  * either side.
@@ -808,14 +999,31 @@ class MessageDeliverData final : public MessageDeliver {
 
   Slice GetPayload() const { return payload_; }
 
+  const MessageTrace& GetTrace() const { return trace_; }
+
+  void SetTrace(const MessageTrace& trace) { trace_ = trace; }
+
+  void StampTrace(MessageTrace::Hop hop, uint64_t micros) {
+    trace_.Stamp(hop, micros);
+  }
+
   Slice Serialize() const override;
   Status DeSerialize(Slice* in) override;
 
+  /**
+   * Appends the serialised message up to the payload, which must follow it
+   * on the wire. Only valid if the message has no sampled trace, so that the
+   * payload is the last serialised field.
+   */
+  void SerializeHead(std::string* out) const;
+
  private:
   /** ID of the message assigned by the publisher. */
   MsgId message_id_;
   /** Payload delivered with the message. */
   Slice payload_;
+  /** Timestamps of a sampled message. */
+  MessageTrace trace_;
 };
 /** @} */
 
@@ -8,6 +8,7 @@
 #include <unordered_set>
 #include <vector>
 
+#include "src/messages/commands.h"
 #include "src/messages/messages.h"
 #include "src/messages/msg_loop.h"
 #include "src/port/port.h"
@@ -186,6 +187,45 @@ TEST(Messaging, MessageSubscribe) {
   ASSERT_EQ(msg1.GetSubID(), msg2.GetSubID());
 }
 
+TEST(Messaging, MessageSubscribeBatch) {
+  MessageSubscribeBatch msg1(Tenant::GuestTenant);
+  for (SubscriptionID sub_id = 1; sub_id <= 1000; ++sub_id) {
+    msg1.Add(GuestNamespace,
+             "MessageSubscribeBatch" + std::to_string(sub_id),
+             sub_id * 1000,
+             sub_id);
+  }
+
+  Slice original = msg1.Serialize();
+  std::unique_ptr<char[]> buffer(new char[original.size()]);
+  memcpy(buffer.get(), original.data(), original.size());
+  std::unique_ptr<Message> msg(
+      Message::CreateNewInstance(std::move(buffer), original.size()));
+  ASSERT_TRUE(msg != nullptr);
+  ASSERT_TRUE(msg->GetMessageType() == MessageType::mSubscribeBatch);
+  auto msg2 = static_cast<MessageSubscribeBatch*>(msg.get());
+
+  ASSERT_EQ(msg1.GetTenantID(), msg2->GetTenantID());
+  ASSERT_EQ(msg1.GetSize(), msg2->GetSize());
+  int mismatches = 0;
+  for (size_t i = 0; i < msg1.GetSize(); ++i) {
+    const auto& sub1 = msg1.GetSubscriptions()[i];
+    const auto& sub2 = msg2->GetSubscriptions()[i];
+    mismatches += sub1.namespace_id != sub2.namespace_id ||
+                  sub1.topic_name != sub2.topic_name ||
+                  sub1.start_seqno != sub2.start_seqno ||
+                  sub1.sub_id != sub2.sub_id;
+  }
+  ASSERT_EQ(mismatches, 0);
+
+  // Truncated batch is rejected.
+  std::string truncated = original.ToString();
+  truncated.resize(truncated.size() - 1);
+  Slice in(truncated);
+  MessageSubscribeBatch msg3;
+  ASSERT_TRUE(!msg3.DeSerialize(&in).ok());
+}
+
 TEST(Messaging, MessageUnsubscribe) {
   MessageUnsubscribe msg1(Tenant::GuestTenant,
                           42,
@@ -234,6 +274,74 @@ TEST(Messaging, MessageDeliverData) {
   ASSERT_EQ(msg1.GetSequenceNumber(), msg2.GetSequenceNumber());
   ASSERT_TRUE(msg1.GetMessageID() == msg2.GetMessageID());
   ASSERT_EQ(msg1.GetPayload().ToString(), msg2.GetPayload().ToString());
+  ASSERT_TRUE(!msg2.GetTrace().IsSampled());
+}
+
+TEST(Messaging, DataTrace) {
+  MessageData data1(MessageType::mPublish,
+                    Tenant::GuestTenant, "Topic1", GuestNamespace, "Payload1");
+  data1.StampTrace(MessageTrace::kClientSend, 1000);
+
+  // Trace is carried through the wire format...
+  Slice original = data1.Serialize();
+  MessageData data2;
+  ASSERT_OK(data2.DeSerialize(&original));
+  ASSERT_TRUE(data2.GetTrace().IsSampled());
+  ASSERT_EQ(data2.GetTrace().Get(MessageTrace::kClientSend), 1000);
+  ASSERT_EQ(data2.GetPayload().ToString(), "Payload1");
+
+  // ...and through the storage format, updated with new hops.
+  data2.StampTrace(MessageTrace::kPilotReceive, 1500);
+  Slice storage = data2.SerializeStorage();
+  MessageData data3(MessageType::mDeliver);
+  ASSERT_OK(data3.DeSerializeStorage(&storage));
+  ASSERT_TRUE(storage.empty());
+  ASSERT_EQ(data3.GetTrace().Get(MessageTrace::kClientSend), 1000);
+  ASSERT_EQ(data3.GetTrace().Get(MessageTrace::kPilotReceive), 1500);
+  ASSERT_TRUE(!data3.GetTrace().Has(MessageTrace::kAppendComplete));
+  ASSERT_EQ(data3.GetPayload().ToString(), "Payload1");
+
+  // Messages which are not sampled have no trailer.
+  MessageData data4(MessageType::mPublish,
+                    Tenant::GuestTenant, "Topic1", GuestNamespace, "Payload1");
+  std::string untraced = data4.SerializeStorage().ToString();
+  ASSERT_EQ(untraced.size() + 5, data2.SerializeStorage().size());
+
+  // Corrupt trailer is rejected.
+  untraced.push_back(static_cast<char>(0xFF));
+  Slice corrupt(untraced);
+  MessageData data5(MessageType::mDeliver);
+  ASSERT_TRUE(!data5.DeSerializeStorage(&corrupt).ok());
+}
+
+TEST(Messaging, DeliverDataTrace) {
+  MessageTrace trace;
+  trace.Stamp(MessageTrace::kClientSend, 1000);
+  trace.Stamp(MessageTrace::kPilotReceive, 900);  // clock skew
+  trace.Stamp(MessageTrace::kTowerRead, 2000);
+  trace.Stamp(MessageTrace::kCopilotDispatch, 2500);
+
+  MessageDeliverData msg1(Tenant::GuestTenant,
+                          42,
+                          GUIDGenerator().Generate(),
+                          Slice("payload"));
+  msg1.SetTrace(trace);
+  Slice original = msg1.Serialize();
+  MessageDeliverData msg2;
+  ASSERT_OK(msg2.DeSerialize(&original));
+  ASSERT_EQ(msg2.GetPayload().ToString(), "payload");
+
+  std::vector<std::pair<MessageTrace::Hop, uint64_t>> latencies;
+  msg2.GetTrace().ForEachHopLatency(
+      [&](MessageTrace::Hop hop, uint64_t micros) {
+        latencies.emplace_back(hop, micros);
+      });
+  std::vector<std::pair<MessageTrace::Hop, uint64_t>> expected = {
+      {MessageTrace::kPilotReceive, 0},
+      {MessageTrace::kTowerRead, 1100},
+      {MessageTrace::kCopilotDispatch, 500},
+  };
+  ASSERT_TRUE(latencies == expected);
 }
 
 TEST(Messaging, InvalidEnum) {
@@ -608,6 +716,56 @@ TEST(Messaging, Timer) {
   ASSERT_EQ(counter2.load(), 2);
 }
 
+TEST(Messaging, ScheduleTimeout) {
+  MsgLoop loop(env_, env_options_, 0, 1, info_log_, "loop");
+  ASSERT_OK(loop.Initialize());
+  MsgLoopThread t1(env_, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+  EventLoop* event_loop = loop.GetEventLoop(0);
+
+  typedef std::chrono::milliseconds ms;
+  const auto start = std::chrono::steady_clock::now();
+  // Only accessed on the event loop thread until done is signalled.
+  std::vector<std::string> fired;
+  std::vector<bool> cancelled;
+  auto elapsed = [&] () {
+    return std::chrono::duration_cast<ms>(
+      std::chrono::steady_clock::now() - start);
+  };
+  ms first_fired(0);
+  port::Semaphore done;
+
+  std::unique_ptr<Command> command(MakeExecuteCommand([&] () {
+    event_loop->ScheduleTimeout(ms(60), [&] () { fired.push_back("c"); });
+    TimeoutID first = event_loop->ScheduleTimeout(ms(20), [&] () {
+      first_fired = elapsed();
+      fired.push_back("a");
+      // Rescheduled from inside of a callback.
+      event_loop->ScheduleTimeout(ms(60), [&] () {
+        fired.push_back("e");
+        done.Post();
+      });
+    });
+    event_loop->ScheduleTimeout(ms(40), [&, first] () {
+      fired.push_back("b");
+      // Already fired.
+      cancelled.push_back(event_loop->CancelTimeout(first));
+    });
+    TimeoutID cancel = event_loop->ScheduleTimeout(ms(30), [&] () {
+      fired.push_back("d");
+    });
+    cancelled.push_back(event_loop->CancelTimeout(cancel));
+    cancelled.push_back(event_loop->CancelTimeout(cancel));
+  }));
+  ASSERT_OK(loop.SendCommand(std::move(command), 0));
+
+  ASSERT_TRUE(done.TimedWait(std::chrono::seconds(5)));
+  ASSERT_TRUE(fired == std::vector<std::string>({"a", "b", "c", "e"}));
+  ASSERT_TRUE(cancelled == std::vector<bool>({true, false, false}));
+  ASSERT_GE(first_fired.count(), 20);
+  ASSERT_GE(elapsed().count(), 80);
+}
+
 TEST(Messaging, InitializeFailure) {
   // Check that Initialize returns failure.
   MsgLoop loop1(env_, env_options_, 58499, 1, info_log_, "loop1");
@@ -402,6 +402,15 @@ MsgLoop::CreateThreadLocalQueues(int worker_id, size_t size) {
     }));
 }
 
+std::string MsgLoop::GetProfileInfo() const {
+  std::string result;
+  for (size_t i = 0; i < event_loops_.size(); ++i) {
+    result += "worker " + std::to_string(i) + ":\n";
+    result += event_loops_[i]->GetProfileInfo();
+  }
+  return result;
+}
+
 Statistics MsgLoop::GetStatisticsSync() {
   return AggregateStatsSync([this] (int i) {
     return event_loops_[i]->GetStatistics();
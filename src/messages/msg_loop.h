@@ -127,6 +127,13 @@ class MsgLoop : public MsgLoopBase {
 
   Statistics GetStatisticsSync() override;
 
+  /**
+   * Reports where time is spent on each event loop, see
+   * EventLoop::GetProfileInfo. Does not require the loops to respond, so
+   * it can be used to find which operation blocks a loop.
+   */
+  std::string GetProfileInfo() const;
+
   // Checks that we are running on any EventLoop thread.
   void ThreadCheck() const override {
     GetThreadWorkerIndex();
@@ -6,8 +6,6 @@
 #define __STDC_FORMAT_MACROS
 #include "msg_loop_base.h"
 
-#include <chrono>
-#include <thread>
 
 #include "src/port/port.h"
 #include "src/util/common/base_env.h"
@@ -17,25 +15,10 @@ namespace rocketspeed {
 
 Statistics MsgLoopBase::AggregateStatsSync(WorkerStatsProvider stats_provider) {
   Statistics aggregated_stats;
-  port::Semaphore done;
-  Status st;
-  do {
-    // Attempt to gather num clients from each event loop.
-    st = Gather(stats_provider,
-      [&done, &aggregated_stats] (std::vector<Statistics> clients) {
-        for (Statistics& stat: clients) {
-          aggregated_stats.Aggregate(stat.MoveThread());
-        }
-        done.Post();
-      });
-    if (!st.ok()) {
-      // Failed, delay for a while.
-      /* sleep override */
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-  } while (!st.ok());
-  done.Wait();
-  return aggregated_stats.MoveThread();
+  for (int i = 0; i < GetNumWorkers(); ++i) {
+    aggregated_stats.Aggregate(stats_provider(i));
+  }
+  return aggregated_stats;
 }
 
 }  // namespace rocketspeed
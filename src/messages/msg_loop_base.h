@@ -137,9 +137,10 @@ class MsgLoopBase {
   using WorkerStatsProvider = std::function<Statistics(int)>;
 
   /**
-   * Call to aggregate a set of statistics provided by the
-   * worker stats provider using the gather pattern. Waits
-   * until the gather call finishes and thus is expensive.
+   * Aggregates statistics of all workers, as returned by the stats provider.
+   * The provider is invoked on the calling thread, and must only take
+   * snapshots of worker statistics, so that workers are never blocked nor
+   * waited for, even when overloaded.
    */
   Statistics AggregateStatsSync(WorkerStatsProvider stats_provider);
 
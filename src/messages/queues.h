@@ -87,6 +87,20 @@ class Queue : public Source<Item>, public Sink<Item> {
   /** Upper-bound estimate of queue size. */
   size_t GetSize() const { return queue_.sizeGuess(); }
 
+  /** Time that items read from this queue spent waiting in it. */
+  struct DwellStats {
+    uint64_t reads;
+    uint64_t total_micros;
+    uint64_t max_micros;
+  };
+
+  /** @return Dwell time stats of this queue, may be called from any thread. */
+  DwellStats GetDwellStats() const {
+    return DwellStats{dwell_reads_.load(std::memory_order_relaxed),
+                      dwell_total_micros_.load(std::memory_order_relaxed),
+                      dwell_max_micros_.load(std::memory_order_relaxed)};
+  }
+
   void RegisterReadEvent(EventLoop* event_loop) final override {
     assert(!read_event_);
     read_event_ =
@@ -114,6 +128,16 @@ class Queue : public Source<Item>, public Sink<Item> {
  private:
   friend class BatchedRead<Item>;
 
+  void RecordDwell(uint64_t micros) {
+    const auto relaxed = std::memory_order_relaxed;
+    dwell_reads_.store(dwell_reads_.load(relaxed) + 1, relaxed);
+    dwell_total_micros_.store(dwell_total_micros_.load(relaxed) + micros,
+                              relaxed);
+    if (micros > dwell_max_micros_.load(relaxed)) {
+      dwell_max_micros_.store(micros, relaxed);
+    }
+  }
+
   std::shared_ptr<Logger> info_log_;
   std::shared_ptr<QueueStats> stats_;
   folly::ProducerConsumerQueue<Timestamped<Item>> queue_;
@@ -128,6 +152,12 @@ class Queue : public Source<Item>, public Sink<Item> {
    * batches.
    */
   std::atomic<size_t> synced_size_;
+
+  // Dwell time of read items, updated only by the reader.
+  std::atomic<uint64_t> dwell_reads_;
+  std::atomic<uint64_t> dwell_total_micros_;
+  std::atomic<uint64_t> dwell_max_micros_;
+
   ThreadCheck read_check_;
   ThreadCheck write_check_;
 };
@@ -295,6 +325,7 @@ bool BatchedRead<Item>::Read(Item& item) {
     auto delta = now - entry.timestamp;
     auto micros = std::chrono::duration_cast<std::chrono::microseconds>(delta);
     queue_->stats_->response_latency->Record(micros.count());
+    queue_->RecordDwell(static_cast<uint64_t>(micros.count()));
     item = std::move(entry.item);
     --pending_reads_;
     ++commands_read_;
@@ -318,7 +349,10 @@ Queue<Item>::Queue(std::shared_ptr<Logger> info_log,
     , queue_(static_cast<uint32_t>(size + 1))  // ProducerConsumerQueue needs
     , read_ready_fd_(true, true)               // n+1 to store n items.
     , write_ready_fd_(true, true)
-    , synced_size_(0) {
+    , synced_size_(0)
+    , dwell_reads_(0)
+    , dwell_total_micros_(0)
+    , dwell_max_micros_(0) {
   assert(read_ready_fd_.status() == 0);
   assert(write_ready_fd_.status() == 0);
 }
@@ -4,6 +4,9 @@
 //  of patent rights can be found in the PATENTS file in the same directory.
 //
 
+#include <signal.h>
+
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <random>
@@ -14,6 +17,8 @@
 #include "src/util/random.h"
 #include "src/util/testharness.h"
 #include "src/port/Env.h"
+#include "src/port/port.h"
+#include "src/port/stack_trace.h"
 
 namespace rocketspeed {
 
@@ -129,6 +134,129 @@ TEST(CommandQueueTest, TwoItemsTwoBatches) {
   loop_thread.join();
 }
 
+TEST(CommandQueueTest, StallProfile) {
+  EventLoop::Options options;
+  options.stall_threshold = std::chrono::milliseconds(20);
+  options.sample_stalled_stacks = true;
+  EventLoop loop(Env::Default(),
+                 EnvOptions(),
+                 0,
+                 std::make_shared<NullLogger>(),
+                 nullptr,
+                 nullptr,
+                 std::move(stream_allocator_),
+                 std::move(options));
+  ASSERT_OK(loop.Initialize());
+  std::thread loop_thread([&]() { loop.Run(); });
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  // Block the loop until released, the report must be available meanwhile.
+  port::Semaphore blocked, release, done;
+  std::unique_ptr<Command> command(MakeExecuteCommand([&]() {
+    blocked.Post();
+    ASSERT_TRUE(release.TimedWait(timeout_));
+  }));
+  ASSERT_OK(loop.SendCommand(command));
+  ASSERT_TRUE(blocked.TimedWait(timeout_));
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+#if !defined(ROCKETSPEED_LITE) && defined(OS_LINUX)
+  const std::string expected = "stack of running callback";
+#else
+  const std::string expected = "running for";
+#endif
+  std::string info;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  do {
+    /* sleep override */
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    info = loop.GetProfileInfo();
+  } while (info.find(expected) == std::string::npos &&
+           std::chrono::steady_clock::now() < deadline);
+  ASSERT_NE(info.find(expected), std::string::npos);
+  ASSERT_NE(info.find("running for"), std::string::npos);
+  ASSERT_NE(info.find("execute"), std::string::npos);
+  release.Post();
+
+  // Fast commands are not reported as stalls.
+  command.reset(MakeExecuteCommand([&]() { done.Post(); }));
+  ASSERT_OK(loop.SendCommand(command));
+  ASSERT_TRUE(done.TimedWait(timeout_));
+  do {
+    info = loop.GetProfileInfo();
+  } while (info.find("running for") != std::string::npos &&
+           std::chrono::steady_clock::now() < deadline + timeout_);
+  ASSERT_EQ(info.find("running for"), std::string::npos);
+  ASSERT_NE(info.find("stalls: 1 "), std::string::npos);
+  ASSERT_NE(info.find("queue[0]"), std::string::npos);
+  ASSERT_EQ(loop.GetStatistics().GetCounterValue(".stalls"), 1);
+
+  loop.Stop();
+  loop_thread.join();
+}
+
+#if !defined(ROCKETSPEED_LITE) && defined(OS_LINUX)
+TEST(CommandQueueTest, StaleStackCaptureSignal) {
+  // Threads which hold off SIGUSR2 until told to accept it.
+  struct Target {
+    port::Semaphore ready, accept, accepted, exit;
+    std::thread thread;
+
+    Target() : thread([this] () {
+      sigset_t set;
+      sigemptyset(&set);
+      sigaddset(&set, SIGUSR2);
+      pthread_sigmask(SIG_BLOCK, &set, nullptr);
+      ready.Post();
+      accept.Wait();
+      // Pending signals are handled before this returns.
+      pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+      accepted.Post();
+      exit.Wait();
+    }) {}
+  } stale, target;
+  ASSERT_TRUE(stale.ready.TimedWait(timeout_));
+  ASSERT_TRUE(target.ready.TimedWait(timeout_));
+
+  // Times out, leaving the signal pending.
+  void* frames[64];
+  ASSERT_EQ(port::CaptureThreadStack(stale.thread.native_handle(),
+                                     frames,
+                                     64,
+                                     std::chrono::milliseconds(10)),
+            0);
+
+  std::atomic<int> num_frames(-1);
+  std::thread capture([&] () {
+    void* target_frames[64];
+    num_frames = port::CaptureThreadStack(target.thread.native_handle(),
+                                          target_frames,
+                                          64,
+                                          std::chrono::seconds(5));
+  });
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  // The stale signal must not answer the capture of the other thread.
+  stale.accept.Post();
+  ASSERT_TRUE(stale.accepted.TimedWait(timeout_));
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_EQ(num_frames.load(), -1);
+
+  target.accept.Post();
+  ASSERT_TRUE(target.accepted.TimedWait(timeout_));
+  capture.join();
+  ASSERT_GT(num_frames.load(), 0);
+
+  stale.exit.Post();
+  target.exit.Post();
+  stale.thread.join();
+  target.thread.join();
+}
+#endif
 
 }  // namespace rocketspeed
 
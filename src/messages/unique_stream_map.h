@@ -171,6 +171,14 @@ class UniqueStreamMap {
     return local_map;
   }
 
+  /** Returns (local -> global) mapping of a context, empty if unknown. */
+  LocalMap GetContext(const Context& context) const {
+    thread_check_.Check();
+
+    const auto it_c = context_to_map_.find(context);
+    return it_c == context_to_map_.end() ? LocalMap() : it_c->second;
+  }
+
   size_t GetNumStreams() const {
     thread_check_.Check();
     return global_to_local_.size();
@@ -15,7 +15,33 @@ namespace rocketspeed {
 
 namespace {
 
-const size_t kFooterSize = sizeof(StreamID) + sizeof(MessageSequenceNumber);
+const size_t kFooterSize = kWrappedMessageFooterSize;
+
+Status StripFooter(std::string* wrapped_message,
+                   StreamID* stream,
+                   MessageSequenceNumber* seqno) {
+  if (wrapped_message->size() < kFooterSize) {
+    return Status::IOError("Message too short to contain footer.");
+  }
+
+  // Read the footer.
+  Slice in(wrapped_message->data() + (wrapped_message->size() - kFooterSize),
+           kFooterSize);
+  // Deserialize origin stream.
+  if (!DecodeOrigin(&in, stream)) {
+    return Status::IOError("Failed deserializing origin stream.");
+  }
+  // Deserialize message sequence number.
+  uint32_t seqno_unsigned;
+  if (!GetFixed32(&in, &seqno_unsigned)) {
+    return Status::IOError("Failed deserializing message sequence number.");
+  }
+  *seqno = static_cast<MessageSequenceNumber>(seqno_unsigned);
+
+  // Strip footer and leave a serialized message only.
+  wrapped_message->resize(wrapped_message->size() - kFooterSize);
+  return Status::OK();
+}
 
 }  // namespace
 
@@ -23,38 +49,42 @@ std::string WrapMessage(std::string message,
                         StreamID origin,
                         MessageSequenceNumber seqno) {
   message.reserve(message.size() + kFooterSize);
+  WrapMessageInPlace(&message, origin, seqno);
+  return message;
+}
+
+void WrapMessageInPlace(std::string* message,
+                        StreamID origin,
+                        MessageSequenceNumber seqno) {
   // Append origin stream.
-  EncodeOrigin(&message, origin);
+  EncodeOrigin(message, origin);
   // Append message sequence number
-  PutFixed32(&message, seqno);
-  return message;
+  PutFixed32(message, seqno);
 }
 
 Status UnwrapMessage(std::string wrapped_message,
                      std::string* raw_message,
                      StreamID* stream,
                      MessageSequenceNumber* seqno) {
-  if (wrapped_message.size() < kFooterSize) {
-    return Status::IOError("Message too short to contain footer.");
+  Status st = StripFooter(&wrapped_message, stream, seqno);
+  if (!st.ok()) {
+    return st;
   }
+  *raw_message = std::move(wrapped_message);
+  return Status::OK();
+}
 
-  // Read the footer.
-  Slice in(wrapped_message.data() + (wrapped_message.size() - kFooterSize),
-           kFooterSize);
-  // Deserialize origin stream.
-  if (!DecodeOrigin(&in, stream)) {
-    return Status::IOError("Failed deserializing origin stream.");
+Status UnwrapMessageInPlace(std::string* wrapped_message,
+                            StreamID* stream,
+                            MessageSequenceNumber* seqno,
+                            MessageType* type) {
+  Status st = StripFooter(wrapped_message, stream, seqno);
+  if (!st.ok()) {
+    return st;
   }
-  // Deserialize message sequence number.
-  uint32_t seqno_unsigned;
-  if (!GetFixed32(&in, &seqno_unsigned)) {
-    return Status::IOError("Failed deserializing message sequence number.");
+  if (!Message::PeekMessageType(Slice(*wrapped_message), type)) {
+    return Status::IOError("Failed deserializing message type.");
   }
-  *seqno = static_cast<MessageSequenceNumber>(seqno_unsigned);
-
-  // Strip header and footer and leave a serialized message only.
-  wrapped_message.resize(wrapped_message.size() - kFooterSize);
-  *raw_message = std::move(wrapped_message);
   return Status::OK();
 }
 
@@ -17,9 +17,14 @@ namespace rocketspeed {
 
 class Message;
 class SendCommand;
+enum class MessageType : uint8_t;
 
 typedef int32_t MessageSequenceNumber;
 
+/** Number of bytes that wrapping appends to a serialized message. */
+constexpr size_t kWrappedMessageFooterSize =
+    sizeof(StreamID) + sizeof(MessageSequenceNumber);
+
 std::string WrapMessage(std::string raw_message,
                         StreamID stream,
                         MessageSequenceNumber seqno);
@@ -34,4 +39,22 @@ Status UnwrapMessage(std::string wrapped_message,
                      StreamID* stream,
                      MessageSequenceNumber* seqno);
 
+/**
+ * Appends stream and sequence number to a serialized message in place.
+ * Doesn't reallocate if the message has kWrappedMessageFooterSize bytes of
+ * spare capacity.
+ */
+void WrapMessageInPlace(std::string* message,
+                        StreamID stream,
+                        MessageSequenceNumber seqno);
+
+/**
+ * Strips stream and sequence number from a wrapped message in place, leaving
+ * the serialized message, of which only the type is decoded.
+ */
+Status UnwrapMessageInPlace(std::string* wrapped_message,
+                            StreamID* stream,
+                            MessageSequenceNumber* seqno,
+                            MessageType* type);
+
 }  // namespace rocketspeed
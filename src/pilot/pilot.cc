@@ -155,6 +155,16 @@ void Pilot::ProcessPublish(std::unique_ptr<Message> msg, StreamID origin) {
 
   // Setup AppendCallback
   uint64_t now = options_.env->NowMicros();
+
+  // Sampled messages are stored along with the time they were received.
+  Slice storage_slice;
+  if (msg_data->GetTrace().IsSampled()) {
+    msg_data->StampTrace(MessageTrace::kPilotReceive, now);
+    storage_slice = msg_data->SerializeStorage();
+  } else {
+    storage_slice = msg_data->GetStorageSlice();
+  }
+
   AppendClosure* closure;
   std::unique_ptr<MessageData> msg_owned(msg_data);
   closure = worker_data.append_closure_pool_->Allocate(
@@ -168,7 +178,7 @@ void Pilot::ProcessPublish(std::unique_ptr<Message> msg, StreamID origin) {
   // Asynchronously append to log storage.
   auto append_callback = std::ref(*closure);
   auto status = log_storage_->AppendAsync(logid,
-                                          msg_data->GetStorageSlice(),
+                                          storage_slice,
                                           std::move(append_callback));
 
   // Fault injection: insert corrupt data into the logs.
@@ -288,6 +298,10 @@ Statistics Pilot::GetStatisticsSync() const {
 }
 
 std::string Pilot::GetInfoSync(std::vector<std::string> args) {
+  if (args.size() == 1 && args[0] == "loop_profile") {
+    // loop_profile  -- where time is spent on event loops.
+    return options_.msg_loop->GetProfileInfo();
+  }
   return "Unknown info for pilot";
 }
 
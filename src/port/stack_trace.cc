@@ -5,6 +5,11 @@
 //
 #include "src/port/stack_trace.h"
 
+#include <cxxabi.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
 namespace rocketspeed {
 namespace port {
 
@@ -12,6 +17,18 @@ namespace port {
 
 void InstallStackTraceHandler() {}
 void PrintStack(int first_frames_to_skip) {}
+int CaptureStack(void** frames, int max_frames, int first_frames_to_skip) {
+  return 0;
+}
+int CaptureThreadStack(pthread_t thread,
+                       void** frames,
+                       int max_frames,
+                       std::chrono::milliseconds timeout) {
+  return 0;
+}
+std::string SymbolizeStack(void* const* frames, int num_frames) {
+  return std::string();
+}
 
 #else
 
@@ -100,8 +117,145 @@ static void StackTraceHandler(int sig) {
   raise(sig);
 }
 
+// Request for a stack of another thread, filled in by the signal handler.
+struct ThreadStackRequest {
+  // Thread whose stack is requested. A signal of an earlier request that
+  // timed out may still be delivered to another thread, which must not
+  // answer this one.
+  pthread_t thread;
+  void** frames;
+  int max_frames;
+  int num_frames;
+  std::atomic<bool> done;
+};
+
+// Pending request, taken by the first handler that runs.
+std::atomic<ThreadStackRequest*> pending_stack_request(nullptr);
+
+// Serialises CaptureThreadStack calls.
+std::mutex capture_thread_stack_mutex;
+
+void ThreadStackHandler(int sig) {
+  ThreadStackRequest* request = pending_stack_request.load();
+  if (request && pthread_equal(request->thread, pthread_self()) &&
+      pending_stack_request.compare_exchange_strong(request, nullptr)) {
+    // skip the handler and the signal trampoline frames
+    request->num_frames =
+        CaptureStack(request->frames, request->max_frames, 2);
+    request->done.store(true);
+  }
+}
+
+void InstallThreadStackHandler() {
+  // backtrace may allocate when first called, so make sure this happens
+  // outside of the signal handler
+  void* frame;
+  backtrace(&frame, 1);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = ThreadStackHandler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR2, &action, nullptr);
+}
+
+// Demangles symbol of the form "binary(mangled+0x1f) [0x...]" in place.
+std::string DemangleSymbol(const char* symbol) {
+  std::string result(symbol);
+  const auto begin = result.find('(');
+  const auto end = result.find('+', begin);
+  if (begin == std::string::npos || end == std::string::npos ||
+      end == begin + 1) {
+    return result;
+  }
+  const std::string mangled = result.substr(begin + 1, end - begin - 1);
+  int status = 0;
+  char* demangled =
+      abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+  if (status == 0 && demangled) {
+    result.replace(begin + 1, mangled.size(), demangled);
+  }
+  free(demangled);
+  return result;
+}
+
 }  // namespace
 
+int CaptureStack(void** frames, int max_frames, int first_frames_to_skip) {
+  const int kMaxFrames = 100;
+  void* all_frames[kMaxFrames];
+
+  // skip the frame of this function too
+  const int skip = first_frames_to_skip + 1;
+  int num_frames = backtrace(all_frames, kMaxFrames) - skip;
+  if (num_frames <= 0) {
+    return 0;
+  }
+  if (num_frames > max_frames) {
+    num_frames = max_frames;
+  }
+  memcpy(frames, all_frames + skip, num_frames * sizeof(void*));
+  return num_frames;
+}
+
+int CaptureThreadStack(pthread_t thread,
+                       void** frames,
+                       int max_frames,
+                       std::chrono::milliseconds timeout) {
+  static std::once_flag install_handler;
+  std::call_once(install_handler, InstallThreadStackHandler);
+
+  std::lock_guard<std::mutex> lock(capture_thread_stack_mutex);
+  ThreadStackRequest request;
+  request.thread = thread;
+  request.frames = frames;
+  request.max_frames = max_frames;
+  request.num_frames = 0;
+  request.done.store(false);
+  pending_stack_request.store(&request);
+  if (pthread_kill(thread, SIGUSR2) != 0) {
+    pending_stack_request.store(nullptr);
+    return 0;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!request.done.load()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      if (pending_stack_request.exchange(nullptr) != nullptr) {
+        // The handler did not run, nobody else references the request.
+        return 0;
+      }
+      // The handler has taken the request, it will finish shortly.
+      while (!request.done.load()) {
+        std::this_thread::yield();
+      }
+      break;
+    }
+    std::this_thread::yield();
+  }
+  return request.num_frames;
+}
+
+std::string SymbolizeStack(void* const* frames, int num_frames) {
+  std::string result;
+  char** symbols = backtrace_symbols(frames, num_frames);
+  for (int i = 0; i < num_frames; ++i) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "#%-2d  ", i);
+    result += prefix;
+    if (symbols) {
+      result += DemangleSymbol(symbols[i]);
+    } else {
+      snprintf(prefix, sizeof(prefix), "%p", frames[i]);
+      result += prefix;
+    }
+    result += '\n';
+  }
+  free(symbols);
+  return result;
+}
+
 void PrintStack(int first_frames_to_skip) {
   const int kMaxFrames = 100;
   void* frames[kMaxFrames];
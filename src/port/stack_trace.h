@@ -5,6 +5,9 @@
 //
 #pragma once
 
+#include <pthread.h>
+#include <chrono>
+#include <string>
 #include <thread>
 
 namespace rocketspeed {
@@ -18,5 +21,24 @@ void InstallStackTraceHandler();
 // Prints stack, skips skip_first_frames frames
 void PrintStack(int first_frames_to_skip = 0);
 
+// Captures up to max_frames return addresses of the calling thread's stack,
+// skipping first_frames_to_skip frames.
+// Returns the number of frames captured, 0 if not supported.
+int CaptureStack(void** frames, int max_frames, int first_frames_to_skip = 0);
+
+// Captures the stack of another thread of this process by interrupting it
+// with SIGUSR2, waiting at most timeout for the thread to respond.
+// Only one capture is in progress at a time, concurrent callers are
+// serialised. A thread that responds after the timeout does not answer later
+// captures of other threads.
+// Returns the number of frames captured, 0 on timeout or if not supported.
+int CaptureThreadStack(pthread_t thread,
+                       void** frames,
+                       int max_frames,
+                       std::chrono::milliseconds timeout);
+
+// Returns human readable, demangled symbols of captured frames, one per line.
+std::string SymbolizeStack(void* const* frames, int num_frames);
+
 }  // namespace port
 }  // namespace rocketspeed
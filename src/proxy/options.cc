@@ -12,7 +12,10 @@ ProxyOptions::ProxyOptions()
 , conf(nullptr)
 , info_log(nullptr)
 , num_workers(1)
-, ordering_buffer_size(16) {
+, ordering_buffer_size(16)
+, zero_copy_forwarding(false)
+, session_migration_period(0)
+, session_migration_imbalance(0.25) {
 }
 
 }  // namespace rocketspeed
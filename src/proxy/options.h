@@ -41,6 +41,24 @@ struct ProxyOptions {
   // Default: 16
   int ordering_buffer_size;
 
+  // Forward messages without decoding them beyond the type, in either
+  // direction. Messages from the service are passed to OnMessageCallback in
+  // the buffers they were received into. Malformed messages from clients are
+  // not detected by the proxy, but by the service.
+  // Default: false
+  bool zero_copy_forwarding;
+
+  // Period at which workers compare their load. A worker that handled more
+  // messages than the average by session_migration_imbalance migrates one of
+  // its sessions to the least loaded worker. Zero disables migration.
+  // Default: 0
+  std::chrono::milliseconds session_migration_period;
+
+  // Fraction of the average load by which a worker may exceed it before it
+  // migrates sessions.
+  // Default: 0.25
+  double session_migration_imbalance;
+
   // Create PilotOptions with default values for all fields
   ProxyOptions();
 };
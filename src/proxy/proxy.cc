@@ -9,6 +9,7 @@
 #include <climits>
 #include <algorithm>
 #include <functional>
+#include <mutex>
 #include <thread>
 #include <tuple>
 #include <unordered_map>
@@ -41,21 +42,58 @@ struct SessionInfo {
   MessageSequenceNumber next_seqno_;
   /** Ordering processor for messages received via Forward. */
   SessionProcessor ordered_processor_;
+  /** Number of messages of the session since the last rebalancing. */
+  uint64_t load_ = 0;
+  /**
+   * Worker that the session was migrated from while it had open streams, or
+   * -1. Those streams stay on the connections of that worker.
+   */
+  int remote_worker_ = -1;
+  /** Maps local to global IDs of the streams on remote_worker_. */
+  std::unordered_map<StreamID, StreamID> remote_streams_;
+  /** Workers that the session was migrated from, which redirect to it. */
+  std::vector<int> moved_from_;
+};
+
+/** Worker of a session that was migrated away from its default worker. */
+struct SessionPlacement {
+  int worker;
+  /** Whether the worker is yet to receive the session. */
+  bool migrating;
+};
+
+struct PlacementShard {
+  std::mutex mutex;
+  std::unordered_map<int64_t, SessionPlacement> sessions;
 };
 
 /** Represents per message loop worker data. */
 struct alignas(CACHE_LINE_SIZE) ProxyWorkerData {
-  ProxyWorkerData(StreamAllocator allocator)
-      : open_streams_(std::move(allocator)) {
+  ProxyWorkerData(int worker_id, StreamAllocator allocator)
+      : open_streams_(std::move(allocator)), stats_(worker_id) {
   }
 
   ProxyWorkerData(const ProxyWorkerData&) = delete;
   ProxyWorkerData& operator=(const ProxyWorkerData&) = delete;
 
-  Statistics GetStatistics() {
+  /** Statistics may be read from any thread. */
+  const Statistics& GetStatistics() const {
+    return stats_.all;
+  }
+
+  /** Updates statistics after sessions or streams were added or removed. */
+  void UpdateSessionStats() {
     stats_.open_sessions->Set(open_sessions_.size());
+    stats_.worker_sessions->Set(open_sessions_.size());
     stats_.open_streams->Set(open_streams_.GetNumStreams());
-    return stats_.all;
+    stats_.moved_sessions->Set(moved_sessions_.size());
+  }
+
+  /** Accounts a message handled on behalf of a session. */
+  void AddLoad(SessionInfo* info) {
+    ++info->load_;
+    ++window_load_;
+    stats_.worker_load->Add(1);
   }
 
   /** The data can only be accessed from a single and the same thread. */
@@ -64,9 +102,19 @@ struct alignas(CACHE_LINE_SIZE) ProxyWorkerData {
   std::unordered_map<int64_t, SessionInfo> open_sessions_;
   /** Stores map: (session, session local stream ID) <-> global stream ID. */
   UniqueStreamMap<int64_t> open_streams_;
+  /** Sessions migrated to other workers, by the worker they went to. */
+  std::unordered_map<int64_t, int> moved_sessions_;
+  /** Commands for sessions on their way to this worker, in arrival order. */
+  std::unordered_map<int64_t, std::vector<std::function<void()>>>
+      incoming_sessions_;
+  /** Number of messages handled since the last rebalancing. */
+  uint64_t window_load_ = 0;
+  /** Number of messages handled in the last rebalancing period. */
+  std::atomic<uint64_t> last_load_{0};
   /** Statistics aggregated by the proxy. */
   struct Stats {
-    Stats() {
+    explicit Stats(int worker_id) {
+      const std::string worker = "proxy.worker" + std::to_string(worker_id);
       forwards = all.AddCounter("proxy.forwards");
       forward_errors = all.AddCounter("proxy.forward_errors");
       on_message_calls = all.AddCounter("proxy.on_message_calls");
@@ -74,6 +122,12 @@ struct alignas(CACHE_LINE_SIZE) ProxyWorkerData {
       goodbyes_from_server = all.AddCounter("proxy.goodbyes_from_server");
       open_sessions = all.AddCounter("proxy.open_sessions");
       open_streams = all.AddCounter("proxy.open_stream");
+      sessions_migrated = all.AddCounter("proxy.sessions_migrated");
+      moved_sessions = all.AddCounter("proxy.moved_sessions");
+      session_placements = all.AddCounter("proxy.session_placements");
+      redirects = all.AddCounter("proxy.redirects");
+      worker_load = all.AddCounter(worker + ".load");
+      worker_sessions = all.AddCounter(worker + ".open_sessions");
     }
 
     Statistics all;
@@ -85,9 +139,23 @@ struct alignas(CACHE_LINE_SIZE) ProxyWorkerData {
     Counter* goodbyes_from_server;
     Counter* open_sessions;
     Counter* open_streams;
+    Counter* sessions_migrated;
+    Counter* moved_sessions;
+    // Added and removed by the worker that changes the placement.
+    Counter* session_placements;
+    Counter* redirects;
+    // Per worker, to expose skew.
+    Counter* worker_load;
+    Counter* worker_sessions;
   } stats_;
 };
 
+namespace {
+
+const size_t kPlacementShards = 16;
+
+}  // namespace
+
 Status Proxy::CreateNewInstance(ProxyOptions options,
                                 std::unique_ptr<Proxy>* proxy) {
   // Sanitize / Validate options.
@@ -103,6 +171,10 @@ Status Proxy::CreateNewInstance(ProxyOptions options,
     return Status::InvalidArgument("Invalid number of workers");
   }
 
+  if (options.session_migration_imbalance < 0) {
+    return Status::InvalidArgument("Invalid session migration imbalance");
+  }
+
   // Create the proxy object.
   proxy->reset(new Proxy(std::move(options)));
   return Status::OK();
@@ -113,13 +185,26 @@ Proxy::Proxy(ProxyOptions options)
     , env_(options.env)
     , config_(std::move(options.conf))
     , ordering_buffer_size_(options.ordering_buffer_size)
-    , msg_thread_(0) {
+    , zero_copy_forwarding_(options.zero_copy_forwarding)
+    , session_migration_period_(options.session_migration_period)
+    , session_migration_imbalance_(options.session_migration_imbalance)
+    , msg_thread_(0)
+    , num_placements_(0) {
   using std::placeholders::_1;
   using std::placeholders::_2;
-
+  using std::placeholders::_3;
+
+  MsgLoop::Options loop_options;
+  if (zero_copy_forwarding_) {
+    // Messages are handed over undecoded, with room for the footer.
+    loop_options.event_loop.raw_message_callback =
+        std::bind(&Proxy::HandleRawMessageReceived, this, _1, _2, _3);
+    loop_options.event_loop.raw_message_reserve = kWrappedMessageFooterSize;
+  }
   msg_loop_.reset(new MsgLoop(env_, options.env_options,
                               0,  // port
-                              options.num_workers, info_log_, "proxy"));
+                              options.num_workers, info_log_, "proxy",
+                              std::move(loop_options)));
 
   auto callback = std::bind(&Proxy::HandleMessageReceived, this, _1, _2);
   auto goodbye_callback = std::bind(&Proxy::HandleGoodbyeMessage, this, _1, _2);
@@ -140,7 +225,10 @@ Proxy::Proxy(ProxyOptions options)
   // streams from it.
   for (int i = 0; i < msg_loop_->GetNumWorkers(); ++i) {
     worker_data_.emplace_back(new ProxyWorkerData(
-        std::move(*msg_loop_->GetOutboundStreamAllocator(i))));
+        i, std::move(*msg_loop_->GetOutboundStreamAllocator(i))));
+  }
+  for (size_t i = 0; i < kPlacementShards; ++i) {
+    placement_shards_.emplace_back(new PlacementShard());
   }
 }
 
@@ -154,6 +242,13 @@ Status Proxy::Start(OnMessageCallback on_message,
   if (!st.ok()) {
     return st;
   }
+  if (session_migration_period_.count() > 0) {
+    st = msg_loop_->RegisterTimerCallback([this]() { HandleRebalance(); },
+                                          session_migration_period_);
+    if (!st.ok()) {
+      return st;
+    }
+  }
   msg_thread_ = env_->StartThread([this]() { msg_loop_->Run(); }, "proxy");
 
   return msg_loop_->WaitUntilRunning();
@@ -163,8 +258,16 @@ Status Proxy::Forward(std::string data, int64_t session) {
   // Deserialize metadata.
   StreamID origin;
   MessageSequenceNumber sequence;
+  MessageType type = MessageType::NotInitialized;
   std::string msg;
-  Status st = UnwrapMessage(std::move(data), &msg, &origin, &sequence);
+  Status st;
+  if (zero_copy_forwarding_) {
+    // Only the type is decoded, the buffer is sent as it is.
+    st = UnwrapMessageInPlace(&data, &origin, &sequence, &type);
+    msg = std::move(data);
+  } else {
+    st = UnwrapMessage(std::move(data), &msg, &origin, &sequence);
+  }
   if (!st.ok()) {
     LOG_ERROR(info_log_,
               "Failed unwrapping message on session %" PRIi64 ", %s",
@@ -176,8 +279,9 @@ Status Proxy::Forward(std::string data, int64_t session) {
   int worker_id = WorkerForSession(session);
   auto moved_msg = folly::makeMoveWrapper(std::move(msg));
   std::unique_ptr<Command> command(MakeExecuteCommand(
-      [this, moved_msg, session, sequence, origin]() mutable {
-        HandleMessageForwarded(moved_msg.move(), session, sequence, origin);
+      [this, type, moved_msg, session, sequence, origin]() mutable {
+        HandleMessageForwarded(
+            type, moved_msg.move(), session, sequence, origin);
       }));
   return msg_loop_->SendCommand(std::move(command), worker_id);
 }
@@ -211,15 +315,97 @@ Statistics Proxy::GetStatisticsSync() {
 }
 
 int Proxy::WorkerForSession(int64_t session) const {
+  // Placement is static while no session is migrated.
+  if (num_placements_.load(std::memory_order_acquire) > 0) {
+    PlacementShard& shard = GetPlacementShard(session);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(session);
+    if (it != shard.sessions.end()) {
+      return it->second.worker;
+    }
+  }
   return static_cast<int>(session % msg_loop_->GetNumWorkers());
 }
 
-ProxyWorkerData& Proxy::GetWorkerDataForSession(int64_t session) {
-  const auto worker_id = WorkerForSession(session);
-  // This way we do not reach into the thread local in production code.
-  assert(worker_id == msg_loop_->GetThreadWorkerIndex());
-  worker_data_[worker_id]->thread_check_.Check();
-  return *worker_data_[worker_id];
+PlacementShard& Proxy::GetPlacementShard(int64_t session) const {
+  return *placement_shards_[static_cast<uint64_t>(session) % kPlacementShards];
+}
+
+void Proxy::SetPlacement(int64_t session, int worker_id, bool migrating) {
+  PlacementShard& shard = GetPlacementShard(session);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto result =
+      shard.sessions.emplace(session, SessionPlacement{worker_id, migrating});
+  if (result.second) {
+    num_placements_.fetch_add(1, std::memory_order_acq_rel);
+    GetWorkerData().stats_.session_placements->Add(1);
+  } else {
+    result.first->second = SessionPlacement{worker_id, migrating};
+  }
+}
+
+void Proxy::ClearPlacement(int64_t session) {
+  if (num_placements_.load(std::memory_order_acquire) == 0) {
+    return;
+  }
+  PlacementShard& shard = GetPlacementShard(session);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.sessions.erase(session)) {
+    num_placements_.fetch_sub(1, std::memory_order_acq_rel);
+    GetWorkerData().stats_.session_placements->Add(-1);
+  }
+}
+
+bool Proxy::IsMigratingTo(int64_t session, int worker_id) const {
+  if (num_placements_.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  PlacementShard& shard = GetPlacementShard(session);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.sessions.find(session);
+  return it != shard.sessions.end() && it->second.worker == worker_id &&
+         it->second.migrating;
+}
+
+ProxyWorkerData& Proxy::GetWorkerData() {
+  auto& data = *worker_data_[msg_loop_->GetThreadWorkerIndex()];
+  data.thread_check_.Check();
+  return data;
+}
+
+bool Proxy::IsSessionOwner(ProxyWorkerData& data, int64_t session) const {
+  return data.open_sessions_.count(session) ||
+         (!data.moved_sessions_.count(session) &&
+          !data.incoming_sessions_.count(session) &&
+          !IsMigratingTo(session, msg_loop_->GetThreadWorkerIndex()));
+}
+
+void Proxy::DeferCommand(ProxyWorkerData& data,
+                         int64_t session,
+                         std::function<void()> command) {
+  assert(!IsSessionOwner(data, session));
+  auto moved = data.moved_sessions_.find(session);
+  if (moved == data.moved_sessions_.end() ||
+      IsMigratingTo(session, msg_loop_->GetThreadWorkerIndex())) {
+    // The session is on its way here.
+    data.incoming_sessions_[session].emplace_back(std::move(command));
+  } else {
+    data.stats_.redirects->Add(1);
+    SendToWorker(moved->second, std::move(command));
+  }
+}
+
+void Proxy::SendToWorker(int worker_id, std::function<void()> command) {
+  Status st = msg_loop_->SendCommand(
+      std::unique_ptr<Command>(MakeExecuteCommand(std::move(command))),
+      worker_id);
+  if (!st.ok()) {
+    LOG_ERROR(info_log_,
+              "Failed to send command to proxy worker %d: %s",
+              worker_id,
+              st.ToString().c_str());
+    GetWorkerData().stats_.forward_errors->Add(1);
+  }
 }
 
 void Proxy::HandleGoodbyeMessage(std::unique_ptr<Message> msg,
@@ -228,8 +414,7 @@ void Proxy::HandleGoodbyeMessage(std::unique_ptr<Message> msg,
   if (goodbye->GetOriginType() == MessageGoodbye::OriginType::Server) {
     LOG_INFO(info_log_, "Received goodbye for stream (%llu).", origin);
 
-    auto& data = *worker_data_[msg_loop_->GetThreadWorkerIndex()];
-    data.thread_check_.Check();
+    auto& data = GetWorkerData();
     data.stats_.goodbyes_from_server->Add(1);
     // Remove entry from streams map.
     int64_t session;
@@ -243,14 +428,28 @@ void Proxy::HandleGoodbyeMessage(std::unique_ptr<Message> msg,
       return;
     }
 
-    // If that was the last stream on the session, remove the session.
-    if (status == decltype(status)::kRemovedLast) {
+    auto it = data.open_sessions_.find(session);
+    auto moved = data.moved_sessions_.find(session);
+    if (it == data.open_sessions_.end() &&
+        moved != data.moved_sessions_.end()) {
+      // The stream was kept for a migrated session.
+      SendToWorker(moved->second, [this, session, local]() {
+        HandleRemoteStreamClosed(session, local);
+      });
+    } else if (status == decltype(status)::kRemovedLast &&
+               (it == data.open_sessions_.end() ||
+                it->second.remote_streams_.empty())) {
+      // If that was the last stream on the session, remove the session.
       LOG_INFO(info_log_,
                "Removed last stream on session %" PRIi64 ", closing session",
                session);
-      data.open_sessions_.erase(session);
+      if (it != data.open_sessions_.end()) {
+        ForgetSession(session, it->second.moved_from_);
+        data.open_sessions_.erase(it);
+      }
       on_disconnect_({session});
     }
+    data.UpdateSessionStats();
   } else {
     LOG_WARN(info_log_,
              "Proxy received client goodbye from %llu, but has no clients.",
@@ -259,8 +458,14 @@ void Proxy::HandleGoodbyeMessage(std::unique_ptr<Message> msg,
 }
 
 void Proxy::HandleDestroySession(int64_t session) {
-  auto& data = GetWorkerDataForSession(session);
-  data.thread_check_.Check();
+  auto& data = GetWorkerData();
+
+  if (!IsSessionOwner(data, session)) {
+    DeferCommand(data, session, [this, session]() {
+      HandleDestroySession(session);
+    });
+    return;
+  }
 
   auto it = data.open_sessions_.find(session);
   if (it == data.open_sessions_.end()) {
@@ -269,10 +474,37 @@ void Proxy::HandleDestroySession(int64_t session) {
   }
 
   LOG_INFO(info_log_, "Destroying session: %" PRIi64, session);
+  const int remote_worker = it->second.remote_worker_;
+  const std::vector<int> moved_from = std::move(it->second.moved_from_);
   // Remove session information.
   data.open_sessions_.erase(it);
+  CloseStreams(data, session);
+  if (remote_worker >= 0) {
+    // Close streams kept by the worker that the session was migrated from.
+    SendToWorker(remote_worker, [this, session]() {
+      CloseStreams(GetWorkerData(), session);
+    });
+  }
+  ForgetSession(session, moved_from);
+}
+
+void Proxy::ForgetSession(int64_t session, const std::vector<int>& moved_from) {
+  ClearPlacement(session);
+  // Sent after the streams kept on those workers were closed, so that their
+  // goodbyes still find the session migrated.
+  for (int worker_id : moved_from) {
+    SendToWorker(worker_id, [this, session]() {
+      auto& data = GetWorkerData();
+      data.moved_sessions_.erase(session);
+      data.UpdateSessionStats();
+    });
+  }
+}
+
+void Proxy::CloseStreams(ProxyWorkerData& data, int64_t session) {
   // Remove all streams for the session.
   auto removed = data.open_streams_.RemoveContext(session);
+  data.UpdateSessionStats();
 
   // Prepare list of streams that we will be sending goodbye to.
   SendCommand::StreamList recipients;
@@ -302,8 +534,42 @@ void Proxy::HandleMessageReceived(std::unique_ptr<Message> msg,
             "Received message from RocketSpeed, type %d",
             static_cast<int>(msg->GetMessageType()));
 
-  auto& data = *worker_data_[msg_loop_->GetThreadWorkerIndex()];
-  data.thread_check_.Check();
+  std::string serialized;
+  msg->SerializeToString(&serialized);
+  DeliverToSession(std::move(serialized), global);
+}
+
+void Proxy::HandleRawMessageReceived(MessageType message_type,
+                                     std::string msg,
+                                     StreamID global) {
+  if (!on_message_) {
+    return;
+  }
+
+  LOG_DEBUG(info_log_,
+            "Received message from RocketSpeed, type %d",
+            static_cast<int>(message_type));
+
+  // Same types as the callbacks registered on the message loop.
+  switch (message_type) {
+    case MessageType::mPing:
+    case MessageType::mDataAck:
+    case MessageType::mUnsubscribe:
+    case MessageType::mDeliverGap:
+    case MessageType::mDeliverData:
+      break;
+
+    default:
+      LOG_WARN(info_log_,
+               "Proxy received unexpected message type (%d)",
+               static_cast<int>(message_type));
+      return;
+  }
+  DeliverToSession(std::move(msg), global);
+}
+
+void Proxy::DeliverToSession(std::string msg, StreamID global) {
+  auto& data = GetWorkerData();
 
   // Find corresponding session and translate stream ID back, drop if stream was
   // not open.
@@ -318,68 +584,105 @@ void Proxy::HandleMessageReceived(std::unique_ptr<Message> msg,
     return;
   }
 
+  if (!data.open_sessions_.count(session) &&
+      !data.moved_sessions_.count(session)) {
+    LOG_ERROR(info_log_,
+              "Could not find open session %" PRIi64 ", stream (%llu) exists",
+              session,
+              global);
+    data.stats_.bad_origins->Add(1);
+    // This shall never happen.
+    assert(false);
+    return;
+  }
+  DeliverToClient(std::move(msg), session, local);
+}
+
+void Proxy::DeliverToClient(std::string msg,
+                            int64_t session,
+                            StreamID local) {
+  auto& data = GetWorkerData();
+
   MessageSequenceNumber seqno;
   {  // Assign sequence number, drop if session is not open.
     auto it = data.open_sessions_.find(session);
     if (it == data.open_sessions_.end()) {
-      LOG_ERROR(info_log_,
-                "Could not find open session %" PRIi64 ", stream (%llu) exists",
-                session,
-                global);
-      data.stats_.bad_origins->Add(1);
-      // This shall never happen.
-      assert(false);
+      auto moved = data.moved_sessions_.find(session);
+      if (moved != data.moved_sessions_.end()) {
+        // Session was migrated, but the stream stayed here.
+        auto moved_msg = folly::makeMoveWrapper(std::move(msg));
+        SendToWorker(moved->second,
+                     [this, moved_msg, session, local]() mutable {
+                       DeliverToClient(moved_msg.move(), session, local);
+                     });
+      } else {
+        // Session was destroyed meanwhile.
+        data.stats_.bad_origins->Add(1);
+      }
       return;
     }
     seqno = it->second.next_seqno_++;
+    data.AddLoad(&it->second);
   }
 
   // Include sequence number and origin stream in the message.
-  std::string serialized;
-  // TODO(pja) 1 : ideally we wouldn't reserialize here.
-  msg->SerializeToString(&serialized);
-  serialized = WrapMessage(std::move(serialized), local, seqno);
+  WrapMessageInPlace(&msg, local, seqno);
 
   // Deliver message.
-  on_message_(session, std::move(serialized));
+  on_message_(session, std::move(msg));
   data.stats_.on_message_calls->Add(1);
 }
 
-void Proxy::HandleMessageForwarded(std::string msg,
+void Proxy::HandleMessageForwarded(MessageType message_type,
+                                   std::string msg,
                                    int64_t session,
                                    MessageSequenceNumber sequence,
                                    StreamID local) {
-  auto& data = *worker_data_[msg_loop_->GetThreadWorkerIndex()];
-  data.thread_check_.Check();
+  auto& data = GetWorkerData();
+
+  if (!IsSessionOwner(data, session)) {
+    auto moved_msg = folly::makeMoveWrapper(std::move(msg));
+    DeferCommand(
+        data,
+        session,
+        [this, message_type, moved_msg, session, sequence, local]() mutable {
+          HandleMessageForwarded(
+              message_type, moved_msg.move(), session, sequence, local);
+        });
+    return;
+  }
 
   data.stats_.forwards->Add(1);
 
-  // TODO(pja) 1 : Really inefficient. Only need to deserialize header,
-  // not entire message, and don't need to copy entire message.
-  std::unique_ptr<char[]> buffer = Slice(msg).ToUniqueChars();
-  std::unique_ptr<Message> message =
-      Message::CreateNewInstance(std::move(buffer), msg.size());
+  if (!zero_copy_forwarding_) {
+    // Validate the whole message before forwarding it.
+    std::unique_ptr<char[]> buffer = Slice(msg).ToUniqueChars();
+    std::unique_ptr<Message> message =
+        Message::CreateNewInstance(std::move(buffer), msg.size());
 
-  // Find message type.
-  if (!message) {
-    LOG_ERROR(info_log_,
-              "Failed deserializing message forwarded to proxy, "
-              "session (%" PRIi64 ") seqno (%d) local stream (%llu)",
-              session,
-              sequence,
-              local);
-    data.stats_.forward_errors->Add(1);
-    // Kill the session.
-    HandleDestroySession(session);
-    on_disconnect_({session});
-    return;
+    // Find message type.
+    if (!message) {
+      LOG_ERROR(info_log_,
+                "Failed deserializing message forwarded to proxy, "
+                "session (%" PRIi64 ") seqno (%d) local stream (%llu)",
+                session,
+                sequence,
+                local);
+      data.stats_.forward_errors->Add(1);
+      // Kill the session.
+      HandleDestroySession(session);
+      on_disconnect_({session});
+      return;
+    }
+    message_type = message->GetMessageType();
   }
 
   // Filter out message by type.
-  switch (message->GetMessageType()) {
+  switch (message_type) {
     case MessageType::mPing:
     case MessageType::mPublish:
     case MessageType::mSubscribe:
+    case MessageType::mSubscribeBatch:
     case MessageType::mUnsubscribe:
     case MessageType::mGoodbye:
       break;
@@ -388,7 +691,7 @@ void Proxy::HandleMessageForwarded(std::string msg,
       LOG_ERROR(info_log_,
                 "Session %" PRIi64
                 " attempting to send invalid message type through proxy (%d)",
-                session, static_cast<int>(message->GetMessageType()));
+                session, static_cast<int>(message_type));
       data.stats_.forward_errors->Add(1);
       // Kill session.
       HandleDestroySession(session);
@@ -403,11 +706,13 @@ void Proxy::HandleMessageForwarded(std::string msg,
     SessionProcessor processor(
         info_log_,
         ordering_buffer_size_,
-        [this, session, &data](SessionProcessor::EventType event) {
-          // It's safe to capture data reference.
+        [this, session](SessionProcessor::EventType event) {
+          // The session may be migrated, so worker data is not captured.
           // Need to check if session is still there. Previous command
           // processed may have caused it to drop.
-          if (data.open_sessions_.find(session) == data.open_sessions_.end()) {
+          auto& worker_data = GetWorkerData();
+          if (worker_data.open_sessions_.find(session) ==
+              worker_data.open_sessions_.end()) {
             return;
           }
           HandleMessageForwardedInorder(event.type, std::move(event.message),
@@ -418,15 +723,16 @@ void Proxy::HandleMessageForwarded(std::string msg,
         data.open_sessions_.emplace(session, SessionInfo(std::move(processor)));
     assert(result.second);
     it = result.first;
+    data.UpdateSessionStats();
   }
+  data.AddLoad(&it->second);
 
   // Handle reordering.
   if (sequence == -1) {
-    HandleMessageForwardedInorder(message->GetMessageType(), std::move(msg),
-                                  session, local);
+    HandleMessageForwardedInorder(message_type, std::move(msg), session, local);
   } else {
     Status st = it->second.ordered_processor_.Process(
-        {message->GetMessageType(), std::move(msg), local}, sequence);
+        {message_type, std::move(msg), local}, sequence);
     if (!st.ok()) {
       LOG_ERROR(info_log_,
                 "Failed to insert message (%d) into processor"
@@ -446,7 +752,23 @@ void Proxy::HandleMessageForwardedInorder(MessageType message_type,
                                           std::string msg,
                                           int64_t session,
                                           StreamID local) {
-  auto& data = GetWorkerDataForSession(session);
+  auto& data = GetWorkerData();
+
+  auto session_it = data.open_sessions_.find(session);
+  if (session_it != data.open_sessions_.end()) {
+    SessionInfo& info = session_it->second;
+    auto remote = info.remote_streams_.find(local);
+    if (remote != info.remote_streams_.end()) {
+      // Stream was opened before the session was migrated, send the message
+      // on the connection of the worker that owns it.
+      const StreamID global = remote->second;
+      auto moved_msg = folly::makeMoveWrapper(std::move(msg));
+      SendToWorker(info.remote_worker_, [this, global, moved_msg]() mutable {
+        HandleRemoteStreamSend(global, moved_msg.move());
+      });
+      return;
+    }
+  }
 
   // Get unique stream ID for session and local stream ID pair.
   StreamID global;
@@ -460,6 +782,7 @@ void Proxy::HandleMessageForwardedInorder(MessageType message_type,
   assert(socket.IsOpen());
 
   if (status == decltype(status)::kInserted) {
+    data.UpdateSessionStats();
     HostId host;
     // Select destination based on message type.
     switch (message_type) {
@@ -473,6 +796,7 @@ void Proxy::HandleMessageForwardedInorder(MessageType message_type,
         break;
       }
       case MessageType::mSubscribe:
+      case MessageType::mSubscribeBatch:
       case MessageType::mUnsubscribe: {
         Status st = config_->GetCopilot(&host);
         if (!st.ok()) {
@@ -497,4 +821,183 @@ void Proxy::HandleMessageForwardedInorder(MessageType message_type,
       SerializedSendCommand::Request(std::move(msg), {&socket}));
 }
 
+void Proxy::HandleRemoteStreamSend(StreamID global, std::string msg) {
+  auto& data = GetWorkerData();
+
+  int64_t session;
+  StreamID local;
+  if (!data.open_streams_.FindLocalAndContext(global, &session, &local)) {
+    // Stream was closed meanwhile.
+    return;
+  }
+  StreamSocket socket(global);
+  assert(socket.IsOpen());
+  msg_loop_->SendCommandToSelf(
+      SerializedSendCommand::Request(std::move(msg), {&socket}));
+}
+
+void Proxy::HandleRemoteStreamClosed(int64_t session, StreamID local) {
+  auto& data = GetWorkerData();
+
+  auto it = data.open_sessions_.find(session);
+  if (it == data.open_sessions_.end()) {
+    // Session was destroyed meanwhile.
+    return;
+  }
+  SessionInfo& info = it->second;
+  info.remote_streams_.erase(local);
+  if (!info.remote_streams_.empty()) {
+    return;
+  }
+  info.remote_worker_ = -1;
+  if (data.open_streams_.GetContext(session).empty()) {
+    LOG_INFO(info_log_,
+             "Removed last stream on session %" PRIi64 ", closing session",
+             session);
+    ForgetSession(session, info.moved_from_);
+    data.open_sessions_.erase(it);
+    data.UpdateSessionStats();
+    on_disconnect_({session});
+  }
+}
+
+void Proxy::HandleRebalance() {
+  const int worker_id = msg_loop_->GetThreadWorkerIndex();
+  auto& data = GetWorkerData();
+
+  const uint64_t load = data.window_load_;
+  data.window_load_ = 0;
+  data.last_load_.store(load, std::memory_order_relaxed);
+
+  // Return commands to sessions that won't come after all.
+  for (auto it = data.incoming_sessions_.begin();
+       it != data.incoming_sessions_.end();) {
+    if (IsMigratingTo(it->first, worker_id)) {
+      ++it;
+      continue;
+    }
+    const int owner = WorkerForSession(it->first);
+    for (auto& command : it->second) {
+      SendToWorker(owner, std::move(command));
+    }
+    it = data.incoming_sessions_.erase(it);
+  }
+
+  // Find the least loaded worker, other workers' loads are from their last
+  // rebalancing.
+  uint64_t total_load = 0;
+  int target = worker_id;
+  uint64_t target_load = load;
+  for (int i = 0; i < msg_loop_->GetNumWorkers(); ++i) {
+    const uint64_t worker_load =
+        worker_data_[i]->last_load_.load(std::memory_order_relaxed);
+    total_load += worker_load;
+    if (worker_load < target_load) {
+      target = i;
+      target_load = worker_load;
+    }
+  }
+
+  // Pick the busiest session that can be moved without making the target
+  // busier than this worker, so that sessions don't bounce between workers.
+  // Sessions that already keep streams on another worker are not moved.
+  const uint64_t max_session_load = (load - target_load) / 2;
+  int64_t candidate = 0;
+  uint64_t candidate_load = 0;
+  for (auto& entry : data.open_sessions_) {
+    SessionInfo& info = entry.second;
+    if (info.load_ > candidate_load && info.load_ <= max_session_load &&
+        info.remote_worker_ < 0) {
+      candidate = entry.first;
+      candidate_load = info.load_;
+    }
+    info.load_ = 0;
+  }
+
+  const double average =
+      static_cast<double>(total_load) / msg_loop_->GetNumWorkers();
+  if (target != worker_id && candidate_load > 0 &&
+      static_cast<double>(load) > average * (1 + session_migration_imbalance_)) {
+    MigrateSession(data, candidate, target);
+  }
+}
+
+void Proxy::MigrateSession(ProxyWorkerData& data,
+                           int64_t session,
+                           int target) {
+  const int worker_id = msg_loop_->GetThreadWorkerIndex();
+  auto it = data.open_sessions_.find(session);
+  assert(it != data.open_sessions_.end());
+
+  // From now on the target queues commands for the session until it arrives.
+  SetPlacement(session, target, true);
+
+  auto info = std::make_shared<SessionInfo>(std::move(it->second));
+  data.open_sessions_.erase(it);
+  // Open streams stay on connections of this worker.
+  info->remote_streams_ = data.open_streams_.GetContext(session);
+  if (!info->remote_streams_.empty()) {
+    info->remote_worker_ = worker_id;
+  }
+  const bool moved_before =
+      std::find(info->moved_from_.begin(), info->moved_from_.end(),
+                worker_id) != info->moved_from_.end();
+  if (!moved_before) {
+    info->moved_from_.push_back(worker_id);
+  }
+
+  std::unique_ptr<Command> command(MakeExecuteCommand([this, session, info]() {
+    HandleSessionMigrated(session, std::move(*info));
+  }));
+  Status st = msg_loop_->SendCommand(std::move(command), target);
+  if (!st.ok()) {
+    LOG_WARN(info_log_,
+             "Failed to migrate session %" PRIi64 " to worker %d: %s",
+             session,
+             target,
+             st.ToString().c_str());
+    // Keep the session, target returns commands that it queued meanwhile.
+    info->remote_worker_ = -1;
+    info->remote_streams_.clear();
+    if (!moved_before) {
+      info->moved_from_.pop_back();
+    }
+    data.open_sessions_.emplace(session, std::move(*info));
+    SetPlacement(session, worker_id, false);
+    return;
+  }
+
+  LOG_INFO(info_log_,
+           "Migrating session %" PRIi64 " from worker %d to %d",
+           session,
+           worker_id,
+           target);
+  // Commands still on their way here are redirected.
+  data.moved_sessions_[session] = target;
+  data.stats_.sessions_migrated->Add(1);
+  data.UpdateSessionStats();
+}
+
+void Proxy::HandleSessionMigrated(int64_t session, SessionInfo info) {
+  const int worker_id = msg_loop_->GetThreadWorkerIndex();
+  auto& data = GetWorkerData();
+
+  data.moved_sessions_.erase(session);
+  auto result = data.open_sessions_.emplace(session, std::move(info));
+  assert(result.second);
+  (void)result;
+  data.UpdateSessionStats();
+  SetPlacement(session, worker_id, false);
+
+  // Run commands that arrived before the session, in order.
+  auto it = data.incoming_sessions_.find(session);
+  if (it != data.incoming_sessions_.end()) {
+    auto commands = std::move(it->second);
+    data.incoming_sessions_.erase(it);
+    for (auto& command : commands) {
+      command();
+    }
+  }
+}
+
 }  // namespace rocketspeed
@@ -5,6 +5,8 @@
 //
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <string>
@@ -26,7 +28,9 @@ namespace rocketspeed {
 
 class MsgLoop;
 class Message;
+struct PlacementShard;
 struct ProxyWorkerData;
+struct SessionInfo;
 class StreamSocket;
 
 /**
@@ -86,6 +90,9 @@ class Proxy {
    * immediately. This should be used if the caller can guarantee ordering or
    * for out of band messages.
    *
+   * Sessions may be migrated between workers to balance load, in which case
+   * their messages remain ordered.
+   *
    * Forward is thread safe.
    *
    * @param data The serialized message, sequence number and origin stream.
@@ -121,6 +128,9 @@ class Proxy {
   BaseEnv* env_;
   std::shared_ptr<Configuration> config_;
   const int ordering_buffer_size_;
+  const bool zero_copy_forwarding_;
+  const std::chrono::milliseconds session_migration_period_;
+  const double session_migration_imbalance_;
 
   std::unique_ptr<MsgLoop> msg_loop_;
   Env::ThreadId msg_thread_;
@@ -128,17 +138,64 @@ class Proxy {
   /** Worker data sharded by session. */
   std::vector<std::unique_ptr<ProxyWorkerData>> worker_data_;
 
+  /** Workers of migrated sessions, sharded by session. */
+  std::vector<std::unique_ptr<PlacementShard>> placement_shards_;
+  /** Number of sessions in placement_shards_, placement is static at 0. */
+  std::atomic<size_t> num_placements_;
+
   int WorkerForSession(int64_t session) const;
 
-  ProxyWorkerData& GetWorkerDataForSession(int64_t session);
+  PlacementShard& GetPlacementShard(int64_t session) const;
+
+  void SetPlacement(int64_t session, int worker_id, bool migrating);
+
+  void ClearPlacement(int64_t session);
+
+  bool IsMigratingTo(int64_t session, int worker_id) const;
+
+  /** Worker data of the calling worker thread. */
+  ProxyWorkerData& GetWorkerData();
+
+  /**
+   * Whether commands for the session are handled by the calling worker, true
+   * unless the session was migrated away from or is on its way to it.
+   */
+  bool IsSessionOwner(ProxyWorkerData& data, int64_t session) const;
+
+  /**
+   * Redirects a command for a session that the calling worker doesn't own,
+   * or queues it until the session arrives.
+   */
+  void DeferCommand(ProxyWorkerData& data,
+                    int64_t session,
+                    std::function<void()> command);
+
+  void SendToWorker(int worker_id, std::function<void()> command);
 
   void HandleGoodbyeMessage(std::unique_ptr<Message> msg, StreamID origin);
 
   void HandleDestroySession(int64_t session);
 
+  /**
+   * Drops the placement of a closed session, and the redirects to it on the
+   * workers that it was migrated from.
+   */
+  void ForgetSession(int64_t session, const std::vector<int>& moved_from);
+
+  void CloseStreams(ProxyWorkerData& data, int64_t session);
+
   void HandleMessageReceived(std::unique_ptr<Message> msg, StreamID origin);
 
-  void HandleMessageForwarded(std::string msg,
+  void HandleRawMessageReceived(MessageType message_type,
+                                std::string msg,
+                                StreamID origin);
+
+  void DeliverToSession(std::string msg, StreamID origin);
+
+  void DeliverToClient(std::string msg, int64_t session, StreamID local);
+
+  void HandleMessageForwarded(MessageType message_type,
+                              std::string msg,
                               int64_t session,
                               MessageSequenceNumber sequence,
                               StreamID local);
@@ -147,6 +204,16 @@ class Proxy {
                                      std::string msg,
                                      int64_t session,
                                      StreamID local);
+
+  void HandleRemoteStreamSend(StreamID global, std::string msg);
+
+  void HandleRemoteStreamClosed(int64_t session, StreamID local);
+
+  void HandleRebalance();
+
+  void MigrateSession(ProxyWorkerData& data, int64_t session, int target);
+
+  void HandleSessionMigrated(int64_t session, SessionInfo info);
 };
 
 }  // namespace rocketspeed
@@ -5,6 +5,7 @@
 //
 #include <unistd.h>
 #include <chrono>
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -42,6 +43,38 @@ TEST(WrappedMessage, Serialization) {
   ASSERT_EQ(seqno, seqno1);
 }
 
+TEST(WrappedMessage, InPlace) {
+  MessagePing ping(Tenant::GuestTenant, MessagePing::PingType::Request);
+  const StreamID stream = 42;
+  const MessageSequenceNumber seqno = 1337;
+  std::string message;
+  ping.SerializeToString(&message);
+
+  // Wrap a copy of the message with enough spare capacity for the footer.
+  std::string wrapped;
+  wrapped.reserve(message.size() + kWrappedMessageFooterSize);
+  wrapped = message;
+  const char* buffer = wrapped.data();
+  WrapMessageInPlace(&wrapped, stream, seqno);
+  ASSERT_EQ(buffer, wrapped.data());
+  ASSERT_EQ(WrapMessage(message, stream, seqno), wrapped);
+
+  // Unwrap it in place, decoding the type only.
+  StreamID stream1;
+  MessageSequenceNumber seqno1;
+  MessageType type;
+  ASSERT_OK(UnwrapMessageInPlace(&wrapped, &stream1, &seqno1, &type));
+  ASSERT_EQ(buffer, wrapped.data());
+  ASSERT_EQ(message, wrapped);
+  ASSERT_EQ(stream, stream1);
+  ASSERT_EQ(seqno, seqno1);
+  ASSERT_EQ(MessageType::mPing, type);
+
+  // Footer only, no message type.
+  std::string empty = WrapMessage("", stream, seqno);
+  ASSERT_TRUE(!UnwrapMessageInPlace(&empty, &stream1, &seqno1, &type).ok());
+}
+
 class ProxyTest {
  public:
   static const int kOrderingBufferSize = 10;
@@ -56,11 +89,15 @@ class ProxyTest {
     ASSERT_OK(cluster->GetStatus());
 
     // Create proxy.
+    ASSERT_OK(Proxy::CreateNewInstance(MakeOptions(), &proxy));
+  }
+
+  ProxyOptions MakeOptions() {
     ProxyOptions opts;
     opts.info_log = info_log;
     opts.conf = cluster->GetConfiguration();
     opts.ordering_buffer_size = kOrderingBufferSize;
-    ASSERT_OK(Proxy::CreateNewInstance(std::move(opts), &proxy));
+    return opts;
   }
 
   Env* env;
@@ -376,6 +413,181 @@ TEST(ProxyTest, ForwardGoodbye) {
   ASSERT_EQ(cockpit_loop->GetNumClientsSync(), clients_num - 2);
 }
 
+TEST(ProxyTest, ZeroCopyForwarding) {
+  ProxyOptions opts = MakeOptions();
+  opts.zero_copy_forwarding = true;
+  proxy.reset();
+  ASSERT_OK(Proxy::CreateNewInstance(std::move(opts), &proxy));
+
+  const int64_t expected_session = 123;
+  const StreamID pilot_stream = 123;
+  const StreamID copilot_stream = 321;
+
+  // Publish and subscribe, expect an ack and the published message back.
+  port::Semaphore ack_checkpoint, data_checkpoint;
+  // This is accessed from on_message callback only.
+  MessageSequenceNumber expected_seqno = 0;
+  auto on_message = [&](int64_t session, std::string data) {
+    ASSERT_EQ(session, expected_session);
+
+    StreamID stream;
+    MessageSequenceNumber seqno;
+    std::unique_ptr<Message> message;
+    ASSERT_OK(UnwrapMessage(std::move(data), &message, &stream, &seqno));
+    ASSERT_EQ(expected_seqno++, seqno);
+
+    switch (message->GetMessageType()) {
+      case MessageType::mDataAck:
+        ASSERT_EQ(stream, pilot_stream);
+        ack_checkpoint.Post();
+        break;
+      case MessageType::mDeliverData: {
+        ASSERT_EQ(stream, copilot_stream);
+        auto deliver = static_cast<MessageDeliverData*>(message.get());
+        ASSERT_EQ(deliver->GetPayload().ToString(), "payload");
+        data_checkpoint.Post();
+        break;
+      }
+      case MessageType::mDeliverGap:
+        ASSERT_EQ(stream, copilot_stream);
+        break;
+      default:
+        ASSERT_TRUE(false);
+    }
+  };
+  proxy->Start(on_message, nullptr);
+
+  std::string sub_serial;
+  MessageSubscribe subscribe(Tenant::GuestTenant,
+                             GuestNamespace,
+                             "ZeroCopyForwarding",
+                             1,
+                             123);
+  subscribe.SerializeToString(&sub_serial);
+  ASSERT_OK(proxy->Forward(WrapMessage(sub_serial, copilot_stream, 0),
+                           expected_session));
+
+  std::string publish_serial;
+  MessageData publish(MessageType::mPublish,
+                      Tenant::GuestTenant,
+                      Slice("ZeroCopyForwarding"),
+                      GuestNamespace,
+                      Slice("payload"));
+  publish.SerializeToString(&publish_serial);
+  ASSERT_OK(proxy->Forward(WrapMessage(publish_serial, pilot_stream, 1),
+                           expected_session));
+
+  ASSERT_TRUE(ack_checkpoint.TimedWait(std::chrono::seconds(1)));
+  ASSERT_TRUE(data_checkpoint.TimedWait(std::chrono::seconds(1)));
+
+  // Messages that can't be forwarded are still rejected by type.
+  port::Semaphore disconnected;
+  proxy.reset();
+  opts = MakeOptions();
+  opts.zero_copy_forwarding = true;
+  ASSERT_OK(Proxy::CreateNewInstance(std::move(opts), &proxy));
+  proxy->Start(nullptr, [&](const std::vector<int64_t>& sessions) {
+    disconnected.Post();
+  });
+  MessageDataAck ack(Tenant::GuestTenant, {});
+  std::string ack_serial;
+  ack.SerializeToString(&ack_serial);
+  ASSERT_OK(proxy->Forward(WrapMessage(ack_serial, pilot_stream, 0),
+                           expected_session));
+  ASSERT_TRUE(disconnected.TimedWait(std::chrono::seconds(1)));
+}
+
+TEST(ProxyTest, SessionMigration) {
+  ProxyOptions opts = MakeOptions();
+  opts.num_workers = 2;
+  opts.session_migration_period = std::chrono::milliseconds(20);
+  proxy.reset();
+  ASSERT_OK(Proxy::CreateNewInstance(std::move(opts), &proxy));
+
+  // Both sessions start on the same worker.
+  const std::vector<int64_t> sessions = {100, 102};
+  const StreamID stream = 1337;
+
+  port::Semaphore checkpoint;
+  std::mutex mutex;
+  std::unordered_map<int64_t, MessageSequenceNumber> expected_seqno;
+  auto on_message = [&](int64_t session, std::string data) {
+    StreamID stream1;
+    MessageSequenceNumber seqno;
+    std::unique_ptr<Message> msg;
+    ASSERT_OK(UnwrapMessage(std::move(data), &msg, &stream1, &seqno));
+    ASSERT_EQ(stream, stream1);
+    ASSERT_EQ(MessageType::mPing, msg->GetMessageType());
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ASSERT_EQ(expected_seqno[session]++, seqno);
+    }
+    checkpoint.Post();
+  };
+  std::atomic<size_t> disconnected(0);
+  auto on_disconnect = [&](const std::vector<int64_t>& disconnected_sessions) {
+    disconnected += disconnected_sessions.size();
+  };
+  proxy->Start(on_message, on_disconnect);
+
+  MessagePing ping(Tenant::GuestTenant, MessagePing::PingType::Request);
+  std::string serial;
+  ping.SerializeToString(&serial);
+
+  // Keep sending pings, pairs out of order, until a session was migrated and
+  // then some more.
+  std::unordered_map<int64_t, MessageSequenceNumber> next_seqno;
+  auto send_round = [&]() {
+    for (int64_t session : sessions) {
+      // Second session is less busy, so that it's the one to be migrated.
+      const int pairs = session == sessions[0] ? 4 : 2;
+      for (int i = 0; i < pairs; ++i) {
+        MessageSequenceNumber seqno = next_seqno[session];
+        next_seqno[session] += 2;
+        ASSERT_OK(proxy->Forward(WrapMessage(serial, stream, seqno + 1),
+                                 session));
+        ASSERT_OK(proxy->Forward(WrapMessage(serial, stream, seqno),
+                                 session));
+      }
+    }
+    for (int i = 0; i < 12; ++i) {
+      ASSERT_TRUE(checkpoint.TimedWait(std::chrono::seconds(1)));
+    }
+  };
+  auto migrated = [&]() {
+    return proxy->GetStatisticsSync().GetCounterValue(
+        "proxy.sessions_migrated");
+  };
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::seconds(5);
+  while (migrated() == 0) {
+    ASSERT_TRUE(std::chrono::steady_clock::now() < deadline);
+    send_round();
+  }
+  for (int i = 0; i < 20; ++i) {
+    send_round();
+  }
+
+  // Sessions are split between the workers now.
+  Statistics stats = proxy->GetStatisticsSync();
+  ASSERT_EQ(stats.GetCounterValue("proxy.worker0.open_sessions"), 1);
+  ASSERT_EQ(stats.GetCounterValue("proxy.worker1.open_sessions"), 1);
+  ASSERT_GT(stats.GetCounterValue("proxy.worker1.load"), 0);
+  ASSERT_GE(stats.GetCounterValue("proxy.session_placements"), 1);
+  ASSERT_GE(stats.GetCounterValue("proxy.moved_sessions"), 1);
+  ASSERT_EQ(0, disconnected.load());
+
+  // Destroying the migrated session closes its stream on the first worker.
+  proxy->DestroySession(sessions[1]);
+  env->SleepForMicroseconds(50000);
+  stats = proxy->GetStatisticsSync();
+  ASSERT_EQ(stats.GetCounterValue("proxy.open_sessions"), 1);
+  ASSERT_EQ(stats.GetCounterValue("proxy.open_stream"), 1);
+  // Nothing is left behind for the destroyed session.
+  ASSERT_EQ(stats.GetCounterValue("proxy.session_placements"), 0);
+  ASSERT_EQ(stats.GetCounterValue("proxy.moved_sessions"), 0);
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
@@ -72,6 +72,9 @@ class RollcallStream {
 class RollcallEntry {
  public:
   static const char ROLLCALL_ENTRY_VERSION_CURRENT = '2';
+  // Batches with cancelled and prefix compressed entries, see
+  // RollcallBatchWriter.
+  static const char ROLLCALL_ENTRY_VERSION_COMPACT = '3';
 
   // The types of Rollcall Entries.
   enum EntryType : char {
@@ -29,12 +29,16 @@ Status RollcallStream::Open(ClientOptions client_options,
 }
 
 const NamespaceID RollcallImpl::kRollcallNamespace = "_r";
+const char RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT;
+const char RollcallEntry::ROLLCALL_ENTRY_VERSION_COMPACT;
 
 RollcallImpl::RollcallImpl(std::shared_ptr<ClientImpl> client,
                            const TenantID tenant_id,
-                           std::string stats_prefix)
+                           std::string stats_prefix,
+                           bool compact_batches)
     : client_(std::move(client)),
       tenant_id_(tenant_id),
+      compact_batches_(compact_batches),
       stats_(std::move(stats_prefix)) {
 }
 
@@ -50,6 +54,30 @@ RollcallShard RollcallImpl::GetNumShards(const NamespaceID& namespace_id) {
 Status RollcallImpl::Subscribe(const NamespaceID& namespace_id,
                                RollcallShard shard_id,
                                const RollCallback callback) {
+  if (!callback) {
+    return Status::InvalidArgument("Missing callback");
+  }
+  return SubscribeBatches(
+    namespace_id,
+    shard_id,
+    0,
+    [callback] (SequenceNumber, RollcallBatchReader* reader) {
+      if (!reader) {
+        callback(RollcallEntry());
+        return;
+      }
+      RollcallEntry::EntryType type;
+      Slice topic_name;
+      while (reader->Next(&type, &topic_name)) {
+        callback(RollcallEntry(topic_name.ToString(), type));
+      }
+    });
+}
+
+Status RollcallImpl::SubscribeBatches(const NamespaceID& namespace_id,
+                                      RollcallShard shard_id,
+                                      SequenceNumber start_seqno,
+                                      RollcallBatchCallback callback) {
   if (shard_id >= GetNumShards(namespace_id)) {
     return Status::InvalidArgument("Shard ID out of range");
   }
@@ -60,30 +88,18 @@ Status RollcallImpl::Subscribe(const NamespaceID& namespace_id,
   auto subscribe_callback = [callback](const SubscriptionStatus& ss) {
     if (!ss.GetStatus().ok()) {
       // Notify about failed subscription.
-      callback(RollcallEntry());
+      callback(0, nullptr);
     }
   };
   auto receive_callback = [callback] (std::unique_ptr<MessageReceived>& msg) {
-    Slice in(msg->GetContents());
-    if (in.size() >= 2 && in[1] == '_') {
-      auto version = in[0];
-      if (version == RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT) {
-        in.remove_prefix(2);
-        while (!in.empty()) {
-          RollcallEntry rmsg(version);
-          if (!rmsg.DeSerialize(&in).ok()) {
-            break;
-          }
-          callback(std::move(rmsg));
-        }
-      }
-    }
+    RollcallBatchReader reader(msg->GetContents());
+    callback(msg->GetSequenceNumber(), &reader);
   };
 
   auto handle = client_->Subscribe(tenant_id_,
                                    kRollcallNamespace,
                                    GetRollcallTopicName(namespace_id, shard_id),
-                                   0,
+                                   start_seqno,
                                    std::move(receive_callback),
                                    std::move(subscribe_callback));
   return handle ? Status::OK()
@@ -95,7 +111,8 @@ Status RollcallImpl::WriteEntry(const TenantID tenant_id,
                                 size_t shard_affinity,
                                 bool isSubscription,
                                 std::function<void(Status)> publish_callback,
-                                size_t max_batch_size_bytes) {
+                                size_t max_batch_size_bytes,
+                                std::chrono::milliseconds flush_latency) {
   thread_check_.Check();
 
   Slice namespace_id;
@@ -108,28 +125,25 @@ Status RollcallImpl::WriteEntry(const TenantID tenant_id,
     return Status::OK();
   }
 
-  // Serialize the entry
-  RollcallEntry impl(topic_name.ToString(),
-                     isSubscription
-                         ? RollcallEntry::EntryType::SubscriptionRequest
-                         : RollcallEntry::EntryType::UnSubscriptionRequest);
-
   const RollcallShard shard = GetRollcallShard(nsid, shard_affinity);
   const BatchKey batch_key(shard, std::move(nsid), tenant_id);
 
-  Batch& batch = batches_[batch_key];
-  if (batch.payload.empty()) {
-    // First entry -- write batch header.
-    batch.payload.push_back(RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT);
-    batch.payload.push_back('_');
-
-    // Also add to batch timeout list.
-    batch_timeouts_.Add(batch_key);
+  auto it = batches_.find(batch_key);
+  if (it == batches_.end()) {
+    it = batches_.emplace(batch_key, Batch(compact_batches_)).first;
+  }
+  Batch& batch = it->second;
+  if (batch.callbacks.empty()) {
+    // First entry -- add to batch timeout list.
+    batch_timeouts_.Add(batch_key, flush_latency);
   }
-  impl.Serialize(&batch.payload);
+  batch.writer.Add(isSubscription
+                       ? RollcallEntry::EntryType::SubscriptionRequest
+                       : RollcallEntry::EntryType::UnSubscriptionRequest,
+                   topic_name);
   batch.callbacks.emplace_back(std::move(publish_callback));
 
-  if (batch.payload.size() >= max_batch_size_bytes) {
+  if (batch.writer.GetEncodedSizeBound() >= max_batch_size_bytes) {
     FlushBatch(batch_key);
     batch_timeouts_.Erase(batch_key);
     stats_.batch_size_writes->Add(1);
@@ -137,10 +151,9 @@ Status RollcallImpl::WriteEntry(const TenantID tenant_id,
   return Status::OK();
 }
 
-void RollcallImpl::CheckBatchTimeouts(std::chrono::milliseconds timeout) {
+void RollcallImpl::CheckBatchTimeouts() {
   thread_check_.Check();
   batch_timeouts_.ProcessExpired(
-    timeout,
     [this] (const BatchKey& key) {
       FlushBatch(key);
       stats_.batch_timeout_writes->Add(1);
@@ -148,18 +161,38 @@ void RollcallImpl::CheckBatchTimeouts(std::chrono::milliseconds timeout) {
     -1 /* process all */);
 }
 
+std::chrono::steady_clock::time_point RollcallImpl::GetNextBatchTimeout() const {
+  thread_check_.Check();
+  return batch_timeouts_.GetNextDeadline();
+}
+
 Status RollcallImpl::FlushBatch(const BatchKey& key) {
   thread_check_.Check();
   Status st;
-  Batch& batch = batches_[key];
-  if (!batch.payload.empty()) {
+  auto it = batches_.find(key);
+  if (it == batches_.end()) {
+    return st;
+  }
+  Batch& batch = it->second;
+  if (!batch.callbacks.empty() && batch.writer.Empty()) {
+    // All entries cancelled out, nothing to write.
+    batch.writer.Finish(&payload_);
+    payload_.clear();
+    stats_.cancelled_batches->Add(1);
+    auto callbacks = std::move(batch.callbacks);
+    batch.callbacks.clear();
+    for (auto& callback : callbacks) {
+      callback(Status::OK());
+    }
+  } else if (!batch.callbacks.empty()) {
     // write it out to rollcall topic
     const RollcallShard shard = std::get<0>(key);
     const NamespaceID& nsid = std::get<1>(key);
     const TenantID tenant_id = std::get<2>(key);
 
+    batch.writer.Finish(&payload_);
     const size_t num_entries = batch.callbacks.size();
-    stats_.batch_size_bytes->Record(batch.payload.size());
+    stats_.batch_size_bytes->Record(payload_.size());
     stats_.batch_size_entries->Record(num_entries);
     stats_.batch_writes->Add(1);
     stats_.entry_writes->Add(num_entries);
@@ -176,10 +209,10 @@ Status RollcallImpl::FlushBatch(const BatchKey& key) {
                           GetRollcallTopicName(nsid, shard),
                           kRollcallNamespace,
                           TopicOptions(),
-                          Slice(batch.payload),
+                          Slice(payload_),
                           std::move(publish_callback),
                           MsgId()).status;
-    batch.payload.clear();
+    payload_.clear();
     batch.callbacks.clear();
   }
   return st;
@@ -231,6 +264,7 @@ RollcallImpl::Stats::Stats(std::string prefix) {
   entry_writes = all.AddCounter(prefix + ".entry_writes");
   batch_size_writes = all.AddCounter(prefix + ".batch_size_writes");
   batch_timeout_writes = all.AddCounter(prefix + ".batch_timeout_writes");
+  cancelled_batches = all.AddCounter(prefix + ".cancelled_batches");
 }
 
 }  // namespace rocketspeed
@@ -0,0 +1,169 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/rollcall/rollcall_batch.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "src/util/common/coding.h"
+
+namespace rocketspeed {
+
+namespace {
+
+const size_t kHeaderSize = 2;
+
+bool IsRequest(RollcallEntry::EntryType type) {
+  return type == RollcallEntry::EntryType::SubscriptionRequest ||
+         type == RollcallEntry::EntryType::UnSubscriptionRequest;
+}
+
+}  // namespace
+
+RollcallBatchWriter::RollcallBatchWriter(bool compact)
+: compact_(compact)
+, encoded_size_bound_(0) {
+}
+
+void RollcallBatchWriter::Add(RollcallEntry::EntryType type,
+                              Slice topic_name) {
+  assert(IsRequest(type));
+  if (encoded_size_bound_ == 0) {
+    encoded_size_bound_ = kHeaderSize;
+  }
+
+  if (!compact_) {
+    const size_t size = payload_.size();
+    payload_.push_back(type);
+    payload_.push_back('_');
+    PutLengthPrefixedSlice(&payload_, topic_name);
+    encoded_size_bound_ += payload_.size() - size;
+    return;
+  }
+
+  int64_t& count = topics_[topic_name.ToString()];
+  encoded_size_bound_ -= CompactSize(topic_name.size(), count);
+  count += type == RollcallEntry::EntryType::SubscriptionRequest ? 1 : -1;
+  encoded_size_bound_ += CompactSize(topic_name.size(), count);
+}
+
+bool RollcallBatchWriter::Empty() const {
+  if (!compact_) {
+    return payload_.empty();
+  }
+  for (const auto& entry : topics_) {
+    if (entry.second != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void RollcallBatchWriter::Finish(std::string* out) {
+  out->reserve(out->size() + encoded_size_bound_);
+  out->push_back(compact_ ? RollcallEntry::ROLLCALL_ENTRY_VERSION_COMPACT
+                          : RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT);
+  out->push_back('_');
+
+  if (!compact_) {
+    out->append(payload_);
+    payload_.clear();
+  } else {
+    // Topics are sorted, so consecutive names share long prefixes.
+    const std::string* previous = nullptr;
+    for (const auto& entry : topics_) {
+      const std::string& topic = entry.first;
+      const auto type = entry.second > 0
+                            ? RollcallEntry::EntryType::SubscriptionRequest
+                            : RollcallEntry::EntryType::UnSubscriptionRequest;
+      size_t shared = 0;
+      if (previous) {
+        const size_t limit = std::min(previous->size(), topic.size());
+        while (shared < limit && (*previous)[shared] == topic[shared]) {
+          ++shared;
+        }
+      }
+      for (int64_t i = 0; i < std::abs(entry.second); ++i) {
+        out->push_back(static_cast<char>(type));
+        PutVarint32(out, static_cast<uint32_t>(shared));
+        PutVarint32(out, static_cast<uint32_t>(topic.size() - shared));
+        out->append(topic, shared, std::string::npos);
+        // Repeated entries share the whole name.
+        shared = topic.size();
+        previous = &topic;
+      }
+    }
+    topics_.clear();
+  }
+  encoded_size_bound_ = 0;
+}
+
+size_t RollcallBatchWriter::CompactSize(size_t topic_size, int64_t count) {
+  if (count == 0) {
+    return 0;
+  }
+  const size_t length_size = VarintLength(topic_size);
+  // The first entry shares at most as much as the following ones.
+  return (1 + length_size + length_size + topic_size) +
+         static_cast<size_t>(std::abs(count) - 1) * (1 + length_size + 1);
+}
+
+RollcallBatchReader::RollcallBatchReader(Slice batch)
+: in_(batch)
+, version_(0) {
+  if (in_.size() < kHeaderSize || in_[1] != '_') {
+    status_ = Status::InvalidArgument("Invalid rollcall batch header");
+    return;
+  }
+  version_ = in_[0];
+  if (version_ != RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT &&
+      version_ != RollcallEntry::ROLLCALL_ENTRY_VERSION_COMPACT) {
+    status_ = Status::NotSupported("Unknown rollcall batch version");
+    return;
+  }
+  in_.remove_prefix(kHeaderSize);
+}
+
+bool RollcallBatchReader::Next(RollcallEntry::EntryType* type,
+                               Slice* topic_name) {
+  if (!status_.ok() || in_.empty()) {
+    return false;
+  }
+
+  if (!GetFixedEnum8(&in_, type) || !IsRequest(*type)) {
+    status_ = Status::InvalidArgument("Invalid rollcall entry type");
+    return false;
+  }
+
+  if (version_ == RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT) {
+    if (in_.empty() || in_[0] != '_') {
+      status_ = Status::InvalidArgument("Invalid rollcall entry format");
+      return false;
+    }
+    in_.remove_prefix(1);
+    if (!GetLengthPrefixedSlice(&in_, topic_name)) {
+      status_ = Status::InvalidArgument("Invalid rollcall entry topic name");
+      return false;
+    }
+    return true;
+  }
+
+  uint32_t shared;
+  uint32_t suffix_size;
+  if (!GetVarint32(&in_, &shared) || !GetVarint32(&in_, &suffix_size) ||
+      shared > topic_name_.size() || suffix_size > in_.size()) {
+    status_ = Status::InvalidArgument("Invalid rollcall entry topic name");
+    return false;
+  }
+  // Reuses the capacity of the previous name.
+  topic_name_.resize(shared);
+  topic_name_.append(in_.data(), suffix_size);
+  in_.remove_prefix(suffix_size);
+  *topic_name = Slice(topic_name_);
+  return true;
+}
+
+}  // namespace rocketspeed
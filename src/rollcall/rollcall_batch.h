@@ -0,0 +1,103 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "include/Slice.h"
+#include "include/Status.h"
+#include "src/rollcall/RollCall.h"
+
+namespace rocketspeed {
+
+/**
+ * Builds the payload of a batch of rollcall entries.
+ *
+ * Batches are written either in the original format, one entry after another,
+ * or in the compact format (ROLLCALL_ENTRY_VERSION_COMPACT). A compact batch
+ * cancels subscribe and unsubscribe entries of the same topic against each
+ * other, sorts the topics, and encodes each topic name as the length of the
+ * prefix shared with the previous one and the remaining suffix:
+ *
+ *   batch := version '_' entry*
+ *   entry := type varint32(shared) varint32(suffix length) suffix
+ *
+ * Entries of one topic in a batch are therefore all of the same type, and
+ * their order relative to entries on other topics is not preserved.
+ */
+class RollcallBatchWriter {
+ public:
+  explicit RollcallBatchWriter(bool compact);
+
+  /** Adds an entry to the batch. */
+  void Add(RollcallEntry::EntryType type, Slice topic_name);
+
+  /** Returns true iff the batch would have no entries. */
+  bool Empty() const;
+
+  /** Upper bound on the size of the encoded batch. */
+  size_t GetEncodedSizeBound() const {
+    return encoded_size_bound_;
+  }
+
+  /**
+   * Encodes the batch and resets the writer.
+   *
+   * @param out Output string to append the batch to.
+   */
+  void Finish(std::string* out);
+
+ private:
+  // Encoded size of the compact entries of a topic, given their number.
+  static size_t CompactSize(size_t topic_size, int64_t count);
+
+  const bool compact_;
+  size_t encoded_size_bound_;
+
+  // Uncompacted entries.
+  std::string payload_;
+
+  // Number of subscriptions minus number of unsubscriptions per topic.
+  std::map<std::string, int64_t> topics_;
+};
+
+/**
+ * Decodes batches of rollcall entries in either format without allocating
+ * per entry. Topic names are valid until the next call to Next.
+ */
+class RollcallBatchReader {
+ public:
+  /**
+   * @param batch The payload of a rollcall batch, has to outlive the reader.
+   */
+  explicit RollcallBatchReader(Slice batch);
+
+  /**
+   * Decodes the next entry.
+   *
+   * @param type Output for the type of the entry.
+   * @param topic_name Output for the topic name.
+   * @return true iff an entry was decoded, false at the end of the batch or
+   *         if the batch is malformed, see GetStatus.
+   */
+  bool Next(RollcallEntry::EntryType* type, Slice* topic_name);
+
+  /** Returns an error if the batch is malformed. */
+  const Status& GetStatus() const {
+    return status_;
+  }
+
+ private:
+  Slice in_;
+  char version_;
+  Status status_;
+  // Last topic name of a compact batch, the next one is built from it.
+  std::string topic_name_;
+};
+
+}  // namespace rocketspeed
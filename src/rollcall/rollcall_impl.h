@@ -10,12 +10,13 @@
 
 #include "include/RocketSpeed.h"
 #include "src/rollcall/RollCall.h"
+#include "src/rollcall/rollcall_batch.h"
 #include "src/client/client.h"
 #include "src/util/common/coding.h"
 #include "src/util/common/hash.h"
 #include "src/util/common/statistics.h"
 #include "src/util/common/thread_check.h"
-#include "src/util/timeout_list.h"
+#include "src/util/timer_wheel.h"
 
 namespace rocketspeed {
 
@@ -27,9 +28,14 @@ struct TopicUUID;
  */
 class RollcallImpl : public RollcallStream {
  public:
+  /**
+   * @param compact_batches Write batches in the compact format, which
+   *                        readers older than the format cannot decode.
+   */
   RollcallImpl(std::shared_ptr<ClientImpl> client,
                TenantID tenant_id,
-               std::string stats_prefix = "rollcall");
+               std::string stats_prefix = "rollcall",
+               bool compact_batches = false);
 
   RollcallShard GetNumShards(const NamespaceID& namespace_id) override;
 
@@ -37,23 +43,50 @@ class RollcallImpl : public RollcallStream {
                    RollcallShard shard_id,
                    RollCallback callback) override;
 
+  /**
+   * Invoked for every batch of entries in the rollcall stream, with the
+   * sequence number of the batch, without constructing RollcallEntries. The
+   * reader, and the topic names it decodes, are only valid during the call.
+   * Errors are reported with a null reader.
+   */
+  typedef std::function<void(SequenceNumber, RollcallBatchReader*)>
+    RollcallBatchCallback;
+
+  /**
+   * Like Subscribe, but does not allocate per entry.
+   *
+   * @param start_seqno First sequence number to read, 0 reads from the tail.
+   */
+  Status SubscribeBatches(const NamespaceID& namespace_id,
+                          RollcallShard shard_id,
+                          SequenceNumber start_seqno,
+                          RollcallBatchCallback callback);
+
   /**
    * Writes an entry to the rollcall topic. This isn't written to RocketSpeed
    * until FlushBatch is called.
+   *
+   * @param flush_latency If this entry starts a new batch, the batch will be
+   *                      flushed by CheckBatchTimeouts after this time.
    */
   Status WriteEntry(const TenantID tenant_id,
                     const TopicUUID& topic,
                     size_t shard_affinity,
                     bool isSubscription,
                     std::function<void(Status)> publish_callback,
-                    size_t max_batch_size_bytes);
+                    size_t max_batch_size_bytes,
+                    std::chrono::milliseconds flush_latency);
 
   /**
-   * Flushes all batches that are older than timeout.
-   *
-   * @param timeout Minimum age of batches to flush.
+   * Flushes all batches that have reached their flush latency.
    */
-  void CheckBatchTimeouts(std::chrono::milliseconds timeout);
+  void CheckBatchTimeouts();
+
+  /**
+   * Returns a time no later than when the next batch reaches its flush
+   * latency, or time_point::max() if there are no pending batches.
+   */
+  std::chrono::steady_clock::time_point GetNextBatchTimeout() const;
 
   const Statistics& GetStatistics() const {
     return stats_.all;
@@ -67,7 +100,9 @@ class RollcallImpl : public RollcallStream {
   // A single batch of rollcall entries.
   // These will be written with one RocketSpeed Publish.
   struct Batch {
-    std::string payload;
+    explicit Batch(bool compact) : writer(compact) {}
+
+    RollcallBatchWriter writer;
     std::vector<std::function<void(Status)>> callbacks;
   };
 
@@ -85,9 +120,11 @@ class RollcallImpl : public RollcallStream {
 
   const std::shared_ptr<ClientImpl> client_;
   const TenantID tenant_id_;
+  const bool compact_batches_;
+  std::string payload_;  // reused between flushes
   std::unordered_map<BatchKey, Batch, BatchKeyHash> batches_;
   ThreadCheck thread_check_;
-  TimeoutList<BatchKey, BatchKeyHash> batch_timeouts_;
+  TimerWheel<BatchKey, BatchKeyHash> batch_timeouts_;
 
   struct Stats {
     explicit Stats(std::string prefix);
@@ -99,6 +136,7 @@ class RollcallImpl : public RollcallStream {
     Counter* entry_writes;
     Counter* batch_size_writes;
     Counter* batch_timeout_writes;
+    Counter* cancelled_batches;
   } stats_;
 
   RollcallShard GetRollcallShard(const NamespaceID& namespace_id,
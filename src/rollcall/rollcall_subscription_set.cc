@@ -0,0 +1,268 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/rollcall/rollcall_subscription_set.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
+
+#include "src/rollcall/rollcall_impl.h"
+#include "src/util/arena.h"
+#include "src/util/common/hash.h"
+
+namespace rocketspeed {
+
+struct RollcallSubscriptionSet::State {
+  // Topics are partitioned by name, independently of rollcall shards, so
+  // that lookups know where to look.
+  static constexpr size_t kNumPartitions = 16;
+
+  struct Partition {
+    std::mutex mutex;
+    // Storage of the interned topic names, keys of topics point into it.
+    Arena names;
+    // Number of subscribers of each topic seen.
+    std::unordered_map<Slice, uint64_t, MurmurHash2<Slice>> topics;
+    size_t num_subscribed = 0;
+  };
+
+  struct Shard {
+    // Held while a batch is applied, so that holding all shard locks gives a
+    // view consistent with the sequence numbers.
+    std::mutex mutex;
+    // Sequence number of the last applied batch, 0 if none.
+    SequenceNumber seqno = 0;
+  };
+
+  typedef std::function<void(RollcallShard, SequenceNumber, Slice, uint64_t)>
+    ChangeCallback;
+
+  State(RollcallShard _num_shards, ChangeCallback _on_change)
+  : num_shards(_num_shards)
+  , shards(new Shard[_num_shards])
+  , on_change(std::move(_on_change)) {
+  }
+
+  Partition& GetPartition(Slice topic_name) {
+    return partitions[MurmurHash2<Slice>()(topic_name) % kNumPartitions];
+  }
+
+  // Returns the entry of a topic, interning its name if not seen yet.
+  // Must be called with the lock of the partition held.
+  std::unordered_map<Slice, uint64_t, MurmurHash2<Slice>>::iterator
+  Intern(Partition* partition, Slice topic_name);
+
+  void HandleBatch(RollcallShard shard,
+                   SequenceNumber seqno,
+                   RollcallBatchReader* reader);
+
+  void HandleEntry(RollcallShard shard,
+                   SequenceNumber seqno,
+                   RollcallEntry::EntryType type,
+                   Slice topic_name);
+
+  const RollcallShard num_shards;
+  Partition partitions[kNumPartitions];
+  std::unique_ptr<Shard[]> shards;
+
+  const ChangeCallback on_change;
+
+  std::atomic<bool> failed{false};
+};
+
+constexpr size_t RollcallSubscriptionSet::State::kNumPartitions;
+
+std::unordered_map<Slice, uint64_t, MurmurHash2<Slice>>::iterator
+RollcallSubscriptionSet::State::Intern(Partition* partition, Slice topic_name) {
+  auto it = partition->topics.find(topic_name);
+  if (it == partition->topics.end()) {
+    // Intern the name, the topic name of the entry is not owned.
+    const size_t size = topic_name.size();
+    char* name = partition->names.Allocate(std::max<size_t>(size, 1));
+    memcpy(name, topic_name.data(), size);
+    it = partition->topics.emplace(Slice(name, size), 0).first;
+  }
+  return it;
+}
+
+void RollcallSubscriptionSet::State::HandleBatch(
+    RollcallShard shard,
+    SequenceNumber seqno,
+    RollcallBatchReader* reader) {
+  if (!reader) {
+    failed = true;
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(shards[shard].mutex);
+  if (seqno <= shards[shard].seqno) {
+    // Already applied.
+    return;
+  }
+  RollcallEntry::EntryType type;
+  Slice topic_name;
+  while (reader->Next(&type, &topic_name)) {
+    HandleEntry(shard, seqno, type, topic_name);
+  }
+  if (!reader->GetStatus().ok()) {
+    failed = true;
+  }
+  shards[shard].seqno = seqno;
+}
+
+void RollcallSubscriptionSet::State::HandleEntry(
+    RollcallShard shard,
+    SequenceNumber seqno,
+    RollcallEntry::EntryType type,
+    Slice topic_name) {
+  Partition& partition = GetPartition(topic_name);
+  std::lock_guard<std::mutex> lock(partition.mutex);
+  uint64_t count;
+  if (type == RollcallEntry::EntryType::SubscriptionRequest) {
+    auto it = Intern(&partition, topic_name);
+    count = ++it->second;
+    if (count == 1) {
+      ++partition.num_subscribed;
+    }
+    topic_name = it->first;
+  } else {
+    // Unsubscriptions of topics without subscribers were either subscribed
+    // before the set started or are duplicates, and change nothing.
+    auto it = partition.topics.find(topic_name);
+    if (it == partition.topics.end() || it->second == 0) {
+      return;
+    }
+    count = --it->second;
+    if (count == 0) {
+      --partition.num_subscribed;
+    }
+  }
+
+  if (on_change) {
+    on_change(shard, seqno, topic_name, count);
+  }
+}
+
+RollcallSubscriptionSet::RollcallSubscriptionSet(
+    std::shared_ptr<RollcallImpl> rollcall,
+    NamespaceID namespace_id,
+    Options options)
+: rollcall_(std::move(rollcall))
+, namespace_id_(std::move(namespace_id))
+, snapshot_period_(options.snapshot_period)
+, state_(std::make_shared<State>(rollcall_->GetNumShards(namespace_id_),
+                                 std::move(options.on_change))) {
+}
+
+RollcallSubscriptionSet::~RollcallSubscriptionSet() = default;
+
+Status RollcallSubscriptionSet::Start(
+    std::shared_ptr<const RollcallSnapshot> snapshot) {
+  if (snapshot) {
+    if (snapshot->shard_seqnos.size() != state_->num_shards) {
+      return Status::InvalidArgument("Snapshot has wrong number of shards");
+    }
+    for (const auto& topic : snapshot->topics) {
+      State::Partition& partition = state_->GetPartition(topic.first);
+      std::lock_guard<std::mutex> lock(partition.mutex);
+      auto it = state_->Intern(&partition, topic.first);
+      if (it->second == 0 && topic.second > 0) {
+        ++partition.num_subscribed;
+      }
+      it->second = topic.second;
+    }
+    for (RollcallShard i = 0; i < state_->num_shards; ++i) {
+      std::lock_guard<std::mutex> lock(state_->shards[i].mutex);
+      state_->shards[i].seqno = snapshot->shard_seqnos[i];
+    }
+  }
+
+  for (RollcallShard shard = 0; shard < state_->num_shards; ++shard) {
+    // Resume after the last applied batch, or from the tail if there is none.
+    const SequenceNumber last_seqno =
+      snapshot ? snapshot->shard_seqnos[shard] : 0;
+    std::shared_ptr<State> state = state_;
+    Status st = rollcall_->SubscribeBatches(
+      namespace_id_,
+      shard,
+      last_seqno ? last_seqno + 1 : 0,
+      [state, shard] (SequenceNumber seqno, RollcallBatchReader* reader) {
+        state->HandleBatch(shard, seqno, reader);
+      });
+    if (!st.ok()) {
+      return st;
+    }
+  }
+  return Status::OK();
+}
+
+uint64_t RollcallSubscriptionSet::GetSubscriberCount(Slice topic_name) const {
+  State::Partition& partition = state_->GetPartition(topic_name);
+  std::lock_guard<std::mutex> lock(partition.mutex);
+  auto it = partition.topics.find(topic_name);
+  return it == partition.topics.end() ? 0 : it->second;
+}
+
+size_t RollcallSubscriptionSet::GetNumTopics() const {
+  size_t num_topics = 0;
+  for (State::Partition& partition : state_->partitions) {
+    std::lock_guard<std::mutex> lock(partition.mutex);
+    num_topics += partition.num_subscribed;
+  }
+  return num_topics;
+}
+
+std::shared_ptr<const RollcallSnapshot> RollcallSubscriptionSet::GetSnapshot() {
+  std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+  const auto now = std::chrono::steady_clock::now();
+  if (snapshot_ && now - snapshot_->time < snapshot_period_) {
+    return snapshot_;
+  }
+
+  std::shared_ptr<RollcallSnapshot> snapshot(new RollcallSnapshot());
+  snapshot->time = now;
+  {
+    // Batches are applied under the lock of their shard, so holding all of
+    // them keeps the sequence numbers consistent with the topics. Shards are
+    // always locked before partitions.
+    std::vector<std::unique_lock<std::mutex>> shard_locks;
+    shard_locks.reserve(state_->num_shards);
+    for (RollcallShard i = 0; i < state_->num_shards; ++i) {
+      shard_locks.emplace_back(state_->shards[i].mutex);
+    }
+    std::unique_lock<std::mutex> locks[State::kNumPartitions];
+    size_t num_topics = 0;
+    for (size_t i = 0; i < State::kNumPartitions; ++i) {
+      locks[i] = std::unique_lock<std::mutex>(state_->partitions[i].mutex);
+      num_topics += state_->partitions[i].num_subscribed;
+    }
+    snapshot->topics.reserve(num_topics);
+    for (const State::Partition& partition : state_->partitions) {
+      for (const auto& entry : partition.topics) {
+        if (entry.second > 0) {
+          snapshot->topics.emplace_back(entry.first.ToString(), entry.second);
+        }
+      }
+    }
+    snapshot->shard_seqnos.reserve(state_->num_shards);
+    for (RollcallShard i = 0; i < state_->num_shards; ++i) {
+      snapshot->shard_seqnos.push_back(state_->shards[i].seqno);
+    }
+  }
+  std::sort(snapshot->topics.begin(), snapshot->topics.end());
+  snapshot_ = std::move(snapshot);
+  return snapshot_;
+}
+
+Status RollcallSubscriptionSet::GetStatus() const {
+  if (state_->failed) {
+    return Status::InternalError("Failed to tail rollcall");
+  }
+  return Status::OK();
+}
+
+}  // namespace rocketspeed
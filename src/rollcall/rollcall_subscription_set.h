@@ -0,0 +1,124 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "include/Slice.h"
+#include "include/Status.h"
+#include "include/Types.h"
+#include "src/rollcall/RollCall.h"
+
+namespace rocketspeed {
+
+class RollcallBatchReader;
+class RollcallImpl;
+
+/**
+ * Consistent copy of a RollcallSubscriptionSet.
+ */
+struct RollcallSnapshot {
+  // Time the snapshot was taken.
+  std::chrono::steady_clock::time_point time;
+
+  // Sequence number of the last rollcall batch of each shard applied to the
+  // snapshot, 0 if none. Changes of a shard with a sequence number up to this
+  // one are already included.
+  std::vector<SequenceNumber> shard_seqnos;
+
+  // Subscribed topics and their number of subscribers, sorted by name.
+  std::vector<std::pair<std::string, uint64_t>> topics;
+};
+
+/**
+ * Tails all rollcall shards of a namespace and maintains the number of
+ * subscribers of each topic, so that downstream services can bootstrap
+ * from a snapshot and follow the changes, instead of tailing the rollcall
+ * themselves.
+ *
+ * Shards are tailed in parallel on the threads of the client. Topic names
+ * are interned: each distinct name is stored once in an arena, and entries
+ * are applied without allocation once a topic is known. Interned names are
+ * kept when a topic has no subscribers left, so memory grows with the number
+ * of distinct topics seen.
+ *
+ * Without a snapshot, shards are read from the tail, so rollcall entries
+ * written before Start are not seen, and unsubscriptions of topics without
+ * subscribers are ignored. Starting from a snapshot of another set resumes
+ * each shard after the last batch applied to the snapshot.
+ */
+class RollcallSubscriptionSet {
+ public:
+  struct Options {
+    // Snapshots younger than this are shared between calls to GetSnapshot.
+    std::chrono::milliseconds snapshot_period{1000};
+
+    // Invoked after the number of subscribers of a topic changed, with the
+    // rollcall shard, the sequence number of the batch, the topic name and
+    // the new number of subscribers. Invoked on client threads, in order for
+    // each topic but concurrently for different topics, and must not call
+    // into the set.
+    std::function<void(RollcallShard, SequenceNumber, Slice, uint64_t)>
+      on_change;
+  };
+
+  /**
+   * @param rollcall Rollcall stream to tail.
+   * @param namespace_id Namespace of the topics to track.
+   * @param options Options for the set.
+   */
+  RollcallSubscriptionSet(std::shared_ptr<RollcallImpl> rollcall,
+                          NamespaceID namespace_id,
+                          Options options);
+
+  ~RollcallSubscriptionSet();
+
+  /**
+   * Subscribes to all rollcall shards of the namespace.
+   *
+   * @param snapshot Optional snapshot to start from, taken from a set of the
+   *                 same namespace. Shards without any applied batch are read
+   *                 from the tail.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  Status Start(std::shared_ptr<const RollcallSnapshot> snapshot = nullptr);
+
+  /** Returns the number of subscribers of a topic. Thread safe. */
+  uint64_t GetSubscriberCount(Slice topic_name) const;
+
+  /** Returns the number of topics with at least one subscriber. */
+  size_t GetNumTopics() const;
+
+  /**
+   * Returns a snapshot of the set, which is taken at most once per
+   * snapshot_period. Thread safe.
+   */
+  std::shared_ptr<const RollcallSnapshot> GetSnapshot();
+
+  /** Returns an error if tailing any of the shards failed. */
+  Status GetStatus() const;
+
+ private:
+  // Shared with the subscriptions, which outlive the set.
+  struct State;
+
+  const std::shared_ptr<RollcallImpl> rollcall_;
+  const NamespaceID namespace_id_;
+  const std::chrono::milliseconds snapshot_period_;
+  std::shared_ptr<State> state_;
+
+  std::mutex snapshot_mutex_;
+  std::shared_ptr<const RollcallSnapshot> snapshot_;
+};
+
+}  // namespace rocketspeed
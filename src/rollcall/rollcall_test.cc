@@ -0,0 +1,128 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/rollcall/rollcall_batch.h"
+#include "src/util/testharness.h"
+
+namespace rocketspeed {
+
+namespace {
+const RollcallEntry::EntryType kSub =
+  RollcallEntry::EntryType::SubscriptionRequest;
+const RollcallEntry::EntryType kUnsub =
+  RollcallEntry::EntryType::UnSubscriptionRequest;
+}  // namespace
+
+class RollcallTest {
+ public:
+  typedef std::vector<std::pair<RollcallEntry::EntryType, std::string>>
+    Entries;
+
+  static Status Read(Slice batch, Entries* entries) {
+    RollcallBatchReader reader(batch);
+    RollcallEntry::EntryType type;
+    Slice topic_name;
+    while (reader.Next(&type, &topic_name)) {
+      entries->emplace_back(type, topic_name.ToString());
+    }
+    return reader.GetStatus();
+  }
+};
+
+TEST(RollcallTest, UncompactedBatch) {
+  RollcallBatchWriter writer(false);
+  ASSERT_TRUE(writer.Empty());
+  writer.Add(kSub, "foo");
+  writer.Add(kUnsub, "foo");
+  writer.Add(kSub, "bar");
+  ASSERT_TRUE(!writer.Empty());
+
+  std::string batch;
+  writer.Finish(&batch);
+  ASSERT_EQ(batch[0], RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT);
+  ASSERT_EQ(writer.GetEncodedSizeBound(), 0U);
+  ASSERT_TRUE(writer.Empty());
+
+  // Same encoding as individually serialized entries.
+  std::string expected = "2_";
+  RollcallEntry("foo", kSub).Serialize(&expected);
+  RollcallEntry("foo", kUnsub).Serialize(&expected);
+  RollcallEntry("bar", kSub).Serialize(&expected);
+  ASSERT_EQ(batch, expected);
+
+  Entries entries;
+  ASSERT_OK(Read(batch, &entries));
+  ASSERT_TRUE(entries == Entries({{kSub, "foo"}, {kUnsub, "foo"},
+                                  {kSub, "bar"}}));
+}
+
+TEST(RollcallTest, CompactBatch) {
+  RollcallBatchWriter writer(true);
+  writer.Add(kSub, "topic.b");
+  writer.Add(kSub, "topic.a");
+  writer.Add(kUnsub, "topic.b");  // cancels the subscription
+  writer.Add(kUnsub, "other");
+  writer.Add(kSub, "topic.aa");
+  writer.Add(kSub, "topic.aa");
+  writer.Add(kUnsub, "topic.c");
+  writer.Add(kSub, "topic.c");
+  ASSERT_TRUE(!writer.Empty());
+
+  const size_t bound = writer.GetEncodedSizeBound();
+  std::string batch;
+  writer.Finish(&batch);
+  ASSERT_EQ(batch[0], RollcallEntry::ROLLCALL_ENTRY_VERSION_COMPACT);
+  ASSERT_LE(batch.size(), bound);
+
+  Entries entries;
+  ASSERT_OK(Read(batch, &entries));
+  ASSERT_TRUE(entries == Entries({{kUnsub, "other"}, {kSub, "topic.a"},
+                                  {kSub, "topic.aa"}, {kSub, "topic.aa"}}));
+
+  // Shared prefixes are not repeated.
+  std::string uncompacted;
+  for (const auto& entry : entries) {
+    RollcallEntry(entry.second, entry.first).Serialize(&uncompacted);
+  }
+  ASSERT_LT(batch.size(), uncompacted.size());
+}
+
+TEST(RollcallTest, CompactBatchCancelled) {
+  RollcallBatchWriter writer(true);
+  writer.Add(kSub, "foo");
+  writer.Add(kUnsub, "foo");
+  ASSERT_TRUE(writer.Empty());
+
+  std::string batch;
+  writer.Finish(&batch);
+  Entries entries;
+  ASSERT_OK(Read(batch, &entries));
+  ASSERT_TRUE(entries.empty());
+}
+
+TEST(RollcallTest, MalformedBatch) {
+  RollcallBatchWriter writer(true);
+  writer.Add(kSub, "topic.a");
+  writer.Add(kSub, "topic.b");
+  std::string batch;
+  writer.Finish(&batch);
+
+  Entries entries;
+  ASSERT_TRUE(!Read(Slice(batch.data(), batch.size() - 1), &entries).ok());
+  ASSERT_TRUE(!Read("9_", &entries).ok());
+  ASSERT_TRUE(!Read("2", &entries).ok());
+  // Shares more than the previous topic name.
+  ASSERT_TRUE(!Read(std::string("3_S\x01\x01x", 6), &entries).ok());
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests();
+}
@@ -8,11 +8,13 @@
 #include <cinttypes>
 #include <cstdio>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "src/server/storage_setup.h"
 #include "src/logdevice/storage.h"
 #include "src/logdevice/log_router.h"
+#include "src/port/Env.h"
 
 // Needed to set logdevice::dbg::currentLevel
 #include "external/logdevice/include/debug.h"
@@ -20,6 +22,12 @@
 #include <gflags/gflags.h>
 
 DEFINE_string(logs, "1..100000", "range of logs");
+DEFINE_string(log_placement, "",
+              "file with log placement overrides of topics and namespaces, "
+              "on logs outside of the range of logs");
+DEFINE_string(log_placement_record, "",
+              "file recording the log placement in use, created if missing, "
+              "a log_placement that differs from it is rejected");
 DEFINE_string(storage_url, "", "Storage config url");
 DEFINE_string(logdevice_cluster, "", "LogDevice cluster tier name");
 DEFINE_int32(storage_workers, 16, "number of logdevice storage workers");
@@ -58,8 +66,44 @@ std::shared_ptr<LogRouter> CreateLogRouter() {
     return nullptr;
   }
 
+  // Load placement overrides.
+  LogPlacementTable placement;
+  if (!FLAGS_log_placement.empty()) {
+    std::string text;
+    Status st = ReadFileToString(Env::Default(), FLAGS_log_placement, &text);
+    if (st.ok()) {
+      st = LogPlacementTable::Parse(text, &placement);
+    }
+    if (st.ok()) {
+      st = placement.Validate(first_log, last_log);
+    }
+    if (!st.ok()) {
+      fprintf(stderr, "Error: invalid log_placement: %s\n",
+        st.ToString().c_str());
+      return nullptr;
+    }
+  }
+  if (!FLAGS_log_placement_record.empty()) {
+    // Topics are not handed off between logs, so refuse to move them.
+    Status st = placement.CheckRecorded(Env::Default(),
+                                        FLAGS_log_placement_record);
+    if (!st.ok()) {
+      fprintf(stderr, "Error: log_placement: %s\n", st.ToString().c_str());
+      return nullptr;
+    }
+  }
+
   // Create LogDevice log router.
-  return std::make_shared<LogDeviceLogRouter>(first_log, last_log);
+  std::shared_ptr<LogDeviceLogRouter> router;
+  Status st = LogDeviceLogRouter::Create(first_log,
+                                         last_log,
+                                         std::move(placement),
+                                         &router);
+  if (!st.ok()) {
+    fprintf(stderr, "Error: invalid logs: %s\n", st.ToString().c_str());
+    return nullptr;
+  }
+  return router;
 }
 
 }  // namespace rocketspeed
@@ -77,6 +77,8 @@ DEFINE_int32(rollcall_max_batch_size_bytes, 16 << 10,
              "max rollcall message size (in bytes) before flush");
 DEFINE_int32(rollcall_flush_latency_ms, 500,
              "time (milliseconds) to automatically flush rollcall writes");
+DEFINE_bool(rollcall_compact_batches, false,
+            "write rollcall batches in the compact format");
 
 // Supervisor settings
 DEFINE_bool(supervisor, true, "start the supervisor");
@@ -91,6 +93,11 @@ DEFINE_int32(heartbeat_timeout,
 DEFINE_int32(heartbeat_expire_batch, -1 /* unbounded */,
              "number of streams to expire in one blocking call");
 
+DEFINE_int32(stall_threshold_ms, 100,
+             "event loop callbacks running longer are reported as stalls, "
+             "0 disables stall detection");
+DEFINE_bool(sample_stalled_stacks, true,
+            "sample stacks of stalled event loops (uses SIGUSR2)");
 DEFINE_string(rs_log_dir, "", "directory for server logs");
 
 #ifdef NDEBUG
@@ -163,6 +170,9 @@ Status RocketSpeed::Initialize(
     options.event_loop.heartbeat_expire_batch =
       FLAGS_heartbeat_expire_batch;
     options.event_loop.heartbeat_enabled = FLAGS_heartbeat_enabled;
+    options.event_loop.stall_threshold =
+      std::chrono::milliseconds(FLAGS_stall_threshold_ms);
+    options.event_loop.sample_stalled_stacks = FLAGS_sample_stalled_stacks;
     return new MsgLoop(env_,
                        env_options_,
                        port,
@@ -296,6 +306,7 @@ Status RocketSpeed::Initialize(
       FLAGS_rollcall_max_batch_size_bytes;
     copilot_opts.rollcall_flush_latency =
       std::chrono::milliseconds(FLAGS_rollcall_flush_latency_ms);
+    copilot_opts.rollcall_compact_batches = FLAGS_rollcall_compact_batches;
     copilot_opts.timer_interval_micros = FLAGS_copilot_timer_interval_micros;
     copilot_opts.resubscriptions_per_second =
       FLAGS_copilot_resubscriptions_per_second;
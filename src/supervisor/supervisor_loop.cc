@@ -25,6 +25,9 @@
 
 namespace rocketspeed {
 
+constexpr std::chrono::milliseconds SupervisorLoop::kStatsPeriod;
+constexpr size_t SupervisorLoop::kStatsWindowPeriods;
+
 Status SupervisorLoop::CreateNewInstance(SupervisorOptions options,
   std::unique_ptr<SupervisorLoop>* supervisor) {
   // Need to check if we can successfully bind to port
@@ -133,6 +136,29 @@ Status SupervisorLoop::Initialize() {
     return Status::InternalError("Failed to add shutdown event to event base");
   }
 
+  // A persistent timer which samples statistics of all services, to maintain
+  // rates and windowed percentiles.
+  stats_timer_event_ = event_new(
+    base_,
+    -1,
+    EV_PERSIST,
+    SupervisorLoop::StatsTimerCallback,
+    reinterpret_cast<void*>(this));
+
+  if (!stats_timer_event_) {
+    return Status::InternalError("Stats timer event could not be created");
+  }
+  const auto period_us =
+    std::chrono::duration_cast<std::chrono::microseconds>(kStatsPeriod);
+  timeval period = {
+    static_cast<time_t>(period_us.count() / 1000000),
+    static_cast<suseconds_t>(period_us.count() % 1000000)
+  };
+  rv = evtimer_add(stats_timer_event_, &period);
+  if (rv != 0) {
+    return Status::InternalError("Failed to add stats timer to event base");
+  }
+
   return Status::OK();
 }
 
@@ -162,6 +188,7 @@ void SupervisorLoop::Stop() {
     }
     if (startup_event_) event_free(startup_event_);
     if (shutdown_event_) event_free(shutdown_event_);
+    if (stats_timer_event_) event_free(stats_timer_event_);
     event_base_free(base_);
     shutdown_eventfd_.closefd();
 
@@ -241,29 +268,37 @@ std::map<std::string, SupervisorCommand> SupervisorLoop::commands_ = {
       "stats",
       "Get the stats for pilot/copilot/tower. Example: 'stats pilot'",
 
+      [](std::vector<std::string> args, SupervisorLoop* supervisor)
+        -> std::string {
+
+        Statistics stats;
+        if (args.size() != 2 ||
+            !supervisor->GetServiceStatistics(args[1], &stats)) {
+          return "Invalid command";
+        }
+        return stats.Report();
+      }
+    )
+  },
+  {
+    "rates",
+    SupervisorCommand(
+      "rates",
+      "Get per-second and per-minute rates of counters and windowed"
+      " percentiles of histograms for pilot/copilot/tower as JSON."
+      " Example: 'rates pilot'",
+
       [](std::vector<std::string> args, SupervisorLoop* supervisor)
         -> std::string {
 
         if (args.size() != 2) {
           return "Invalid command";
-        } else {
-          std::string response("Invalid command");
-          const SupervisorOptions& options = supervisor->options_;
-          if (args[1] == "pilot" && options.pilot != nullptr) {
-            Statistics stats = options.pilot->GetStatisticsSync();
-            stats.Aggregate(options.pilot->GetMsgLoop()->GetStatisticsSync());
-            response = stats.Report();
-          } else if (args[1] == "copilot" && options.copilot != nullptr) {
-            Statistics stats = options.copilot->GetStatisticsSync();
-            stats.Aggregate(options.copilot->GetMsgLoop()->GetStatisticsSync());
-            response = stats.Report();
-          } else if (args[1] == "tower" && options.tower != nullptr) {
-            Statistics stats = options.tower->GetStatisticsSync();
-            stats.Aggregate(options.tower->GetMsgLoop()->GetStatisticsSync());
-            response = stats.Report();
-          }
-          return response;
         }
+        auto it = supervisor->windowed_stats_.find(args[1]);
+        if (it == supervisor->windowed_stats_.end()) {
+          return "Invalid command";
+        }
+        return it->second.ReportJSON();
       }
     )
   },
@@ -299,7 +334,8 @@ std::map<std::string, SupervisorCommand> SupervisorLoop::commands_ = {
       "info tower tail_seqno N\n"
       "info copilot subscriptions FILTER [MAX]\n"
       "info copilot towers_for_log N\n"
-      "info copilot log_for_topic NAMESPACE TOPIC\n",
+      "info copilot log_for_topic NAMESPACE TOPIC\n"
+      "info {pilot | copilot | tower} loop_profile\n",
       [](std::vector<std::string> args, SupervisorLoop* supervisor)
         -> std::string {
 
@@ -322,6 +358,40 @@ std::map<std::string, SupervisorCommand> SupervisorLoop::commands_ = {
   }
 };
 
+bool SupervisorLoop::GetServiceStatistics(const std::string& service,
+                                          Statistics* out) {
+  if (service == "pilot" && options_.pilot != nullptr) {
+    *out = options_.pilot->GetStatisticsSync();
+    out->Aggregate(options_.pilot->GetMsgLoop()->GetStatisticsSync());
+  } else if (service == "copilot" && options_.copilot != nullptr) {
+    *out = options_.copilot->GetStatisticsSync();
+    out->Aggregate(options_.copilot->GetMsgLoop()->GetStatisticsSync());
+  } else if (service == "tower" && options_.tower != nullptr) {
+    *out = options_.tower->GetStatisticsSync();
+    out->Aggregate(options_.tower->GetMsgLoop()->GetStatisticsSync());
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void SupervisorLoop::SampleStatistics() {
+  thread_check_.Check();
+  for (const char* service : {"pilot", "copilot", "tower"}) {
+    Statistics stats;
+    if (GetServiceStatistics(service, &stats)) {
+      auto it = windowed_stats_.find(service);
+      if (it == windowed_stats_.end()) {
+        it = windowed_stats_.emplace(
+            service,
+            WindowedStatistics(kStatsWindowPeriods)).first;
+      }
+      it->second.AddSnapshot(std::move(stats),
+                             std::chrono::steady_clock::now());
+    }
+  }
+}
+
 std::string SupervisorLoop::ExecuteCommand(std::string cmd) {
   std::vector<std::string> args = SplitString(cmd, ' ');
   if (args.empty()) {
@@ -353,6 +423,14 @@ void SupervisorLoop::ShutdownCallback(evutil_socket_t listener,
   event_base_loopexit(obj->base_, nullptr);
 }
 
+void SupervisorLoop::StatsTimerCallback(evutil_socket_t listener,
+                                        short event,
+                                        void *arg) {
+  SupervisorLoop* obj = static_cast<SupervisorLoop *>(arg);
+  obj->thread_check_.Check();
+  obj->SampleStatistics();
+}
+
 void SupervisorLoop::AcceptCallback(evconnlistener *listener,
                                    evutil_socket_t fd,
                                    sockaddr *address,
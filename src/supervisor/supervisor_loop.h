@@ -7,9 +7,12 @@
 #include <netinet/in.h>
 
 #include "src/port/port.h"
+#include "src/util/common/statistics.h"
 #include "src/util/common/thread_check.h"
 #include "src/supervisor/options.h"
+#include <chrono>
 #include <map>
+#include <string>
 
 struct event;
 struct event_base;
@@ -32,6 +35,7 @@ class SupervisorCommand;
  *  nc localhost 58800
  *  help
  *  stats pilot
+ *  rates pilot
  *  set_log_level info
  *  ^C
  */
@@ -62,6 +66,18 @@ class SupervisorLoop {
  private:
   explicit SupervisorLoop(SupervisorOptions opts);
 
+  // Period of statistics sampling for rates and windowed percentiles.
+  static constexpr std::chrono::milliseconds kStatsPeriod{1000};
+  // Number of periods in the sliding window.
+  static constexpr size_t kStatsWindowPeriods = 60;
+
+  // Takes a snapshot of statistics of a service (pilot, copilot or tower),
+  // returns false if there is no such service.
+  bool GetServiceStatistics(const std::string& service, Statistics* out);
+
+  // Adds a snapshot of statistics of all services to their windows.
+  void SampleStatistics();
+
   // libevent event callbacks
   static void AcceptCallback(evconnlistener* listener,
                              int fd,
@@ -70,6 +86,7 @@ class SupervisorLoop {
                              void* arg);
   static void StartCallback(int listener, short event, void* arg);
   static void ShutdownCallback(int listener, short event, void* arg);
+  static void StatsTimerCallback(int listener, short event, void* arg);
   static void CommandCallback(bufferevent *bev, void *arg);
   static void ErrorCallback(bufferevent *bev, short error, void *arg);
 
@@ -96,6 +113,12 @@ class SupervisorLoop {
 
   // Shutdown event
   event* shutdown_event_ = nullptr;
+
+  // Periodic statistics sampling event
+  event* stats_timer_event_ = nullptr;
+
+  // Windowed statistics of each service, only accessed on the loop thread.
+  std::map<std::string, WindowedStatistics> windowed_stats_;
   rocketspeed::port::Eventfd shutdown_eventfd_;
 };
 
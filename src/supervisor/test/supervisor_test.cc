@@ -13,6 +13,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <cstdlib>
 
 namespace rocketspeed {
 
@@ -75,6 +76,19 @@ TEST(SupervisorTest, Basic) {
   std::string str = DoRequest("stats pilot\n");
   ASSERT_TRUE(str.find("cockpit.accepts") != std::string::npos);
 
+  // Wait for rates to be computed over at least one period.
+  env_->SleepForMicroseconds(2500000);
+  str = DoRequest("rates pilot\n");
+  // Periods are measured, so they are only about as long as the timer's.
+  const std::string prefix = "{\"period_seconds\":";
+  ASSERT_EQ(str.find(prefix), 0);
+  const double period_seconds = strtod(str.c_str() + prefix.size(), nullptr);
+  ASSERT_GT(period_seconds, 0.9);
+  ASSERT_LT(period_seconds, 1.5);
+  ASSERT_TRUE(str.find("\"cockpit.accepts\":{\"value\":") !=
+              std::string::npos);
+  ASSERT_EQ("Invalid command\n", DoRequest("rates foo\n"));
+
   // close the supervisor & the connection to it
   supervisor->Stop();
   env_->WaitForJoin(supervisor_thread_id);
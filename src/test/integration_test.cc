@@ -1304,6 +1304,122 @@ TEST(IntegrationTest, SubscriptionManagement) {
   recv(1, {"k1"});
 }
 
+TEST(IntegrationTest, SubscribeBatch) {
+  // Setup local RocketSpeed cluster.
+  LocalTestCluster cluster(info_log);
+  ASSERT_OK(cluster.GetStatus());
+
+  // Create RocketSpeed client which sends batched subscriptions.
+  ClientOptions options;
+  options.config = cluster.GetConfiguration();
+  options.info_log = info_log;
+  options.max_subscribe_batch_size = 100;
+  std::unique_ptr<Client> client;
+  ASSERT_OK(Client::Create(std::move(options), &client));
+
+  const size_t kNumTopics = 500;
+  port::Semaphore msg_received;
+  std::vector<SubscriptionParameters> params;
+  for (size_t i = 0; i < kNumTopics; ++i) {
+    params.emplace_back(GuestTenant,
+                        GuestNamespace,
+                        "SubscribeBatch" + std::to_string(i),
+                        1);
+  }
+  std::vector<SubscriptionHandle> handles;
+  ASSERT_OK(client->SubscribeBatch(
+      std::move(params),
+      &handles,
+      [&](std::unique_ptr<MessageReceived>& mr) {
+        ASSERT_EQ(mr->GetContents().ToString(), "data");
+        msg_received.Post();
+      }));
+  ASSERT_EQ(handles.size(), kNumTopics);
+  size_t null_handles = 0;
+  for (auto handle : handles) {
+    null_handles += !handle;
+  }
+  ASSERT_EQ(null_handles, 0);
+
+  // All subscriptions should reach the Copilot.
+  int64_t num_subs = 0;
+  for (int i = 0; i < 50 && num_subs != kNumTopics; ++i) {
+    env_->SleepForMicroseconds(100000);
+    num_subs = cluster.GetCopilot()->GetStatisticsSync().GetCounterValue(
+        "copilot.incoming_subscriptions");
+  }
+  ASSERT_EQ(num_subs, kNumTopics);
+
+  // Messages are delivered on batched subscriptions.
+  auto ps = client->Publish(GuestTenant,
+                            "SubscribeBatch123",
+                            GuestNamespace,
+                            TopicOptions(),
+                            Slice("data"));
+  ASSERT_OK(ps.status);
+  ASSERT_TRUE(msg_received.TimedWait(timeout));
+}
+
+TEST(IntegrationTest, TraceSampling) {
+  // Setup local RocketSpeed cluster.
+  LocalTestCluster cluster(info_log);
+  ASSERT_OK(cluster.GetStatus());
+
+  // Create RocketSpeed client which traces every message.
+  ClientOptions options;
+  options.config = cluster.GetConfiguration();
+  options.info_log = info_log;
+  options.trace_sampling_probability = 1.0;
+  std::unique_ptr<ClientImpl> client;
+  ASSERT_OK(ClientImpl::Create(std::move(options), &client));
+
+  port::Semaphore msg_received;
+  auto handle = client->Subscribe(GuestTenant,
+                                  GuestNamespace,
+                                  "TraceSampling",
+                                  1,
+                                  [&](std::unique_ptr<MessageReceived>& mr) {
+                                    msg_received.Post();
+                                  });
+  ASSERT_TRUE(handle);
+
+  const int kNumMessages = 10;
+  for (int i = 0; i < kNumMessages; ++i) {
+    auto ps = client->Publish(GuestTenant,
+                              "TraceSampling",
+                              GuestNamespace,
+                              TopicOptions(),
+                              Slice("data"),
+                              nullptr,
+                              MsgId());
+    ASSERT_OK(ps.status);
+  }
+  for (int i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(msg_received.TimedWait(timeout));
+  }
+
+  // Every hop has been stamped and aggregated at the client.
+  Statistics stats = client->GetStatisticsSync();
+  ASSERT_EQ(stats.GetCounterValue("client.trace.messages"), kNumMessages);
+  for (int hop = 1; hop < MessageTrace::kNumHops; ++hop) {
+    const auto name = std::string("client.trace.") +
+        MessageTrace::HopName(static_cast<MessageTrace::Hop>(hop)) +
+        "_latency";
+    const Histogram* histogram = stats.GetHistogram(name);
+    ASSERT_TRUE(histogram != nullptr);
+    ASSERT_EQ(histogram->GetNumSamples(), kNumMessages);
+  }
+
+  // Hops up to the copilot are aggregated there as well, so that they are
+  // visible through the supervisor.
+  Statistics copilot_stats = cluster.GetCopilot()->GetStatisticsSync();
+  ASSERT_EQ(copilot_stats.GetCounterValue("copilot.trace.messages"),
+            kNumMessages);
+  ASSERT_EQ(copilot_stats.GetHistogram("copilot.trace.total_latency")
+                ->GetNumSamples(),
+            kNumMessages);
+}
+
 TEST(IntegrationTest, LogAvailability) {
   // Tests the availability of a single log after control tower failure.
   // Requires copilot talks to at least 2 control towers for each log.
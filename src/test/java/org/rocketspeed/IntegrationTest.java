@@ -81,6 +81,57 @@ public class IntegrationTest {
     statuses.checkExceptions();
   }
 
+  @Test
+  public void testBatchedDelivery() throws Exception {
+    final String topic = "BatchedDelivery";
+    final int numMessages = 100;
+    final StatusMonoidFirst statuses = new StatusMonoidFirst();
+
+    final Semaphore publishSemaphore = new Semaphore(0);
+    PublishCallback publishCallback = new PublishCallback() {
+      @Override
+      public void call(
+          MsgId messageId, String namespaceId, String topicName, long seqno, Status status) {
+        statuses.append(status);
+        publishSemaphore.release();
+      }
+    };
+    final List<String> received = synchronizedList(new ArrayList<String>());
+    final List<Long> seqnos = synchronizedList(new ArrayList<Long>());
+    final Semaphore receiveSemaphore = new Semaphore(0);
+    MessageBatchReceivedCallback receiveCallback = new MessageBatchReceivedCallback() {
+      @Override
+      public void call(byte[] batch) {
+        MessageBatch messages = new MessageBatch(batch);
+        for (int i = 0; i < messages.size(); ++i) {
+          received.add(new String(messages.getContentsArray(i)));
+          seqnos.add(messages.getSeqno(i));
+        }
+        receiveSemaphore.release(messages.size());
+      }
+    };
+
+    try (Client client = new Builder().cockpit(testCluster.getCockpit()).build()) {
+      for (int i = 0; i < numMessages; ++i) {
+        client.publish(
+            GUEST_TENANT, GUEST_NAMESPACE, topic, valueOf(i).getBytes(), publishCallback);
+      }
+      assertTrue(publishSemaphore.tryAcquire(numMessages, TIMEOUT, TIMEOUT_UNIT));
+      statuses.checkExceptions();
+
+      client.subscribeBatched(
+          GUEST_TENANT, GUEST_NAMESPACE, topic, BEGINNING_SEQNO, receiveCallback, null);
+      assertTrue(receiveSemaphore.tryAcquire(numMessages, TIMEOUT, TIMEOUT_UNIT));
+    }
+
+    for (int i = 0; i < numMessages; ++i) {
+      assertEquals(valueOf(i), received.get(i));
+      if (i > 0) {
+        assertTrue(seqnos.get(i - 1) < seqnos.get(i));
+      }
+    }
+  }
+
   @Test
   public void testSequenceNumberZero() throws Exception {
     final String topic = "SequenceNumberZero";
@@ -32,7 +32,15 @@ struct LocalTestCluster::TestStorage {
   std::shared_ptr<facebook::logdevice::Client> client_;
 #endif  // USE_LOGDEVICE
   std::shared_ptr<LogDeviceStorage> storage_;
+  std::shared_ptr<MemoryLogStorage> memory_storage_;
   std::shared_ptr<LogDeviceLogRouter> log_router_;
+
+  std::shared_ptr<LogStorage> GetStorage() const {
+    if (memory_storage_) {
+      return memory_storage_;
+    }
+    return storage_;
+  }
 };
 
 #ifdef USE_LOGDEVICE
@@ -70,7 +78,8 @@ void LocalTestCluster::Initialize(Options opts) {
   cockpit_thread_ = 0;
   control_tower_thread_ = 0;
 
-  if (opts.start_copilot && !opts.start_controltower) {
+  if (opts.start_copilot && !opts.start_controltower &&
+      !opts.copilot.control_tower_router) {
     status_ = Status::InvalidArgument("Copilot needs ControlTower.");
     return;
   }
@@ -82,15 +91,32 @@ void LocalTestCluster::Initialize(Options opts) {
 #endif  // NDEBUG
 #endif  // USE_LOGDEVICE
 
-  if (!opts.log_storage) {
-    // Range of logs to use.
-    std::pair<LogID, LogID> log_range;
-    if (opts.single_log) {
-      log_range = std::pair<LogID, LogID>(1, 1);
-    } else {
-      log_range = std::pair<LogID, LogID>(1, 1000);
-    }
+  // Range of logs to use.
+  std::pair<LogID, LogID> log_range;
+  if (opts.single_log) {
+    log_range = std::pair<LogID, LogID>(1, 1);
+  } else {
+    log_range = std::pair<LogID, LogID>(1, 1000);
+  }
 
+  if (opts.memory_storage) {
+    MemoryLogStorage* storage = nullptr;
+    status_ = MemoryLogStorage::Create(opts.memory_storage_options,
+                                       info_log_,
+                                       &storage);
+    if (!status_.ok()) {
+      LOG_ERROR(info_log_, "Failed to create MemoryLogStorage.");
+      return;
+    }
+    storage_->memory_storage_.reset(storage);
+    status_ = LogDeviceLogRouter::Create(log_range.first,
+                                         log_range.second,
+                                         &storage_->log_router_);
+    if (!status_.ok()) {
+      LOG_ERROR(info_log_, "Failed to create LogDeviceLogRouter.");
+      return;
+    }
+  } else if (!opts.log_storage) {
     LogDeviceStorage* storage = nullptr;
     if (opts.start_pilot || opts.start_controltower) {
 #ifdef USE_LOGDEVICE
@@ -140,8 +166,13 @@ void LocalTestCluster::Initialize(Options opts) {
       storage_->storage_.reset(storage);
       storage = nullptr;
 
-      storage_->log_router_ =
-        std::make_shared<LogDeviceLogRouter>(log_range.first, log_range.second);
+      status_ = LogDeviceLogRouter::Create(log_range.first,
+                                           log_range.second,
+                                           &storage_->log_router_);
+      if (!status_.ok()) {
+        LOG_ERROR(info_log_, "Failed to create LogDeviceLogRouter.");
+        return;
+      }
     }
   } else {
     storage_->storage_ = std::move(opts.log_storage);
@@ -149,17 +180,22 @@ void LocalTestCluster::Initialize(Options opts) {
   }
 
   // Tell rocketspeed to use this storage interface/router.
-  opts.pilot.storage = storage_->storage_;
+  opts.pilot.storage = storage_->GetStorage();
   opts.pilot.log_router = storage_->log_router_;
   opts.copilot.log_router = storage_->log_router_;
-  opts.tower.storage = storage_->storage_;
+  opts.tower.storage = storage_->GetStorage();
   opts.tower.log_router = storage_->log_router_;
 
   EnvOptions env_options;
 
   if (opts.start_controltower) {
-    control_tower_loop_.reset(new MsgLoop(
-        env_, env_options, opts.controltower_port, 4, info_log_, "tower"));
+    control_tower_loop_.reset(new MsgLoop(env_,
+                                          env_options,
+                                          opts.controltower_port,
+                                          4,
+                                          info_log_,
+                                          "tower",
+                                          opts.tower_loop));
     status_ = control_tower_loop_->Initialize();
     if (!status_.ok()) {
       LOG_ERROR(info_log_, "Failed to initialize Control Tower loop.");
@@ -209,12 +245,15 @@ void LocalTestCluster::Initialize(Options opts) {
     HostId pilot_host(
         HostId::CreateLocal(static_cast<uint16_t>(opts.cockpit_port)));
     if (opts.start_copilot) {
-      // Create Copilot
-      std::unordered_map<ControlTowerId, HostId> tower_hosts = {
-          {0, control_tower_->GetHostId()},
-      };
-      opts.copilot.control_tower_router =
-          std::make_shared<ConsistentHashTowerRouter>(tower_hosts, 20, 1);
+      // Create Copilot, routing to our own ControlTower unless provided with
+      // a router to another cluster.
+      if (!opts.copilot.control_tower_router) {
+        std::unordered_map<ControlTowerId, HostId> tower_hosts = {
+            {0, control_tower_->GetHostId()},
+        };
+        opts.copilot.control_tower_router =
+            std::make_shared<ConsistentHashTowerRouter>(tower_hosts, 20, 1);
+      }
       opts.copilot.info_log = info_log_;
       opts.copilot.msg_loop = cockpit_loop_.get();
       opts.copilot.control_tower_connections =
@@ -301,8 +340,11 @@ LocalTestCluster::~LocalTestCluster() {
 #ifdef USE_LOGDEVICE
   storage_->client_.reset();
 #endif
-  assert(storage_->storage_.unique());  // should be last reference
+  // Should be the last references.
+  assert(!storage_->storage_ || storage_->storage_.unique());
+  assert(!storage_->memory_storage_ || storage_->memory_storage_.unique());
   storage_->storage_.reset();
+  storage_->memory_storage_.reset();
 
   delete control_tower_;
   delete pilot_;
@@ -334,6 +376,10 @@ std::shared_ptr<LogDeviceStorage> LocalTestCluster::GetLogStorage() {
   return storage_->storage_;
 }
 
+std::shared_ptr<MemoryLogStorage> LocalTestCluster::GetMemoryLogStorage() {
+  return storage_->memory_storage_;
+}
+
 std::shared_ptr<LogDeviceLogRouter> LocalTestCluster::GetLogRouter() {
   return storage_->log_router_;
 }
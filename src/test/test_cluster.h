@@ -17,6 +17,7 @@
 #include "src/pilot/options.h"
 #include "src/pilot/pilot.h"
 #include "src/messages/msg_loop.h"
+#include "src/util/memory_storage.h"
 #include "src/util/storage.h"
 #include "src/util/common/statistics.h"
 #include "src/logdevice/storage.h"
@@ -45,10 +46,14 @@ class LocalTestCluster {
     bool start_pilot = true;
     bool single_log = false;
     std::string storage_url;
+    // Keep logs in process memory instead of LogDevice.
+    bool memory_storage = false;
+    MemoryLogStorage::Options memory_storage_options;
     Env* env = Env::Default();
     PilotOptions pilot;
     CopilotOptions copilot;
     ControlTowerOptions tower;
+    MsgLoop::Options tower_loop;
     int controltower_port = ControlTower::DEFAULT_PORT;
     int cockpit_port = Copilot::DEFAULT_PORT;
     std::shared_ptr<LogDeviceStorage> log_storage;
@@ -121,6 +126,8 @@ class LocalTestCluster {
 
   std::shared_ptr<LogDeviceStorage> GetLogStorage();
 
+  std::shared_ptr<MemoryLogStorage> GetMemoryLogStorage();
+
   std::shared_ptr<LogDeviceLogRouter> GetLogRouter();
 
   Statistics GetStatisticsSync() const;
@@ -0,0 +1,589 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+// Micro-benchmarks of message serialization and dispatch hot paths.
+//
+// Reports ns/op through folly, then a table of heap allocations per
+// operation. Both tables list benchmarks in a fixed order with fixed widths,
+// so that outputs of different commits can be diffed directly.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/Foreach.h>
+
+#include "common/init/Init.h"
+#include "include/Types.h"
+#include "src/controltower/data_cache.h"
+#include "src/controltower/log_tailer.h"
+#include "src/messages/commands.h"
+#include "src/messages/event_loop.h"
+#include "src/messages/messages.h"
+#include "src/messages/queues.h"
+#include "src/port/Env.h"
+#include "src/port/port.h"
+#include "src/util/random.h"
+#include "src/util/storage.h"
+#include "src/util/subscription_map.h"
+#include "src/util/topic_uuid.h"
+
+using namespace std;
+using namespace folly;
+using namespace rocketspeed;
+
+namespace {
+
+// Heap allocations made by all threads of the process.
+atomic<uint64_t> allocations{0};
+
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, memory_order_relaxed);
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) {
+    throw bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+namespace {
+
+/** Benchmark bodies, run once more after timing to count allocations. */
+vector<pair<string, function<void(size_t)>>>& AllocationBenchmarks() {
+  static vector<pair<string, function<void(size_t)>>> benchmarks;
+  return benchmarks;
+}
+
+struct RegisterAllocations {
+  RegisterAllocations(string name, function<void(size_t)> body) {
+    AllocationBenchmarks().emplace_back(move(name), move(body));
+  }
+};
+
+// Iterations of each benchmark when counting allocations.
+const size_t kAllocationIterations = 10000;
+
+/**
+ * Prints allocations per operation of every registered benchmark.
+ * Setup and teardown allocate the same regardless of the number of iterations,
+ * so they cancel out in the difference between a run of N and 2N iterations.
+ */
+void ReportAllocations() {
+  printf("%s\n", string(76, '=').c_str());
+  printf("%-64s%12s\n", "Allocations", "allocs/op");
+  printf("%s\n", string(76, '=').c_str());
+  for (auto& benchmark : AllocationBenchmarks()) {
+    benchmark.second(kAllocationIterations);  // warm up lazy state
+    const uint64_t start = allocations.load();
+    benchmark.second(kAllocationIterations);
+    const uint64_t single = allocations.load() - start;
+    benchmark.second(2 * kAllocationIterations);
+    const uint64_t twice = allocations.load() - start - single;
+    const double per_op =
+      (static_cast<double>(twice) - static_cast<double>(single)) /
+      static_cast<double>(kAllocationIterations);
+    printf("%-64s%12.2f\n", benchmark.first.c_str(), per_op < 0 ? 0 : per_op);
+  }
+  printf("%s\n", string(76, '=').c_str());
+}
+
+// Defines a benchmark which also reports allocations.
+#define HOT_PATH_BENCHMARK(name)                                     \
+  void name##Body(size_t n);                                         \
+  BENCHMARK(name, n) { name##Body(n); }                              \
+  RegisterAllocations name##Allocations(#name, &name##Body);         \
+  void name##Body(size_t n)
+
+const char* const kNamespace = "guest";
+const char* const kTopic = "benchmark.topic.with.typical.length";
+const string kPayload(100, 'x');
+
+/** Creates a typical message of given type. */
+unique_ptr<Message> MakeMessage(MessageType type) {
+  const TenantID tenant = Tenant::GuestTenant;
+  switch (type) {
+    case MessageType::mPing:
+      return unique_ptr<Message>(
+        new MessagePing(tenant, MessagePing::Request, "cookie"));
+    case MessageType::mPublish:
+    case MessageType::mDeliver: {
+      unique_ptr<MessageData> data(
+        new MessageData(type, tenant, kTopic, kNamespace, kPayload));
+      data->SetSequenceNumbers(122, 123);
+      return move(data);
+    }
+    case MessageType::mDataAck: {
+      MessageDataAck::Ack ack;
+      ack.status = MessageDataAck::Success;
+      ack.seqno = 123;
+      return unique_ptr<Message>(
+        new MessageDataAck(tenant, MessageDataAck::AckVector{ack}));
+    }
+    case MessageType::mGap:
+      return unique_ptr<Message>(
+        new MessageGap(tenant, kNamespace, kTopic, kBenign, 100, 200));
+    case MessageType::mGoodbye:
+      return unique_ptr<Message>(new MessageGoodbye(
+        tenant, MessageGoodbye::Graceful, MessageGoodbye::Client));
+    case MessageType::mSubscribe:
+      return unique_ptr<Message>(
+        new MessageSubscribe(tenant, kNamespace, kTopic, 123, 42));
+    case MessageType::mUnsubscribe:
+      return unique_ptr<Message>(new MessageUnsubscribe(
+        tenant, 42, MessageUnsubscribe::Reason::kRequested));
+    case MessageType::mDeliverGap: {
+      unique_ptr<MessageDeliverGap> gap(
+        new MessageDeliverGap(tenant, 42, kBenign));
+      gap->SetSequenceNumbers(100, 200);
+      return move(gap);
+    }
+    case MessageType::mDeliverData: {
+      unique_ptr<MessageDeliverData> data(
+        new MessageDeliverData(tenant, 42, MsgId(), kPayload));
+      data->SetSequenceNumbers(122, 123);
+      return move(data);
+    }
+    case MessageType::mFindTailSeqno:
+      return unique_ptr<Message>(
+        new MessageFindTailSeqno(tenant, kNamespace, kTopic));
+    case MessageType::mTailSeqno:
+      return unique_ptr<Message>(
+        new MessageTailSeqno(tenant, kNamespace, kTopic, 123));
+    case MessageType::mSubscribeBatch: {
+      unique_ptr<MessageSubscribeBatch> batch(
+        new MessageSubscribeBatch(tenant));
+      for (SubscriptionID sub_id = 1; sub_id <= 16; ++sub_id) {
+        batch->Add(kNamespace, kTopic, 123, sub_id);
+      }
+      return move(batch);
+    }
+    case MessageType::NotInitialized:
+      break;
+  }
+  return nullptr;
+}
+
+void SerializeMessage(size_t n, MessageType type) {
+  unique_ptr<Message> message;
+  BENCHMARK_SUSPEND {
+    message = MakeMessage(type);
+  }
+  FOR_EACH_RANGE (i, 0, n) {
+    string serial;
+    message->SerializeToString(&serial);
+    doNotOptimizeAway(serial.size());
+  }
+}
+
+void DeserializeMessage(size_t n, MessageType type) {
+  // Includes copying into the owned buffer, as done when reading a socket.
+  string serial;
+  BENCHMARK_SUSPEND {
+    MakeMessage(type)->SerializeToString(&serial);
+  }
+  FOR_EACH_RANGE (i, 0, n) {
+    unique_ptr<char[]> buffer(new char[serial.size()]);
+    memcpy(buffer.get(), serial.data(), serial.size());
+    auto message = Message::CreateNewInstance(move(buffer), serial.size());
+    doNotOptimizeAway(message.get());
+  }
+}
+
+// Serialize and deserialize benchmarks for a message type.
+#define MESSAGE_BENCHMARKS(name, type)                                \
+  BENCHMARK_NAMED_PARAM(SerializeMessage, name, MessageType::type)    \
+  RegisterAllocations SerializeMessage##name##Allocations(            \
+    "SerializeMessage(" #name ")",                                    \
+    [](size_t n) { SerializeMessage(n, MessageType::type); });        \
+  BENCHMARK_NAMED_PARAM(DeserializeMessage, name, MessageType::type)  \
+  RegisterAllocations DeserializeMessage##name##Allocations(          \
+    "DeserializeMessage(" #name ")",                                  \
+    [](size_t n) { DeserializeMessage(n, MessageType::type); });
+
+}  // namespace
+
+MESSAGE_BENCHMARKS(ping, mPing)
+MESSAGE_BENCHMARKS(publish, mPublish)
+MESSAGE_BENCHMARKS(data_ack, mDataAck)
+MESSAGE_BENCHMARKS(gap, mGap)
+MESSAGE_BENCHMARKS(deliver, mDeliver)
+MESSAGE_BENCHMARKS(goodbye, mGoodbye)
+MESSAGE_BENCHMARKS(subscribe, mSubscribe)
+MESSAGE_BENCHMARKS(unsubscribe, mUnsubscribe)
+MESSAGE_BENCHMARKS(deliver_gap, mDeliverGap)
+MESSAGE_BENCHMARKS(deliver_data, mDeliverData)
+MESSAGE_BENCHMARKS(find_tail_seqno, mFindTailSeqno)
+MESSAGE_BENCHMARKS(tail_seqno, mTailSeqno)
+MESSAGE_BENCHMARKS(subscribe_batch, mSubscribeBatch)
+
+BENCHMARK_DRAW_LINE();
+
+HOT_PATH_BENCHMARK(MessageHeaderParse) {
+  string encoded;
+  BENCHMARK_SUSPEND {
+    MessageHeader header{1, 123};
+    encoded = header.ToString();
+  }
+  FOR_EACH_RANGE (i, 0, n) {
+    Slice in(encoded);
+    MessageHeader header;
+    Status st = MessageHeader::Parse(&in, &header);
+    doNotOptimizeAway(st.ok());
+    doNotOptimizeAway(header.size);
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+HOT_PATH_BENCHMARK(CommandQueueWriteRead) {
+  // Writes batches of commands, then reads them back on the same thread.
+  const size_t kBatch = 64;
+  unique_ptr<CommandQueue> queue;
+  vector<unique_ptr<Command>> commands;
+  BENCHMARK_SUSPEND {
+    queue.reset(new CommandQueue(make_shared<NullLogger>(),
+                                 make_shared<QueueStats>("bench"),
+                                 2 * kBatch));
+    FOR_EACH_RANGE (i, 0, kBatch) {
+      commands.emplace_back(MakeExecuteCommand([]() {}));
+    }
+  }
+  size_t done = 0;
+  while (done < n) {
+    const size_t batch = min(kBatch, n - done);
+    FOR_EACH_RANGE (i, 0, batch) {
+      queue->TryWrite(commands[i], false);
+    }
+    BatchedRead<unique_ptr<Command>> read(queue.get());
+    size_t i = 0;
+    while (read.Read(commands[i])) {
+      ++i;
+    }
+    done += batch;
+  }
+  doNotOptimizeAway(commands.back().get());
+  BENCHMARK_SUSPEND {
+    queue.reset();
+    commands.clear();
+  }
+}
+
+HOT_PATH_BENCHMARK(EventLoopDispatch) {
+  // Sends commands from this thread, executed by the event loop thread.
+  const size_t kInFlight = 1000;
+  unique_ptr<EventLoop> loop;
+  thread loop_thread;
+  BENCHMARK_SUSPEND {
+    loop.reset(new EventLoop(Env::Default(),
+                             EnvOptions(),
+                             0,
+                             make_shared<NullLogger>(),
+                             nullptr,
+                             nullptr,
+                             StreamAllocator(),
+                             EventLoop::Options()));
+    loop->Initialize();
+    loop_thread = thread([&]() { loop->Run(); });
+    loop->WaitUntilRunning();
+  }
+  size_t executed = 0;
+  port::Semaphore done;
+  FOR_EACH_RANGE (i, 0, n) {
+    unique_ptr<Command> command;
+    if ((i + 1) % kInFlight == 0 || i + 1 == n) {
+      command.reset(MakeExecuteCommand([&]() {
+        ++executed;
+        done.Post();
+      }));
+    } else {
+      command.reset(MakeExecuteCommand([&]() { ++executed; }));
+    }
+    while (!loop->SendCommand(command).ok()) {
+      this_thread::yield();
+    }
+    if ((i + 1) % kInFlight == 0 || i + 1 == n) {
+      done.Wait();
+    }
+  }
+  doNotOptimizeAway(executed);
+  BENCHMARK_SUSPEND {
+    loop->Stop();
+    loop_thread.join();
+    loop.reset();
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+HOT_PATH_BENCHMARK(TopicUUIDHash) {
+  FOR_EACH_RANGE (i, 0, n) {
+    TopicUUID uuid(kNamespace, kTopic);
+    doNotOptimizeAway(uuid.Hash());
+  }
+}
+
+HOT_PATH_BENCHMARK(TopicUUIDRoutingHash) {
+  FOR_EACH_RANGE (i, 0, n) {
+    doNotOptimizeAway(TopicUUID::RoutingHash(kNamespace, kTopic));
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+namespace {
+
+// Subscriptions kept in the map during SubscriptionMap benchmarks.
+const StreamID kStreams = 100;
+const SubscriptionID kSubscriptionsPerStream = 1000;
+
+unique_ptr<SubscriptionMap<SequenceNumber>> MakeSubscriptionMap() {
+  unique_ptr<SubscriptionMap<SequenceNumber>> map(
+    new SubscriptionMap<SequenceNumber>());
+  for (StreamID stream = 0; stream < kStreams; ++stream) {
+    for (SubscriptionID sub = 1; sub <= kSubscriptionsPerStream; ++sub) {
+      map->Insert(stream, sub, sub);
+    }
+  }
+  return map;
+}
+
+}  // namespace
+
+HOT_PATH_BENCHMARK(SubscriptionMapInsertRemove) {
+  unique_ptr<SubscriptionMap<SequenceNumber>> map;
+  BENCHMARK_SUSPEND {
+    map = MakeSubscriptionMap();
+  }
+  Random64 rng(1);
+  FOR_EACH_RANGE (i, 0, n) {
+    const StreamID stream = rng.Uniform(kStreams);
+    map->Insert(stream, kSubscriptionsPerStream + 1, i);
+    map->Remove(stream, kSubscriptionsPerStream + 1);
+  }
+  BENCHMARK_SUSPEND {
+    map.reset();
+  }
+}
+
+HOT_PATH_BENCHMARK(SubscriptionMapFind) {
+  unique_ptr<SubscriptionMap<SequenceNumber>> map;
+  BENCHMARK_SUSPEND {
+    map = MakeSubscriptionMap();
+  }
+  Random64 rng(2);
+  FOR_EACH_RANGE (i, 0, n) {
+    doNotOptimizeAway(map->Find(rng.Uniform(kStreams),
+                                1 + rng.Uniform(kSubscriptionsPerStream)));
+  }
+  BENCHMARK_SUSPEND {
+    map.reset();
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+namespace {
+
+// Logs with cached records in the VisitCache benchmark.
+const LogID kCachedLogs = 1000;
+// Records cached for each log, all delivered by a VisitCache call.
+const SequenceNumber kRecordsPerLog = 100;
+
+unique_ptr<MessageData> MakeRecord(SequenceNumber seqno) {
+  unique_ptr<MessageData> data(new MessageData(MessageType::mDeliver,
+                                               Tenant::GuestTenant,
+                                               kTopic,
+                                               kNamespace,
+                                               kPayload));
+  data->SetSequenceNumbers(seqno - 1, seqno);
+  return data;
+}
+
+}  // namespace
+
+HOT_PATH_BENCHMARK(DataCacheStoreData) {
+  unique_ptr<DataCache> cache;
+  vector<unique_ptr<MessageData>> records;
+  BENCHMARK_SUSPEND {
+    cache.reset(new DataCache(1 << 30, false));
+    records.reserve(n);
+    FOR_EACH_RANGE (i, 0, n) {
+      records.push_back(MakeRecord(1 + i));
+    }
+  }
+  FOR_EACH_RANGE (i, 0, n) {
+    cache->StoreData(kNamespace, kTopic, 1, move(records[i]));
+  }
+  BENCHMARK_SUSPEND {
+    cache.reset();
+    records.clear();
+  }
+}
+
+HOT_PATH_BENCHMARK(DataCacheVisitCache) {
+  // Each visit delivers the records of a log, as when a subscription reads
+  // its backlog from the cache.
+  unique_ptr<DataCache> cache;
+  BENCHMARK_SUSPEND {
+    cache.reset(new DataCache(1 << 30, false));
+    for (LogID log_id = 1; log_id <= kCachedLogs; ++log_id) {
+      for (SequenceNumber seqno = 1; seqno <= kRecordsPerLog; ++seqno) {
+        cache->StoreData(kNamespace, kTopic, log_id, MakeRecord(seqno));
+      }
+    }
+  }
+  Random64 rng(3);
+  size_t visited = 0;
+  FOR_EACH_RANGE (i, 0, n) {
+    cache->VisitCache(1 + rng.Uniform(kCachedLogs),
+                      1,
+                      [&](MessageData* data) { ++visited; });
+  }
+  doNotOptimizeAway(visited);
+  BENCHMARK_SUSPEND {
+    cache.reset();
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+namespace {
+
+// Records converted at once by the LogTailer benchmarks, then freed together
+// by another thread, as room threads free the messages of reader threads.
+const size_t kRecordBatch = 256;
+
+string MakeStoragePayload() {
+  MessageData data(MessageType::mDeliver,
+                   Tenant::GuestTenant,
+                   kTopic,
+                   kNamespace,
+                   kPayload);
+  return data.SerializeStorage().ToString();
+}
+
+LogRecord MakeLogRecord(Slice payload, SequenceNumber seqno) {
+  LogRecord record;
+  record.log_id = 1;
+  record.payload = payload;
+  record.seqno = seqno;
+  return record;
+}
+
+/**
+ * Converts n records with make_message on this thread and frees the messages
+ * on another thread.
+ */
+void RecordsToMessages(
+    size_t n,
+    function<unique_ptr<MessageData>(LogRecord, Status*)> make_message) {
+  string payload;
+  vector<unique_ptr<MessageData>> converted, freed;
+  port::Semaphore ready, done;
+  bool stop = false;
+  thread room_thread;
+  BENCHMARK_SUSPEND {
+    payload = MakeStoragePayload();
+    converted.reserve(kRecordBatch);
+    freed.reserve(kRecordBatch);
+    room_thread = thread([&]() {
+      for (;;) {
+        ready.Wait();
+        if (stop) {
+          return;
+        }
+        freed.clear();
+        done.Post();
+      }
+    });
+    done.Post();
+  }
+  size_t converted_records = 0;
+  while (converted_records < n) {
+    const size_t batch = min(kRecordBatch, n - converted_records);
+    FOR_EACH_RANGE (i, 0, batch) {
+      Status st;
+      converted.push_back(
+        make_message(MakeLogRecord(payload, converted_records + i + 1), &st));
+      doNotOptimizeAway(st.ok());
+    }
+    converted_records += batch;
+    done.Wait();
+    converted.swap(freed);
+    ready.Post();
+  }
+  BENCHMARK_SUSPEND {
+    done.Wait();
+    stop = true;
+    ready.Post();
+    room_thread.join();
+  }
+}
+
+}  // namespace
+
+HOT_PATH_BENCHMARK(LogTailerCreateMessage) {
+  RecordsToMessages(n, &LogTailer::CreateMessage);
+}
+
+HOT_PATH_BENCHMARK(LogTailerCreateMessageUnpooled) {
+  // Same as LogTailerCreateMessage, with a message allocated per record.
+  RecordsToMessages(n, [](LogRecord record, Status* status) {
+    unique_ptr<MessageData> data(new MessageData(MessageType::mDeliver));
+    *status = data->DeSerializeStorage(&record.payload);
+    return data;
+  });
+}
+
+HOT_PATH_BENCHMARK(MessageDataDeserializeStorage) {
+  string payload;
+  BENCHMARK_SUSPEND {
+    payload = MakeStoragePayload();
+  }
+  MessageData data(MessageType::mDeliver);
+  FOR_EACH_RANGE (i, 0, n) {
+    Slice in(payload);
+    doNotOptimizeAway(data.DeSerializeStorage(&in).ok());
+  }
+}
+
+HOT_PATH_BENCHMARK(MessageDataParseTopicOnly) {
+  // Lower bound of a parse deferring all but the topic until delivery.
+  string payload;
+  BENCHMARK_SUSPEND {
+    payload = MakeStoragePayload();
+  }
+  FOR_EACH_RANGE (i, 0, n) {
+    Slice in(payload);
+    uint16_t tenant;
+    Slice namespace_id, topic;
+    doNotOptimizeAway(GetFixed16(&in, &tenant) &&
+                      GetTopicID(&in, &namespace_id, &topic));
+  }
+}
+
+int main(int argc, char** argv) {
+  facebook::initFacebook(&argc, &argv);
+
+  runBenchmarks();
+  ReportAllocations();
+
+  return 0;
+}
@@ -0,0 +1,420 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#define __STDC_FORMAT_MACROS
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <gflags/gflags.h>
+#include <inttypes.h>
+#include <signal.h>
+#include "include/RocketSpeed.h"
+#include "include/Types.h"
+#include "src/client/client.h"
+#include "src/port/port.h"
+#include "src/test/test_cluster.h"
+#include "src/util/auto_roll_logger.h"
+#include "src/util/control_tower_router.h"
+
+// Loads many subscriptions onto a local cluster, then restarts the control
+// tower or the copilot and measures how long it takes until every
+// subscription is delivering again.
+//
+// The tower and the cockpit (pilot + copilot) run as separate local clusters
+// in this process, so that either can be restarted on its own. Health of a
+// subscription is probed by publishing a round of messages, one per topic,
+// tagged with the current epoch; a subscription is healthy once it receives a
+// message of the current epoch.
+DEFINE_uint64(num_subscriptions, 1000000, "number of subscriptions to load");
+DEFINE_uint64(num_topics, 10000, "number of topics subscribed to");
+DEFINE_uint64(client_workers, 8, "number of client workers");
+DEFINE_string(restart, "tower", "component to restart: tower or copilot");
+DEFINE_int32(restarts, 1, "number of restarts to measure");
+DEFINE_int32(downtime_ms, 0, "time the component stays down on restart");
+DEFINE_int32(probe_interval_ms, 1000,
+             "interval between rounds of probe messages while recovering");
+DEFINE_int32(recovery_timeout, 600,
+             "seconds to wait for all subscriptions to become healthy");
+DEFINE_uint64(resubscriptions_per_second, 100000,
+              "copilot rate of resubscriptions to control towers");
+DEFINE_bool(rollcall, false, "enable copilot rollcall writes");
+DEFINE_bool(logging, false, "enable/disable logging");
+
+using namespace rocketspeed;
+
+namespace {
+
+/** Counters of the tower that reflect storage reads. */
+const char* const kStorageCounters[] = {
+  "tower.topic_tailer.log_records_received",
+  "tower.topic_tailer.gap_records_received",
+  "tower.topic_tailer.log_reader_seeks",
+  "tower.topic_tailer.add_subscriber_requests",
+  "tower.topic_tailer.add_subscriber_requests_at_0_slow",
+};
+
+/** Reads a "<key>: <value> kB" entry of /proc/self/status, in bytes. */
+uint64_t ReadProcStatus(const char* key) {
+  FILE* file = fopen("/proc/self/status", "r");
+  if (!file) {
+    return 0;
+  }
+  const size_t key_len = strlen(key);
+  char line[256];
+  uint64_t value = 0;
+  while (fgets(line, sizeof(line), file)) {
+    if (strncmp(line, key, key_len) == 0 && line[key_len] == ':') {
+      value = 1024 * strtoull(line + key_len + 1, nullptr, 10);
+      break;
+    }
+  }
+  fclose(file);
+  return value;
+}
+
+/** Resets the peak resident set size reported as VmHWM. */
+void ResetPeakMemory() {
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if (file) {
+    fputs("5", file);
+    fclose(file);
+  }
+}
+
+/**
+ * Subscriptions and their health, updated from client threads.
+ * Subscription i is on topic i % num_topics.
+ */
+class HealthTracker {
+ public:
+  HealthTracker(size_t num_subscriptions, size_t num_topics)
+  : num_subscriptions_(num_subscriptions)
+  , num_topics_(num_topics)
+  , seen_epoch_(new std::atomic<uint32_t>[num_subscriptions])
+  , unhealthy_in_topic_(new std::atomic<size_t>[num_topics])
+  , epoch_(0)
+  , healthy_(0) {
+    for (size_t i = 0; i < num_subscriptions; ++i) {
+      seen_epoch_[i] = 0;
+    }
+  }
+
+  /** Must be called for all subscriptions before any delivery. */
+  void AddSubscription(SubscriptionHandle handle, size_t index) {
+    index_.emplace(handle, index);
+  }
+
+  /** Starts a new epoch, all subscriptions become unhealthy. */
+  uint32_t NextEpoch() {
+    healthy_ = 0;
+    for (size_t t = 0; t < num_topics_; ++t) {
+      unhealthy_in_topic_[t] = num_subscriptions_ / num_topics_ +
+                               (t < num_subscriptions_ % num_topics_ ? 1 : 0);
+    }
+    return ++epoch_;
+  }
+
+  void OnMessage(SubscriptionHandle handle, uint32_t epoch) {
+    auto it = index_.find(handle);
+    if (it == index_.end()) {
+      return;
+    }
+    std::atomic<uint32_t>& seen = seen_epoch_[it->second];
+    uint32_t old_epoch = seen.load();
+    while (old_epoch < epoch &&
+           !seen.compare_exchange_weak(old_epoch, epoch)) {
+    }
+    const uint32_t current = epoch_.load();
+    if (old_epoch < current && epoch >= current) {
+      --unhealthy_in_topic_[it->second % num_topics_];
+      ++healthy_;
+    }
+  }
+
+  /** True iff all subscriptions on the topic got a message of this epoch. */
+  bool IsTopicHealthy(size_t topic) const {
+    return unhealthy_in_topic_[topic].load() == 0;
+  }
+
+  size_t GetHealthy() const { return healthy_.load(); }
+
+ private:
+  const size_t num_subscriptions_;
+  const size_t num_topics_;
+  std::unique_ptr<std::atomic<uint32_t>[]> seen_epoch_;
+  std::unique_ptr<std::atomic<size_t>[]> unhealthy_in_topic_;
+  std::unordered_map<SubscriptionHandle, size_t> index_;
+  std::atomic<uint32_t> epoch_;
+  std::atomic<size_t> healthy_;
+};
+
+std::string TopicName(uint64_t topic) {
+  return "storm." + std::to_string(topic);
+}
+
+std::unique_ptr<LocalTestCluster> StartTower(std::shared_ptr<Logger> info_log) {
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log;
+  opts.start_controltower = true;
+  opts.start_copilot = false;
+  opts.start_pilot = false;
+  std::unique_ptr<LocalTestCluster> cluster(new LocalTestCluster(opts));
+  return cluster;
+}
+
+std::unique_ptr<LocalTestCluster> StartCockpit(
+    std::shared_ptr<Logger> info_log,
+    const HostId& tower) {
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log;
+  opts.start_controltower = false;
+  opts.start_copilot = true;
+  opts.start_pilot = true;
+  opts.copilot.rollcall_enabled = FLAGS_rollcall;
+  opts.copilot.resubscriptions_per_second = FLAGS_resubscriptions_per_second;
+  opts.copilot.control_tower_router =
+    std::make_shared<ConsistentHashTowerRouter>(
+      std::unordered_map<ControlTowerId, HostId>{{0, tower}}, 20, 1);
+  std::unique_ptr<LocalTestCluster> cluster(new LocalTestCluster(opts));
+  return cluster;
+}
+
+/** Creates a client of the cockpit, workers are shared by subscriptions. */
+Status CreateClient(std::shared_ptr<Logger> info_log,
+                    LocalTestCluster* cockpit,
+                    std::unique_ptr<ClientImpl>* client) {
+  ClientOptions options;
+  options.info_log = info_log;
+  options.config = cockpit->GetConfiguration();
+  options.num_workers = static_cast<int>(FLAGS_client_workers);
+  return ClientImpl::Create(std::move(options), client);
+}
+
+/**
+ * Publishes rounds of messages of an epoch, one per topic that still has
+ * unhealthy subscriptions, until all are healthy or time runs out.
+ *
+ * @return true iff all subscriptions became healthy.
+ */
+bool ProbeUntilHealthy(Client* client,
+                       HealthTracker* health,
+                       uint32_t epoch,
+                       std::chrono::steady_clock::time_point deadline) {
+  const std::string payload = std::to_string(epoch);
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (uint64_t t = 0; t < FLAGS_num_topics; ++t) {
+      if (health->IsTopicHealthy(t)) {
+        continue;
+      }
+      client->Publish(GuestTenant,
+                      TopicName(t),
+                      GuestNamespace,
+                      TopicOptions(),
+                      payload);
+    }
+    auto next_round = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(FLAGS_probe_interval_ms);
+    while (std::chrono::steady_clock::now() < next_round) {
+      if (health->GetHealthy() == FLAGS_num_subscriptions) {
+        return true;
+      }
+      /* sleep override */
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  return health->GetHealthy() == FLAGS_num_subscriptions;
+}
+
+double Seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Env::InstallSignalHandlers();
+  GFLAGS::ParseCommandLineFlags(&argc, &argv, true);
+
+  // Ignore SIGPIPE, we'll just handle the EPIPE returned by write.
+  signal(SIGPIPE, SIG_IGN);
+
+  if (FLAGS_num_topics == 0 || FLAGS_num_subscriptions == 0) {
+    fprintf(stderr, "num_topics and num_subscriptions must be positive.\n");
+    return 1;
+  }
+  if (FLAGS_restart != "tower" && FLAGS_restart != "copilot") {
+    fprintf(stderr, "restart must be tower or copilot.\n");
+    return 1;
+  }
+  const bool restart_tower = FLAGS_restart == "tower";
+
+  std::shared_ptr<Logger> info_log;
+  if (FLAGS_logging) {
+    if (!CreateLoggerFromOptions(Env::Default(),
+                                 "",
+                                 "LOG.restart_storm",
+                                 0,
+                                 0,
+                                 WARN_LEVEL,
+                                 &info_log).ok()) {
+      fprintf(stderr, "Error creating logger, aborting.\n");
+      return 1;
+    }
+  } else {
+    info_log = std::make_shared<NullLogger>();
+  }
+
+  std::unique_ptr<LocalTestCluster> tower = StartTower(info_log);
+  if (!tower->GetStatus().ok()) {
+    fprintf(stderr, "Failed to start tower: %s\n",
+            tower->GetStatus().ToString().c_str());
+    return 1;
+  }
+  const HostId tower_host = tower->GetControlTower()->GetHostId();
+  std::unique_ptr<LocalTestCluster> cockpit = StartCockpit(info_log,
+                                                           tower_host);
+  if (!cockpit->GetStatus().ok()) {
+    fprintf(stderr, "Failed to start cockpit: %s\n",
+            cockpit->GetStatus().ToString().c_str());
+    return 1;
+  }
+
+  HealthTracker health(FLAGS_num_subscriptions, FLAGS_num_topics);
+  auto receive_callback = [&](std::unique_ptr<MessageReceived>& msg) {
+    const uint32_t epoch = static_cast<uint32_t>(
+      strtoul(msg->GetContents().ToString().c_str(), nullptr, 10));
+    health.OnMessage(msg->GetSubscriptionHandle(), epoch);
+  };
+
+  // Probes are published from a separate client, which is recreated after
+  // the pilot restarts, since publishers do not reconnect.
+  std::unique_ptr<ClientImpl> client;
+  std::unique_ptr<ClientImpl> publisher;
+  Status st = CreateClient(info_log, cockpit.get(), &client);
+  if (st.ok()) {
+    st = CreateClient(info_log, cockpit.get(), &publisher);
+  }
+  if (!st.ok()) {
+    fprintf(stderr, "Failed to create client: %s\n", st.ToString().c_str());
+    return 1;
+  }
+  static_cast<Client*>(client.get())
+      ->SetDefaultCallbacks(nullptr, receive_callback);
+
+  // Load subscriptions, spread evenly across topics.
+  printf("Loading %" PRIu64 " subscriptions on %" PRIu64 " topics... ",
+         FLAGS_num_subscriptions, FLAGS_num_topics);
+  fflush(stdout);
+  auto load_start = std::chrono::steady_clock::now();
+  std::vector<SubscriptionParameters> parameters;
+  parameters.reserve(FLAGS_num_subscriptions);
+  for (uint64_t i = 0; i < FLAGS_num_subscriptions; ++i) {
+    parameters.emplace_back(GuestTenant,
+                            GuestNamespace,
+                            TopicName(i % FLAGS_num_topics),
+                            0);
+  }
+  std::vector<SubscriptionHandle> handles;
+  st = client->SubscribeBatch(std::move(parameters), &handles,
+                              nullptr, nullptr, nullptr);
+  if (!st.ok()) {
+    fprintf(stderr, "Failed to subscribe: %s\n", st.ToString().c_str());
+    return 1;
+  }
+  for (size_t i = 0; i < handles.size(); ++i) {
+    health.AddSubscription(handles[i], i);
+  }
+
+  const auto timeout = std::chrono::seconds(FLAGS_recovery_timeout);
+  if (!ProbeUntilHealthy(publisher.get(), &health, health.NextEpoch(),
+                         std::chrono::steady_clock::now() + timeout)) {
+    fprintf(stderr, "\nOnly %zu subscriptions became healthy.\n",
+            health.GetHealthy());
+    return 1;
+  }
+  printf("done in %.3lfs\n",
+         Seconds(std::chrono::steady_clock::now() - load_start));
+  printf("Resident memory after load: %.1lf MB\n",
+         static_cast<double>(ReadProcStatus("VmRSS")) * 1e-6);
+
+  int ret = 0;
+  for (int r = 1; r <= FLAGS_restarts; ++r) {
+    printf("\nRestart %d of %s\n", r, FLAGS_restart.c_str());
+    fflush(stdout);
+
+    // Storage reads are counted across the restart, a restarted tower starts
+    // counting from zero.
+    Statistics before = tower->GetStatisticsSync();
+    ResetPeakMemory();
+
+    const auto kill_time = std::chrono::steady_clock::now();
+    if (restart_tower) {
+      tower.reset();
+    } else {
+      publisher.reset();
+      cockpit.reset();
+    }
+    /* sleep override */
+    std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_downtime_ms));
+    if (restart_tower) {
+      tower = StartTower(info_log);
+      st = tower->GetStatus();
+      before = Statistics();
+    } else {
+      cockpit = StartCockpit(info_log, tower_host);
+      st = cockpit->GetStatus();
+      if (st.ok()) {
+        st = CreateClient(info_log, cockpit.get(), &publisher);
+      }
+    }
+    if (!st.ok()) {
+      fprintf(stderr, "Failed to restart: %s\n", st.ToString().c_str());
+      return 1;
+    }
+    const auto up_time = std::chrono::steady_clock::now();
+
+    const bool healthy = ProbeUntilHealthy(publisher.get(), &health,
+                                           health.NextEpoch(),
+                                           up_time + timeout);
+    const auto healthy_time = std::chrono::steady_clock::now();
+    Statistics after = tower->GetStatisticsSync();
+    after.Disaggregate(before);
+
+    printf("Restart took:               %.3lfs\n",
+           Seconds(up_time - kill_time));
+    if (healthy) {
+      printf("Recovered after restart in: %.3lfs\n",
+             Seconds(healthy_time - up_time));
+      printf("Total time to recovery:     %.3lfs\n",
+             Seconds(healthy_time - kill_time));
+    } else {
+      printf("Only %zu of %" PRIu64 " subscriptions recovered.\n",
+             health.GetHealthy(), FLAGS_num_subscriptions);
+      ret = 1;
+    }
+    printf("Peak resident memory:       %.1lf MB\n",
+           static_cast<double>(ReadProcStatus("VmHWM")) * 1e-6);
+    printf("Storage reads during recovery:\n");
+    for (const char* counter : kStorageCounters) {
+      printf("  %-54s %12" PRId64 "\n", counter, after.GetCounterValue(counter));
+    }
+    fflush(stdout);
+    if (!healthy) {
+      break;
+    }
+  }
+
+  publisher.reset();
+  client.reset();
+  cockpit.reset();
+  tower.reset();
+  return ret;
+}
@@ -37,6 +37,9 @@ DEFINE_bool(start_producer, true, "starts the producer");
 DEFINE_bool(start_consumer, true, "starts the consumer");
 DEFINE_bool(start_local_server, false, "starts an embedded rocketspeed server");
 DEFINE_string(storage_url, "", "Storage service URL for local server");
+DEFINE_bool(memory_storage, false, "local server keeps logs in memory");
+DEFINE_int64(memory_storage_latency_us, 0,
+             "append latency of the in-memory storage (microseconds)");
 
 DEFINE_int32(num_threads, 8, "number of threads");
 DEFINE_string(config,
@@ -60,12 +63,37 @@ DEFINE_bool(logging, true, "enable/disable logging");
 DEFINE_bool(report, true, "report results to stdout");
 DEFINE_string(namespaceid, rocketspeed::GuestNamespace, "namespace id");
 DEFINE_string(topics_distribution, "uniform",
-"uniform, normal, poisson, fixed");
+"uniform, normal, poisson, zipf, fixed");
 DEFINE_int64(topics_mean, 0,
 "Mean for Normal and Poisson topic distributions (rounded to nearest int64)");
 DEFINE_int64(topics_stddev, 0,
 "Standard Deviation for Normal topic distribution (rounded to nearest int64)");
+DEFINE_double(topics_zipf_exponent, 1.0,
+"Exponent for Zipf topic distribution");
+DEFINE_uint64(subscribers_per_topic, 1, "number of subscriptions per topic");
+DEFINE_double(backlog_fraction, 0.0,
+"fraction of subscriptions reading backlog from the first published seqno, "
+"created once publishing is done");
+DEFINE_int64(churn_rate, 0,
+"subscriptions replaced per second while publishing (0 = no churn)");
+DEFINE_uint64(churn_subscriptions, 1000,
+"number of subscriptions to random topics replaced during churn");
 DEFINE_int32(wait_for_debugger, 0, "wait for debugger to attach to me");
+DEFINE_bool(sweep, false,
+"ramp up message rate in steps, measuring latency at each step");
+DEFINE_int64(sweep_start_rate, 1000, "message rate of the first sweep step");
+DEFINE_int64(sweep_rate_step, 1000, "message rate increase per sweep step");
+DEFINE_int64(sweep_max_rate, 100000, "maximum message rate of the sweep");
+DEFINE_int32(sweep_step_seconds, 10, "duration of each sweep step");
+DEFINE_double(sweep_warmup, 0.2,
+"fraction of each sweep step excluded from latency measurements");
+DEFINE_double(sweep_knee_throughput, 0.95,
+"step is saturated if achieved rate is below this fraction of target rate");
+DEFINE_double(sweep_knee_latency, 4.0,
+"step is saturated if p99 ack latency exceeds that of first step this often");
+DEFINE_bool(sweep_stop_at_knee, true, "stop sweep after first saturated step");
+DEFINE_string(sweep_report_format, "csv", "sweep report format: csv, json");
+DEFINE_string(sweep_report_file, "", "sweep report file, stdout if empty");
 
 using namespace rocketspeed;
 
@@ -82,6 +110,11 @@ struct Result {
 struct ProducerArgs {
   std::vector<std::unique_ptr<rocketspeed::ClientImpl>>* producers;
   rocketspeed::NamespaceID nsid;
+  int64_t num_messages;
+  int64_t message_rate;
+  uint64_t sweep_step;   // 1-based step of the sweep, 0 if not sweeping
+  double warmup;         // fraction of messages not measured in sweep step
+  bool await_ack;
   rocketspeed::port::Semaphore* all_ack_messages_received;
   std::atomic<int64_t>* ack_messages_received;
   std::chrono::time_point<std::chrono::steady_clock>* last_ack_message;
@@ -91,6 +124,9 @@ struct ProducerArgs {
 
 struct ProducerWorkerArgs {
   int64_t num_messages;
+  int64_t rate;          // messages per second (0 = unlimited)
+  uint64_t sweep_step;
+  int64_t warmup_messages;
   rocketspeed::NamespaceID namespaceid;
   rocketspeed::Client* producer;
   rocketspeed::PublishCallback publish_callback;
@@ -98,7 +134,44 @@ struct ProducerWorkerArgs {
   uint64_t seed;
 };
 
+// Per-thread latency histograms of each sweep step.
+struct SweepLatencies {
+  std::vector<rocketspeed::Histogram*> ack;
+  std::vector<rocketspeed::Histogram*> recv;
+};
+
+// Progress of a sweep step, updated from client threads.
+struct SweepStepCounters {
+  std::atomic<int64_t> acks{0};
+  std::atomic<int64_t> received{0};
+  std::atomic<uint64_t> last_ack_micros{0};
+};
+
+// Measurements of a single sweep step. Latencies are in microseconds, at
+// the p50, p90, p99 and p99.9 percentiles.
+struct SweepStepResult {
+  int64_t target_rate;
+  int64_t messages;
+  int64_t acks;
+  int64_t received;
+  double achieved_rate;
+  double ack_latency[4];
+  double recv_latency[4];
+  bool saturated;
+};
+
+static const double kSweepPercentiles[] = {0.5, 0.9, 0.99, 0.999};
+
+struct ChurnArgs {
+  std::vector<std::unique_ptr<rocketspeed::ClientImpl>>* clients;
+  rocketspeed::NamespaceID nsid;
+  std::atomic<bool>* stop;
+  std::atomic<int64_t>* messages_received;
+  int64_t churns;
+};
+
 struct ConsumerArgs {
+  int64_t expected_messages;
   rocketspeed::port::Semaphore* all_messages_received;
   std::atomic<int64_t>* messages_received;
   std::chrono::time_point<std::chrono::steady_clock>* last_data_message;
@@ -122,7 +195,8 @@ static void ProducerWorker(void* param) {
                                 FLAGS_num_topics - 1,
                                 static_cast<double>(FLAGS_topics_mean),
                                 static_cast<double>(FLAGS_topics_stddev),
-                                args->seed));
+                                args->seed,
+                                FLAGS_topics_zipf_exponent));
 
   // Generate some dummy data.
   std::vector<char> data(FLAGS_message_size);
@@ -135,10 +209,9 @@ static void ProducerWorker(void* param) {
   LOG_INFO(info_log, "Starting message loop");
   info_log->Flush();
 
-  // Calculate message rate for this worker.
-  int64_t rate = FLAGS_message_rate / FLAGS_num_threads + 1;
+  const int64_t rate = args->rate;
 
-  auto start = std::chrono::steady_clock::now();
+  const uint64_t start_micros = env->NowMicros();
   for (int64_t i = 0; i < num_messages; ++i) {
     // Create random topic name
     char topic_name[64];
@@ -150,14 +223,33 @@ static void ProducerWorker(void* param) {
              static_cast<long long unsigned int>(topic_num));
 
     TopicOptions topic_options;
+    uint64_t send_time = env->NowMicros();
+    if (rate) {
+      // Time at which the message should be sent at the desired rate.
+      const uint64_t scheduled =
+        start_micros + static_cast<uint64_t>(1000000 * i / rate);
+
+      // If we are ahead of schedule then sleep for the difference.
+      if (scheduled > send_time) {
+        /* sleep override */
+        std::this_thread::sleep_for(
+          std::chrono::microseconds(scheduled - send_time));
+      }
+
+      // Latency is measured from the scheduled rather than actual send time,
+      // so that stalls of the producer are not hidden (coordinated omission).
+      send_time = scheduled;
+    }
+
     // Add ID and timestamp to message ID.
     static std::atomic<uint64_t> message_index;
-    uint64_t send_time = env->NowMicros();
     uint64_t index = message_index++;
     snprintf(data.data(), data.size(),
-             "%llu %llu",
+             "%llu %llu %llu %d",
              static_cast<long long unsigned int>(index),
-             static_cast<long long unsigned int>(send_time));
+             static_cast<long long unsigned int>(send_time),
+             static_cast<long long unsigned int>(args->sweep_step),
+             i >= args->warmup_messages ? 1 : 0);
 
     // Send the message
     PublishStatus ps = producer->Publish(GuestTenant,
@@ -175,22 +267,6 @@ static void ProducerWorker(void* param) {
       info_log->Flush();
       args->result = false;
     }
-
-    if (FLAGS_message_rate) {
-      // Check if we are sending messages too fast, and if so, sleep.
-      int64_t have_sent = i;
-
-      // Time since we started sending messages.
-      auto expired = std::chrono::steady_clock::now() - start;
-
-      // Time that should have expired if we were sending at the desired rate.
-      auto expected = std::chrono::microseconds(1000000 * have_sent / rate);
-
-      // If we are ahead of schedule then sleep for the difference.
-      if (expected > expired) {
-        std::this_thread::sleep_for(expected - expired);
-      }
-    }
   }
   args->result = true;
 }
@@ -211,9 +287,13 @@ static void DoProduce(void* params) {
     args->last_ack_message;
   rocketspeed::PublishCallback publish_callback = args->publish_callback;
 
+  // Calculate message rate for each worker.
+  const int64_t rate =
+    args->message_rate ? args->message_rate / FLAGS_num_threads + 1 : 0;
+
   // Distribute total number of messages among them.
   std::vector<Env::ThreadId> thread_ids;
-  int64_t total_messages = FLAGS_num_messages;
+  int64_t total_messages = args->num_messages;
   size_t p = 0;
   ProducerWorkerArgs pargs[1024]; // no more than 1K threads
 
@@ -221,6 +301,10 @@ static void DoProduce(void* params) {
     int64_t num_messages = total_messages / remaining;
     ProducerWorkerArgs* parg = &pargs[p];
     parg->num_messages = num_messages;
+    parg->rate = rate;
+    parg->sweep_step = args->sweep_step;
+    parg->warmup_messages =
+      static_cast<int64_t>(static_cast<double>(num_messages) * args->warmup);
     parg->namespaceid = namespaceid;
     parg->producer = (*producers)[p % producers->size()].get();
     parg->publish_callback = publish_callback;
@@ -248,7 +332,7 @@ static void DoProduce(void* params) {
     }
   }
 
-  if (FLAGS_await_ack) {
+  if (args->await_ack) {
     // Wait for the all_ack_messages_received semaphore to be posted.
     // Keep waiting as long as a message was received in the last 5 seconds.
     auto timeout = std::chrono::seconds(FLAGS_idle_timeout);
@@ -263,40 +347,110 @@ static void DoProduce(void* params) {
 }
 
 /**
- * Subscribe to topics.
+ * Subscribe to topics, FLAGS_subscribers_per_topic times each.
+ * Subscriptions reading backlog (all when FLAGS_delay_subscribe, otherwise a
+ * FLAGS_backlog_fraction of them) are created in a separate pass, once
+ * publishing is done.
+ *
+ * @param backlog Whether to create backlog or tail subscriptions.
  */
-void DoSubscribe(std::vector<std::unique_ptr<ClientImpl>>& consumers,
-                 NamespaceID nsid,
-                 std::unordered_map<std::string, SequenceNumber> first_seqno) {
+void DoSubscribe(
+    std::vector<std::unique_ptr<ClientImpl>>& consumers,
+    NamespaceID nsid,
+    const std::unordered_map<std::string, SequenceNumber>& first_seqno,
+    bool backlog) {
   auto start = std::chrono::steady_clock::now();
   size_t c = 0;
   auto rate = FLAGS_subscribe_rate;
+  int64_t have_sent = 0;
+  // Both passes draw the same sequence, to agree on which are backlog.
+  std::mt19937_64 rng(0);
+  std::bernoulli_distribution is_backlog(FLAGS_backlog_fraction);
   for (uint64_t i = 0; i < FLAGS_num_topics; i++) {
     std::string topic_name("benchmark." + std::to_string(i));
-    SequenceNumber seqno = 0;   // start sequence number (0 = only new records)
-    if (FLAGS_delay_subscribe) {
-      // Find the first seqno published to this topic (or 0 if none published).
-      auto it = first_seqno.find(topic_name);
-      if (it == first_seqno.end()) {
-        seqno = 0;
-      } else {
-        seqno = it->second;
+    for (uint64_t j = 0; j < FLAGS_subscribers_per_topic; j++) {
+      const bool backlog_subscriber =
+        is_backlog(rng) || FLAGS_delay_subscribe;
+      if (backlog_subscriber != backlog) {
+        continue;
       }
-    }
-    consumers[c++ % consumers.size()]->Subscribe(
-        GuestTenant, nsid, topic_name, seqno);
-    if (rate) {
-      int64_t have_sent = i;
-      auto expired = std::chrono::steady_clock::now() - start;
-      auto expected = std::chrono::microseconds(1000000 * have_sent / rate);
-      if (expected > expired) {
-        /* sleep override */
-        std::this_thread::sleep_for(expected - expired);
+      SequenceNumber seqno = 0;   // start sequence number (0 = new records)
+      if (backlog) {
+        // Find the first seqno published to this topic (or 0 if none).
+        auto it = first_seqno.find(topic_name);
+        if (it == first_seqno.end()) {
+          seqno = 0;
+        } else {
+          seqno = it->second;
+        }
+      }
+      consumers[c++ % consumers.size()]->Subscribe(
+          GuestTenant, nsid, topic_name, seqno);
+      if (rate) {
+        auto expired = std::chrono::steady_clock::now() - start;
+        auto expected = std::chrono::microseconds(1000000 * have_sent / rate);
+        if (expected > expired) {
+          /* sleep override */
+          std::this_thread::sleep_for(expected - expired);
+        }
       }
+      ++have_sent;
     }
   }
 }
 
+/**
+ * Replaces subscriptions to random topics at FLAGS_churn_rate until stopped.
+ * Messages received on these subscriptions are only counted.
+ */
+static void DoChurn(void* param) {
+  ChurnArgs* args = static_cast<ChurnArgs*>(param);
+  auto& clients = *args->clients;
+  std::atomic<int64_t>* messages_received = args->messages_received;
+  auto deliver_callback = [messages_received]
+    (std::unique_ptr<MessageReceived>& msg) {
+    ++*messages_received;
+  };
+
+  std::mt19937_64 rng(1);
+  std::uniform_int_distribution<uint64_t> topics(0, FLAGS_num_topics - 1);
+  std::vector<std::pair<ClientImpl*, SubscriptionHandle>> subscriptions;
+  size_t c = 0;
+  auto subscribe = [&] () {
+    ClientImpl* client = clients[c++ % clients.size()].get();
+    std::string topic_name("benchmark." + std::to_string(topics(rng)));
+    return std::make_pair(client,
+                          client->Subscribe(GuestTenant,
+                                            args->nsid,
+                                            topic_name,
+                                            0,
+                                            deliver_callback));
+  };
+  for (uint64_t i = 0; i < FLAGS_churn_subscriptions; i++) {
+    subscriptions.push_back(subscribe());
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  args->churns = 0;
+  while (!args->stop->load() && !subscriptions.empty()) {
+    auto& subscription = subscriptions[args->churns % subscriptions.size()];
+    subscription.first->Unsubscribe(subscription.second);
+    subscription = subscribe();
+    ++args->churns;
+
+    auto expired = std::chrono::steady_clock::now() - start;
+    auto expected =
+      std::chrono::microseconds(1000000 * args->churns / FLAGS_churn_rate);
+    if (expected > expired) {
+      /* sleep override */
+      std::this_thread::sleep_for(expected - expired);
+    }
+  }
+  for (auto& subscription : subscriptions) {
+    subscription.first->Unsubscribe(subscription.second);
+  }
+}
+
 /*
  ** Receive messages
  */
@@ -312,10 +466,73 @@ static void DoConsume(void* param) {
   auto timeout = std::chrono::seconds(FLAGS_idle_timeout);
   do {
     all_messages_received->TimedWait(timeout);
-  } while (messages_received->load() != FLAGS_num_messages &&
+  } while (messages_received->load() != args->expected_messages &&
            std::chrono::steady_clock::now() - *last_data_message < timeout);
 
-  args->result = messages_received->load() == FLAGS_num_messages ? 0 : 1;
+  args->result = messages_received->load() == args->expected_messages ? 0 : 1;
+}
+
+/**
+ * Writes results of sweep steps in FLAGS_sweep_report_format.
+ *
+ * @param results Results of all steps, in order of increasing rate.
+ * @param out Stream to write report to.
+ */
+static void WriteSweepReport(const std::vector<SweepStepResult>& results,
+                             FILE* out) {
+  const char* names[] = {"p50", "p90", "p99", "p999"};
+  // The knee is the highest rate sustained before the first saturated step.
+  int64_t knee_rate = 0;
+  for (const auto& result : results) {
+    if (result.saturated) {
+      break;
+    }
+    knee_rate = result.target_rate;
+  }
+
+  if (FLAGS_sweep_report_format == "json") {
+    fprintf(out, "{\n  \"steps\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& r = results[i];
+      fprintf(out,
+              "    {\"target_rate\": %" PRId64 ", \"achieved_rate\": %.1lf, "
+              "\"messages\": %" PRId64 ", \"acks\": %" PRId64 ", "
+              "\"received\": %" PRId64,
+              r.target_rate, r.achieved_rate, r.messages, r.acks, r.received);
+      for (size_t p = 0; p < 4; ++p) {
+        fprintf(out, ", \"ack_%s_us\": %.1lf", names[p], r.ack_latency[p]);
+      }
+      for (size_t p = 0; p < 4; ++p) {
+        fprintf(out, ", \"recv_%s_us\": %.1lf", names[p], r.recv_latency[p]);
+      }
+      fprintf(out, ", \"saturated\": %s}%s\n",
+              r.saturated ? "true" : "false",
+              i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n  \"knee_rate\": %" PRId64 "\n}\n", knee_rate);
+  } else {
+    fprintf(out, "target_rate,achieved_rate,messages,acks,received");
+    for (const char* prefix : {"ack", "recv"}) {
+      for (size_t p = 0; p < 4; ++p) {
+        fprintf(out, ",%s_%s_us", prefix, names[p]);
+      }
+    }
+    fprintf(out, ",saturated\n");
+    for (const auto& r : results) {
+      fprintf(out,
+              "%" PRId64 ",%.1lf,%" PRId64 ",%" PRId64 ",%" PRId64,
+              r.target_rate, r.achieved_rate, r.messages, r.acks, r.received);
+      for (size_t p = 0; p < 4; ++p) {
+        fprintf(out, ",%.1lf", r.ack_latency[p]);
+      }
+      for (size_t p = 0; p < 4; ++p) {
+        fprintf(out, ",%.1lf", r.recv_latency[p]);
+      }
+      fprintf(out, ",%d\n", r.saturated ? 1 : 0);
+    }
+  }
+  fflush(out);
+  printf("Saturation knee at %" PRId64 " messages/s\n", knee_rate);
 }
 
 }  // namespace rocketspeed
@@ -359,6 +576,58 @@ int main(int argc, char** argv) {
             "or --start_consumer\n");
     return 1;
   }
+  if (FLAGS_subscribers_per_topic == 0) {
+    fprintf(stderr, "subscribers_per_topic must be greater than 0.\n");
+    return 1;
+  }
+  if (FLAGS_backlog_fraction < 0.0 || FLAGS_backlog_fraction > 1.0) {
+    fprintf(stderr, "backlog_fraction must be in [0, 1].\n");
+    return 1;
+  }
+  if (FLAGS_churn_rate < 0) {
+    fprintf(stderr, "churn_rate must not be negative.\n");
+    return 1;
+  }
+  if ((FLAGS_backlog_fraction > 0.0 || FLAGS_churn_rate > 0) &&
+      (!FLAGS_start_producer || !FLAGS_start_consumer)) {
+    fprintf(stderr, "--backlog_fraction and --churn_rate require "
+            "--start_producer and --start_consumer\n");
+    return 1;
+  }
+  const bool backlog_subscribe =
+    FLAGS_delay_subscribe || FLAGS_backlog_fraction > 0.0;
+  // Each message is delivered once per subscription on its topic.
+  const int64_t expected_messages =
+    FLAGS_num_messages * static_cast<int64_t>(FLAGS_subscribers_per_topic);
+
+  // Message rates of sweep steps.
+  std::vector<int64_t> sweep_rates;
+  if (FLAGS_sweep) {
+    if (!FLAGS_start_producer || backlog_subscribe) {
+      fprintf(stderr, "--sweep requires --start_producer and does not "
+              "support --delay_subscribe or --backlog_fraction\n");
+      return 1;
+    }
+    if (FLAGS_sweep_start_rate <= 0 || FLAGS_sweep_rate_step <= 0 ||
+        FLAGS_sweep_step_seconds <= 0) {
+      fprintf(stderr, "sweep rates and step duration must be positive.\n");
+      return 1;
+    }
+    if (FLAGS_sweep_warmup < 0.0 || FLAGS_sweep_warmup >= 1.0) {
+      fprintf(stderr, "sweep_warmup must be in [0, 1).\n");
+      return 1;
+    }
+    if (FLAGS_sweep_report_format != "csv" &&
+        FLAGS_sweep_report_format != "json") {
+      fprintf(stderr, "sweep_report_format must be csv or json.\n");
+      return 1;
+    }
+    for (int64_t rate = FLAGS_sweep_start_rate;
+         rate <= FLAGS_sweep_max_rate;
+         rate += FLAGS_sweep_rate_step) {
+      sweep_rates.push_back(rate);
+    }
+  }
 
   // Create logger
   if (FLAGS_logging) {
@@ -394,6 +663,9 @@ int main(int argc, char** argv) {
     test_options.start_copilot = true;
     test_options.start_pilot = true;
     test_options.storage_url = FLAGS_storage_url;
+    test_options.memory_storage = FLAGS_memory_storage;
+    test_options.memory_storage_options.append_latency =
+      std::chrono::microseconds(FLAGS_memory_storage_latency_us);
     if (FLAGS_cache_size) {
       test_options.tower.cache_size = FLAGS_cache_size;
     }
@@ -442,6 +714,8 @@ int main(int argc, char** argv) {
   rocketspeed::ThreadLocalPtr per_thread_stats;
   rocketspeed::ThreadLocalPtr ack_latency;
   rocketspeed::ThreadLocalPtr recv_latency;
+  std::vector<std::unique_ptr<SweepLatencies>> all_sweep_latencies;
+  rocketspeed::ThreadLocalPtr sweep_latency;
 
   // Initializes stats for current thread.
   auto InitThreadLocalStats = [&] () {
@@ -451,11 +725,29 @@ int main(int argc, char** argv) {
       per_thread_stats.Reset(stats.get());
       ack_latency.Reset(stats->AddLatency("ack-latency"));
       recv_latency.Reset(stats->AddLatency("recv-latency"));
+      std::unique_ptr<SweepLatencies> sweep(new SweepLatencies());
+      for (size_t step = 0; step < sweep_rates.size(); ++step) {
+        const std::string prefix = "sweep." + std::to_string(step) + ".";
+        sweep->ack.push_back(stats->AddLatency(prefix + "ack-latency"));
+        sweep->recv.push_back(stats->AddLatency(prefix + "recv-latency"));
+      }
+      sweep_latency.Reset(sweep.get());
       std::lock_guard<std::mutex> lock(all_stats_mutex);
       all_stats.emplace_back(std::move(stats));
+      all_sweep_latencies.emplace_back(std::move(sweep));
     }
   };
 
+  // Get thread local latency histograms of sweep steps.
+  auto GetSweepLatency = [&] () {
+    InitThreadLocalStats();
+    return static_cast<SweepLatencies*>(sweep_latency.Get());
+  };
+
+  // Progress of each sweep step.
+  std::unique_ptr<SweepStepCounters[]> sweep_counters(
+    new SweepStepCounters[sweep_rates.size()]);
+
   // Get thread local ack latency histogram.
   auto GetAckLatency = [&] () {
     InitThreadLocalStats();
@@ -483,11 +775,23 @@ int main(int argc, char** argv) {
     if (rs->GetStatus().ok()) {
       // Parse message data to get received index.
       rocketspeed::Slice data = rs->GetContents();
-      unsigned long long int message_index, send_time;
-      std::sscanf(data.data(), "%llu %llu", &message_index, &send_time);
+      unsigned long long int message_index, send_time, sweep_step = 0;
+      int measured = 0;
+      std::sscanf(data.data(), "%llu %llu %llu %d",
+                  &message_index, &send_time, &sweep_step, &measured);
+      if (sweep_step != 0 && sweep_step <= sweep_rates.size()) {
+        if (measured) {
+          GetSweepLatency()->ack[sweep_step - 1]->Record(
+            static_cast<uint64_t>(now - send_time));
+        }
+        auto& counters = sweep_counters[sweep_step - 1];
+        counters.last_ack_micros = now;
+        ++counters.acks;
+        return;
+      }
       GetAckLatency()->Record(static_cast<uint64_t>(now - send_time));
 
-      if (FLAGS_delay_subscribe) {
+      if (backlog_subscribe) {
         if (rs->GetStatus().ok()) {
           // Get the min sequence number for this topic to subscribe to later.
           std::string topic = rs->GetTopicName().ToString();
@@ -522,8 +826,8 @@ int main(int argc, char** argv) {
 
   // Create callback for processing messages received
   std::atomic<int64_t> messages_received{0};
-  std::vector<bool> is_received(FLAGS_num_messages, false);
-  std::mutex is_received_mutex;
+  std::vector<uint32_t> times_received(FLAGS_num_messages, 0);
+  std::mutex times_received_mutex;
   auto receive_callback = [&]
     (std::unique_ptr<rocketspeed::MessageReceived>& rs) {
     uint64_t now = env->NowMicros();
@@ -532,21 +836,30 @@ int main(int argc, char** argv) {
 
     // Parse message data to get received index.
     rocketspeed::Slice data = rs->GetContents();
-    unsigned long long int message_index, send_time;
-    std::sscanf(data.data(), "%llu %llu", &message_index, &send_time);
+    unsigned long long int message_index, send_time, sweep_step = 0;
+    int measured = 0;
+    std::sscanf(data.data(), "%llu %llu %llu %d",
+                &message_index, &send_time, &sweep_step, &measured);
+    if (sweep_step != 0 && sweep_step <= sweep_rates.size()) {
+      if (measured) {
+        GetSweepLatency()->recv[sweep_step - 1]->Record(
+          static_cast<uint64_t>(now - send_time));
+      }
+      ++sweep_counters[sweep_step - 1].received;
+      return;
+    }
     if (message_index < static_cast<uint64_t>(FLAGS_num_messages)) {
       LOG_INFO(info_log,
           "Received message %llu with timestamp %llu",
           static_cast<long long unsigned int>(message_index),
           static_cast<long long unsigned int>(send_time));
       GetRecvLatency()->Record(static_cast<uint64_t>(now - send_time));
-      std::lock_guard<std::mutex> lock(is_received_mutex);
-      if (is_received[message_index]) {
+      std::lock_guard<std::mutex> lock(times_received_mutex);
+      if (++times_received[message_index] > FLAGS_subscribers_per_topic) {
         LOG_WARN(info_log,
-          "Received message %llu twice.",
+          "Received message %llu more times than subscribed.",
           static_cast<long long unsigned int>(message_index));
       }
-      is_received[message_index] = true;
     } else {
       LOG_WARN(info_log,
           "Received out of bounds message index (%llu), message was (%s)",
@@ -555,7 +868,7 @@ int main(int argc, char** argv) {
     }
 
     // If we've received all messages, let the main thread know to finish up.
-    if (messages_received.load() == FLAGS_num_messages) {
+    if (messages_received.load() == expected_messages) {
       all_messages_received.Post();
     }
   };
@@ -616,7 +929,7 @@ int main(int argc, char** argv) {
     if (FLAGS_start_consumer) {
       printf("Subscribing to topics... ");
       fflush(stdout);
-      DoSubscribe(clients, nsid, std::move(first_seqno));
+      DoSubscribe(clients, nsid, first_seqno, false);
       env->SleepForMicroseconds(1000000);  // allow 1 seconds for subscribe
       printf("done\n");
     }
@@ -625,10 +938,133 @@ int main(int argc, char** argv) {
     start = std::chrono::steady_clock::now();
   }
 
+  if (FLAGS_sweep) {
+    std::vector<SweepStepResult> results;
+    for (size_t step = 0; step < sweep_rates.size(); ++step) {
+      const int64_t rate = sweep_rates[step];
+      const int64_t num_messages = rate * FLAGS_sweep_step_seconds;
+      printf("Sweep step %zu: %" PRId64 " messages/s\n", step + 1, rate);
+      fflush(stdout);
+
+      ProducerArgs sargs;
+      sargs.producers = &clients;
+      sargs.nsid = nsid;
+      sargs.num_messages = num_messages;
+      sargs.message_rate = rate;
+      sargs.sweep_step = step + 1;
+      sargs.warmup = FLAGS_sweep_warmup;
+      sargs.await_ack = false;
+      sargs.all_ack_messages_received = &all_ack_messages_received;
+      sargs.ack_messages_received = &ack_messages_received;
+      sargs.last_ack_message = &last_ack_message;
+      sargs.publish_callback = publish_callback;
+      const uint64_t step_start = env->NowMicros();
+      DoProduce(&sargs);
+
+      // Wait for outstanding acks and deliveries of this step, as long as
+      // there is progress.
+      auto& counters = sweep_counters[step];
+      const int64_t expected_received = FLAGS_start_consumer ?
+        num_messages * static_cast<int64_t>(FLAGS_subscribers_per_topic) : 0;
+      int64_t progress = -1;
+      auto last_progress = std::chrono::steady_clock::now();
+      while (counters.acks < num_messages ||
+             counters.received < expected_received) {
+        const int64_t current = counters.acks + counters.received;
+        if (current != progress) {
+          progress = current;
+          last_progress = std::chrono::steady_clock::now();
+        } else if (std::chrono::steady_clock::now() - last_progress >
+                   std::chrono::seconds(FLAGS_idle_timeout)) {
+          break;
+        }
+        /* sleep override */
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+
+      // Aggregate snapshots of per-thread stats.
+      rocketspeed::Statistics stats;
+      {
+        std::lock_guard<std::mutex> lock(all_stats_mutex);
+        for (auto& s : all_stats) {
+          stats.Aggregate(rocketspeed::Statistics(*s));
+        }
+      }
+      const std::string prefix = "sweep." + std::to_string(step) + ".";
+      const auto* ack = stats.GetHistogram(prefix + "ack-latency");
+      const auto* recv = stats.GetHistogram(prefix + "recv-latency");
+
+      SweepStepResult result;
+      result.target_rate = rate;
+      result.messages = num_messages;
+      result.acks = counters.acks;
+      result.received = counters.received;
+      const uint64_t elapsed = counters.last_ack_micros - step_start;
+      result.achieved_rate = counters.last_ack_micros > step_start ?
+        1e6 * static_cast<double>(result.acks) / static_cast<double>(elapsed) :
+        0.0;
+      for (size_t p = 0; p < 4; ++p) {
+        result.ack_latency[p] = ack ? ack->Percentile(kSweepPercentiles[p]) : 0;
+        result.recv_latency[p] =
+          recv ? recv->Percentile(kSweepPercentiles[p]) : 0;
+      }
+      result.saturated =
+        result.acks < num_messages ||
+        result.received < expected_received ||
+        result.achieved_rate <
+          FLAGS_sweep_knee_throughput * static_cast<double>(rate) ||
+        (!results.empty() &&
+         result.ack_latency[2] >
+           FLAGS_sweep_knee_latency * results[0].ack_latency[2]);
+      printf("  achieved %.1lf messages/s, ack p99 %.1lfus%s\n",
+             result.achieved_rate,
+             result.ack_latency[2],
+             result.saturated ? " (saturated)" : "");
+      fflush(stdout);
+      results.push_back(result);
+      if (result.saturated && FLAGS_sweep_stop_at_knee) {
+        break;
+      }
+    }
+
+    FILE* out = stdout;
+    if (!FLAGS_sweep_report_file.empty()) {
+      out = fopen(FLAGS_sweep_report_file.c_str(), "w");
+      if (!out) {
+        fprintf(stderr, "Failed to open %s\n",
+                FLAGS_sweep_report_file.c_str());
+        return 1;
+      }
+    }
+    printf("\n");
+    WriteSweepReport(results, out);
+    if (out != stdout) {
+      fclose(out);
+    }
+    return 0;
+  }
+
   ProducerArgs pargs;
   ConsumerArgs cargs;
+  ChurnArgs churn_args;
+  std::atomic<bool> stop_churn{false};
+  std::atomic<int64_t> churn_messages_received{0};
   rocketspeed::Env::ThreadId producer_threadid = 0;
   rocketspeed::Env::ThreadId consumer_threadid = 0;
+  rocketspeed::Env::ThreadId churn_threadid = 0;
+  cargs.expected_messages = expected_messages;
+
+  // Replace subscriptions while publishing.
+  if (FLAGS_churn_rate > 0) {
+    churn_args.clients = &clients;
+    churn_args.nsid = nsid;
+    churn_args.stop = &stop_churn;
+    churn_args.messages_received = &churn_messages_received;
+    churn_args.churns = 0;
+    churn_threadid = env->StartThread(rocketspeed::DoChurn,
+                                      static_cast<void*>(&churn_args),
+                                      "ChurnMain");
+  }
 
   // Start producing messages
   if (FLAGS_start_producer) {
@@ -636,6 +1072,11 @@ int main(int argc, char** argv) {
     fflush(stdout);
     pargs.producers = &clients;
     pargs.nsid = nsid;
+    pargs.num_messages = FLAGS_num_messages;
+    pargs.message_rate = FLAGS_message_rate;
+    pargs.sweep_step = 0;
+    pargs.warmup = 0.0;
+    pargs.await_ack = FLAGS_await_ack;
     pargs.all_ack_messages_received = &all_ack_messages_received;
     pargs.ack_messages_received = &ack_messages_received;
     pargs.last_ack_message = &last_ack_message;
@@ -672,26 +1113,35 @@ int main(int argc, char** argv) {
       fflush(stdout);
     }
   }
+  if (FLAGS_churn_rate > 0) {
+    stop_churn = true;
+    env->WaitForJoin(churn_threadid);
+  }
 
   // If we are delayed, then start subscriptions after all
-  // publishers are completed.
+  // publishers are completed. Backlog subscriptions of a mixed workload are
+  // created at this point too, while tail subscriptions keep receiving.
   uint64_t subscribe_time = 0;
-  if (FLAGS_delay_subscribe) {
+  if (backlog_subscribe) {
     assert(FLAGS_start_consumer);
     printf("Subscribing (delayed) to topics.\n");
     fflush(stdout);
 
     // Start the clock.
-    start = std::chrono::steady_clock::now();
+    if (FLAGS_delay_subscribe) {
+      start = std::chrono::steady_clock::now();
+    }
 
     // Subscribe to topics
     subscribe_time = env->NowMicros();
-    DoSubscribe(clients, nsid, std::move(first_seqno));
+    DoSubscribe(clients, nsid, first_seqno, true);
     subscribe_time = env->NowMicros() - subscribe_time;
-    printf("Took %" PRIu64 "ms to subscribe to %" PRIu64 " topics",
+    printf("Took %" PRIu64 "ms to subscribe to %" PRIu64 " topics\n",
       subscribe_time / 1000,
       FLAGS_num_topics);
+  }
 
+  if (FLAGS_delay_subscribe) {
     // Wait for all messages to be received
     printf("Waiting (delayed) for messages.\n");
     fflush(stdout);
@@ -707,7 +1157,7 @@ int main(int argc, char** argv) {
     // Wait for Consumer thread to exit
     env->WaitForJoin(consumer_threadid);
     ret = cargs.result;
-    if (messages_received.load() != FLAGS_num_messages) {
+    if (messages_received.load() != expected_messages) {
       printf("Time out awaiting messages.\n");
       fflush(stdout);
     } else {
@@ -764,20 +1214,29 @@ int main(int argc, char** argv) {
       printf("%lld messages received\n",
              static_cast<long long unsigned int>(messages_received.load()));
     }
+    if (FLAGS_churn_rate > 0) {
+      printf("%lld subscriptions churned\n",
+             static_cast<long long int>(churn_args.churns));
+      printf("%lld messages received on churned subscriptions\n",
+             static_cast<long long int>(churn_messages_received.load()));
+    }
 
     if (FLAGS_start_consumer &&
-        messages_received.load() != FLAGS_num_messages) {
+        messages_received.load() != expected_messages) {
       // Print out dropped messages if there are any. This helps when
       // debugging problems.
       printf("\n");
       printf("Messages failed to receive\n");
 
-      for (uint64_t i = 0; i < is_received.size(); ++i) {
-        if (!is_received[i]) {
+      auto is_received = [&](uint64_t i) {
+        return times_received[i] >= FLAGS_subscribers_per_topic;
+      };
+      for (uint64_t i = 0; i < times_received.size(); ++i) {
+        if (!is_received(i)) {
           // Find the range of message IDs dropped (e.g. 100-200)
           uint64_t j;
-          for (j = i; j < is_received.size(); ++j) {
-            if (is_received[j]) {
+          for (j = i; j < times_received.size(); ++j) {
+            if (is_received(j)) {
               break;
             }
           }
@@ -822,6 +1281,25 @@ int main(int argc, char** argv) {
       printf("\n");
       printf("Statistics\n");
       printf("%s", stats.Report().c_str());
+
+      // Throughput of each stage on the path of a message, server stages are
+      // only known when running a local server.
+      const char* const stages[] = {
+        "pilot.append_requests",
+        "tower.topic_tailer.log_records_received",
+        "tower.topic_tailer.tail_records_received",
+        "tower.topic_tailer.backlog_records_received",
+        "copilot.data_received",
+        "copilot.data_delivered",
+        "client.messages_received.deliver_data",
+      };
+      printf("\n");
+      printf("Stage throughput\n");
+      for (const char* stage : stages) {
+        const int64_t count = stats.GetCounterValue(stage);
+        printf("%-45s %12" PRId64 " %12" PRId64 "/s\n",
+               stage, count, 1000 * count / total_ms);
+      }
     }
   }
   fflush(stdout);
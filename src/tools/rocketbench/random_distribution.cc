@@ -6,8 +6,41 @@
 
 #include "src/tools/rocketbench/random_distribution.h"
 
+#include <algorithm>
+
 namespace rocketspeed {
 
+ZipfDistribution::ZipfDistribution(uint64_t a,
+                                   uint64_t b,
+                                   double exponent,
+                                   uint64_t seed)
+: RandomDistributionBase(seed)
+, a_(a)
+, distr(0.0, 1.0) {
+    //precompute the cumulative distribution, normalised at the end
+    double sum = 0.0;
+    cdf_.reserve(b - a + 1);
+    for (uint64_t k = 0; k <= b - a; k++)
+    {
+        sum += 1.0 / pow(static_cast<double>(k + 1), exponent);
+        cdf_.push_back(sum);
+    }
+    for (double& p : cdf_)
+    {
+        p /= sum;
+    }
+}
+
+uint64_t ZipfDistribution::generateRandomInt() {
+    //find the first value with cumulative probability above the sample
+    double sample = distr(RandomDistributionBase::rng);
+    auto it = std::upper_bound(cdf_.begin(), cdf_.end(), sample);
+    if (it == cdf_.end()) {
+        --it;
+    }
+    return a_ + static_cast<uint64_t>(it - cdf_.begin());
+}
+
 
 //Calculate the standard deviation of the sequence of numbers, given the mean
 double StandardDeviation(uint64_t a, uint64_t b, double mean) {
@@ -31,7 +64,7 @@ double StandardDeviation(uint64_t a, uint64_t b, double mean) {
 RandomDistributionBase* GetDistributionByName(
                         const std::string& dist_name, uint64_t a,
                         uint64_t b, double amean, double stdd,
-                        uint64_t seed) {
+                        uint64_t seed, double zipf_exponent) {
 
     RandomDistributionBase* pDistribution = nullptr;
     //mean: if not provided, this is close enough as the range
@@ -48,6 +81,8 @@ RandomDistributionBase* GetDistributionByName(
     }
     else if (dist_name.compare("uniform") == 0) {
         pDistribution = new UniformDistribution(a, b, seed);
+    } else if (dist_name.compare("zipf") == 0) {
+        pDistribution = new ZipfDistribution(a, b, zipf_exponent, seed);
     } else if (dist_name.compare("fixed") == 0) {
         pDistribution = nullptr;
     }
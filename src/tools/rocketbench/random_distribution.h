@@ -8,6 +8,7 @@
 #include <random>
 #include <cmath>
 #include <string>
+#include <vector>
 
 
 namespace rocketspeed {
@@ -69,6 +70,24 @@ class PoissonDistribution : public RandomDistributionBase
   std::poisson_distribution<uint64_t> distr;
 };
 
+//Zipf distribution, probability of value a + k is proportional to
+//1 / (k + 1)^exponent, so a is the most popular value
+class ZipfDistribution : public RandomDistributionBase
+{
+ public:
+  explicit ZipfDistribution(uint64_t a,
+                            uint64_t b,
+                            double exponent,
+                            uint64_t seed);
+
+  virtual uint64_t generateRandomInt();
+
+ private:
+  uint64_t a_;
+  std::vector<double> cdf_;  // cumulative probability of a + k
+  std::uniform_real_distribution<double> distr;
+};
+
 //Calculate the standard deviation of the sequence of numbers, given the mean
 double StandardDeviation(uint64_t a, uint64_t b, double mean);
 //get a pointer to the distribution instance based on the distribution name
@@ -78,6 +97,7 @@ RandomDistributionBase* GetDistributionByName(
                         uint64_t b,
                         double amean,
                         double stdd,
-                        uint64_t seed);
+                        uint64_t seed,
+                        double zipf_exponent = 1.0);
 
 };
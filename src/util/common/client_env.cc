@@ -70,6 +70,10 @@ void ClientEnv::WaitForJoin(ThreadId tid) {
   PthreadCall("join", pthread_join((pthread_t)tid, nullptr));
 }
 
+void ClientEnv::DetachThread(ThreadId tid) {
+  PthreadCall("detach", pthread_detach((pthread_t)tid));
+}
+
 BaseEnv::ThreadId ClientEnv::GetCurrentThreadId() const {
 #if defined(OS_MACOSX)
   return reinterpret_cast<BaseEnv::ThreadId>(pthread_self());
@@ -43,6 +43,9 @@ class ClientEnv : public BaseEnv {
 
   virtual void WaitForJoin(ThreadId tid);
 
+  // Lets the thread release its resources on exit without being joined.
+  virtual void DetachThread(ThreadId tid);
+
   virtual ThreadId GetCurrentThreadId() const;
 
   virtual uint64_t NowMicros();
@@ -141,6 +141,14 @@ class HeterogeneousQueue {
     return true;
   }
 
+  /**
+   * Transfers reading to the current thread, e.g. for consuming the remaining
+   * entries before destruction, once the reader thread has stopped.
+   */
+  void ResetReadThread() {
+    read_check_.Reset();
+  }
+
   /**
    * RAII-style wrapper that encapsulates a write transaction.
    * This allows multiple writes to occur atomically. If any single write,
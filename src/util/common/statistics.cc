@@ -6,9 +6,11 @@
 #include "statistics.h"
 
 #include <cmath>
+#include <cstdlib>
 
 #include <algorithm>
 #include <limits>
+#include <new>
 #include <string>
 
 #include "src/port/port.h"
@@ -34,10 +36,7 @@ Histogram::Histogram(double min,
   assert(max >= min);
   assert(ratio > 1.0);
   num_buckets_ = BucketIndex(max) + 1;
-  bucket_counts_.reset(new uint64_t[num_buckets_]);
-  for (size_t i = 0; i < num_buckets_; ++i) {
-    bucket_counts_[i] = 0;
-  }
+  ResetBuckets();
 }
 
 Histogram::Histogram(const Histogram& src)
@@ -50,10 +49,7 @@ Histogram::Histogram(const Histogram& src)
 , log_ratio_(src.log_ratio_)
 , log_smallest_bucket_(src.log_smallest_bucket_) {
   // Copy the size then use the existing Aggregate code to copy.
-  bucket_counts_.reset(new uint64_t[num_buckets_]);
-  for (size_t i = 0; i < num_buckets_; ++i) {
-    bucket_counts_[i] = 0;
-  }
+  ResetBuckets();
   Aggregate(src);
 }
 
@@ -67,21 +63,27 @@ Histogram::Histogram(Histogram&& src)
 , num_buckets_(src.num_buckets_)
 , log_ratio_(src.log_ratio_)
 , log_smallest_bucket_(src.log_smallest_bucket_) {
-  src.bucket_counts_.reset(new uint64_t[num_buckets_]);
   src.thread_check_.Reset();
+  src.ResetBuckets();
+  src.num_samples_ = 0;
+}
+
+void Histogram::ResetBuckets() {
+  bucket_counts_.reset(new std::atomic<uint64_t>[num_buckets_]);
   for (size_t i = 0; i < num_buckets_; ++i) {
-    src.bucket_counts_[i] = 0;
+    bucket_counts_[i].store(0, std::memory_order_relaxed);
   }
-  src.num_samples_ = 0;
 }
 
 void Histogram::Record(double sample) {
   thread_check_.Check();
   size_t index = std::min(BucketIndex(sample), num_buckets_ - 1);
-  bucket_counts_[index] += 1;
+  // There is a single writer, no need for an atomic read-modify-write.
+  auto& bucket = bucket_counts_[index];
+  bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
   num_samples_ += 1;
 }
-
 size_t Histogram::BucketIndex(double sample) const {
   // Compute the log of sample_real in base ratio_.
   // This formula puts samples below min_ + smallest_bucket_ into bucket 0
@@ -112,7 +114,7 @@ double Histogram::Percentile(double p) const {
   }
 
   for (size_t bucket = 0; bucket < num_buckets_; ++bucket) {
-    size_t count = bucket_counts_[bucket];
+    size_t count = bucket_counts_[bucket].load(std::memory_order_relaxed);
     if (index > count || count == 0) {
       // Percentile does not lie in this bucket.
       index -= count;
@@ -132,7 +134,6 @@ double Histogram::Percentile(double p) const {
 
 void Histogram::Aggregate(const Histogram& histogram) {
   thread_check_.Check();
-  histogram.thread_check_.Check();
 
   // Parameters must match exactly for histograms to aggregate.
   assert(histogram.min_ == min_);
@@ -141,17 +142,20 @@ void Histogram::Aggregate(const Histogram& histogram) {
   assert(histogram.ratio_ == ratio_);
   assert(histogram.num_buckets_ == num_buckets_);
 
-  // Just sum up the bucket counts and number of samples.
+  // Just sum up the bucket counts and number of samples. The other histogram
+  // may be concurrently modified, so number of samples is computed from the
+  // buckets we have actually read.
   for (size_t i = 0; i < num_buckets_; ++i) {
-    uint64_t n = histogram.bucket_counts_[i];
-    bucket_counts_[i] += n;
+    uint64_t n = histogram.bucket_counts_[i].load(std::memory_order_relaxed);
+    auto& bucket = bucket_counts_[i];
+    bucket.store(bucket.load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
     num_samples_ += n;
   }
 }
 
 void Histogram::Disaggregate(const Histogram& histogram) {
   thread_check_.Check();
-  histogram.thread_check_.Check();
 
   // Parameters must match exactly for histograms to aggregate.
   assert(histogram.min_ == min_);
@@ -162,8 +166,10 @@ void Histogram::Disaggregate(const Histogram& histogram) {
 
   // Just subtract the bucket counts and number of samples.
   for (size_t i = 0; i < num_buckets_; ++i) {
-    uint64_t n = histogram.bucket_counts_[i];
-    bucket_counts_[i] -= n;
+    uint64_t n = histogram.bucket_counts_[i].load(std::memory_order_relaxed);
+    auto& bucket = bucket_counts_[i];
+    bucket.store(bucket.load(std::memory_order_relaxed) - n,
+                 std::memory_order_relaxed);
     num_samples_ -= n;
   }
 }
@@ -182,22 +188,76 @@ std::string Histogram::Report() const {
   return std::string(buffer);
 }
 
+constexpr size_t Statistics::kCountersPerBlock;
+
+size_t Statistics::FindIndex(const std::vector<std::string>& names,
+                             const std::string& name,
+                             size_t hint) {
+  if (hint < names.size() && names[hint] == name) {
+    return hint;
+  }
+  auto it = std::find(names.begin(), names.end(), name);
+  return static_cast<size_t>(it - names.begin());
+}
+
 void Statistics::Aggregate(const Statistics& stats) {
   thread_check_.Check();
-  AggregateOne(&counters_, stats.counters_);
-  AggregateOne(&histograms_, stats.histograms_);
+  for (size_t i = 0; i < stats.counter_names_.size(); ++i) {
+    const std::string& name = stats.counter_names_[i];
+    size_t index = FindIndex(counter_names_, name, i);
+    Counter* counter =
+        index == counter_names_.size() ? AddCounter(name) : &CounterAt(index);
+    counter->Aggregate(stats.CounterAt(i));
+  }
+  for (size_t i = 0; i < stats.histogram_names_.size(); ++i) {
+    const std::string& name = stats.histogram_names_[i];
+    size_t index = FindIndex(histogram_names_, name, i);
+    if (index == histogram_names_.size()) {
+      // Histogram with this name doesn't exist, so add a copy.
+      histogram_names_.push_back(name);
+      histograms_.emplace_back(new Histogram(*stats.histograms_[i]));
+    } else {
+      histograms_[index]->Aggregate(*stats.histograms_[i]);
+    }
+  }
 }
 
 void Statistics::Disaggregate(const Statistics& stats) {
   thread_check_.Check();
-  DisaggregateOne(&counters_, stats.counters_);
-  DisaggregateOne(&histograms_, stats.histograms_);
+  for (size_t i = 0; i < stats.counter_names_.size(); ++i) {
+    size_t index = FindIndex(counter_names_, stats.counter_names_[i], i);
+    assert(index != counter_names_.size());
+    CounterAt(index).Disaggregate(stats.CounterAt(i));
+  }
+  for (size_t i = 0; i < stats.histogram_names_.size(); ++i) {
+    size_t index = FindIndex(histogram_names_, stats.histogram_names_[i], i);
+    assert(index != histogram_names_.size());
+    histograms_[index]->Disaggregate(*stats.histograms_[i]);
+  }
+}
+
+void* Statistics::CounterBlock::operator new(size_t size) {
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, alignof(CounterBlock), size) != 0) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void Statistics::CounterBlock::operator delete(void* ptr) {
+  free(ptr);
 }
 
 Counter* Statistics::AddCounter(const std::string& name) {
   thread_check_.Check();
-  counters_[name] = std::unique_ptr<Counter>(new Counter());
-  return counters_[name].get();
+  size_t index = FindIndex(counter_names_, name, counter_names_.size());
+  if (index == counter_names_.size()) {
+    if (index % kCountersPerBlock == 0) {
+      counter_blocks_.emplace_back(new CounterBlock());
+    }
+    counter_names_.push_back(name);
+  }
+  return &CounterAt(index);
 }
 
 Histogram* Statistics::AddHistogram(const std::string& name,
@@ -206,16 +266,39 @@ Histogram* Statistics::AddHistogram(const std::string& name,
                                     double smallest_bucket,
                                     double bucket_ratio) {
   thread_check_.Check();
-  histograms_[name] = std::unique_ptr<Histogram>(
-    new Histogram(min, max, smallest_bucket, bucket_ratio));
-  return histograms_[name].get();
+  size_t index = FindIndex(histogram_names_, name, histogram_names_.size());
+  if (index == histogram_names_.size()) {
+    histogram_names_.push_back(name);
+    histograms_.emplace_back(
+      new Histogram(min, max, smallest_bucket, bucket_ratio));
+  }
+  return histograms_[index].get();
 }
 
 Histogram* Statistics::AddLatency(const std::string& name) {
+  return AddHistogram(name, 0, 1e12, 1.0, 1.1);
+}
+
+const Counter* Statistics::GetCounter(const std::string& name) const {
+  return GetCounter(name, counter_names_.size());
+}
+
+const Counter* Statistics::GetCounter(const std::string& name,
+                                      size_t hint) const {
+  thread_check_.Check();
+  size_t index = FindIndex(counter_names_, name, hint);
+  return index == counter_names_.size() ? nullptr : &CounterAt(index);
+}
+
+const Histogram* Statistics::GetHistogram(const std::string& name) const {
+  return GetHistogram(name, histogram_names_.size());
+}
+
+const Histogram* Statistics::GetHistogram(const std::string& name,
+                                          size_t hint) const {
   thread_check_.Check();
-  histograms_[name] = std::unique_ptr<Histogram>(
-    new Histogram(0, 1e12, 1.0, 1.1));
-  return histograms_[name].get();
+  size_t index = FindIndex(histogram_names_, name, hint);
+  return index == histogram_names_.size() ? nullptr : histograms_[index].get();
 }
 
 std::string Statistics::Report() const {
@@ -224,20 +307,18 @@ std::string Statistics::Report() const {
   size_t width = 40;
 
   // Add all counters to the report.
-  for (const auto& stat : counters_) {
-    size_t padding = width - std::min(width, stat.first.size());
-    reports.emplace_back(stat.first +
-                         ": " + std::string(padding, ' ') +
-                         stat.second->Report());
-  }
+  ForEachCounter([&](const std::string& name, const Counter& counter) {
+    size_t padding = width - std::min(width, name.size());
+    reports.emplace_back(name + ": " + std::string(padding, ' ') +
+                         counter.Report());
+  });
 
   // Add all histograms to the report.
-  for (const auto& stat : histograms_) {
-    size_t padding = width - std::min(width, stat.first.size());
-    reports.emplace_back(stat.first +
-                         ": " + std::string(padding, ' ') +
-                         stat.second->Report());
-  }
+  ForEachHistogram([&](const std::string& name, const Histogram& histogram) {
+    size_t padding = width - std::min(width, name.size());
+    reports.emplace_back(name + ": " + std::string(padding, ' ') +
+                         histogram.Report());
+  });
 
   // Sort the strings (effectively sorting by statistic name).
   std::sort(reports.begin(), reports.end());
@@ -251,57 +332,213 @@ std::string Statistics::Report() const {
   return report;
 }
 
-Statistics::Statistics(const Statistics &s) {
-  // Deep copy of statistics
-  for (auto &p : s.counters_) {
-    counters_.emplace(
-      p.first,
-      std::unique_ptr<Counter>(new Counter(*p.second.get()))
-    );
+Statistics::Statistics(const Statistics& s)
+: counter_names_(s.counter_names_)
+, histogram_names_(s.histogram_names_) {
+  // Deep copy of statistics, the source may be concurrently updated by the
+  // owning thread, but not registered to.
+  for (size_t i = 0; i < s.counter_blocks_.size(); ++i) {
+    counter_blocks_.emplace_back(new CounterBlock());
   }
-
-  for (auto &p : s.histograms_) {
-    histograms_.emplace(
-      p.first,
-      std::unique_ptr<Histogram>(new Histogram(*p.second.get()))
-    );
+  for (size_t i = 0; i < counter_names_.size(); ++i) {
+    CounterAt(i).count_.store(s.CounterAt(i).Get(), std::memory_order_relaxed);
+  }
+  for (const auto& histogram : s.histograms_) {
+    histograms_.emplace_back(new Histogram(*histogram));
   }
 }
 
 Statistics::Statistics(Statistics&& src)
-: counters_(std::move(src.counters_))
+: counter_names_(std::move(src.counter_names_))
+, counter_blocks_(std::move(src.counter_blocks_))
+, histogram_names_(std::move(src.histogram_names_))
 , histograms_(std::move(src.histograms_)) {
 }
 
 Statistics& Statistics::operator=(Statistics&& src) {
-  counters_ = std::move(src.counters_);
+  counter_names_ = std::move(src.counter_names_);
+  counter_blocks_ = std::move(src.counter_blocks_);
+  histogram_names_ = std::move(src.histogram_names_);
   histograms_ = std::move(src.histograms_);
   return *this;
 }
 
 Statistics Statistics::MoveThread() {
   Statistics stats = std::move(*this);
-  for (auto& p : stats.counters_) {
-    p.second.reset(new Counter(std::move(*p.second)));
+  stats.ResetThreadChecks();
+  return stats;
+}
+
+void Statistics::ResetThreadChecks() {
+  thread_check_.Reset();
+  for (size_t i = 0; i < counter_names_.size(); ++i) {
+    CounterAt(i).thread_check_.Reset();
   }
-  for (auto& p : stats.histograms_) {
-    p.second.reset(new Histogram(std::move(*p.second)));
+  for (auto& histogram : histograms_) {
+    histogram->thread_check_.Reset();
   }
-  return stats;
 }
 
 StatisticsWindowAggregator::StatisticsWindowAggregator(size_t window_size)
-: window_size_(window_size) {
+: next_sample_(0)
+, window_size_(window_size) {
   assert(window_size != 0);
+  samples_.reserve(window_size);
 }
 
 void StatisticsWindowAggregator::AddSample(Statistics sample) {
   aggregate_.Aggregate(sample);
-  if (samples_.size() == window_size_) {
-    aggregate_.Disaggregate(samples_.front());
-    samples_.pop_front();
+  if (samples_.size() < window_size_) {
+    samples_.emplace_back(std::move(sample));
+  } else {
+    // Replace the oldest sample.
+    aggregate_.Disaggregate(samples_[next_sample_]);
+    samples_[next_sample_] = std::move(sample);
+    next_sample_ = (next_sample_ + 1) % window_size_;
+  }
+}
+
+namespace {
+
+void AppendJSONString(std::string* out, const std::string& str) {
+  out->push_back('"');
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buffer[8];
+      snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      out->append(buffer);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+void AppendJSONNumber(std::string* out, double value) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.3lf", value);
+  out->append(buffer);
+}
+
+void AppendJSONHistogram(std::string* out,
+                         const Histogram* histogram,
+                         double seconds) {
+  uint64_t samples = histogram ? histogram->GetNumSamples() : 0;
+  out->append("{\"per_second\":");
+  AppendJSONNumber(out, seconds > 0 ? static_cast<double>(samples) / seconds
+                                    : 0.0);
+  const double percentiles[] = {0.5, 0.99, 0.999};
+  const char* names[] = {"p50", "p99", "p999"};
+  for (size_t i = 0; i < 3; ++i) {
+    out->append(",\"");
+    out->append(names[i]);
+    out->append("\":");
+    AppendJSONNumber(out, samples ? histogram->Percentile(percentiles[i]) : 0);
+  }
+  out->push_back('}');
+}
+
+}  // namespace
+
+WindowedStatistics::WindowedStatistics(size_t window_periods)
+: window_periods_(window_periods)
+, has_snapshot_(false)
+, window_(window_periods) {
+}
+
+void WindowedStatistics::AddSnapshot(
+    Statistics snapshot,
+    std::chrono::steady_clock::time_point time) {
+  if (has_snapshot_) {
+    Statistics delta(snapshot);
+    delta.Disaggregate(last_snapshot_);
+    last_period_ = Statistics(delta);
+    window_.AddSample(std::move(delta));
+    periods_.push_back(time - last_snapshot_time_);
+    if (periods_.size() > window_periods_) {
+      periods_.pop_front();
+    }
+  }
+  last_snapshot_ = std::move(snapshot);
+  last_snapshot_time_ = time;
+  has_snapshot_ = true;
+}
+
+std::string WindowedStatistics::ReportJSON() const {
+  using Seconds = std::chrono::duration<double>;
+  const double period_seconds =
+      periods_.empty() ? 0.0 : Seconds(periods_.back()).count();
+  double window_seconds = 0.0;
+  for (const auto& period : periods_) {
+    window_seconds += Seconds(period).count();
   }
-  samples_.emplace_back(std::move(sample));
+  const Statistics& window = window_.GetAggregate();
+
+  // Deltas are derived from the snapshots, so statistics are usually at the
+  // same index in all three.
+  size_t index = 0;
+
+  std::string out;
+  out.append("{\"period_seconds\":");
+  AppendJSONNumber(&out, period_seconds);
+  out.append(",\"window_seconds\":");
+  AppendJSONNumber(&out, window_seconds);
+
+  out.append(",\"counters\":{");
+  bool first = true;
+  last_snapshot_.ForEachCounter(
+      [&](const std::string& name, const Counter& counter) {
+        if (!first) {
+          out.push_back(',');
+        }
+        first = false;
+        AppendJSONString(&out, name);
+        out.append(":{\"value\":");
+        out.append(std::to_string(counter.Get()));
+        const Counter* period_counter = last_period_.GetCounter(name, index);
+        const Counter* window_counter = window.GetCounter(name, index);
+        ++index;
+        const double period_delta = static_cast<double>(
+            period_counter ? period_counter->Get() : 0);
+        const double window_delta = static_cast<double>(
+            window_counter ? window_counter->Get() : 0);
+        out.append(",\"per_second\":");
+        AppendJSONNumber(&out,
+                         period_seconds > 0 ? period_delta / period_seconds
+                                            : 0.0);
+        out.append(",\"per_minute\":");
+        AppendJSONNumber(&out,
+                         window_seconds > 0 ? window_delta * 60 / window_seconds
+                                            : 0.0);
+        out.push_back('}');
+      });
+
+  out.append("},\"histograms\":{");
+  first = true;
+  index = 0;
+  last_snapshot_.ForEachHistogram(
+      [&](const std::string& name, const Histogram&) {
+        if (!first) {
+          out.push_back(',');
+        }
+        first = false;
+        AppendJSONString(&out, name);
+        out.append(":{\"last_period\":");
+        AppendJSONHistogram(&out,
+                            last_period_.GetHistogram(name, index),
+                            period_seconds);
+        out.append(",\"window\":");
+        AppendJSONHistogram(&out,
+                            window.GetHistogram(name, index),
+                            window_seconds);
+        ++index;
+        out.push_back('}');
+      });
+  out.append("}}");
+  return out;
 }
 
 }  // namespace rocketspeed
@@ -5,20 +5,25 @@
 //
 #pragma once
 
+#include <atomic>
 #include <cassert>
-#include <list>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "src/port/port.h"
 #include "src/util/common/thread_check.h"
 
 namespace rocketspeed {
 
+class Statistics;
+
 /**
  * Simple counter.
- * Not thread safe.
+ * Only a single thread may modify the counter, but the value may be read from
+ * any thread at any time.
  */
 class Counter {
  public:
@@ -27,27 +32,28 @@ class Counter {
   }
 
   Counter(const Counter& src)
-  : count_(src.count_) {
+  : count_(src.Get()) {
   }
 
   Counter(Counter&& src) noexcept
-  : count_(src.count_) {
+  : count_(src.Get()) {
     src.thread_check_.Reset();
   }
 
   void Add(int64_t delta) {
     thread_check_.Check();
-    count_ += delta;
+    // There is a single writer, no need for an atomic read-modify-write.
+    count_.store(count_.load(std::memory_order_relaxed) + delta,
+                 std::memory_order_relaxed);
   }
 
   void Set(int64_t count) {
     thread_check_.Check();
-    count_ = count;
+    count_.store(count, std::memory_order_relaxed);
   }
 
   int64_t Get() const {
-    thread_check_.Check();
-    return count_;
+    return count_.load(std::memory_order_relaxed);
   }
 
   void Aggregate(const Counter& counter) {
@@ -69,13 +75,16 @@ class Counter {
   }
 
 private:
-  int64_t count_{0};
+  friend class Statistics;
+
+  std::atomic<int64_t> count_;
   ThreadCheck thread_check_;
 };
 
 /**
  * Histogram with log-scale buckets.
- * Not thread-safe.
+ * Only a single thread may record samples or query the histogram, but a copy
+ * may be taken from any thread at any time.
  */
 class Histogram {
  public:
@@ -95,7 +104,8 @@ class Histogram {
                      double ratio = 1.2);
 
   /**
-   * Make a copy of a histogram.
+   * Make a copy of a histogram. Number of samples of the copy is consistent
+   * with its buckets, even if the source is concurrently modified.
    */
   Histogram(const Histogram& src);
 
@@ -141,18 +151,24 @@ class Histogram {
   }
 
   uint64_t GetNumSamples() const {
+    thread_check_.Check();
     return num_samples_;
   }
 
 private:
+  friend class Statistics;
+
   size_t BucketIndex(double sample) const;
 
+  void ResetBuckets();
+
   double min_;
   double max_;
   double smallest_bucket_;
   double ratio_;
   uint64_t num_samples_;
-  std::unique_ptr<uint64_t[]> bucket_counts_;
+  // Buckets are read by concurrent copies, everything else only by the writer.
+  std::unique_ptr<std::atomic<uint64_t>[]> bucket_counts_;
   size_t num_buckets_;
   double log_ratio_;  // == log(ratio_)
   double log_smallest_bucket_;  // == log(smallest_bucket_)
@@ -162,12 +178,21 @@ private:
 /**
  * Collection of named statistics.
  *
- * Not thread-safe.
+ * Statistics are registered into flat arrays, counters owned by a collection
+ * are packed into cache-line aligned blocks, so that collections of different
+ * threads never share a cache line.
+ *
+ * Only the owning thread may register and update statistics. Once all
+ * statistics have been registered, any thread may take a snapshot of the
+ * collection at any time by copying it, without synchronising with the owner.
+ * Every statistic in the snapshot is internally consistent, but statistics
+ * may be captured at slightly different points in time.
  */
 class Statistics {
  public:
   Statistics() {}
 
+  /** Takes a snapshot, may be called from any thread. */
   Statistics(const Statistics& s);
   Statistics(Statistics&& src) /* may throw */;
   Statistics& operator=(Statistics&& src);
@@ -177,13 +202,21 @@ class Statistics {
    */
   Statistics MoveThread();
 
+  /**
+   * Moves ownership of the statistics to the current thread in place, without
+   * moving the containers, so snapshots may be taken concurrently.
+   */
+  void ResetThreadChecks();
+
   /**
    * Adds a new, named Counter object to the tracked statistics.
+   * Returns the existing counter if one with the same name was already added.
    */
   Counter* AddCounter(const std::string& name);
 
   /**
    * Adds a new, named Histogram object to the tracked statistics.
+   * Returns the existing histogram if one with the same name was already added.
    */
   Histogram* AddHistogram(const std::string& name,
                           double min,
@@ -205,6 +238,7 @@ class Statistics {
   /**
    * Adds another set of statistics to this statistic.
    * Statistics with the same name should have the same parameters.
+   * The other set is read as a snapshot, it may be owned by another thread.
    */
   void Aggregate(const Statistics& stats);
 
@@ -214,79 +248,86 @@ class Statistics {
    */
   void Disaggregate(const Statistics& stats);
 
-  const std::unordered_map<std::string, std::unique_ptr<Counter>>&
-    GetCounters() const {
+  /** Returns counter with given name or null if there is none. */
+  const Counter* GetCounter(const std::string& name) const;
+
+  /**
+   * Like GetCounter, but looks at the index hint first, which is where the
+   * counter is in statistics derived from ones registered in the same order.
+   */
+  const Counter* GetCounter(const std::string& name, size_t hint) const;
+
+  /** Returns histogram with given name or null if there is none. */
+  const Histogram* GetHistogram(const std::string& name) const;
+
+  /** Like GetHistogram, with an index hint. */
+  const Histogram* GetHistogram(const std::string& name, size_t hint) const;
+
+  /** Invokes visitor(name, counter) for each counter. */
+  template <typename Visitor>
+  void ForEachCounter(Visitor&& visitor) const {
     thread_check_.Check();
-    return counters_;
+    for (size_t i = 0; i < counter_names_.size(); ++i) {
+      const Counter& counter = CounterAt(i);
+      visitor(counter_names_[i], counter);
+    }
   }
 
-  const std::unordered_map<std::string, std::unique_ptr<Histogram>>&
-    GetHistograms() const {
+  /** Invokes visitor(name, histogram) for each histogram. */
+  template <typename Visitor>
+  void ForEachHistogram(Visitor&& visitor) const {
     thread_check_.Check();
-    return histograms_;
+    for (size_t i = 0; i < histogram_names_.size(); ++i) {
+      visitor(histogram_names_[i], *histograms_[i]);
+    }
   }
 
   int64_t GetCounterValue(const std::string& name) const {
-    thread_check_.Check();
-    auto it = counters_.find(name);
-    if (it == counters_.end()) {
-      return 0;
-    }
-    return it->second->Get();
+    const Counter* counter = GetCounter(name);
+    return counter ? counter->Get() : 0;
   }
 
  private:
-  // Aggregates one set of statistics into another.
-  template <typename T>
-  static void AggregateOne(
-    std::unordered_map<std::string, std::unique_ptr<T>>* dst,
-    const std::unordered_map<std::string, std::unique_ptr<T>>& src);
+  /** Number of counters in a block, which spans whole cache lines. */
+  static constexpr size_t kCountersPerBlock = 32;
 
-  // Disaggregates one set of statistics into another.
-  template <typename T>
-  static void DisaggregateOne(
-    std::unordered_map<std::string, std::unique_ptr<T>>* dst,
-    const std::unordered_map<std::string, std::unique_ptr<T>>& src);
+  struct alignas(CACHE_LINE_SIZE) CounterBlock {
+    Counter counters[kCountersPerBlock];
+
+    // Plain new does not honour extended alignment before C++17.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+  };
+
+  Counter& CounterAt(size_t index) const {
+    return counter_blocks_[index / kCountersPerBlock]
+        ->counters[index % kCountersPerBlock];
+  }
+
+  /**
+   * Finds index of a statistic by name, starting at the hint, which is where
+   * it usually is when both sets of statistics were registered in the same
+   * order. Returns names.size() if not found.
+   */
+  static size_t FindIndex(const std::vector<std::string>& names,
+                          const std::string& name,
+                          size_t hint);
 
-  // Maps of counter/histogram names to those objects.
-  std::unordered_map<std::string, std::unique_ptr<Counter>> counters_;
-  std::unordered_map<std::string, std::unique_ptr<Histogram>> histograms_;
+  // Names of counters and histograms, index of a name is index of statistic.
+  std::vector<std::string> counter_names_;
+  std::vector<std::unique_ptr<CounterBlock>> counter_blocks_;
+  std::vector<std::string> histogram_names_;
+  std::vector<std::unique_ptr<Histogram>> histograms_;
 
   ThreadCheck thread_check_;
 };
 
-template <typename T>
-void Statistics::AggregateOne(
-  std::unordered_map<std::string, std::unique_ptr<T>>* dst,
-  const std::unordered_map<std::string, std::unique_ptr<T>>& src) {
-  for (const auto& stat : src) {
-    const std::string& name = stat.first;
-    auto it = dst->find(name);
-    if (it == dst->end()) {
-      // Stat with this name doesn't exist, so add a copy.
-      (*dst)[name] = std::unique_ptr<T>(new T(*stat.second.get()));
-    } else {
-      // Stat already exists, so call Aggregate.
-      it->second->Aggregate(*stat.second);
-    }
-  }
-}
-
-template <typename T>
-void Statistics::DisaggregateOne(
-  std::unordered_map<std::string, std::unique_ptr<T>>* dst,
-  const std::unordered_map<std::string, std::unique_ptr<T>>& src) {
-  for (const auto& stat : src) {
-    const std::string& name = stat.first;
-    auto it = dst->find(name);
-    assert(it != dst->end());
-    it->second->Disaggregate(*stat.second);
-  }
-}
-
 /**
  * Aggregates regular statistics samples within a sliding window with a fixed
  * number of samples.
+ *
+ * Samples are kept in a ring buffer, and the aggregate is maintained
+ * incrementally, so adding a sample costs as much as aggregating two samples.
  */
 class StatisticsWindowAggregator {
  public:
@@ -303,10 +344,70 @@ class StatisticsWindowAggregator {
     return aggregate_;
   }
 
+  /** Number of samples in the window, at most the window size. */
+  size_t GetNumSamples() const {
+    return samples_.size();
+  }
+
  private:
   Statistics aggregate_;
-  std::list<Statistics> samples_;
+  std::vector<Statistics> samples_;
+  size_t next_sample_;
   size_t window_size_;
 };
 
+/**
+ * Maintains rates and percentiles of statistics over the last period and
+ * over a sliding window of periods.
+ *
+ * It is fed with snapshots of cumulative statistics, taken once per period
+ * by a thread which is not on the hot path. Only deltas between consecutive
+ * snapshots are kept.
+ */
+class WindowedStatistics {
+ public:
+  /**
+   * @param window_periods Number of periods in the sliding window.
+   */
+  explicit WindowedStatistics(size_t window_periods);
+
+  /**
+   * Adds a snapshot of cumulative statistics. The period since the last
+   * snapshot is measured, so late or skipped snapshots do not skew rates.
+   *
+   * @param snapshot Cumulative statistics.
+   * @param time When the snapshot was taken.
+   */
+  void AddSnapshot(Statistics snapshot,
+                   std::chrono::steady_clock::time_point time);
+
+  /** Changes in statistics during the last period. */
+  const Statistics& GetLastPeriod() const {
+    return last_period_;
+  }
+
+  /** Changes in statistics during the window. */
+  const Statistics& GetWindow() const {
+    return window_.GetAggregate();
+  }
+
+  /**
+   * Reports, as a single line of JSON, current values, per-second and
+   * per-minute rates of counters, and sample rates and p50, p99 and p999 of
+   * histograms over the last period and the window.
+   */
+  std::string ReportJSON() const;
+
+ private:
+  const size_t window_periods_;
+  /** Cumulative statistics of the last snapshot. */
+  Statistics last_snapshot_;
+  bool has_snapshot_;
+  std::chrono::steady_clock::time_point last_snapshot_time_;
+  /** Measured durations of the periods in the window, oldest first. */
+  std::deque<std::chrono::steady_clock::duration> periods_;
+  Statistics last_period_;
+  StatisticsWindowAggregator window_;
+};
+
 }  // namespace rocketspeed
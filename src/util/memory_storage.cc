@@ -0,0 +1,674 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#define __STDC_FORMAT_MACROS
+#include "src/util/memory_storage.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include "include/Logger.h"
+
+namespace rocketspeed {
+
+namespace {
+
+// Interval for redelivering records and gaps refused by the callbacks.
+const std::chrono::milliseconds kRetryInterval(1);
+
+// Maximum number of records and gaps read out of a log at once.
+const size_t kReadBatchSize = 256;
+
+uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+/**
+ * Fixed size block of records and gaps of one log. Chunks are reference
+ * counted, the log holds one reference and each record read from it another,
+ * so payloads stay valid after the chunk has fallen out of retention.
+ */
+class MemoryLogStorage::Chunk {
+ public:
+  struct Entry {
+    SequenceNumber seqno;   // first sequence number
+    uint64_t length;        // sequence numbers spanned, 1 for records
+    uint64_t timestamp;     // microseconds since epoch
+    size_t offset;          // payload offset in data
+    size_t size;            // payload size
+    bool is_gap;
+    GapType gap_type;
+  };
+
+  explicit Chunk(size_t size)
+  : data(new char[size])
+  , capacity(size) {}
+
+  bool HasRoom(size_t size) const {
+    return used + size <= capacity;
+  }
+
+  SequenceNumber FirstSeqno() const {
+    return entries.front().seqno;
+  }
+
+  void Ref() {
+    refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static void Unref(void* ptr) {
+    Chunk* chunk = static_cast<Chunk*>(ptr);
+    if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete chunk;
+    }
+  }
+
+  std::vector<Entry> entries;
+  std::unique_ptr<char[]> data;
+  const size_t capacity;
+  size_t used = 0;
+  std::atomic<int> refs{1};
+};
+
+/**
+ * State of one log. All members are protected by the mutex.
+ */
+struct MemoryLogStorage::Log {
+  explicit Log(const Options& opts) : options(opts) {}
+
+  ~Log() {
+    for (Chunk* chunk : chunks) {
+      Chunk::Unref(chunk);
+    }
+    if (spare) {
+      Chunk::Unref(spare);
+    }
+  }
+
+  // Adds an entry spanning length sequence numbers with room for size bytes
+  // of payload, returns it with the payload left to fill in.
+  Chunk::Entry* Add(size_t size, uint64_t length, Chunk** chunk_out) {
+    Chunk* chunk = chunks.empty() ? nullptr : chunks.back();
+    if (!chunk || !chunk->HasRoom(size)) {
+      chunk = NewChunk(std::max(options.chunk_size, size));
+    }
+    Chunk::Entry entry;
+    entry.seqno = next_seqno;
+    entry.length = length;
+    entry.timestamp = last_timestamp = std::max(last_timestamp, NowMicros());
+    entry.offset = chunk->used;
+    entry.size = size;
+    entry.is_gap = false;
+    entry.gap_type = kBenign;
+    chunk->entries.push_back(entry);
+    chunk->used += size;
+    next_seqno += length;
+    *chunk_out = chunk;
+    return &chunk->entries.back();
+  }
+
+  SequenceNumber Append(const Slice& data) {
+    Chunk* chunk;
+    Chunk::Entry* entry = Add(data.size(), 1, &chunk);
+    memcpy(chunk->data.get() + entry->offset, data.data(), data.size());
+    const SequenceNumber seqno = entry->seqno;
+    ApplyRetention();
+    return seqno;
+  }
+
+  SequenceNumber AppendGap(GapType type, uint64_t length) {
+    Chunk* chunk;
+    Chunk::Entry* entry = Add(0, length, &chunk);
+    entry->is_gap = true;
+    entry->gap_type = type;
+    const SequenceNumber seqno = entry->seqno;
+    ApplyRetention();
+    return seqno;
+  }
+
+  void Trim(SequenceNumber seqno) {
+    trim_point = std::max(trim_point, std::min(seqno, next_seqno - 1));
+    // Drop chunks that are trimmed entirely.
+    while (!chunks.empty() && LastSeqno(0) <= trim_point) {
+      DropFront();
+    }
+  }
+
+  // Returns the first sequence number with a timestamp at or after the one
+  // given, or the next sequence number if there is none.
+  SequenceNumber FindTime(uint64_t timestamp) const {
+    auto chunk_it = std::lower_bound(chunks.begin(), chunks.end(), timestamp,
+      [] (const Chunk* chunk, uint64_t t) {
+        return chunk->entries.back().timestamp < t;
+      });
+    if (chunk_it == chunks.end()) {
+      return next_seqno;
+    }
+    const std::vector<Chunk::Entry>& entries = (*chunk_it)->entries;
+    auto entry_it = std::lower_bound(entries.begin(), entries.end(), timestamp,
+      [] (const Chunk::Entry& entry, uint64_t t) {
+        return entry.timestamp < t;
+      });
+    return std::max(entry_it->seqno, trim_point + 1);
+  }
+
+  // Reads up to max records and gaps in [from, until].
+  void Read(LogID id,
+            SequenceNumber from,
+            SequenceNumber until,
+            size_t max,
+            std::vector<Item>* items) {
+    if (from <= trim_point) {
+      items->emplace_back();
+      Item& item = items->back();
+      item.is_gap = true;
+      item.gap = GapRecord { kRetention, id, from, std::min(until, trim_point) };
+      return;
+    }
+    if (from >= next_seqno || chunks.empty()) {
+      return;
+    }
+
+    // Find the entry containing from.
+    auto chunk_it = std::upper_bound(chunks.begin(), chunks.end(), from,
+      [] (SequenceNumber seqno, const Chunk* chunk) {
+        return seqno < chunk->FirstSeqno();
+      });
+    assert(chunk_it != chunks.begin());
+    --chunk_it;
+    const std::vector<Chunk::Entry>& first = (*chunk_it)->entries;
+    size_t index = std::upper_bound(first.begin(), first.end(), from,
+      [] (SequenceNumber seqno, const Chunk::Entry& entry) {
+        return seqno < entry.seqno;
+      }) - first.begin() - 1;
+
+    for (; chunk_it != chunks.end(); ++chunk_it, index = 0) {
+      Chunk* chunk = *chunk_it;
+      for (; index < chunk->entries.size(); ++index) {
+        const Chunk::Entry& entry = chunk->entries[index];
+        if (entry.seqno > until || items->size() == max) {
+          return;
+        }
+        items->emplace_back();
+        Item& item = items->back();
+        item.is_gap = entry.is_gap;
+        if (entry.is_gap) {
+          item.gap = GapRecord {
+            entry.gap_type,
+            id,
+            std::max(from, entry.seqno),
+            std::min(until, entry.seqno + entry.length - 1)
+          };
+        } else {
+          chunk->Ref();
+          item.record.log_id = id;
+          item.record.payload = Slice(chunk->data.get() + entry.offset,
+                                      entry.size);
+          item.record.seqno = entry.seqno;
+          item.record.timestamp = std::chrono::microseconds(entry.timestamp);
+          item.record.context =
+            std::unique_ptr<void, void(*)(void*)>(chunk, &Chunk::Unref);
+        }
+      }
+    }
+  }
+
+  void WakeReaders(LogID id) {
+    for (MemoryLogReader* reader : readers) {
+      reader->Wake(id);
+    }
+  }
+
+  const Options& options;
+  std::mutex mutex;
+  std::deque<Chunk*> chunks;
+  // Dropped chunk kept for reuse, so that a log at its retention limit does
+  // not allocate.
+  Chunk* spare = nullptr;
+  SequenceNumber next_seqno = 1;
+  // Highest sequence number that is not available anymore.
+  SequenceNumber trim_point = 0;
+  uint64_t last_timestamp = 0;
+  std::vector<MemoryLogReader*> readers;
+
+ private:
+  // Last sequence number in chunks[i].
+  SequenceNumber LastSeqno(size_t i) const {
+    return i + 1 < chunks.size() ? chunks[i + 1]->FirstSeqno() - 1
+                                 : next_seqno - 1;
+  }
+
+  Chunk* NewChunk(size_t capacity) {
+    Chunk* chunk;
+    if (spare && spare->capacity == capacity) {
+      chunk = spare;
+      spare = nullptr;
+    } else {
+      chunk = new Chunk(capacity);
+    }
+    chunks.push_back(chunk);
+    return chunk;
+  }
+
+  void DropFront() {
+    Chunk* chunk = chunks.front();
+    trim_point = std::max(trim_point, LastSeqno(0));
+    chunks.pop_front();
+    // Readers only take references with the mutex held, so a chunk that is
+    // not referenced now can be reused.
+    if (!spare &&
+        chunk->capacity == options.chunk_size &&
+        chunk->refs.load(std::memory_order_acquire) == 1) {
+      chunk->entries.clear();
+      chunk->used = 0;
+      spare = chunk;
+    } else {
+      Chunk::Unref(chunk);
+    }
+  }
+
+  void ApplyRetention() {
+    if (options.retention == 0) {
+      return;
+    }
+    while (chunks.size() > 1 &&
+           next_seqno - chunks[1]->FirstSeqno() >= options.retention) {
+      DropFront();
+    }
+  }
+};
+
+Status MemoryLogStorage::Create(Options options,
+                                std::shared_ptr<Logger> info_log,
+                                MemoryLogStorage** storage) {
+  if (options.chunk_size == 0) {
+    return Status::InvalidArgument("Chunk size must be positive");
+  }
+  if (options.append_latency.count() < 0) {
+    return Status::InvalidArgument("Append latency must not be negative");
+  }
+  if (options.find_time_latency.count() < 0) {
+    return Status::InvalidArgument("Find time latency must not be negative");
+  }
+  *storage = new MemoryLogStorage(options, std::move(info_log));
+  return Status::OK();
+}
+
+MemoryLogStorage::MemoryLogStorage(Options options,
+                                   std::shared_ptr<Logger> info_log)
+: options_(options)
+, info_log_(std::move(info_log)) {
+  if (options_.append_latency.count() > 0 ||
+      options_.find_time_latency.count() > 0) {
+    delayed_thread_ = std::thread([this] { DelayedLoop(); });
+  }
+  LOG_INFO(info_log_,
+    "Created MemoryLogStorage with chunk size %zu, retention %" PRIu64
+    ", append latency %" PRIi64 "us, find time latency %" PRIi64 "us",
+    options_.chunk_size,
+    options_.retention,
+    static_cast<int64_t>(options_.append_latency.count()),
+    static_cast<int64_t>(options_.find_time_latency.count()));
+}
+
+MemoryLogStorage::~MemoryLogStorage() {
+  if (delayed_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(delayed_mutex_);
+      stop_ = true;
+    }
+    delayed_cv_.notify_one();
+    delayed_thread_.join();
+  }
+}
+
+MemoryLogStorage::Log* MemoryLogStorage::GetLog(LogID id) {
+  std::lock_guard<std::mutex> lock(logs_mutex_);
+  std::unique_ptr<Log>& log = logs_[id];
+  if (!log) {
+    log.reset(new Log(options_));
+  }
+  return log.get();
+}
+
+Status MemoryLogStorage::AppendAsync(LogID id,
+                                     const Slice& data,
+                                     AppendCallback callback) {
+  if (options_.append_latency.count() > 0) {
+    Delay(options_.append_latency,
+      [this, id, data, callback] (Status status) {
+        if (status.ok()) {
+          AppendNow(id, data, callback);
+        } else {
+          callback(status, 0);
+        }
+      });
+    return Status::OK();
+  }
+  AppendNow(id, data, callback);
+  return Status::OK();
+}
+
+void MemoryLogStorage::AppendNow(LogID id,
+                                 const Slice& data,
+                                 const AppendCallback& callback) {
+  Log* log = GetLog(id);
+  SequenceNumber seqno;
+  {
+    std::lock_guard<std::mutex> lock(log->mutex);
+    seqno = log->Append(data);
+    log->WakeReaders(id);
+  }
+  callback(Status::OK(), seqno);
+}
+
+void MemoryLogStorage::Delay(std::chrono::microseconds latency,
+                             std::function<void(Status)> operation) {
+  const auto due = std::chrono::steady_clock::now() + latency;
+  bool first;
+  {
+    std::lock_guard<std::mutex> lock(delayed_mutex_);
+    auto it = delayed_.emplace(due, std::move(operation));
+    first = it == delayed_.begin();
+  }
+  if (first) {
+    delayed_cv_.notify_one();
+  }
+}
+
+void MemoryLogStorage::DelayedLoop() {
+  std::vector<std::function<void(Status)>> due;
+  std::unique_lock<std::mutex> lock(delayed_mutex_);
+  while (!stop_) {
+    if (delayed_.empty()) {
+      delayed_cv_.wait(lock);
+      continue;
+    }
+    auto now = std::chrono::steady_clock::now();
+    const auto next_due = delayed_.begin()->first;
+    if (next_due > now) {
+      delayed_cv_.wait_until(lock, next_due);
+      continue;
+    }
+    while (!delayed_.empty() && delayed_.begin()->first <= now) {
+      due.emplace_back(std::move(delayed_.begin()->second));
+      delayed_.erase(delayed_.begin());
+    }
+    lock.unlock();
+    for (auto& operation : due) {
+      operation(Status::OK());
+    }
+    due.clear();
+    lock.lock();
+  }
+
+  // Operations that were not due yet are failed.
+  decltype(delayed_) remaining;
+  remaining.swap(delayed_);
+  lock.unlock();
+  for (auto& entry : remaining) {
+    entry.second(Status::IOError("Log storage closed"));
+  }
+}
+
+Status MemoryLogStorage::FindTimeAsync(
+    LogID id,
+    std::chrono::milliseconds timestamp,
+    std::function<void(Status, SequenceNumber)> callback) {
+  if (options_.find_time_latency.count() > 0) {
+    Delay(options_.find_time_latency,
+      [this, id, timestamp, callback] (Status status) {
+        if (status.ok()) {
+          FindTimeNow(id, timestamp, callback);
+        } else {
+          callback(status, 0);
+        }
+      });
+    return Status::OK();
+  }
+  FindTimeNow(id, timestamp, callback);
+  return Status::OK();
+}
+
+void MemoryLogStorage::FindTimeNow(
+    LogID id,
+    std::chrono::milliseconds timestamp,
+    const std::function<void(Status, SequenceNumber)>& callback) {
+  Log* log = GetLog(id);
+  SequenceNumber seqno;
+  {
+    std::lock_guard<std::mutex> lock(log->mutex);
+    const int64_t max_millis = std::numeric_limits<int64_t>::max() / 1000;
+    if (timestamp.count() >= max_millis) {
+      seqno = log->next_seqno;
+    } else if (timestamp.count() <= 0) {
+      seqno = log->FindTime(0);
+    } else {
+      seqno = log->FindTime(static_cast<uint64_t>(timestamp.count()) * 1000);
+    }
+  }
+  callback(Status::OK(), seqno);
+}
+
+Status MemoryLogStorage::CreateAsyncReaders(
+    unsigned int parallelism,
+    std::function<bool(LogRecord&)> record_cb,
+    std::function<bool(const GapRecord&)> gap_cb,
+    std::vector<AsyncLogReader*>* readers) {
+  for (unsigned int i = 0; i < parallelism; ++i) {
+    readers->push_back(new MemoryLogReader(this, record_cb, gap_cb));
+  }
+  return Status::OK();
+}
+
+Status MemoryLogStorage::Trim(LogID id, SequenceNumber seqno) {
+  Log* log = GetLog(id);
+  std::lock_guard<std::mutex> lock(log->mutex);
+  log->Trim(seqno);
+  log->WakeReaders(id);
+  return Status::OK();
+}
+
+Status MemoryLogStorage::InjectGap(LogID id,
+                                   GapType type,
+                                   uint64_t length,
+                                   SequenceNumber* first) {
+  if (type != kBenign && type != kDataLoss) {
+    return Status::InvalidArgument("Only benign and data loss gaps");
+  }
+  if (length == 0) {
+    return Status::InvalidArgument("Gap must not be empty");
+  }
+  Log* log = GetLog(id);
+  std::lock_guard<std::mutex> lock(log->mutex);
+  SequenceNumber seqno = log->AppendGap(type, length);
+  log->WakeReaders(id);
+  if (first) {
+    *first = seqno;
+  }
+  return Status::OK();
+}
+
+MemoryLogReader::MemoryLogReader(MemoryLogStorage* storage,
+                                 std::function<bool(LogRecord&)> record_cb,
+                                 std::function<bool(const GapRecord&)> gap_cb)
+: storage_(storage)
+, record_cb_(std::move(record_cb))
+, gap_cb_(std::move(gap_cb)) {
+  thread_ = std::thread([this] {
+    std::unordered_set<LogID> logs;
+    std::unordered_set<LogID> retry;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        auto ready = [this] { return stop_ || signalled_; };
+        if (retry.empty()) {
+          wake_cv_.wait(lock, ready);
+        } else {
+          wake_cv_.wait_for(lock, kRetryInterval, ready);
+        }
+        if (stop_) {
+          break;
+        }
+        logs.swap(woken_);
+        signalled_ = false;
+      }
+      logs.insert(retry.begin(), retry.end());
+      retry.clear();
+      for (LogID id : logs) {
+        if (ReadLog(id)) {
+          retry.insert(id);
+        }
+      }
+      logs.clear();
+    }
+  });
+}
+
+MemoryLogReader::~MemoryLogReader() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stop_ = true;
+  }
+  wake_cv_.notify_one();
+  thread_.join();
+  for (auto& entry : logs_) {
+    MemoryLogStorage::Log* log = entry.second.log;
+    std::lock_guard<std::mutex> lock(log->mutex);
+    log->readers.erase(
+      std::find(log->readers.begin(), log->readers.end(), this));
+  }
+}
+
+Status MemoryLogReader::Open(LogID id,
+                             SequenceNumber startPoint,
+                             SequenceNumber endPoint) {
+  MemoryLogStorage::Log* log = storage_->GetLog(id);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = logs_.emplace(id, ReadState());
+    ReadState& state = result.first->second;
+    // Sequence numbers start at 1, so there is nothing to read at 0.
+    state.log = log;
+    state.from = std::max<SequenceNumber>(startPoint, 1);
+    state.until = endPoint;
+    state.generation = ++next_generation_;
+    state.pending.reset();
+    if (result.second) {
+      std::lock_guard<std::mutex> log_lock(log->mutex);
+      log->readers.push_back(this);
+    }
+  }
+  // Records may already be there.
+  Wake(id);
+  return Status::OK();
+}
+
+Status MemoryLogReader::Close(LogID id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = logs_.find(id);
+  if (it != logs_.end()) {
+    MemoryLogStorage::Log* log = it->second.log;
+    {
+      std::lock_guard<std::mutex> log_lock(log->mutex);
+      log->readers.erase(
+        std::find(log->readers.begin(), log->readers.end(), this));
+    }
+    logs_.erase(it);
+  }
+  return Status::OK();
+}
+
+void MemoryLogReader::Wake(LogID id) {
+  std::lock_guard<std::mutex> lock(wake_mutex_);
+  woken_.insert(id);
+  if (!signalled_) {
+    signalled_ = true;
+    wake_cv_.notify_one();
+  }
+}
+
+bool MemoryLogReader::Deliver(MemoryLogStorage::Item& item) {
+  if (item.is_gap) {
+    return !gap_cb_ || gap_cb_(item.gap);
+  }
+  return record_cb_(item.record);
+}
+
+bool MemoryLogReader::ReadLog(LogID id) {
+  MemoryLogStorage::Log* log;
+  SequenceNumber from;
+  SequenceNumber until;
+  uint64_t generation;
+  std::unique_ptr<MemoryLogStorage::Item> pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = logs_.find(id);
+    if (it == logs_.end()) {
+      return false;
+    }
+    log = it->second.log;
+    from = it->second.from;
+    until = it->second.until;
+    generation = it->second.generation;
+    pending = std::move(it->second.pending);
+  }
+
+  auto next = [] (const MemoryLogStorage::Item& item) {
+    return item.is_gap ? item.gap.to + 1 : item.record.seqno + 1;
+  };
+
+  // Deliver one batch of records and gaps, or a refused one.
+  bool refused = false;
+  bool more = false;
+  if (pending) {
+    if (Deliver(*pending)) {
+      from = next(*pending);
+      pending.reset();
+      more = true;
+    } else {
+      refused = true;
+    }
+  } else if (from <= until) {
+    {
+      std::lock_guard<std::mutex> lock(log->mutex);
+      log->Read(id, from, until, kReadBatchSize, &items_);
+    }
+    for (MemoryLogStorage::Item& item : items_) {
+      if (!Deliver(item)) {
+        // Callback must leave the record alone if it refused it.
+        pending.reset(new MemoryLogStorage::Item(std::move(item)));
+        refused = true;
+        break;
+      }
+      from = next(item);
+    }
+    more = !refused && !items_.empty();
+    // Releases the chunks of records that the callback did not take.
+    items_.clear();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = logs_.find(id);
+    if (it == logs_.end() || it->second.generation != generation) {
+      // Reading was stopped or restarted meanwhile.
+      return false;
+    }
+    it->second.from = from;
+    it->second.pending = std::move(pending);
+  }
+  if (more) {
+    // Come back for the rest after other logs had their turn.
+    Wake(id);
+  }
+  return refused;
+}
+
+}  // namespace rocketspeed
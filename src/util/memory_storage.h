@@ -0,0 +1,226 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "src/util/storage.h"
+
+namespace rocketspeed {
+
+class Logger;
+class MemoryLogReader;
+
+/**
+ * Log storage that keeps all logs in process memory. Records are copied into
+ * fixed size chunks, which are shared with the records handed to readers, so
+ * reading does not copy or allocate. Meant for tests and benchmarks that need
+ * deterministic behaviour, injected gaps and high throughput.
+ *
+ * Sequence numbers of each log start at 1.
+ */
+class MemoryLogStorage : public LogStorage {
+ public:
+  struct Options {
+    // Bytes of payload per chunk. Larger records get a chunk of their own.
+    size_t chunk_size = 1 << 20;
+
+    // Minimum number of sequence numbers retained per log. Older chunks are
+    // dropped once the rest of the log holds that many, and read as
+    // retention gaps. 0 retains everything.
+    uint64_t retention = 0;
+
+    // Time after an append until it is visible to readers and the callback
+    // is invoked. With no latency, callbacks are invoked before AppendAsync
+    // returns.
+    std::chrono::microseconds append_latency{0};
+
+    // Time until the callback of FindTimeAsync is invoked. With no latency,
+    // callbacks are invoked before FindTimeAsync returns.
+    std::chrono::microseconds find_time_latency{0};
+  };
+
+  /**
+   * Constructs a MemoryLogStorage.
+   *
+   * @param options Storage options.
+   * @param info_log For logging.
+   * @param storage Output parameter for the constructed storage.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  static Status Create(Options options,
+                       std::shared_ptr<Logger> info_log,
+                       MemoryLogStorage** storage);
+
+  ~MemoryLogStorage() final;
+
+  Status AppendAsync(LogID id,
+                     const Slice& data,
+                     AppendCallback callback) final;
+
+  Status FindTimeAsync(LogID id,
+                       std::chrono::milliseconds timestamp,
+                       std::function<void(Status, SequenceNumber)> callback)
+    final;
+
+  Status CreateAsyncReaders(
+    unsigned int parallelism,
+    std::function<bool(LogRecord&)> record_cb,
+    std::function<bool(const GapRecord&)> gap_cb,
+    std::vector<AsyncLogReader*>* readers) final;
+
+  bool CanSubscribePastEnd() const final {
+    return true;
+  }
+
+  /**
+   * Drops all records up to and including seqno. Readers behind that point
+   * receive a retention gap.
+   */
+  Status Trim(LogID id, SequenceNumber seqno);
+
+  /**
+   * Appends a gap of the given length to the log, which readers receive
+   * instead of records. Only kBenign and kDataLoss gaps can be injected,
+   * retention gaps follow from Trim and Options::retention.
+   *
+   * @param id ID of the log.
+   * @param type Type of the gap.
+   * @param length Number of sequence numbers that the gap spans.
+   * @param first Output for the first sequence number of the gap, optional.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  Status InjectGap(LogID id,
+                   GapType type,
+                   uint64_t length,
+                   SequenceNumber* first = nullptr);
+
+ private:
+  friend class MemoryLogReader;
+
+  class Chunk;
+  struct Log;
+
+  // Record or gap returned by Log::Read.
+  struct Item {
+    bool is_gap;
+    LogRecord record;
+    GapRecord gap;
+  };
+
+  MemoryLogStorage(Options options, std::shared_ptr<Logger> info_log);
+
+  // Returns the log, creating it if necessary.
+  Log* GetLog(LogID id);
+
+  // Schedules an operation to run once the latency has passed. The operation
+  // is invoked with OK, or with an error if the storage is closed first.
+  void Delay(std::chrono::microseconds latency,
+             std::function<void(Status)> operation);
+
+  // Runs delayed operations once they are due.
+  void DelayedLoop();
+
+  // Appends data and invokes the callback, without latency.
+  void AppendNow(LogID id, const Slice& data, const AppendCallback& callback);
+
+  // Finds the seqno for timestamp and invokes the callback, without latency.
+  void FindTimeNow(LogID id,
+                   std::chrono::milliseconds timestamp,
+                   const std::function<void(Status, SequenceNumber)>& callback);
+
+  const Options options_;
+  std::shared_ptr<Logger> info_log_;
+
+  // Logs are never removed, so Log pointers are stable.
+  std::mutex logs_mutex_;
+  std::unordered_map<LogID, std::unique_ptr<Log>> logs_;
+
+  // Operations waiting for the injected latency, keyed by due time.
+  std::mutex delayed_mutex_;
+  std::condition_variable delayed_cv_;
+  std::multimap<std::chrono::steady_clock::time_point,
+                std::function<void(Status)>> delayed_;
+  bool stop_ = false;
+  std::thread delayed_thread_;
+};
+
+/**
+ * Reader of a MemoryLogStorage, delivering records and gaps of the open logs
+ * on its own thread.
+ */
+class MemoryLogReader : public AsyncLogReader {
+ public:
+  MemoryLogReader(MemoryLogStorage* storage,
+                  std::function<bool(LogRecord&)> record_cb,
+                  std::function<bool(const GapRecord&)> gap_cb);
+
+  ~MemoryLogReader() final;
+
+  Status Open(LogID id,
+              SequenceNumber startPoint,
+              SequenceNumber endPoint) final;
+
+  Status Close(LogID id) final;
+
+  /**
+   * Called by the storage after appends to or trims of an open log.
+   * Thread safe.
+   */
+  void Wake(LogID id);
+
+ private:
+  // Range of a log to read. The generation changes when reading is
+  // restarted, so that stale progress is discarded.
+  struct ReadState {
+    MemoryLogStorage::Log* log;
+    SequenceNumber from;
+    SequenceNumber until;
+    uint64_t generation;
+    // Record or gap that a callback refused, to be redelivered.
+    std::unique_ptr<MemoryLogStorage::Item> pending;
+  };
+
+  // Delivers available records and gaps of a log. Returns true if a callback
+  // refused one, and it should be retried later.
+  bool ReadLog(LogID id);
+
+  // Delivers a record or gap, returns false if refused.
+  bool Deliver(MemoryLogStorage::Item& item);
+
+  MemoryLogStorage* storage_;
+  std::function<bool(LogRecord&)> record_cb_;
+  std::function<bool(const GapRecord&)> gap_cb_;
+
+  // Logs currently read from.
+  std::mutex mutex_;
+  std::unordered_map<LogID, ReadState> logs_;
+  uint64_t next_generation_ = 0;
+
+  // Logs with new records since the reader thread last looked.
+  std::mutex wake_mutex_;
+  std::condition_variable wake_cv_;
+  std::unordered_set<LogID> woken_;
+  bool signalled_ = false;
+  bool stop_ = false;
+
+  // Reused between reads.
+  std::vector<MemoryLogStorage::Item> items_;
+
+  std::thread thread_;
+};
+
+}  // namespace rocketspeed
@@ -0,0 +1,505 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "include/RocketSpeed.h"
+#include "src/port/port.h"
+#include "src/test/test_cluster.h"
+#include "src/util/common/guid_generator.h"
+#include "src/util/memory_storage.h"
+#include "src/util/testharness.h"
+
+namespace rocketspeed {
+
+class MemoryStorageTest {
+ public:
+  MemoryStorageTest()
+  : timeout(5)
+  , env_(Env::Default()) {
+    ASSERT_OK(test::CreateLogger(env_, "MemoryStorageTest", &info_log_));
+  }
+
+  // Records and gaps received by a reader.
+  struct Received {
+    std::mutex mutex;
+    std::vector<LogRecord> records;
+    std::vector<GapRecord> gaps;
+    SequenceNumber next = 0;
+    port::Semaphore sem;
+  };
+
+  std::unique_ptr<MemoryLogStorage> MakeStorage(
+      MemoryLogStorage::Options options = MemoryLogStorage::Options()) {
+    MemoryLogStorage* storage = nullptr;
+    ASSERT_OK(MemoryLogStorage::Create(options, info_log_, &storage));
+    return std::unique_ptr<MemoryLogStorage>(storage);
+  }
+
+  // Creates a reader that keeps everything it reads in received.
+  // If refuse is set, every other record and gap is refused.
+  std::unique_ptr<AsyncLogReader> MakeReader(MemoryLogStorage* storage,
+                                             Received* received,
+                                             bool refuse = false) {
+    auto toggle = std::make_shared<bool>(false);
+    auto record_cb = [received, refuse, toggle] (LogRecord& record) {
+      if (refuse && (*toggle = !*toggle)) {
+        return false;
+      }
+      std::lock_guard<std::mutex> lock(received->mutex);
+      received->next = record.seqno + 1;
+      received->records.emplace_back(std::move(record));
+      received->sem.Post();
+      return true;
+    };
+    auto gap_cb = [received, refuse, toggle] (const GapRecord& gap) {
+      if (refuse && (*toggle = !*toggle)) {
+        return false;
+      }
+      std::lock_guard<std::mutex> lock(received->mutex);
+      received->next = gap.to + 1;
+      received->gaps.push_back(gap);
+      received->sem.Post();
+      return true;
+    };
+    std::vector<AsyncLogReader*> readers;
+    ASSERT_OK(storage->CreateAsyncReaders(1, record_cb, gap_cb, &readers));
+    ASSERT_EQ(readers.size(), 1U);
+    return std::unique_ptr<AsyncLogReader>(readers[0]);
+  }
+
+  // Waits until everything before seqno has been received.
+  bool WaitFor(Received* received, SequenceNumber seqno) {
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(received->mutex);
+        if (received->next >= seqno) {
+          return true;
+        }
+      }
+      if (!received->sem.TimedWait(timeout)) {
+        return false;
+      }
+    }
+  }
+
+  SequenceNumber Append(MemoryLogStorage* storage,
+                        LogID log_id,
+                        const std::string& data) {
+    SequenceNumber result = 0;
+    ASSERT_OK(storage->AppendAsync(log_id, Slice(data),
+      [&] (Status status, SequenceNumber seqno) {
+        ASSERT_OK(status);
+        result = seqno;
+      }));
+    // Without append latency the callback is invoked before returning.
+    ASSERT_NE(result, 0U);
+    return result;
+  }
+
+  SequenceNumber FindTime(MemoryLogStorage* storage,
+                          LogID log_id,
+                          std::chrono::milliseconds timestamp) {
+    SequenceNumber result = 0;
+    ASSERT_OK(storage->FindTimeAsync(log_id, timestamp,
+      [&] (Status status, SequenceNumber seqno) {
+        ASSERT_OK(status);
+        result = seqno;
+      }));
+    return result;
+  }
+
+  std::chrono::seconds timeout;
+
+ protected:
+  Env* env_;
+  std::shared_ptr<Logger> info_log_;
+};
+
+TEST(MemoryStorageTest, AppendAndRead) {
+  MemoryLogStorage::Options options;
+  options.chunk_size = 1024;  // to span many chunks
+  auto storage = MakeStorage(options);
+
+  const uint64_t kRecords = 1000;
+  for (uint64_t i = 0; i < kRecords; ++i) {
+    ASSERT_EQ(Append(storage.get(), 1, "record" + std::to_string(i)), i + 1);
+  }
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds(0)), 1U);
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds::max()),
+            kRecords + 1);
+  // Other logs are independent.
+  ASSERT_EQ(Append(storage.get(), 2, "other"), 1U);
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, kBeginningOfTimeSeqno, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, kRecords + 1));
+
+  // Records appended while tailing are delivered too.
+  ASSERT_EQ(Append(storage.get(), 1, "tail"), kRecords + 1);
+  ASSERT_TRUE(WaitFor(&received, kRecords + 2));
+
+  std::lock_guard<std::mutex> lock(received.mutex);
+  ASSERT_EQ(received.records.size(), kRecords + 1);
+  ASSERT_TRUE(received.gaps.empty());
+  for (uint64_t i = 0; i < kRecords; ++i) {
+    ASSERT_EQ(received.records[i].log_id, 1U);
+    ASSERT_EQ(received.records[i].seqno, i + 1);
+    ASSERT_EQ(received.records[i].payload.ToString(),
+              "record" + std::to_string(i));
+  }
+  ASSERT_EQ(received.records.back().payload.ToString(), "tail");
+}
+
+TEST(MemoryStorageTest, Retention) {
+  MemoryLogStorage::Options options;
+  options.chunk_size = 100;  // 10 records per chunk
+  options.retention = 50;
+  auto storage = MakeStorage(options);
+
+  const uint64_t kRecords = 1000;
+  for (uint64_t i = 0; i < kRecords; ++i) {
+    char data[11];
+    snprintf(data, sizeof(data), "%010d", static_cast<int>(i));
+    Append(storage.get(), 1, data);
+  }
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, 1, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, kRecords + 1));
+
+  // Old records are lost a chunk at a time, at least 50 remain.
+  std::lock_guard<std::mutex> lock(received.mutex);
+  ASSERT_EQ(received.gaps.size(), 1U);
+  ASSERT_TRUE(received.gaps[0].type == kRetention);
+  ASSERT_EQ(received.gaps[0].from, 1U);
+  ASSERT_EQ(received.gaps[0].to, kRecords - received.records.size());
+  ASSERT_GE(received.records.size(), 50U);
+  ASSERT_LT(received.records.size(), 60U);
+  ASSERT_EQ(received.records.front().seqno, received.gaps[0].to + 1);
+}
+
+TEST(MemoryStorageTest, RecordsOutliveTrim) {
+  MemoryLogStorage::Options options;
+  options.chunk_size = 64;
+  auto storage = MakeStorage(options);
+  for (int i = 0; i < 10; ++i) {
+    Append(storage.get(), 1, "record" + std::to_string(i));
+  }
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, 1, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, 11));
+
+  // Trim everything, and append enough to reuse dropped chunks.
+  ASSERT_OK(storage->Trim(1, 10));
+  for (int i = 10; i < 100; ++i) {
+    Append(storage.get(), 1, "record" + std::to_string(i));
+  }
+  ASSERT_TRUE(WaitFor(&received, 101));
+
+  // Payloads of delivered records stay valid.
+  std::lock_guard<std::mutex> lock(received.mutex);
+  ASSERT_EQ(received.records.size(), 100U);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(received.records[i].payload.ToString(),
+              "record" + std::to_string(i));
+  }
+}
+
+TEST(MemoryStorageTest, Trim) {
+  auto storage = MakeStorage();
+  for (int i = 0; i < 10; ++i) {
+    Append(storage.get(), 1, "record" + std::to_string(i));
+  }
+  ASSERT_OK(storage->Trim(1, 5));
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds(0)), 6U);
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, 1, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, 11));
+
+  std::lock_guard<std::mutex> lock(received.mutex);
+  ASSERT_EQ(received.gaps.size(), 1U);
+  ASSERT_TRUE(received.gaps[0].type == kRetention);
+  ASSERT_EQ(received.gaps[0].from, 1U);
+  ASSERT_EQ(received.gaps[0].to, 5U);
+  ASSERT_EQ(received.records.size(), 5U);
+  ASSERT_EQ(received.records[0].seqno, 6U);
+}
+
+TEST(MemoryStorageTest, InjectedGaps) {
+  auto storage = MakeStorage();
+  SequenceNumber first = 0;
+  ASSERT_EQ(Append(storage.get(), 1, "a"), 1U);
+  ASSERT_OK(storage->InjectGap(1, kDataLoss, 5, &first));
+  ASSERT_EQ(first, 2U);
+  ASSERT_EQ(Append(storage.get(), 1, "b"), 7U);
+  ASSERT_OK(storage->InjectGap(1, kBenign, 1, &first));
+  ASSERT_EQ(first, 8U);
+  ASSERT_EQ(Append(storage.get(), 1, "c"), 9U);
+  ASSERT_TRUE(!storage->InjectGap(1, kRetention, 1).ok());
+  ASSERT_TRUE(!storage->InjectGap(1, kBenign, 0).ok());
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, 1, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, 10));
+  {
+    std::lock_guard<std::mutex> lock(received.mutex);
+    ASSERT_EQ(received.records.size(), 3U);
+    ASSERT_EQ(received.records[0].seqno, 1U);
+    ASSERT_EQ(received.records[1].seqno, 7U);
+    ASSERT_EQ(received.records[2].seqno, 9U);
+    ASSERT_EQ(received.gaps.size(), 2U);
+    ASSERT_TRUE(received.gaps[0].type == kDataLoss);
+    ASSERT_EQ(received.gaps[0].from, 2U);
+    ASSERT_EQ(received.gaps[0].to, 6U);
+    ASSERT_TRUE(received.gaps[1].type == kBenign);
+    ASSERT_EQ(received.gaps[1].from, 8U);
+    ASSERT_EQ(received.gaps[1].to, 8U);
+  }
+
+  // Reading from within a gap gets the rest of it, and stops at the end.
+  Received partial;
+  auto partial_reader = MakeReader(storage.get(), &partial);
+  ASSERT_OK(partial_reader->Open(1, 4, 7));
+  ASSERT_TRUE(WaitFor(&partial, 8));
+  Append(storage.get(), 1, "d");
+  ASSERT_TRUE(WaitFor(&received, 11));
+  std::lock_guard<std::mutex> lock(partial.mutex);
+  ASSERT_EQ(partial.gaps.size(), 1U);
+  ASSERT_EQ(partial.gaps[0].from, 4U);
+  ASSERT_EQ(partial.gaps[0].to, 6U);
+  ASSERT_EQ(partial.records.size(), 1U);
+  ASSERT_EQ(partial.records[0].seqno, 7U);
+}
+
+TEST(MemoryStorageTest, ReopenAndClose) {
+  auto storage = MakeStorage();
+  for (int i = 0; i < 10; ++i) {
+    Append(storage.get(), 1, "record" + std::to_string(i));
+  }
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, 8, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, 11));
+
+  // Reopening restarts from the new position.
+  {
+    std::lock_guard<std::mutex> lock(received.mutex);
+    received.next = 0;
+  }
+  ASSERT_OK(reader->Open(1, 1, 2));
+  ASSERT_TRUE(WaitFor(&received, 3));
+
+  // Nothing is delivered after closing.
+  ASSERT_OK(reader->Close(1));
+  Append(storage.get(), 1, "closed");
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::lock_guard<std::mutex> lock(received.mutex);
+  ASSERT_EQ(received.records.size(), 5U);
+  ASSERT_EQ(received.records[0].seqno, 8U);
+  ASSERT_EQ(received.records[2].seqno, 10U);
+  ASSERT_EQ(received.records[3].seqno, 1U);
+  ASSERT_EQ(received.records[4].seqno, 2U);
+}
+
+TEST(MemoryStorageTest, RefusedRecords) {
+  auto storage = MakeStorage();
+  const uint64_t kRecords = 1000;
+  for (uint64_t i = 0; i < kRecords; ++i) {
+    if (i % 100 == 50) {
+      storage->InjectGap(1, kBenign, 1);
+    } else {
+      Append(storage.get(), 1, "record" + std::to_string(i));
+    }
+  }
+
+  // Every other record and gap is refused and redelivered.
+  Received received;
+  auto reader = MakeReader(storage.get(), &received, true);
+  ASSERT_OK(reader->Open(1, 1, kEndOfTimeSeqno));
+  ASSERT_TRUE(WaitFor(&received, kRecords + 1));
+
+  std::lock_guard<std::mutex> lock(received.mutex);
+  ASSERT_EQ(received.gaps.size(), kRecords / 100);
+  ASSERT_EQ(received.records.size(), kRecords - kRecords / 100);
+  size_t record = 0;
+  for (uint64_t i = 0; i < kRecords; ++i) {
+    if (i % 100 != 50) {
+      ASSERT_EQ(received.records[record].seqno, i + 1);
+      ASSERT_EQ(received.records[record].payload.ToString(),
+                "record" + std::to_string(i));
+      ++record;
+    }
+  }
+}
+
+TEST(MemoryStorageTest, AppendLatency) {
+  MemoryLogStorage::Options options;
+  options.append_latency = std::chrono::milliseconds(100);
+  auto storage = MakeStorage(options);
+
+  Received received;
+  auto reader = MakeReader(storage.get(), &received);
+  ASSERT_OK(reader->Open(1, 1, kEndOfTimeSeqno));
+
+  port::Semaphore appended;
+  std::atomic<SequenceNumber> appended_seqno{0};
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_OK(storage->AppendAsync(1, "delayed",
+    [&] (Status status, SequenceNumber seqno) {
+      ASSERT_OK(status);
+      appended_seqno = seqno;
+      appended.Post();
+    }));
+
+  // Not visible until the latency has passed.
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds::max()), 1U);
+  ASSERT_TRUE(appended.TimedWait(timeout));
+  ASSERT_TRUE(std::chrono::steady_clock::now() - start >=
+              std::chrono::milliseconds(100));
+  ASSERT_EQ(appended_seqno.load(), 1U);
+  ASSERT_TRUE(WaitFor(&received, 2));
+
+  // Appends still delayed when the storage is closed fail.
+  reader.reset();
+  options.append_latency = std::chrono::seconds(10);
+  storage = MakeStorage(options);
+  Status closed_status;
+  ASSERT_OK(storage->AppendAsync(1, "closed",
+    [&] (Status status, SequenceNumber) {
+      closed_status = status;
+    }));
+  storage.reset();
+  ASSERT_TRUE(!closed_status.ok());
+}
+
+TEST(MemoryStorageTest, FindTimeLatency) {
+  MemoryLogStorage::Options options;
+  options.find_time_latency = std::chrono::milliseconds(100);
+  auto storage = MakeStorage(options);
+  ASSERT_OK(storage->AppendAsync(1, "record", [] (Status, SequenceNumber) {}));
+
+  port::Semaphore found;
+  std::atomic<SequenceNumber> found_seqno{0};
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_OK(storage->FindTimeAsync(1, std::chrono::milliseconds::max(),
+    [&] (Status status, SequenceNumber seqno) {
+      ASSERT_OK(status);
+      found_seqno = seqno;
+      found.Post();
+    }));
+  ASSERT_TRUE(found.TimedWait(timeout));
+  ASSERT_TRUE(std::chrono::steady_clock::now() - start >=
+              std::chrono::milliseconds(100));
+  ASSERT_EQ(found_seqno.load(), 2U);
+}
+
+TEST(MemoryStorageTest, Throughput) {
+  const int kLogs = 8;
+  const int kRecords = 1000000;
+  auto storage = MakeStorage();
+
+  std::atomic<int> read{0};
+  port::Semaphore done;
+  auto record_cb = [&] (LogRecord& record) {
+    if (++read == kRecords) {
+      done.Post();
+    }
+    return true;
+  };
+  std::vector<AsyncLogReader*> readers;
+  ASSERT_OK(storage->CreateAsyncReaders(2, record_cb, nullptr, &readers));
+  std::vector<std::unique_ptr<AsyncLogReader>> owned(readers.begin(),
+                                                     readers.end());
+  for (int i = 0; i < kLogs; ++i) {
+    ASSERT_OK(readers[i % readers.size()]->Open(i + 1, 1, kEndOfTimeSeqno));
+  }
+
+  std::string payload(100, 'x');
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < kRecords; ++i) {
+    storage->AppendAsync(i % kLogs + 1, payload, [] (Status, SequenceNumber) {});
+  }
+  auto appended = std::chrono::steady_clock::now();
+  ASSERT_TRUE(done.TimedWait(std::chrono::seconds(60)));
+  auto end = std::chrono::steady_clock::now();
+
+  auto rate = [] (std::chrono::steady_clock::duration elapsed) {
+    return kRecords /
+      std::chrono::duration_cast<std::chrono::duration<double>>(elapsed)
+        .count();
+  };
+  fprintf(stderr, "%.0f appends/s, %.0f reads/s\n",
+          rate(appended - start), rate(end - start));
+}
+
+TEST(MemoryStorageTest, LocalTestCluster) {
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log_;
+  opts.memory_storage = true;
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+  ASSERT_TRUE(cluster.GetMemoryLogStorage() != nullptr);
+
+  port::Semaphore published;
+  port::Semaphore received;
+  std::string data = "test_message";
+
+  ClientOptions options;
+  options.config = cluster.GetConfiguration();
+  options.info_log = info_log_;
+  std::unique_ptr<Client> client;
+  ASSERT_OK(Client::Create(std::move(options), &client));
+
+  // Publish one message, then read it from the start of the topic.
+  SequenceNumber seqno = 0;
+  auto ps = client->Publish(GuestTenant,
+                            "LocalTestCluster",
+                            GuestNamespace,
+                            TopicOptions(),
+                            Slice(data),
+                            [&] (std::unique_ptr<ResultStatus> rs) {
+                              ASSERT_OK(rs->GetStatus());
+                              seqno = rs->GetSequenceNumber();
+                              published.Post();
+                            });
+  ASSERT_OK(ps.status);
+  ASSERT_TRUE(published.TimedWait(timeout));
+
+  ASSERT_TRUE(client->Subscribe(GuestTenant,
+                                GuestNamespace,
+                                "LocalTestCluster",
+                                seqno,
+                                [&] (std::unique_ptr<MessageReceived>& mr) {
+                                  ASSERT_EQ(mr->GetContents().ToString(),
+                                            data);
+                                  received.Post();
+                                }));
+  ASSERT_TRUE(received.TimedWait(timeout));
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests();
+}
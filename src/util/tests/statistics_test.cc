@@ -5,9 +5,12 @@
 //
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <map>
 #include <set>
 #include <string>
+#include <thread>
 
 #include "src/util/common/statistics.h"
 #include "src/util/testharness.h"
@@ -171,7 +174,7 @@ TEST(StatisticsTest, StatisticsWindowAggregator) {
     return window.GetAggregate().GetCounterValue("a");
   };
   auto GetB = [&] () {
-    return window.GetAggregate().GetHistograms().find("b")->second.get();
+    return window.GetAggregate().GetHistogram("b");
   };
 
   // Fill up window.
@@ -220,6 +223,119 @@ TEST(StatisticsTest, StatisticsWindowAggregator) {
   ASSERT_LE(GetB()->Percentile(0.5), 4.5);
 }
 
+TEST(StatisticsTest, ConcurrentSnapshots) {
+  // Snapshots may be taken while the owning thread updates statistics.
+  Statistics stats;
+  Counter* counter = stats.AddCounter("counter");
+  Histogram* histogram = stats.AddHistogram("histogram", 0, 100, 1, 2);
+  const int kUpdates = 1000000;
+  std::atomic<bool> done(false);
+
+  std::thread writer([&]() {
+    for (int i = 0; i < kUpdates; ++i) {
+      counter->Add(1);
+      histogram->Record(i % 100);
+    }
+    done = true;
+  });
+
+  int64_t last = 0;
+  int errors = 0;
+  while (!done) {
+    Statistics snapshot(stats);
+    int64_t value = snapshot.GetCounterValue("counter");
+    errors += value < last;
+    last = value;
+    const Histogram* snapshot_histogram = snapshot.GetHistogram("histogram");
+    errors += snapshot_histogram->Percentile(0.5) > 100;
+  }
+  writer.join();
+  ASSERT_EQ(errors, 0);
+
+  Statistics snapshot(stats);
+  ASSERT_EQ(snapshot.GetCounterValue("counter"), kUpdates);
+  ASSERT_EQ(snapshot.GetHistogram("histogram")->GetNumSamples(), kUpdates);
+}
+
+TEST(StatisticsTest, CountersInFlatArray) {
+  Statistics stats;
+  std::vector<Counter*> counters;
+  for (int i = 0; i < 100; ++i) {
+    counters.push_back(stats.AddCounter("c" + std::to_string(i)));
+  }
+  // Pointers stay valid while registering, and registering twice is a no-op.
+  ASSERT_TRUE(stats.AddCounter("c0") == counters[0]);
+  // Blocks of counters start at cache line boundaries, so that they do not
+  // share cache lines with other allocations.
+  for (size_t i = 0; i < counters.size(); i += 32) {
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(counters[i]) % CACHE_LINE_SIZE, 0U);
+  }
+  for (int i = 0; i < 100; ++i) {
+    counters[i]->Add(i);
+  }
+  Statistics copy(stats);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(copy.GetCounterValue("c" + std::to_string(i)), i);
+  }
+  ASSERT_TRUE(stats.GetCounter("none") == nullptr);
+  ASSERT_EQ(stats.GetCounterValue("none"), 0);
+}
+
+TEST(StatisticsTest, WindowedStatistics) {
+  Statistics stats;
+  Counter* counter = stats.AddCounter("requests");
+  Histogram* latency = stats.AddLatency("latency");
+
+  WindowedStatistics windowed(4);
+  auto time = std::chrono::steady_clock::time_point();
+  windowed.AddSnapshot(stats, time);
+  ASSERT_EQ(windowed.GetLastPeriod().GetCounterValue("requests"), 0);
+
+  // Each period records 10 more requests of increasing latency.
+  for (int period = 1; period <= 6; ++period) {
+    for (int i = 0; i < 10; ++i) {
+      counter->Add(1);
+      latency->Record(100.0 * period);
+    }
+    time += std::chrono::milliseconds(500);
+    windowed.AddSnapshot(stats, time);
+    ASSERT_EQ(windowed.GetLastPeriod().GetCounterValue("requests"), 10);
+    const Histogram* period_latency =
+        windowed.GetLastPeriod().GetHistogram("latency");
+    ASSERT_EQ(period_latency->GetNumSamples(), 10);
+    ASSERT_GT(period_latency->Percentile(0.5), 100.0 * period / 1.2);
+    ASSERT_LT(period_latency->Percentile(0.5), 100.0 * period * 1.2);
+  }
+  // Only last 4 periods are in the window.
+  ASSERT_EQ(windowed.GetWindow().GetCounterValue("requests"), 40);
+  const Histogram* window_latency =
+      windowed.GetWindow().GetHistogram("latency");
+  ASSERT_EQ(window_latency->GetNumSamples(), 40);
+  ASSERT_GT(window_latency->Percentile(0.0), 300.0 / 1.2);
+
+  std::string json = windowed.ReportJSON();
+  ASSERT_EQ(json.find("{\"period_seconds\":0.500,\"window_seconds\":2.000,"),
+            0);
+  ASSERT_NE(json.find("\"requests\":{\"value\":60,\"per_second\":20.000,"
+                      "\"per_minute\":1200.000}"),
+            std::string::npos);
+  ASSERT_NE(json.find("\"latency\":{\"last_period\":{\"per_second\":20.000,"),
+            std::string::npos);
+  ASSERT_EQ(json.find('\n'), std::string::npos);
+
+  // Rates are computed over the measured time, so a late snapshot does not
+  // inflate them.
+  counter->Add(10);
+  time += std::chrono::milliseconds(1000);
+  windowed.AddSnapshot(stats, time);
+  json = windowed.ReportJSON();
+  ASSERT_EQ(json.find("{\"period_seconds\":1.000,\"window_seconds\":2.500,"),
+            0);
+  ASSERT_NE(json.find("\"requests\":{\"value\":70,\"per_second\":10.000,"
+                      "\"per_minute\":960.000}"),
+            std::string::npos);
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
@@ -0,0 +1,149 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/util/timer_wheel.h"
+#include "src/util/testharness.h"
+#include "src/util/testutil.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "src/util/random.h"
+
+namespace rocketspeed {
+
+class TimerWheelTest {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using ms = std::chrono::milliseconds;
+
+  TimerWheelTest() : start(Clock::now()) {}
+
+ protected:
+  const Clock::time_point start;
+};
+
+TEST(TimerWheelTest, Count) {
+  TimerWheel<std::string> wheel(ms(1), start);
+  wheel.Add("Red", ms(10), start);
+  wheel.Add("Green", ms(10), start);
+  wheel.Add("blue", ms(10), start);
+  wheel.Add("blue", ms(20), start);
+
+  ASSERT_EQ(wheel.Size(), 3);
+  ASSERT_TRUE(wheel.Contains("blue"));
+  ASSERT_TRUE(wheel.Erase("blue"));
+  ASSERT_TRUE(!wheel.Erase("blue"));
+  ASSERT_TRUE(!wheel.Contains("blue"));
+  ASSERT_EQ(wheel.Size(), 2);
+  wheel.Clear();
+  ASSERT_TRUE(wheel.Empty());
+}
+
+TEST(TimerWheelTest, PerItemDeadlines) {
+  TimerWheel<std::string> wheel(ms(1), start);
+  wheel.Add("Red", ms(300), start);
+  wheel.Add("Green", ms(100), start);
+  wheel.Add("blue", ms(200), start);
+
+  std::vector<std::string> expired;
+  ASSERT_EQ(wheel.GetExpired(back_inserter(expired), -1, start + ms(99)), 0);
+  ASSERT_EQ(wheel.GetExpired(back_inserter(expired), -1, start + ms(100)), 1);
+  ASSERT_EQ(wheel.GetExpired(back_inserter(expired), -1, start + ms(1000)), 2);
+  std::vector<std::string> expected = {"Green", "blue", "Red"};
+  ASSERT_TRUE(expired == expected);
+  ASSERT_TRUE(wheel.Empty());
+}
+
+TEST(TimerWheelTest, Reschedule) {
+  TimerWheel<std::string> wheel(ms(1), start);
+  wheel.Add("Red", ms(100), start);
+  wheel.Add("Green", ms(100), start);
+  // Push "Red" further into the future.
+  wheel.Add("Red", ms(100), start + ms(50));
+
+  std::vector<std::string> expired;
+  wheel.GetExpired(back_inserter(expired), -1, start + ms(120));
+  ASSERT_EQ(expired.size(), 1);
+  ASSERT_EQ(expired[0], "Green");
+  wheel.GetExpired(back_inserter(expired), -1, start + ms(150));
+  ASSERT_EQ(expired.size(), 2);
+  ASSERT_EQ(expired[1], "Red");
+}
+
+TEST(TimerWheelTest, BatchLimitExpiry) {
+  TimerWheel<int> wheel(ms(1), start);
+  for (int i = 0; i < 10; ++i) {
+    wheel.Add(i, ms(5), start);
+  }
+  std::vector<int> expired;
+  ASSERT_EQ(wheel.GetExpired(back_inserter(expired), 4, start + ms(10)), 4);
+  ASSERT_EQ(wheel.Size(), 6);
+  ASSERT_TRUE(wheel.GetNextDeadline() <= start + ms(10));
+  ASSERT_EQ(wheel.GetExpired(back_inserter(expired), -1, start + ms(10)), 6);
+  ASSERT_TRUE(wheel.Empty());
+}
+
+TEST(TimerWheelTest, CallbackMayReschedule) {
+  TimerWheel<int> wheel(ms(1), start);
+  wheel.Add(1, ms(10), start);
+  int fired = 0;
+  auto now = start;
+  for (int i = 0; i < 5; ++i) {
+    now += ms(10);
+    wheel.ProcessExpired([&](int item) {
+      ++fired;
+      wheel.Add(item, ms(10), now);
+    }, -1, now);
+  }
+  ASSERT_EQ(fired, 5);
+  ASSERT_EQ(wheel.Size(), 1);
+}
+
+TEST(TimerWheelTest, NextDeadline) {
+  TimerWheel<int> wheel(ms(1), start);
+  ASSERT_TRUE(wheel.GetNextDeadline() == Clock::time_point::max());
+  wheel.Add(1, ms(100000), start);
+  auto next = wheel.GetNextDeadline();
+  ASSERT_TRUE(next > start && next <= start + ms(100000));
+  wheel.Add(2, ms(30), start);
+  ASSERT_TRUE(wheel.GetNextDeadline() == start + ms(30));
+}
+
+TEST(TimerWheelTest, RandomDeadlines) {
+  // Deadlines spanning all levels of the wheel must never fire early or late.
+  TimerWheel<int> wheel(ms(1), start);
+  Random64 rng(42);
+  const int kItems = 2000;
+  std::vector<uint64_t> deadline(kItems);
+  for (int i = 0; i < kItems; ++i) {
+    uint64_t level = rng.Uniform(4);
+    deadline[i] = 1 + rng.Uniform(uint64_t(1) << (8 * level + 7));
+    wheel.Add(i, ms(deadline[i]), start);
+  }
+  uint64_t now = 0;
+  int fired = 0;
+  while (!wheel.Empty()) {
+    now += 1 + rng.Skewed(20);
+    wheel.ProcessExpired([&](int item) {
+      ASSERT_LE(deadline[item], now);
+      deadline[item] = 0;
+      ++fired;
+    }, -1, start + ms(now));
+    int late = 0;
+    for (int i = 0; i < kItems; ++i) {
+      late += deadline[i] != 0 && deadline[i] <= now;
+    }
+    ASSERT_EQ(late, 0);
+  }
+  ASSERT_EQ(fired, kItems);
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests();
+}
@@ -0,0 +1,411 @@
+// Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rocketspeed {
+// A set of items, each with its own deadline, backed by a hierarchical timing
+// wheel. Adding, rescheduling and erasing an item are O(1), expiring items is
+// O(1) amortised per item plus O(1) per elapsed tick.
+//
+// Time is divided into ticks of configurable resolution. The wheel consists of
+// kLevels levels, kSlots slots each. A slot on level L spans kSlots^L ticks.
+// Items due within kSlots ticks live on level 0, later items live on higher
+// levels and cascade down as time advances. Deadlines further in the future
+// than the span of the top level are clamped to it and will be re-examined,
+// so they never fire early.
+//
+// Unlike TimeoutList, each item carries its own deadline, so items with
+// different timeouts can be mixed, and the deadline of the earliest item can
+// be queried, which allows the owner to schedule a precise wakeup instead of
+// polling.
+//
+// Simple usage example:
+//
+//   TimerWheel<std::string> wheel;
+//   wheel.Add("red", std::chrono::seconds(1));
+//   wheel.Add("green", std::chrono::seconds(5));
+//   // 2 seconds later
+//   wheel.ProcessExpired([](std::string colour) { ... });  // "red"
+//
+// This class is not thread-safe.
+
+template <class T, class Hash = std::hash<T>> class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Number of bits of a tick number resolved by a single level.
+  static constexpr int kSlotBits = 8;
+  static constexpr size_t kSlots = size_t(1) << kSlotBits;
+  static constexpr int kLevels = 4;
+
+  /**
+   * Creates an empty wheel.
+   *
+   * @param resolution Duration of a single tick. Deadlines are rounded up to
+   *                   the nearest tick.
+   * @param start Time point corresponding to the beginning of the first tick.
+   */
+  explicit TimerWheel(
+      std::chrono::microseconds resolution = std::chrono::milliseconds(1),
+      Clock::time_point start = Clock::now())
+  : resolution_(std::max(resolution, std::chrono::microseconds(1)))
+  , start_(start)
+  , current_tick_(0) {
+    level_size_.fill(0);
+    for (auto& level : slots_) {
+      level.fill(kNil);
+    }
+  }
+
+  TimerWheel(TimerWheel&&) = default;
+  TimerWheel& operator= (TimerWheel&&) = default;
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator= (const TimerWheel&) = delete;
+
+  // Capacity
+  bool Empty() const { return index_.empty(); }
+  size_t Size() const { return index_.size(); }
+
+  /**
+   * Checks whether the wheel contains provided item.
+   */
+  bool Contains(const T& t) const {
+    return index_.count(t) != 0;
+  }
+
+  /**
+   * Adds a new item which expires after provided timeout, or reschedules an
+   * existing item.
+   */
+  template <class Rep, class Period>
+  void Add(const T& t,
+           const std::chrono::duration<Rep, Period>& timeout,
+           Clock::time_point now = Clock::now()) {
+    AddAt(t, now + std::chrono::duration_cast<Clock::duration>(timeout));
+  }
+
+  /**
+   * Adds a new item which expires at provided deadline, or reschedules an
+   * existing item.
+   */
+  void AddAt(const T& t, Clock::time_point deadline) {
+    // Items which are already due will fire on the next tick.
+    const uint64_t tick = std::max(ToTickCeil(deadline), current_tick_ + 1);
+    auto it = index_.find(t);
+    uint32_t node_id;
+    if (it == index_.end()) {
+      node_id = AllocateNode(t);
+      index_.emplace(t, node_id);
+    } else {
+      node_id = it->second;
+      Unlink(node_id);
+    }
+    nodes_[node_id].deadline = tick;
+    Link(node_id);
+  }
+
+  /**
+   * Erases the entry if found
+   */
+  bool Erase(const T& t) {
+    auto it = index_.find(t);
+    if (it == index_.end()) {
+      return false;
+    }
+    const uint32_t node_id = it->second;
+    index_.erase(it);
+    Unlink(node_id);
+    FreeNode(node_id);
+    return true;
+  }
+
+  /**
+   * Removes all entries, without invoking any callbacks.
+   */
+  void Clear() {
+    index_.clear();
+    nodes_.clear();
+    free_ = kNil;
+    for (auto& level : slots_) {
+      level.fill(kNil);
+    }
+    level_size_.fill(0);
+  }
+
+  /**
+   * Returns a time point no later than the deadline of the earliest item, or
+   * Clock::time_point::max() if the wheel is empty. The bound is exact for
+   * items due within kSlots ticks, otherwise it is the earliest time at which
+   * a call to ProcessExpired can make progress.
+   */
+  Clock::time_point GetNextDeadline() const {
+    if (Empty()) {
+      return Clock::time_point::max();
+    }
+    // Leftovers of a batch-limited expiry are due right now.
+    if (slots_[0][current_tick_ & kSlotMask] != kNil) {
+      return FromTick(current_tick_);
+    }
+    // Find the first occupied slot on each level, items on higher levels may
+    // be due before items on lower levels, if they were added earlier.
+    uint64_t next_tick = std::numeric_limits<uint64_t>::max();
+    for (int level = 0; level < kLevels; ++level) {
+      const int shift = level * kSlotBits;
+      const uint64_t base = current_tick_ >> shift;
+      for (uint64_t i = 1; i <= kSlots; ++i) {
+        if (slots_[level][(base + i) & kSlotMask] != kNil) {
+          next_tick = std::min(next_tick, (base + i) << shift);
+          break;
+        }
+      }
+    }
+    assert(next_tick != std::numeric_limits<uint64_t>::max());
+    return FromTick(next_tick);
+  }
+
+  /**
+   * Gets a list of expired items and removes them from the wheel.
+   *
+   * @param out     OutputIterator to write the expired entries to
+   */
+  template <class OutputIterator>
+  size_t GetExpired(OutputIterator out,
+                    int batch_limit = -1,
+                    Clock::time_point now = Clock::now()) {
+    return ProcessExpired([&out] (T item) { *out++ = std::move(item); },
+                          batch_limit,
+                          now);
+  }
+
+  /**
+   * Invokes a callback for each item whose deadline has passed, in order of
+   * deadlines (rounded to ticks). Items are removed from the wheel before the
+   * callback is invoked, the callback may add and erase items.
+   *
+   * @param callback Callback invoked for each expired entry,
+   *                 should take a T parameter e.g. [](T expired_item) {...}
+   * @param batch_limit
+   *                 limit the number of entries to be expired & processed.
+   *                 -1 exipres all qualified entries.
+   * @return Number of expired entries.
+   */
+  template <class ExpiryCallback>
+  size_t ProcessExpired(ExpiryCallback callback,
+                        int batch_limit = -1,
+                        Clock::time_point now = Clock::now()) {
+    const uint64_t target = ToTickFloor(now);
+    size_t expired = 0;
+    // Finish the current tick, if the previous call stopped in the middle.
+    if (!ExpireSlot(callback, &batch_limit, &expired)) {
+      return expired;
+    }
+    while (current_tick_ < target) {
+      // Skip ticks at which nothing can expire or cascade. If the lowest L
+      // levels are empty, nothing happens until the next multiple of
+      // kSlots^L ticks.
+      int empty_levels = 0;
+      while (empty_levels < kLevels && level_size_[empty_levels] == 0) {
+        ++empty_levels;
+      }
+      if (empty_levels == kLevels) {
+        current_tick_ = target;
+        break;
+      }
+      if (empty_levels > 0) {
+        const uint64_t mask =
+            (uint64_t(1) << (empty_levels * kSlotBits)) - 1;
+        current_tick_ = std::min(current_tick_ | mask, target - 1);
+      }
+      ++current_tick_;
+      Cascade();
+      if (!ExpireSlot(callback, &batch_limit, &expired)) {
+        break;
+      }
+    }
+    return expired;
+  }
+
+ private:
+  static constexpr uint32_t kNil = std::numeric_limits<uint32_t>::max();
+  static constexpr uint64_t kSlotMask = kSlots - 1;
+
+  struct Node {
+    T item;
+    // Tick at which the item expires.
+    uint64_t deadline;
+    // Position in a slot, or in the free list.
+    uint32_t prev;
+    uint32_t next;
+    uint16_t slot;
+    uint8_t level;
+  };
+
+  uint64_t ToTickFloor(Clock::time_point time) const {
+    if (time <= start_) {
+      return 0;
+    }
+    return static_cast<uint64_t>((time - start_) / resolution_);
+  }
+
+  uint64_t ToTickCeil(Clock::time_point time) const {
+    if (time <= start_) {
+      return 0;
+    }
+    const auto elapsed = time - start_;
+    const uint64_t ticks = static_cast<uint64_t>(elapsed / resolution_);
+    return elapsed % resolution_ == Clock::duration::zero() ? ticks : ticks + 1;
+  }
+
+  Clock::time_point FromTick(uint64_t tick) const {
+    return start_ + std::chrono::duration_cast<Clock::duration>(
+                        resolution_ * static_cast<int64_t>(tick));
+  }
+
+  uint32_t AllocateNode(const T& t) {
+    if (free_ != kNil) {
+      const uint32_t node_id = free_;
+      free_ = nodes_[node_id].next;
+      nodes_[node_id].item = t;
+      return node_id;
+    }
+    assert(nodes_.size() < kNil);
+    nodes_.push_back(Node{t, 0, kNil, kNil, 0, 0});
+    return static_cast<uint32_t>(nodes_.size() - 1);
+  }
+
+  void FreeNode(uint32_t node_id) {
+    nodes_[node_id].item = T();
+    nodes_[node_id].next = free_;
+    free_ = node_id;
+  }
+
+  /** Links node into the slot determined by its deadline. */
+  void Link(uint32_t node_id) {
+    Node& node = nodes_[node_id];
+    // Items cascaded during the current tick may be due right now.
+    const uint64_t deadline = std::max(node.deadline, current_tick_);
+    const uint64_t delta = deadline - current_tick_;
+    int level = 0;
+    while (level + 1 < kLevels &&
+           delta >= (uint64_t(1) << ((level + 1) * kSlotBits))) {
+      ++level;
+    }
+    uint64_t slot_tick = deadline;
+    if (level == kLevels - 1) {
+      // Clamp deadlines beyond the span of the wheel.
+      const uint64_t max_delta =
+          (uint64_t(1) << (kLevels * kSlotBits)) - 1;
+      slot_tick = current_tick_ + std::min(delta, max_delta);
+    }
+    const uint64_t slot = (slot_tick >> (level * kSlotBits)) & kSlotMask;
+    uint32_t& head = slots_[level][slot];
+    node.level = static_cast<uint8_t>(level);
+    node.slot = static_cast<uint16_t>(slot);
+    ++level_size_[level];
+    node.prev = kNil;
+    node.next = head;
+    if (head != kNil) {
+      nodes_[head].prev = node_id;
+    }
+    head = node_id;
+  }
+
+  /** Removes node from its slot. */
+  void Unlink(uint32_t node_id) {
+    Node& node = nodes_[node_id];
+    --level_size_[node.level];
+    if (node.prev != kNil) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      assert(slots_[node.level][node.slot] == node_id);
+      slots_[node.level][node.slot] = node.next;
+    }
+    if (node.next != kNil) {
+      nodes_[node.next].prev = node.prev;
+    }
+  }
+
+  /** Moves items from higher levels whose slots start at current tick. */
+  void Cascade() {
+    for (int level = 1; level < kLevels; ++level) {
+      const int shift = level * kSlotBits;
+      if ((current_tick_ & ((uint64_t(1) << shift) - 1)) != 0) {
+        break;
+      }
+      uint32_t& head = slots_[level][(current_tick_ >> shift) & kSlotMask];
+      uint32_t node_id = head;
+      head = kNil;
+      while (node_id != kNil) {
+        const uint32_t next = nodes_[node_id].next;
+        --level_size_[level];
+        Link(node_id);
+        node_id = next;
+      }
+    }
+  }
+
+  /**
+   * Expires items in the level 0 slot of the current tick. Returns false iff
+   * the batch limit was reached.
+   */
+  template <class ExpiryCallback>
+  bool ExpireSlot(ExpiryCallback& callback, int* batch_limit, size_t* count) {
+    uint32_t& head = slots_[0][current_tick_ & kSlotMask];
+    while (head != kNil) {
+      if (*batch_limit == 0) {
+        return false;
+      }
+      const uint32_t node_id = head;
+      Node& node = nodes_[node_id];
+      assert(node.deadline <= current_tick_);
+      head = node.next;
+      if (head != kNil) {
+        nodes_[head].prev = kNil;
+      }
+      --level_size_[0];
+      T item = std::move(node.item);
+      index_.erase(item);
+      FreeNode(node_id);
+      if (*batch_limit > 0) {
+        --*batch_limit;
+      }
+      ++*count;
+      callback(std::move(item));
+    }
+    return true;
+  }
+
+  std::chrono::microseconds resolution_;
+  Clock::time_point start_;
+  // Last tick, which has been processed.
+  uint64_t current_tick_;
+  // Heads of doubly-linked lists of nodes in each slot.
+  std::array<std::array<uint32_t, kSlots>, kLevels> slots_;
+  // Number of items on each level.
+  std::array<size_t, kLevels> level_size_;
+  std::vector<Node> nodes_;
+  // Head of the list of free nodes.
+  uint32_t free_ = kNil;
+  std::unordered_map<T, uint32_t, Hash> index_;
+};
+
+template <class T, class Hash> constexpr size_t TimerWheel<T, Hash>::kSlots;
+template <class T, class Hash> constexpr uint32_t TimerWheel<T, Hash>::kNil;
+template <class T, class Hash> constexpr uint64_t TimerWheel<T, Hash>::kSlotMask;
+
+} // namespace rocketspeed
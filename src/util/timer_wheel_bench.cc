@@ -0,0 +1,127 @@
+//  Copyright (c) 2014, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <folly/Benchmark.h>
+#include <folly/Foreach.h>
+
+#include "common/init/Init.h"
+#include "src/util/random.h"
+#include "src/util/timeout_list.h"
+#include "src/util/timer_wheel.h"
+
+using namespace std;
+using namespace folly;
+using namespace rocketspeed;
+
+namespace {
+
+// Number of timers kept alive during each benchmark.
+const uint64_t kLiveTimers = 10000000;
+
+using Clock = chrono::steady_clock;
+
+// Spreads deadlines of live timers over up to ~16 minutes.
+chrono::milliseconds RandomTimeout(Random64* rng) {
+  return chrono::milliseconds(1 + rng->Uniform(1 << 20));
+}
+
+unique_ptr<TimerWheel<uint64_t>> MakeWheel(Clock::time_point start) {
+  unique_ptr<TimerWheel<uint64_t>> wheel(
+      new TimerWheel<uint64_t>(chrono::milliseconds(1), start));
+  Random64 rng(1);
+  for (uint64_t i = 0; i < kLiveTimers; ++i) {
+    wheel->Add(i, RandomTimeout(&rng), start);
+  }
+  return wheel;
+}
+
+}  // namespace
+
+BENCHMARK(TimerWheelInsertCancel, n) {
+  unique_ptr<TimerWheel<uint64_t>> wheel;
+  const auto start = Clock::now();
+  BENCHMARK_SUSPEND {
+    wheel = MakeWheel(start);
+  }
+  Random64 rng(2);
+  FOR_EACH_RANGE (i, 0, n) {
+    const uint64_t key = kLiveTimers + i;
+    wheel->Add(key, RandomTimeout(&rng), start);
+    wheel->Erase(key);
+  }
+  doNotOptimizeAway(wheel->Size());
+  BENCHMARK_SUSPEND {
+    wheel.reset();
+  }
+}
+
+BENCHMARK(TimerWheelReschedule, n) {
+  unique_ptr<TimerWheel<uint64_t>> wheel;
+  const auto start = Clock::now();
+  BENCHMARK_SUSPEND {
+    wheel = MakeWheel(start);
+  }
+  Random64 rng(3);
+  FOR_EACH_RANGE (i, 0, n) {
+    wheel->Add(rng.Uniform(kLiveTimers), RandomTimeout(&rng), start);
+  }
+  doNotOptimizeAway(wheel->Size());
+  BENCHMARK_SUSPEND {
+    wheel.reset();
+  }
+}
+
+BENCHMARK_RELATIVE(TimeoutListReschedule, n) {
+  unique_ptr<TimeoutList<uint64_t>> list;
+  BENCHMARK_SUSPEND {
+    list.reset(new TimeoutList<uint64_t>());
+    for (uint64_t i = 0; i < kLiveTimers; ++i) {
+      list->Add(i);
+    }
+  }
+  Random64 rng(3);
+  FOR_EACH_RANGE (i, 0, n) {
+    list->Add(rng.Uniform(kLiveTimers));
+  }
+  doNotOptimizeAway(list->Size());
+  BENCHMARK_SUSPEND {
+    list.reset();
+  }
+}
+
+BENCHMARK(TimerWheelExpire, n) {
+  // Advances time by one tick per iteration, expiring and rescheduling all
+  // timers which are due.
+  unique_ptr<TimerWheel<uint64_t>> wheel;
+  const auto start = Clock::now();
+  BENCHMARK_SUSPEND {
+    wheel = MakeWheel(start);
+  }
+  Random64 rng(4);
+  auto now = start;
+  size_t expired = 0;
+  FOR_EACH_RANGE (i, 0, n) {
+    now += chrono::milliseconds(1);
+    expired += wheel->ProcessExpired([&](uint64_t key) {
+      wheel->Add(key, RandomTimeout(&rng), now);
+    }, -1, now);
+  }
+  doNotOptimizeAway(expired);
+  BENCHMARK_SUSPEND {
+    wheel.reset();
+  }
+}
+
+int main(int argc, char** argv) {
+  facebook::initFacebook(&argc, &argv);
+
+  runBenchmarks();
+
+  return 0;
+}